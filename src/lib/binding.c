@@ -20,25 +20,214 @@
  * THE SOFTWARE.
  */
 
-#define _POSIX_SOURCE   /* Use POSIX threads */
+#define _POSIX_C_SOURCE 200112L     /* Use POSIX threads and thread specific data */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include "debug.h"
 #include "hashtable.h"
+#include "queue.h"
+#include "router.h"
 #include "binding.h"
 
+#define BND_READERS 64      /* Maximum number of threads that can look up bindings without locking */
+
+
+/* Published tables are never modified. Writers copy the current table, modify
+ * the copy and publish it. Readers access the published table with a single
+ * atomic load and announce the epoch they are reading in, so a replaced table
+ * is only freed once no reader can still be using it. */
+
+/* The handlers of an event, sorted by priority. Published chains are never
+ * modified either: the tables share the chains of the events that did not change */
+struct bnd_chain {
+    int count;                                  /* The number of handlers */
+    struct bnd_handler handlers[BND_HANDLERS];  /* The handlers in invocation order */
+};
+
+/* A table that has been replaced and waits to be freed */
+struct bnd_retired {
+    struct ht_table* table;         /* The replaced table, or NULL */
+    struct bnd_chain* chain;        /* The replaced chain, or NULL */
+    struct rtr_table* commands;     /* The replaced command router, or NULL */
+    unsigned long epoch;            /* The epoch when the table was replaced */
+    struct bnd_retired* next;       /* The next retired table */
+};
 
 /* The thread safe binding table data type */
 struct bnd_table {
-    struct ht_table* table;      /* The binding table */
-    pthread_mutex_t* lock;              /* Prevent race conditions if user callbacks modify the bindings */
+    struct ht_table* table;         /* The published binding table */
+    struct rtr_table* commands;     /* The published command router */
+    pthread_mutex_t* lock;          /* Serialize the writers, since user callbacks may modify the bindings */
+    struct bnd_retired* retired;    /* Replaced tables that may still be in use */
+};
+
+/* The epoch announced by a reader thread. Each one lives in its own cache line */
+struct bnd_reader {
+    unsigned long epoch;            /* The epoch when the current lookup started, or 0 if not reading */
+    int used;                       /* If the slot belongs to a thread */
+    char __pad[CACHE_LINE - sizeof(unsigned long) - sizeof(int)];
 };
 
 /* The binding table */
 static struct bnd_table* bindings;
 
+/* The global epoch. It advances each time a table is replaced */
+static unsigned long epoch = 1;
+
+/* The reader slots, assigned to threads the first time they look up a binding */
+static struct bnd_reader readers[BND_READERS];
+static pthread_key_t reader_key;
+static pthread_once_t reader_once = PTHREAD_ONCE_INIT;
+
+
+/* ************** */
+/* Reader helpers */
+/* ************** */
+
+/* Release the reader slot when its thread exits */
+static void bnd_reader_release(void* slot) {
+    __atomic_store_n(&((struct bnd_reader*) slot)->used, 0, __ATOMIC_RELEASE);
+}
+
+static void bnd_reader_init() {
+    if (pthread_key_create(&reader_key, bnd_reader_release) != 0) {
+        printf("binding: Error creating the reader key\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Get the reader slot of the current thread, or NULL if all of them are in use */
+static struct bnd_reader* bnd_reader() {
+    struct bnd_reader* reader;
+    int i, unused;
+
+    pthread_once(&reader_once, bnd_reader_init);
+    if ((reader = pthread_getspecific(reader_key)) != NULL) {
+        return reader;
+    }
+
+    for (i = 0; i < BND_READERS; i++) {
+        unused = 0;
+        if (__atomic_compare_exchange_n(&readers[i].used, &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&readers[i].epoch, 0, __ATOMIC_RELAXED);
+            pthread_setspecific(reader_key, &readers[i]);
+            return &readers[i];
+        }
+    }
+
+    debug(("binding: No free reader slots\n"));
+    return NULL;
+}
+
+/* Get the oldest epoch in which a reader is still reading, or 0 if there are none */
+static unsigned long bnd_oldest_reader() {
+    unsigned long oldest = 0, current;
+    int i;
+
+    for (i = 0; i < BND_READERS; i++) {
+        current = __atomic_load_n(&readers[i].epoch, __ATOMIC_SEQ_CST);
+        if (current != 0 && (oldest == 0 || current < oldest)) {
+            oldest = current;
+        }
+    }
+
+    return oldest;
+}
+
+
+/* ************** */
+/* Writer helpers */
+/* ************** */
+
+static void bnd_free(struct bnd_retired* retired) {
+    if (retired->table != NULL) {
+        ht_destroy(retired->table);
+    }
+    free(retired->chain);
+    if (retired->commands != NULL) {
+        rtr_destroy(retired->commands);
+    }
+    free(retired);
+}
+
+/* Free the retired tables that no reader can be using. Must be called with the lock held */
+static void bnd_reclaim() {
+    struct bnd_retired** current = &bindings->retired;
+    struct bnd_retired* retired;
+    unsigned long oldest = bnd_oldest_reader();
+
+    while (*current != NULL) {
+        retired = *current;
+        /* Readers that started after the table was replaced use a newer table */
+        if (oldest == 0 || retired->epoch < oldest) {
+            debug(("binding: Freeing the table retired in epoch %lu\n", retired->epoch));
+            *current = retired->next;
+            bnd_free(retired);
+        } else {
+            current = &retired->next;
+        }
+    }
+}
+
+/* Publish a new table or a new router and retire the current one, along with
+ * the chain that the new table replaces. Must be called with the lock held */
+static void bnd_publish(struct ht_table* table, struct bnd_chain* chain, struct rtr_table* commands) {
+    struct bnd_retired* retired;
+
+    if ((retired = malloc(sizeof(struct bnd_retired))) == 0) {
+        perror("Out of memory (bnd_publish)");
+        exit(EXIT_FAILURE);
+    }
+
+    retired->table = table != NULL ? bindings->table : NULL;
+    retired->chain = chain;
+    retired->commands = commands != NULL ? bindings->commands : NULL;
+    retired->epoch = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+    retired->next = bindings->retired;
+    bindings->retired = retired;
+
+    /* Readers that see the new epoch are guaranteed to see the new table */
+    if (table != NULL) {
+        __atomic_store_n(&bindings->table, table, __ATOMIC_SEQ_CST);
+    }
+    if (commands != NULL) {
+        __atomic_store_n(&bindings->commands, commands, __ATOMIC_SEQ_CST);
+    }
+    __atomic_add_fetch(&epoch, 1, __ATOMIC_SEQ_CST);
+
+    bnd_reclaim();
+}
+
+/* Start reading the published tables. Returns the reader slot, or NULL if
+ * the thread has none and the lock is held instead */
+static struct bnd_reader* bnd_read_begin() {
+    struct bnd_reader* reader;
+
+    if ((reader = bnd_reader()) == NULL) {
+        pthread_mutex_lock(bindings->lock);
+        return NULL;
+    }
+
+    /* Announce the epoch before loading the table, so writers do not free it */
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    return reader;
+}
+
+static void bnd_read_end(struct bnd_reader* reader) {
+    if (reader == NULL) {
+        pthread_mutex_unlock(bindings->lock);
+    } else {
+        __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+    }
+}
+
+
+/* ***************** */
+/* Binding functions */
+/* ***************** */
 
 static void bnd_init() {
     debug(("binding: Creating table\n"));
@@ -49,6 +238,8 @@ static void bnd_init() {
     }
 
     bindings->table = ht_create();
+    bindings->commands = rtr_create();
+    bindings->retired = NULL;
 
     debug(("binding: Creating binding lock\n"));
     if ((bindings->lock = malloc(sizeof(pthread_mutex_t))) == 0) {
@@ -59,34 +250,269 @@ static void bnd_init() {
     pthread_mutex_init(bindings->lock, NULL);
 }
 
+/* Get the callback bound to an event, which is the only handler that is not chained */
+static Callback bnd_bound(struct ht_table* table, char* event) {
+    struct ht_data* data = ht_find(table, event);
+    struct bnd_chain* chain = data == NULL ? NULL : data->value;
+    int i;
+
+    for (i = 0; chain != NULL && i < chain->count; i++) {
+        if (!chain->handlers[i].chained) {
+            return chain->handlers[i].callback;
+        }
+    }
+
+    return NULL;
+}
+
+/* Publish a copy of the chain of an event where the old handler is replaced
+ * with a new one, or just removed if the new one is NULL. Handlers are identified
+ * by their function and their kind, so the callback bound with bnd_bind can also
+ * be in the chain as a handler. Returns 0 if nothing changed. Must be called
+ * with the lock held */
+static int bnd_update(char* event, Callback old, Callback callback, int chained, int priority) {
+    struct ht_data* data = ht_find(bindings->table, event);
+    struct bnd_chain* current = data == NULL ? NULL : data->value;
+    struct bnd_chain* chain;
+    struct ht_table* table;
+    int i, pos, removed = 0;
+
+    if ((chain = malloc(sizeof(struct bnd_chain))) == 0) {
+        perror("Out of memory (bnd_update)");
+        exit(EXIT_FAILURE);
+    }
+
+    chain->count = 0;
+    for (i = 0; current != NULL && i < current->count; i++) {
+        if (current->handlers[i].callback == old && current->handlers[i].chained == chained) {
+            removed = 1;
+        } else {
+            chain->handlers[chain->count++] = current->handlers[i];
+        }
+    }
+
+    if ((callback != NULL && chain->count == BND_HANDLERS) || (callback == NULL && !removed)) {
+        free(chain);
+        return 0;
+    }
+
+    if (callback != NULL) {
+        /* Handlers with the same priority run in the order they were added */
+        for (pos = 0; pos < chain->count && chain->handlers[pos].priority >= priority; pos++);
+        memmove(&chain->handlers[pos + 1], &chain->handlers[pos], (chain->count - pos) * sizeof(struct bnd_handler));
+        chain->handlers[pos].callback = callback;
+        chain->handlers[pos].priority = priority;
+        chain->handlers[pos].chained = chained;
+        chain->count++;
+    }
+
+    table = ht_copy(bindings->table);
+    if (chain->count > 0) {
+        ht_add_value(table, event, chain);
+    } else {
+        ht_del(table, event);
+        free(chain);
+    }
+    bnd_publish(table, current, NULL);
+
+    return 1;
+}
+
 void bnd_bind(char* event, Callback callback) {
     debug(("binding: Adding event %s\n", event));
     if (bindings == NULL) {
         bnd_init();
     }
     pthread_mutex_lock(bindings->lock);
-    ht_add_function(bindings->table, event, callback);
+    /* The bound callback replaces the previous one, with the default priority */
+    if (!bnd_update(event, bnd_bound(bindings->table, event), callback, 0, 0)) {
+        debug(("binding: The chain of %s is full\n", event));
+    }
     pthread_mutex_unlock(bindings->lock);
 }
 
 void bnd_unbind(char* event) {
     debug(("binding: Removing event %s\n", event));
+    if (bindings == NULL) {
+        return;
+    }
     pthread_mutex_lock(bindings->lock);
-    ht_del(bindings->table, event);
+    bnd_update(event, bnd_bound(bindings->table, event), NULL, 0, 0);
     pthread_mutex_unlock(bindings->lock);
 }
 
 Callback bnd_lookup(char* event) {
-    struct ht_data* data;
+    struct bnd_reader* reader;
+    Callback callback;
+
     debug(("binding: Looking for event %s\n", event));
-    data = ht_find(bindings->table, event);
-    return data == NULL? NULL : data->function;
+    if (bindings == NULL) {
+        return NULL;
+    }
+
+    reader = bnd_read_begin();
+    callback = bnd_bound(__atomic_load_n(&bindings->table, __ATOMIC_SEQ_CST), event);
+    bnd_read_end(reader);
+
+    return callback;
+}
+
+int bnd_add_handler(char* event, Handler handler, int priority) {
+    int added;
+
+    debug(("binding: Adding handler for event %s with priority %d\n", event, priority));
+    if (bindings == NULL) {
+        bnd_init();
+    }
+    pthread_mutex_lock(bindings->lock);
+    /* Adding a handler again changes its priority */
+    added = bnd_update(event, (Callback) handler, (Callback) handler, 1, priority);
+    pthread_mutex_unlock(bindings->lock);
+
+    return added;
+}
+
+int bnd_remove_handler(char* event, Handler handler) {
+    int removed;
+
+    debug(("binding: Removing handler for event %s\n", event));
+    if (bindings == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(bindings->lock);
+    removed = bnd_update(event, (Callback) handler, NULL, 1, 0);
+    pthread_mutex_unlock(bindings->lock);
+
+    return removed;
+}
+
+int bnd_handlers(char* event, struct bnd_handler* handlers) {
+    struct bnd_reader* reader;
+    struct ht_data* data;
+    struct bnd_chain* chain;
+    int count = 0;
+
+    if (bindings == NULL) {
+        return 0;
+    }
+
+    /* Handlers run on the copy, so they can modify the bindings and the chain can be freed meanwhile */
+    reader = bnd_read_begin();
+    data = ht_find(__atomic_load_n(&bindings->table, __ATOMIC_SEQ_CST), event);
+    if (data != NULL) {
+        chain = data->value;
+        count = chain->count;
+        memcpy(handlers, chain->handlers, count * sizeof(struct bnd_handler));
+    }
+    bnd_read_end(reader);
+
+    return count;
+}
+
+
+/* ***************** */
+/* Command functions */
+/* ***************** */
+
+void bnd_bind_command(char* command, Callback callback) {
+    struct rtr_table* commands;
+
+    debug(("binding: Adding command %s\n", command));
+    if (bindings == NULL) {
+        bnd_init();
+    }
+    pthread_mutex_lock(bindings->lock);
+    commands = rtr_copy(bindings->commands);    /* The published router is never modified */
+    rtr_add(commands, command, callback);
+    bnd_publish(NULL, NULL, commands);
+    pthread_mutex_unlock(bindings->lock);
+}
+
+void bnd_unbind_command(char* command) {
+    struct rtr_table* commands;
+
+    debug(("binding: Removing command %s\n", command));
+    if (bindings == NULL) {
+        return;
+    }
+    pthread_mutex_lock(bindings->lock);
+    commands = rtr_copy(bindings->commands);
+    if (rtr_del(commands, command)) {
+        bnd_publish(NULL, NULL, commands);
+    } else {
+        rtr_destroy(commands);
+    }
+    pthread_mutex_unlock(bindings->lock);
+}
+
+void bnd_alias_command(char* alias, char* command) {
+    struct rtr_table* commands;
+
+    if (bindings == NULL) {
+        bnd_init();
+    }
+    pthread_mutex_lock(bindings->lock);
+    commands = rtr_copy(bindings->commands);
+    rtr_alias(commands, alias, command);
+    bnd_publish(NULL, NULL, commands);
+    pthread_mutex_unlock(bindings->lock);
+}
+
+void bnd_command_syntax(char* prefix, int nick, int abbrev) {
+    struct rtr_table* commands;
+
+    if (bindings == NULL) {
+        bnd_init();
+    }
+    pthread_mutex_lock(bindings->lock);
+    commands = rtr_copy(bindings->commands);
+    if (prefix != NULL) {
+        rtr_prefix(commands, prefix);
+    }
+    if (nick >= 0) {
+        rtr_nick(commands, nick);
+    }
+    if (abbrev >= 0) {
+        rtr_abbrev(commands, abbrev);
+    }
+    bnd_publish(NULL, NULL, commands);
+    pthread_mutex_unlock(bindings->lock);
+}
+
+Callback bnd_lookup_command(const char* text, const char* nick, const char** rest) {
+    struct bnd_reader* reader;
+    Callback callback;
+
+    if (bindings == NULL) {
+        return NULL;
+    }
+
+    reader = bnd_read_begin();
+    callback = rtr_match(__atomic_load_n(&bindings->commands, __ATOMIC_SEQ_CST), text, nick, rest);
+    bnd_read_end(reader);
+
+    return callback;
 }
 
 void bnd_destroy() {
     if (bindings != NULL) {
+        struct bnd_retired* retired;
+        int i;
+
         debug(("binding: Cleaning up binding table\n"));
+        for (i = 0; i < bindings->table->size; i++) {
+            if (bindings->table->entries[i].hash != 0) {
+                free(bindings->table->entries[i].data.value);
+            }
+        }
         ht_destroy(bindings->table);
+        rtr_destroy(bindings->commands);
+
+        /* Callers must make sure no thread is looking up bindings anymore */
+        while ((retired = bindings->retired) != NULL) {
+            bindings->retired = retired->next;
+            bnd_free(retired);
+        }
 
         debug(("binding: Destroying binding lock\n"));
         pthread_mutex_destroy(bindings->lock);
@@ -96,4 +522,3 @@ void bnd_destroy() {
         bindings = NULL;
     }
 }
-
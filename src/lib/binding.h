@@ -25,9 +25,26 @@
 
 #include "events.h"
 
+#define BND_HANDLERS 16     /* Maximum number of handlers in the chain of an event */
+
+/* A handler in the chain of an event */
+struct bnd_handler {
+    Callback callback;      /* The function to invoke with the event */
+    int priority;           /* Handlers with higher priority are invoked first */
+    int chained;            /* If the function is a Handler that can stop the propagation of the event */
+};
+
 void bnd_bind(char* event, Callback callback);  /* Bind an event to the given callback */
 void bnd_unbind(char* event);		        /* Remove the binding for the given event */
 Callback bnd_lookup(char* event);  		/* Lookup for a callback for the given event */
+int bnd_add_handler(char* event, Handler handler, int priority);   /* Add a handler to the chain of an event. Returns 0 if the chain is full */
+int bnd_remove_handler(char* event, Handler handler);               /* Remove a handler from the chain of an event. Returns 0 if it was not there */
+int bnd_handlers(char* event, struct bnd_handler* handlers);        /* Copy the chain of an event (up to BND_HANDLERS) in invocation order. Returns the number of handlers */
+void bnd_bind_command(char* command, Callback callback);   /* Bind a command to the given callback */
+void bnd_unbind_command(char* command);                     /* Remove the binding for the given command */
+void bnd_alias_command(char* alias, char* command);         /* Make another name run a command */
+void bnd_command_syntax(char* prefix, int nick, int abbrev);    /* Add a command prefix (if not NULL) and set the nick and abbreviation options (if not negative) */
+Callback bnd_lookup_command(const char* text, const char* nick, const char** rest); /* Lookup for the command of a message and where its arguments start */
 void bnd_destroy();                             /* Destroy the binding table */
  
 #endif
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "casemap.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CM_SIMD                 /* Fold 16 characters at a time, or 32 if the processor has AVX2 */
+#include <immintrin.h>
+#endif
+
+#define CM_CHUNK 256            /* Characters folded at once when hashing */
+
+/* In every case mapping the uppercase characters are a single range starting
+ * at 'A', and each lowercase character is 0x20 above its uppercase form:
+ * ascii is A-Z, strict-rfc1459 adds []\ and rfc1459 adds []\^ */
+static const unsigned char cm_last[] = { '^', ']', 'Z' };
+
+#define CM_LAST(casemapping) (cm_last[(casemapping)])
+#define CM_LOWER(c, last) ((unsigned char) (c) >= 'A' && (unsigned char) (c) <= (last) ? (c) + 0x20 : (c))
+
+
+/* ************* */
+/* Block folding */
+/* ************* */
+
+static void fold_scalar(char* dst, const char* src, unsigned int len, unsigned char last) {
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        dst[i] = CM_LOWER(src[i], last);
+    }
+}
+
+/* Get the position of the first different character, or len if they are all equal */
+static unsigned int mismatch_scalar(const char* a, const char* b, unsigned int len, unsigned char last) {
+    unsigned int i;
+
+    for (i = 0; i < len && CM_LOWER(a[i], last) == CM_LOWER(b[i], last); i++) {
+        continue;
+    }
+
+    return i;
+}
+
+#ifdef CM_SIMD
+
+/* Bytes above 0x7f are negative in the signed comparisons, so they are never folded */
+static __m128i fold_sse2_block(__m128i c, unsigned char last) {
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)),
+            _mm_cmplt_epi8(c, _mm_set1_epi8(last + 1)));
+    return _mm_add_epi8(c, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static void fold_sse2(char* dst, const char* src, unsigned int len, unsigned char last) {
+    for (; len >= 16; len -= 16, src += 16, dst += 16) {
+        _mm_storeu_si128((__m128i*) dst, fold_sse2_block(_mm_loadu_si128((const __m128i*) src), last));
+    }
+    fold_scalar(dst, src, len, last);
+}
+
+static unsigned int mismatch_sse2(const char* a, const char* b, unsigned int len, unsigned char last) {
+    unsigned int i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i fa = fold_sse2_block(_mm_loadu_si128((const __m128i*) (a + i)), last);
+        __m128i fb = fold_sse2_block(_mm_loadu_si128((const __m128i*) (b + i)), last);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(fa, fb)) != 0xffff) {
+            break;
+        }
+    }
+
+    return i + mismatch_scalar(a + i, b + i, len - i, last);
+}
+
+__attribute__((target("avx2")))
+static __m256i fold_avx2_block(__m256i c, unsigned char last) {
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8(last + 1), c));
+    return _mm256_add_epi8(c, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static void fold_avx2(char* dst, const char* src, unsigned int len, unsigned char last) {
+    for (; len >= 32; len -= 32, src += 32, dst += 32) {
+        _mm256_storeu_si256((__m256i*) dst, fold_avx2_block(_mm256_loadu_si256((const __m256i*) src), last));
+    }
+    fold_sse2(dst, src, len, last);
+}
+
+__attribute__((target("avx2")))
+static unsigned int mismatch_avx2(const char* a, const char* b, unsigned int len, unsigned char last) {
+    unsigned int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i fa = fold_avx2_block(_mm256_loadu_si256((const __m256i*) (a + i)), last);
+        __m256i fb = fold_avx2_block(_mm256_loadu_si256((const __m256i*) (b + i)), last);
+        if ((unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(fa, fb)) != 0xffffffffu) {
+            break;
+        }
+    }
+
+    return i + mismatch_sse2(a + i, b + i, len - i, last);
+}
+
+#endif
+
+/* Fold the given number of characters with the widest instructions available */
+static void fold(char* dst, const char* src, unsigned int len, unsigned char last) {
+#ifdef CM_SIMD
+    if (len >= 32 && __builtin_cpu_supports("avx2")) {
+        fold_avx2(dst, src, len, last);
+        return;
+    } else if (len >= CM_BLOCK) {
+        fold_sse2(dst, src, len, last);
+        return;
+    }
+#endif
+    fold_scalar(dst, src, len, last);
+}
+
+/* Get the position of the first character that differs ignoring case */
+static unsigned int mismatch(const char* a, const char* b, unsigned int len, unsigned char last) {
+#ifdef CM_SIMD
+    if (len >= 32 && __builtin_cpu_supports("avx2")) {
+        return mismatch_avx2(a, b, len, last);
+    } else if (len >= CM_BLOCK) {
+        return mismatch_sse2(a, b, len, last);
+    }
+#endif
+    return mismatch_scalar(a, b, len, last);
+}
+
+
+/* ********************** */
+/* Case mapping functions */
+/* ********************** */
+
+char* cm_fold(char* dst, const char* src, unsigned int size, enum isp_casemapping casemapping) {
+    unsigned int len = strlen(src);
+
+    if (len > size - 1) {
+        len = size - 1;
+    }
+
+    fold(dst, src, len, CM_LAST(casemapping));
+    dst[len] = '\0';
+
+    return dst;
+}
+
+int cm_compare(const char* a, const char* b, enum isp_casemapping casemapping) {
+    unsigned char last = CM_LAST(casemapping);
+    unsigned int len_a = strlen(a), len_b = strlen(b);
+    unsigned int i = mismatch(a, b, (len_a < len_b ? len_a : len_b) + 1, last);
+
+    /* The terminator is included, so there is always a difference unless both are equal */
+    if (i > len_a || i > len_b) {
+        return 0;
+    }
+
+    return (int) (unsigned char) CM_LOWER(a[i], last) - (int) (unsigned char) CM_LOWER(b[i], last);
+}
+
+int cm_equal(const char* a, const char* b, enum isp_casemapping casemapping) {
+    unsigned int len = strlen(a);
+    return len == strlen(b) && mismatch(a, b, len, CM_LAST(casemapping)) == len;
+}
+
+unsigned int cm_hash(const char* str, enum isp_casemapping casemapping) {
+    char chunk[CM_CHUNK];
+    unsigned int hash = 2166136261u, len = strlen(str), size, i;
+
+    for (; len > 0; len -= size, str += size) {
+        size = len < CM_CHUNK ? len : CM_CHUNK;
+        fold(chunk, str, size, CM_LAST(casemapping));
+        for (i = 0; i < size; i++) {
+            hash ^= (unsigned char) chunk[i];
+            hash *= 16777619u;
+        }
+    }
+
+    return hash == 0 ? 1 : hash;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __CASEMAP_H__
+#define __CASEMAP_H__
+
+#include "isupport.h"
+
+#define CM_BLOCK 16             /* Strings shorter than this are folded one character at a time */
+
+/* Nicks and channel names are compared as the server does, following its CASEMAPPING.
+ * Strings are treated as bytes: the locale is never used. */
+
+char* cm_fold(char* dst, const char* src, unsigned int size, enum isp_casemapping casemapping);    /* Copy a string in lowercase (dst can be src) */
+int cm_compare(const char* a, const char* b, enum isp_casemapping casemapping);    /* Compare two strings ignoring case, as strcmp does */
+int cm_equal(const char* a, const char* b, enum isp_casemapping casemapping);      /* Check if two strings are equal ignoring case */
+unsigned int cm_hash(const char* str, enum isp_casemapping casemapping);           /* Get the FNV-1a hash of the lowercase form of a string (never 0) */
+
+#endif
@@ -23,6 +23,56 @@
 #include <stdlib.h>
 #include "codes.h"
 
+/* Textual commands must be between these lengths to have an identifier */
+#define CMD_MIN_LEN     4
+#define CMD_MAX_LEN     7
+#define CMD_HASH_SIZE   32
+
+/* Folds a lowercase letter to uppercase. Other characters never match a command name anyway */
+#define CMD_FOLD(c)     ((unsigned char) (c) & 0xDF)
+
+/* Perfect hash for the textual commands in codes.h. Each name lands in its own slot.
+ * If a command is added, regenerate the table searching for new multipliers. */
+#define CMD_HASH(s, len) ((CMD_FOLD(s[0]) * 5 + CMD_FOLD(s[1]) + CMD_FOLD(s[len - 1]) + len) & (CMD_HASH_SIZE - 1))
+
+static const struct {
+    const char* name;
+    int id;
+} cmd_table[CMD_HASH_SIZE] = {
+    { NOTICE,    CMD_NOTICE },
+    { NULL,      CMD_UNKNOWN },
+    { QUIT,      CMD_QUIT },
+    { NULL,      CMD_UNKNOWN },
+    { PING,      CMD_PING },
+    { NULL,      CMD_UNKNOWN },
+    { INVITE,    CMD_INVITE },
+    { NULL,      CMD_UNKNOWN },
+    { NULL,      CMD_UNKNOWN },
+    { PART,      CMD_PART },
+    { PONG,      CMD_PONG },
+    { NULL,      CMD_UNKNOWN },
+    { NULL,      CMD_UNKNOWN },
+    { NULL,      CMD_UNKNOWN },
+    { NULL,      CMD_UNKNOWN },
+    { KICK,      CMD_KICK },
+    { PRIVMSG,   CMD_PRIVMSG },
+    { NULL,      CMD_UNKNOWN },
+    { USER,      CMD_USER },
+    { JOIN,      CMD_JOIN },
+    { NULL,      CMD_UNKNOWN },
+    { NULL,      CMD_UNKNOWN },
+    { NULL,      CMD_UNKNOWN },
+    { NULL,      CMD_UNKNOWN },
+    { NULL,      CMD_UNKNOWN },
+    { MODE,      CMD_MODE },
+    { NULL,      CMD_UNKNOWN },
+    { TOPIC,     CMD_TOPIC },
+    { NULL,      CMD_UNKNOWN },
+    { LIST,      CMD_LIST },
+    { NICK,      CMD_NICK },
+    { NAMES,     CMD_NAMES }
+};
+
 int is_error(char* code) {
     int num_code = atoi(code);
     return num_code >= ERR_CODE_START && num_code <= ERR_CODE_END;
@@ -33,3 +83,33 @@ int is_numeric_response(char* code) {
     return num_code >= RESP_CODE_START && num_code <= RESP_CODE_END;
 }
 
+
+int cmd_id(const char* command, unsigned int length) {
+    const char* name;
+    unsigned int i;
+
+    /* Numeric replies are always three digits */
+    if (length == 3 && command[0] >= '0' && command[0] <= '9'
+            && command[1] >= '0' && command[1] <= '9'
+            && command[2] >= '0' && command[2] <= '9') {
+        return (command[0] - '0') * 100 + (command[1] - '0') * 10 + (command[2] - '0');
+    }
+
+    if (length < CMD_MIN_LEN || length > CMD_MAX_LEN) {
+        return CMD_UNKNOWN;
+    }
+
+    /* Verify the candidate, since unknown commands can land in any slot */
+    i = CMD_HASH(command, length);
+    if ((name = cmd_table[i].name) == NULL) {
+        return CMD_UNKNOWN;
+    }
+
+    for (; length > 0; length--, command++, name++) {
+        if (CMD_FOLD(*command) != *name) {
+            return CMD_UNKNOWN;
+        }
+    }
+
+    return *name == '\0' ? cmd_table[i].id : CMD_UNKNOWN;
+}
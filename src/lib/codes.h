@@ -27,10 +27,37 @@
 int is_error(char* code);
 int is_numeric_response(char* code);
 
+/* Command identifiers. Numeric replies use their own value
+ * and textual commands are numbered after them. */
+enum cmd_id {
+    CMD_UNKNOWN = 1000,     /* Any command without its own identifier */
+    CMD_INVITE,
+    CMD_JOIN,
+    CMD_KICK,
+    CMD_LIST,
+    CMD_MODE,
+    CMD_NAMES,
+    CMD_NICK,
+    CMD_NOTICE,
+    CMD_PART,
+    CMD_PING,
+    CMD_PONG,
+    CMD_PRIVMSG,
+    CMD_TOPIC,
+    CMD_USER,
+    CMD_QUIT,
+    CMD_MAX                 /* Number of command identifiers */
+};
+
+int cmd_id(const char* command, unsigned int length);   /* Get the identifier of the given command */
+
 /* Global binding message types */
 #define ALL             "ALL"       /* If no specific binging is found, call this global binding */
 #define ERROR           "ERROR"     /* If no specific error binding is found, call this global binding */
 
+/* Connection message types, generated by the library */
+#define DISCONNECT      "DISCONNECT"    /* The connection was closed by the server or timed out */
+
 /* Text message types */
 #define INVITE          "INVITE"    /* Invite a user to a channel */
 #define JOIN            "JOIN"      /* Someone joins a channel */
@@ -57,6 +84,8 @@ int is_numeric_response(char* code);
 #define RESP_CODE_END       399
 
 /* Response codes */
+#define RPL_WELCOME         "001"       /* "<nick> :Welcome to the Internet Relay Network <nick>!<user>@<host>" */
+#define RPL_ISUPPORT        "005"       /* "<nick> <token>{ <token>} :are supported by this server" */
 #define RPL_NONE            "300"       /* Dummy reply number. Not used. */
 #define RPL_USERHOST        "302"       /* ":[<reply>{<space><reply>}]" */
 #define RPL_ISON            "303"       /* ":[<nick> {<space><nick>}]" */
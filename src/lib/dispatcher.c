@@ -20,464 +20,596 @@
  * THE SOFTWARE.
  */
 
-#define _XOPEN_SOURCE   /* Support strtok_r in POSIX and BSD environments */
+#define _POSIX_C_SOURCE 200112L      /* Support sched_yield */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include "dispatcher.h"
 #include "debug.h"
 #include "codes.h"
 #include "utils.h"
 #include "irc.h"
 #include "binding.h"
+#include "queue.h"
+#include "network.h"
+#include "casemap.h"
+#include "intern.h"
 
 
-/* ***************** */
-/* Dispatcher thread */
-/* ***************** */
+/* ****************** */
+/* Dispatcher threads */
+/* ****************** */
+
+/* Each worker owns an event queue. The listener is the only producer
+ * of all queues, and each worker the only consumer of its own queue. */
+struct dsp_worker {
+    pthread_t thread;           /* The thread that consumes the events */
+    struct q_ring* events;      /* The events assigned to this worker */
+};
 
 struct dsp_consumer {
-    pthread_t* worker;          /* The thread that consumes events */
-    pthread_mutex_t* lock;      /* The mutex for the consumer thread */
-    pthread_cond_t* ready;      /* Control if there is work to do */
-    int terminate;              /* Flag to terminate the dispatcher thread */
+    int num_workers;            /* Number of workers that process regular events */
+    struct dsp_worker* workers; /* The regular workers, followed by the fast lane */
+    int terminate;              /* Flag to terminate the dispatcher threads */
 };
 
-/* The event consumer */
+/* The event consumers */
 static struct dsp_consumer* consumer = NULL;
 
-static void consumer_notify();                  /* Notify the consumer that there are events to process */
+/* If events are fired directly by the listener thread */
+static int inline_dispatch = 0;
+
 static void _fire_event(struct raw_event*);     /* Build the appropriate event and invoke user callbacks */
+static void _track_event(struct raw_event*);    /* Update the state of the connection with the event */
 
 
-/* ************ */
-/* Event queue  */
-/* ************ */
+/* ********************* */
+/* Event queue functions */
+/* ********************* */
 
-/* A node in the dispatcher queue. Double linked to improve insertions. */
-struct q_node {
-    struct raw_event* event;    /* The target event */
-    struct q_node* prev;        /* Previous node in the queue */
-    struct q_node* next;        /* Next node in the queue */
-};
+/* Creates the event queue of a worker */
+static void events_create(struct dsp_worker* worker) {
+    debug(("dispatcher: Creating event dispatcher queue\n"));
+    worker->events = q_create(Q_SIZE);
+}
 
-/* The dispacher queue type */
-struct q_dispatch {
-    struct q_node* top;         /* The top of the queue */
-    struct q_node* bottom;      /* The bottom of the queue */
-    pthread_mutex_t* lock;      /* The write mutex for the event queue */
-    int size;                   /* The number of elements in the queue */
-};
+/* Destroys the event queue of a worker and the events that have not been processed */
+static void events_destroy(struct dsp_worker* worker) {
+    if (worker->events != NULL) {
+        struct raw_event* event;
 
-/* The event dispatcher queue */
-static struct q_dispatch* events = NULL;
+        debug(("dispatcher: Destroying event dispatcher queue\n"));
 
+        while ((event = q_pop(worker->events)) != NULL) {
+            evt_raw_destroy(event);
+        }
 
-/* ********************* */
-/* Event queue functions */
-/* ********************* */
+        q_destroy(worker->events);
+        worker->events = NULL;
+    }
+}
 
-/* Creates the event dispatcher queue */
-static void q_create() {
-    debug(("dispatcher: Creating event dispatcher queue\n"));
 
-    if ((events = malloc(sizeof(struct q_dispatch))) == 0) {
-        perror("Out of memory (q_create)");
+/* ************************ */
+/* Event consumer functions */
+/* ************************ */
+
+/* Check if the consumer threads have been asked to terminate */
+static int consumer_terminated() {
+    return __atomic_load_n(&consumer->terminate, __ATOMIC_ACQUIRE);
+}
+
+/* Worker thread to process the events in its queue */
+static void* event_consumer(void* arg) {
+    struct dsp_worker* worker = (struct dsp_worker*) arg;
+    struct raw_event* event;
+
+    while (!consumer_terminated()) {
+        /* Process all queued events before waiting again */
+        while (!consumer_terminated() && (event = q_pop(worker->events)) != NULL) {
+            _fire_event(event);         /* Invoke user callbacks */
+            evt_raw_destroy(event);     /* Free memory once the event has been handled */
+        }
+
+        if (!consumer_terminated()) {
+            debug(("dispatcher: Waiting for events\n"));
+            q_wait(worker->events);
+        }
+    }
+
+    debug(("dispatcher: Terminating consumer\n"));
+
+    pthread_exit(NULL);
+}
+
+/* Creates the event consumer threads: the regular workers plus the fast lane */
+static void consumer_create(int num_workers) {
+    int i;
+
+    if ((consumer = malloc(sizeof(struct dsp_consumer))) == 0) {
+        perror("Out of memory (consumer_create)");
         exit(EXIT_FAILURE);
     }
 
-    if ((events->lock = malloc(sizeof(pthread_mutex_t))) == 0) {
-        perror("Out of memory (q_create: lock)");
+    if ((consumer->workers = malloc((num_workers + 1) * sizeof(struct dsp_worker))) == 0) {
+        perror("Out of memory (consumer_create: workers)");
         exit(EXIT_FAILURE);
     }
 
-    events->top = NULL;
-    events->bottom = NULL;
-    events->size = 0;
+    consumer->num_workers = num_workers;
+    consumer->terminate = 0;
+
+    for (i = 0; i <= num_workers; i++) {
+        events_create(&consumer->workers[i]);
+    }
 
-    pthread_mutex_init(events->lock, NULL);
+    /* Create and start the dispatcher threads once all queues exist */
+    debug(("dispatcher: Creating %d event dispatcher threads\n", num_workers + 1));
+    for (i = 0; i <= num_workers; i++) {
+        if (pthread_create(&consumer->workers[i].thread, NULL, event_consumer, &consumer->workers[i]) != 0) {
+            printf("dispatcher: Error creating event consumer thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
-/* Add the givent event to the dispatcher queue */
-static void q_push(struct raw_event* event) {
-    struct q_node* node;
+/* Terminates the event consumer threads */
+static void consumer_destroy() {
+    if (consumer != NULL) {
+        void* status;
+        int i;
+
+        /* Force the dispatcher threads to terminate */
+        __atomic_store_n(&consumer->terminate, 1, __ATOMIC_RELEASE);
 
-    /* Prevent concurrent modifications */
-    pthread_mutex_lock(events->lock);
+        debug(("dispatcher: Terminating the event dispatcher threads\n"));
+        for (i = 0; i <= consumer->num_workers; i++) {
+            q_wake(consumer->workers[i].events);    /* Unlock the dispatcher thread */
 
-    if ((node = malloc(sizeof(struct q_node))) == 0) {
-        perror("Out of memory (q_node)");
-        exit(EXIT_FAILURE);
+            /* Wait until the dispatcher thread terminates */
+            if (pthread_join(consumer->workers[i].thread, &status) != 0) {
+                printf("dispatcher: Error waiting for the event consumer thread\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        for (i = 0; i <= consumer->num_workers; i++) {
+            events_destroy(&consumer->workers[i]);
+        }
+
+        free(consumer->workers);
+        free(consumer);
+        consumer = NULL;
     }
+}
 
-    node->event = event;
-    node->prev = NULL;
-    node->next = NULL;
 
-    /* First element in the event queue*/
-    if (events->top == NULL) {
-        debug(("dispatcher: Adding the first element: %s\n", event->type));
-        events->top = node;
-        events->bottom = node;
-    } else {
-        debug(("dispatcher: Adding at the bottom: %s\n", event->type));
-        events->bottom->next = node;
-        node->prev = events->bottom;
-        events->bottom = node;
+/* ************* */
+/* Event routing */
+/* ************* */
+
+/* The case mapping of the server, to hash the targets as it compares them.
+ * The listener is the thread that updates the features (under the tracker
+ * lock), so it can read them without the lock. Workers must not. */
+static enum isp_casemapping raw_casemapping(struct raw_event* event) {
+    return event->conn != NULL ? net_isupport(event->conn)->casemapping : ISP_RFC1459;
+}
+
+/* Select the worker that must process the event. Events for the same
+ * target (channel or nick) always go to the same worker, so they are
+ * processed in order. PING goes to the fast lane to be answered quickly. */
+static struct dsp_worker* dsp_route(struct raw_event* event) {
+    if (event->cmd == CMD_PING) {
+        return &consumer->workers[consumer->num_workers];
     }
 
-    events->size++;
-    debug(("dispatcher: New queue size: %d\n", events->size));
+    if (event->num_params == 0 || consumer->num_workers == 1) {
+        return &consumer->workers[0];
+    }
 
-    pthread_mutex_unlock(events->lock);
-    consumer_notify();
+    return &consumer->workers[cm_hash(event->params[0], raw_casemapping(event)) % consumer->num_workers];
 }
 
-/* Removes the top element from the queue */
-struct raw_event* q_pop() {
-    struct raw_event* event = NULL;
 
-    /* Prevent concurrent modifications */
-    pthread_mutex_lock(events->lock);
+/* ******************** */
+/* Dispatcher functions */
+/* ******************** */
+
+void dsp_start(int num_workers) {
+    if (num_workers <= DSP_INLINE) {
+        debug(("dispatcher: Firing events in the listener thread\n"));
+        inline_dispatch = 1;        /* No threads. Callbacks run in the caller of dsp_dispatch */
+    } else {
+        consumer_create(num_workers);   /* Create the event queues and the consumer threads */
+    }
+}
 
-     /* Empty queue */
-    if (events->top != NULL) {
-        struct q_node* node;
+void dsp_shutdown() {
+    consumer_destroy();     /* Terminate the consumer threads and free the pending events */
+    inline_dispatch = 0;
+}
 
-        node = events->top;
-        events->top = node->next;
+void dsp_dispatch(struct raw_event* event) {
+    struct dsp_worker* worker;
 
-        /* If the last element of the queue was removed, make sure the bottom pointer
-         * also is set to NULL */
-        if (events->top == NULL) {
-            events->bottom = NULL;
-        } else {
-            /* Otherwise, remove the previous element for the new top */
-            events->top->prev = NULL;
-        }
+    /* Keep the state in the order of the messages, before the workers reorder them */
+    _track_event(event);
 
-        events->size--;
-        event = node->event;
-        free(node);
+    if (inline_dispatch) {
+        _fire_event(event);         /* Invoke user callbacks */
+        evt_raw_destroy(event);     /* Free memory once the event has been handled */
+        return;
+    }
+
+    worker = dsp_route(event);
 
-        debug(("dispatcher: Removed top element: %s\n", event->type));
-        debug(("dispatcher: New queue size: %d\n", events->size));
+    /* The queue is bounded. If the worker falls behind, wait
+     * until it makes room for the new event. */
+    while (!q_push(worker->events, event)) {
+        sched_yield();
     }
+}
 
-    pthread_mutex_unlock(events->lock);
+/* Workers that have not reached the barrier of the drain in progress. It
+ * is not on the stack of dsp_drain, as a worker stopped by a shutdown may
+ * still count itself after dsp_drain has given up */
+static int drain_pending = 0;
 
-    return event;
+/* Count a worker that has handled all the events queued before the barrier */
+static void drain_barrier(void* data) {
+    __atomic_sub_fetch((int*) data, 1, __ATOMIC_RELEASE);
 }
 
-/* Destroys the event queue */
-static void q_destroy() {
-    if (events != NULL) {
-        struct q_node* node, *next;
+void dsp_drain() {
+    struct raw_event* event;
+    int i;
 
-        debug(("dispatcher: Destroying event dispatcher queue\n"));
+    if (consumer == NULL) {
+        return;     /* Inline dispatch has nothing queued */
+    }
 
-        node = events->top;
-        while (node != NULL) {
-            next = node->next;
-            free(node);
-            node = next;
+    /* Each queue is processed in order, so once every worker has run
+     * the barrier, all the events dispatched before it have been handled */
+    __atomic_store_n(&drain_pending, consumer->num_workers + 1, __ATOMIC_RELAXED);
+    for (i = 0; i <= consumer->num_workers; i++) {
+        event = evt_raw_create();
+        event->__task = drain_barrier;
+        event->__task_data = &drain_pending;
+        while (!q_push(consumer->workers[i].events, event)) {
+            sched_yield();
         }
+    }
 
-        pthread_mutex_destroy(events->lock);
-
-        free(events->lock);
-        free(events);
-        events = NULL;
+    /* Terminated workers leave their barriers in the queue. Do not wait for them */
+    while (__atomic_load_n(&drain_pending, __ATOMIC_ACQUIRE) > 0 && !consumer_terminated()) {
+        sched_yield();
     }
 }
 
+void dsp_call(void (*task)(void*), void* data) {
+    struct raw_event* event = evt_raw_create();
 
-/* ************************ */
-/* Event consumer functions */
-/* ************************ */
+    /* Tasks have no target, so they go to the first worker */
+    event->__task = task;
+    event->__task_data = data;
+    dsp_dispatch(event);
+}
 
-/* Consumer thread to process the events in the queue */
-static void* event_consumer(void* arg) {
-    pthread_mutex_lock(consumer->lock);
+/* **************** */
+/* Event triggering */
+/* **************** */
 
-    while (consumer->terminate == 0) {
-        /* Wait until there are events to process */
-        if (events->size == 0) {
-            debug(("dispatcher: Waiting for events\n"));
-            pthread_cond_wait(consumer->ready, consumer->lock);
-            debug(("dispatcher: Notification received\n"));
-        }
+/* Event handlers build the appropriate event and invoke the handler chain.
+ * They return the number of handlers in the chain, or 0 if there were none. */
+typedef int (*dsp_handler)(struct raw_event*);
+
+/* Handlers indexed by command identifier. NULL means there is no specific event */
+static dsp_handler handlers[CMD_MAX];
+static pthread_once_t handlers_once = PTHREAD_ONCE_INIT;
+
+static void __circus__ping_handler(PingEvent* event) {
+    irc_pong(event->server);
+}
 
-        /* Need to recheck, because a shutdown request may
-         * have changed it */
-        if (consumer->terminate == 0) {
-            struct raw_event* event = q_pop();  /* Get the next event */
-            _fire_event(event);                 /* Invoke user callbacks */
-            evt_raw_destroy(event);   /* Free memory once the event has been handled */
+/* Invoke the handlers of an event in order, until one of them stops the propagation */
+static void run_chain(struct bnd_handler* chain, int count, void* event) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!chain[i].chained) {
+            ((void (*)(void*)) chain[i].callback)(event);
+        } else if (((int (*)(void*)) chain[i].callback)(event) == EVT_STOP) {
+            debug(("dispatcher: Event stopped by handler %d of %d\n", i + 1, count));
+            break;
         }
     }
+}
 
-    debug(("dispatcher: Terminating consumer\n"));
+/* Connection registration */
 
-    pthread_mutex_unlock(consumer->lock);
-    pthread_exit(NULL);
+static int fire_nick(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count = bnd_handlers(NICK, chain);
+    if (count > 0) {
+        NickEvent event = evt_nick(raw);
+        run_chain(chain, count, &event);
+    }
+    return count;
 }
 
-/* Creates the event consumer thread */
-static void consumer_create() {
-    if ((consumer = malloc(sizeof(struct dsp_consumer))) == 0) {
-        perror("Out of memory (consumer_create)");
-        exit(EXIT_FAILURE);
+static int fire_quit(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count = bnd_handlers(QUIT, chain);
+    if (count > 0) {
+        QuitEvent event = evt_quit(raw);
+        run_chain(chain, count, &event);
     }
+    return count;
+}
 
-    if ((consumer->worker = malloc(sizeof(pthread_t))) == 0) {
-        perror("Out of memory (consumer_create: worker)");
-        exit(EXIT_FAILURE);
+/* Channel operations */
+
+static int fire_join(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count = bnd_handlers(JOIN, chain);
+    if (count > 0) {
+        JoinEvent event = evt_join(raw);
+        run_chain(chain, count, &event);
     }
+    return count;
+}
 
-    if ((consumer->lock = malloc(sizeof(pthread_mutex_t))) == 0) {
-        perror("Out of memory (consumer_create: lock)");
-        exit(EXIT_FAILURE);
+static int fire_part(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count = bnd_handlers(PART, chain);
+    if (count > 0) {
+        PartEvent event = evt_part(raw);
+        run_chain(chain, count, &event);
     }
+    return count;
+}
 
-    if ((consumer->ready = malloc(sizeof(pthread_cond_t))) == 0) {
-        perror("Out of memory (consumer_create: ready)");
-        exit(EXIT_FAILURE);
+static int fire_topic(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count = bnd_handlers(TOPIC, chain);
+    if (count > 0) {
+        TopicEvent event = evt_topic(raw);
+        run_chain(chain, count, &event);
     }
+    return count;
+}
 
-    consumer->terminate = 0;
-    pthread_mutex_init(consumer->lock, NULL);
-    pthread_cond_init(consumer->ready, NULL);
+static int fire_names(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count = bnd_handlers(NAMES, chain);
+    if (count > 0) {
+        NamesEvent event = evt_names(raw);
+        run_chain(chain, count, &event);
+    }
+    return count;
+}
 
-    /* Create and start the dispatcher thread */
-    debug(("dispatcher: Creating the event dispatcher thread\n"));
-    if (pthread_create(consumer->worker, NULL, event_consumer, NULL) != 0) {
-        printf("dispatcher: Error creating event consumer thread\n");
-        exit(EXIT_FAILURE);
+static int fire_list(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count = bnd_handlers(LIST, chain);
+    if (count > 0) {
+        ListEvent event = evt_list(raw);
+        run_chain(chain, count, &event);
     }
+    return count;
 }
 
-/* Terminates the event consumer thread */
-static void consumer_destroy() {
-    if (consumer != NULL) {
-        void* status;
+static int fire_invite(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count = bnd_handlers(INVITE, chain);
+    if (count > 0) {
+        InviteEvent event = evt_invite(raw);
+        run_chain(chain, count, &event);
+    }
+    return count;
+}
 
-        /* Force the dispatcher thread to terminate */
-        consumer->terminate = 1;
-        pthread_cond_signal(consumer->ready); /* Unlock the dispatcher thread */
+static int fire_kick(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count = bnd_handlers(KICK, chain);
+    if (count > 0) {
+        KickEvent event = evt_kick(raw);
+        run_chain(chain, count, &event);
+    }
+    return count;
+}
 
-        /* Wait until the dispatcher thread terminates */
-        debug(("dispatcher: Terminating the event dispatcher thread\n"));
-        if (pthread_join(*consumer->worker, &status) != 0) {
-            printf("dispatcher: Error waiting for the event consumer thread\n");
-            exit(EXIT_FAILURE);
-        }
+/* Get the nick of the bot if the message may be addressed to it ("circus: help") */
+static const char* addressed_nick(struct raw_event* raw, const char* text) {
+    while (*text == ' ') {
+        text++;
+    }
 
-        pthread_mutex_destroy(consumer->lock);
-        pthread_cond_destroy(consumer->ready);
+    /* Only look the nick up when the first word has the separator, to avoid locking the state */
+    text += strcspn(text, " :,");
+    return raw->conn != NULL && (*text == ':' || *text == ',') ? trk_me(net_tracker(raw->conn)) : NULL;
+}
 
-        free(consumer->lock);
-        free(consumer->ready);
-        free(consumer->worker);
-        free(consumer);
-        consumer = NULL;
+static int fire_message(struct raw_event* raw) {
+    /* Look for a command binding. The first word of the message is matched in place */
+    char* text = raw->params[1] != NULL ? raw->params[1] : "";
+    const char* nick = addressed_nick(raw, text), *rest;
+    Callback callback = bnd_lookup_command(text, nick, &rest);
+    struct bnd_handler chain[BND_HANDLERS];
+    int count;
+
+    if (nick != NULL) {
+        str_release(nick);
     }
+
+    if (callback != NULL) {
+        /* Remove the command name from the raw message */
+        raw->params[1] = (char*) rest;
+        chain[0].callback = callback;
+        chain[0].chained = 0;
+        count = 1;
+    } else {
+        /* If no command binding is found, look for the event handlers */
+        debug(("dispatcher: No command found. Looking for event.\n"));
+        count = bnd_handlers(PRIVMSG, chain);
+    }
+
+    if (count > 0) {
+        MessageEvent event = evt_message(raw);
+        run_chain(chain, count, &event);
+    }
+    return count;
 }
 
-/* Notifies the event consumer that there are new events in the queue */
-static void consumer_notify() {
-    if (consumer != NULL) {
-        pthread_cond_signal(consumer->ready);
+static int fire_mode(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count = bnd_handlers(MODE, chain);
+    if (count > 0) {
+        ModeEvent event = evt_mode(raw);
+        run_chain(chain, count, &event);
     }
+    return count;
 }
 
+/* Miscellaneous events */
 
-/* ******************** */
-/* Dispatcher functions */
-/* ******************** */
+static int fire_ping(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count;
+    PingEvent event = evt_ping(raw);
+    __circus__ping_handler(&event);    /* Call the system callback for ping before calling the bindings */
+    count = bnd_handlers(PING, chain);
+    run_chain(chain, count, &event);
+    return count;
+}
 
-void dsp_start() {
-    q_create();         /* Create the dispatcher events queue */
-    consumer_create();  /* Create the events consumer */
+static int fire_notice(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    int count = bnd_handlers(NOTICE, chain);
+    if (count > 0) {
+        NoticeEvent event = evt_notice(raw);
+        run_chain(chain, count, &event);
+    }
+    return count;
 }
 
-void dsp_shutdown() {
-    consumer_destroy();     /* Terminate the consumer thread and free resources */
-    q_destroy();            /* Free the event queue resources */
+/* Global bindings */
+
+static int fire_error(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    /* Look for the handlers of the concrete error */
+    int count = bnd_handlers(raw->type, chain);
+    /* If there are none, look for the generic error handlers */
+    if (count == 0) {
+        count = bnd_handlers(ERROR, chain);
+    }
+
+    if (count > 0) {
+        ErrorEvent event = evt_error(raw);
+        run_chain(chain, count, &event);
+    }
+    return count;
 }
 
-void dsp_dispatch(struct raw_event* event) {
-    q_push(event);
+static int fire_generic(struct raw_event* raw) {
+    struct bnd_handler chain[BND_HANDLERS];
+    /* Look for the handlers of the concrete message */
+    int count = bnd_handlers(raw->type, chain);
+    /* If there are none, look for the generic message handlers */
+    if (count == 0) {
+        count = bnd_handlers(ALL, chain);
+    }
+
+    if (count > 0) {
+        GenericEvent event = evt_generic(raw);
+        run_chain(chain, count, &event);
+    }
+    return count;
 }
 
-/* **************** */
-/* Event triggering */
-/* **************** */
+/* Fill the handler table. Numeric replies map to the handler of their event */
+static void handlers_init() {
+    handlers[CMD_NICK] = fire_nick;
+    handlers[CMD_QUIT] = fire_quit;
+    handlers[CMD_JOIN] = fire_join;
+    handlers[CMD_PART] = fire_part;
+    handlers[CMD_TOPIC] = fire_topic;
+    handlers[atoi(RPL_NAMREPLY)] = fire_names;
+    handlers[atoi(RPL_ENDOFNAMES)] = fire_names;
+    handlers[atoi(RPL_LIST)] = fire_list;
+    handlers[atoi(RPL_LISTEND)] = fire_list;
+    handlers[CMD_INVITE] = fire_invite;
+    handlers[CMD_KICK] = fire_kick;
+    handlers[CMD_PRIVMSG] = fire_message;
+    handlers[CMD_MODE] = fire_mode;
+    handlers[CMD_PING] = fire_ping;
+    handlers[CMD_NOTICE] = fire_notice;
+}
 
-static void __circus__ping_handler(PingEvent* event) {
-    irc_pong(event->server);
+static void _track_event(struct raw_event* raw) {
+    if (raw->conn == NULL) {
+        return;
+    }
+
+    /* Learn the server limits before the user callbacks and the tracker need them */
+    if (raw->cmd == atoi(RPL_ISUPPORT) && raw->num_params > 1) {
+        trk_features(net_tracker(raw->conn), raw->num_params - 1, raw->params + 1);
+    }
+
+    /* Measure the lag before the workers delay the answer */
+    if (raw->cmd == CMD_PONG && raw->num_params > 0) {
+        net_pong(raw->conn, raw->params[raw->num_params - 1]);
+    }
+
+    /* A reconnected session goes back to its channels as soon as it is registered */
+    if (raw->cmd == atoi(RPL_WELCOME)) {
+        net_registered(raw->conn);
+    }
+
+    trk_update(net_tracker(raw->conn), raw);
 }
 
 static void _fire_event(struct raw_event* raw) {
-    Callback callback = NULL;
+    dsp_handler handler;
+    int count = 0;
+
+    if (raw->__task != NULL) {
+        raw->__task(raw->__task_data);
+        return;
+    }
+
+    pthread_once(&handlers_once, handlers_init);
     upper(raw->type);
 
+    /* Callbacks answer through the connection where the message was received */
+    if (raw->conn != NULL) {
+        net_use(raw->conn);
+    }
+
     /* Check if there is a concrete binding for the
      * incoming message type. */
     debug(("dispatcher: Looking for a binding for %s\n", raw->type));
 
-    /* Connection registration */
-    if (s_eq(raw->type, NICK)) {
-        callback = bnd_lookup(raw->type);
-        if (callback != NULL) {
-            NickEvent event = evt_nick(raw);
-            NickCallback(callback)(&event);
-        }
-    } else if (s_eq(raw->type, QUIT)) {
-        callback = bnd_lookup(raw->type);
-        if (callback != NULL) {
-            QuitEvent event = evt_quit(raw);
-            QuitCallback(callback)(&event);
-        }
-    } /* Channel operations */
-    else if (s_eq(raw->type, JOIN)) {
-        callback = bnd_lookup(raw->type);
-        if (callback != NULL) {
-            JoinEvent event = evt_join(raw);
-            JoinCallback(callback)(&event);
-        }
-    } else if (s_eq(raw->type, PART)) {
-        callback = bnd_lookup(raw->type);
-        if (callback != NULL) {
-            PartEvent event = evt_part(raw);
-            PartCallback(callback)(&event);
-        }
-    } else if (s_eq(raw->type, TOPIC)) {
-        callback = bnd_lookup(raw->type);
-        if (callback != NULL) {
-            TopicEvent event = evt_topic(raw);
-            TopicCallback(callback)(&event);
-        }
-    } else if (s_eq(raw->type, RPL_NAMREPLY) || s_eq(raw->type, RPL_ENDOFNAMES)) {
-        callback = bnd_lookup(NAMES);
-        if (callback != NULL) {
-            NamesEvent event = evt_names(raw);
-            NamesCallback(callback)(&event);
-        }
-    } else if (s_eq(raw->type, RPL_LIST) || s_eq(raw->type, RPL_LISTEND)) {
-        callback = bnd_lookup(LIST);
-        if (callback != NULL) {
-            ListEvent event = evt_list(raw);
-            ListCallback(callback)(&event);
-        }
-    } else if (s_eq(raw->type, INVITE)) {
-        callback = bnd_lookup(raw->type);
-        if (callback != NULL) {
-            InviteEvent event = evt_invite(raw);
-            InviteCallback(callback)(&event);
-        }
-    } else if (s_eq(raw->type, KICK)) {
-        callback = bnd_lookup(raw->type);
-        if (callback != NULL) {
-            KickEvent event = evt_kick(raw);
-            KickCallback(callback)(&event);
-        }
-    } else if (s_eq(raw->type, PRIVMSG)) {
-        /* Look for a command binding */
-        char key[50];
-        char* buffer, *command, *command_params;
-        size_t lparam = strlen(raw->params[1]);
-
-        /* The first parameter in PRIVMSG contains the whole message.
-         * We need to consider only the first word */
-        if ((buffer = malloc((lparam + 1) * sizeof(char))) == 0) {
-            perror("Out of memory (fire_event)");
-            exit(EXIT_FAILURE);
-        }
-
-        memset(buffer, '\0', lparam + 1);
-        strncpy(buffer, raw->params[1], lparam);
-        command = strtok_r(buffer, " ", &command_params);
-
-        if (command != NULL) {
-            build_command_key(key, command);
-            debug(("dispatcher: Looking for command: %s\n", command));
-            callback = bnd_lookup(key);
-            if (callback != NULL) {
-                /* Remove the command name from the raw message */
-                raw->params[1] = command_params;
-            }
-        }
-
-        /* If no command binding is found, look for an event binding */
-        if (callback == NULL) {
-            debug(("dispatcher: No command found. Looking for event.\n"));
-            callback = bnd_lookup(raw->type);
-        }
-
-        if (callback != NULL) {
-            MessageEvent event = evt_message(raw);
-            MessageCallback(callback)(&event);
-        }
-    } else if (s_eq(raw->type, MODE)) {
-        callback = bnd_lookup(raw->type);
-        if (callback != NULL) {
-            ModeEvent event = evt_mode(raw);
-            ModeCallback(callback)(&event);
-        }
-    } /* Miscellaneous events */
-    else if (s_eq(raw->type, PING)) {
-        PingEvent event = evt_ping(raw);
-        __circus__ping_handler(&event);    /* Call the system callback for ping before calling the bindings */
-        callback = bnd_lookup(raw->type);
-        if (callback != NULL) {
-            PingCallback(callback)(&event);
-        }
-    } else if (s_eq(raw->type, NOTICE)) {
-        callback = bnd_lookup(raw->type);
-        if (callback != NULL) {
-            NoticeEvent event = evt_notice(raw);
-            NoticeCallback(callback)(&event);
-        }
+    if (raw->cmd >= 0 && raw->cmd < CMD_MAX && (handler = handlers[raw->cmd]) != NULL) {
+        count = handler(raw);
     }
 
-    /* If no specific callback is found, check if there is
+    /* If no specific handler is found, check if there is
      * a global binding defined to handle the incoming message. */
-
-    if (callback == NULL) {
-        if (is_error(raw->type)) {
-            /* Look for a concrete error binding */
-            callback = bnd_lookup(raw->type);
-            /* If none is found, look for a generic error binding */
-            if (callback == NULL) {
-                callback = bnd_lookup(ERROR);
-            }
-
-            if (callback != NULL) {
-                ErrorEvent event = evt_error(raw);
-                ErrorCallback(callback)(&event);
-            }
+    if (count == 0) {
+        if (raw->cmd >= ERR_CODE_START && raw->cmd <= ERR_CODE_END) {
+            count = fire_error(raw);
         } else {
-            /* Look for a concrete message binding */
-            callback = bnd_lookup(raw->type);
-            /* If none is found, look for a generic message binding */
-            if (callback == NULL) {
-                callback = bnd_lookup(ALL);
-            }
-
-            if (callback != NULL) {
-                GenericEvent event = evt_generic(raw);
-                GenericCallback(callback)(&event);
-            }
+            count = fire_generic(raw);
         }
     }
 
     #ifdef DEBUG
-    if (callback == NULL) {
+    if (count == 0) {
         debug(("dispatcher: Binding not found\n"));
     }
     #endif
 }
-
@@ -25,8 +25,13 @@
 
 #include "events.h"
 
-void dsp_start();                               /* Initialize the event dispatcher */
+#define DSP_WORKERS 1    /* Default number of threads that invoke the callbacks */
+#define DSP_INLINE 0     /* Invoke the callbacks in the listener thread, without dispatcher threads */
+
+void dsp_start(int num_workers);                /* Initialize the event dispatcher with the given number of workers (or DSP_INLINE) */
 void dsp_dispatch(struct raw_event* event);     /* Dispatch the given event */
+void dsp_call(void (*task)(void*), void* data); /* Run a function in the dispatcher, along with the callbacks */
+void dsp_drain();                               /* Wait until the dispatched events have been handled (only from the listener thread) */
 void dsp_shutdown();                            /* Shuts down the event dispatcher */
 
 #endif
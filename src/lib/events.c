@@ -25,13 +25,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include "utils.h"
 #include "events.h"
 #include "listener.h"
+#include "network.h"
 #include "irc.h"
 
 
+/* Check if a target is a channel for the server that sent the message. The
+ * listener may be parsing RPL_ISUPPORT, so the tracker lock guards the features */
+static int raw_is_channel(struct raw_event* raw, const char* name) {
+    return raw->conn != NULL ? trk_is_channel(net_tracker(raw->conn), name) : isp_is_channel(isp_defaults(), name);
+}
+
+
 /* ********************************** */
 /* User information utility functions */
 /* ********************************** */
@@ -64,31 +73,96 @@ UserInfo user_info(char* user_ref) {
 /* Raw events */
 /* ********** */
 
+/* Raw events are recycled through a free list. They are allocated in chunks
+ * that are only released when the pool is destroyed. */
+struct evt_chunk {
+    struct evt_chunk* next;                     /* The next allocated chunk */
+    struct raw_event events[EVT_POOL_CHUNK];    /* The events in the chunk */
+};
+
+static struct evt_pool {
+    pthread_mutex_t lock;       /* Events are taken by the listener and returned by the dispatcher threads */
+    struct raw_event* free;     /* The events available to be used */
+    struct evt_chunk* chunks;   /* All the allocated chunks */
+} pool = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL };
+
+/* Allocate a new chunk of events and add them to the free list. Must be called with the lock held */
+static void evt_pool_grow() {
+    struct evt_chunk* chunk;
+    int i;
+
+    if ((chunk = malloc(sizeof(struct evt_chunk))) == 0) {
+        perror("Out of memory (evt_pool_grow)");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < EVT_POOL_CHUNK; i++) {
+        chunk->events[i].__next = pool.free;
+        pool.free = &chunk->events[i];
+    }
+
+    chunk->next = pool.chunks;
+    pool.chunks = chunk;
+}
+
 struct raw_event* evt_raw_create() {
     int i;
     struct raw_event* raw;
 
-    if ((raw = malloc(sizeof(struct raw_event))) == 0) {
-        perror("Out of memory (raw_create)");
-        exit(EXIT_FAILURE);
+    pthread_mutex_lock(&pool.lock);
+    if (pool.free == NULL) {
+        evt_pool_grow();
     }
+    raw = pool.free;
+    pool.free = raw->__next;
+    pthread_mutex_unlock(&pool.lock);
 
     gettimeofday(&raw->timestamp, NULL);
+    raw->conn = NULL;
     raw->__buffer = NULL;
+    raw->__next = NULL;
+    raw->__task = NULL;
+    raw->__task_data = NULL;
     raw->prefix = NULL;
     raw->type = NULL;
+    raw->cmd = CMD_UNKNOWN;
     raw->num_params = 0;
+    raw->type_view.offset = 0;
+    raw->type_view.length = 0;
+    raw->prefix_view.offset = 0;
+    raw->prefix_view.length = 0;
 
     for (i = 0; i < MAX_PARAMS; i++) {
         raw->params[i] = NULL;
+        raw->param_views[i].offset = 0;
+        raw->param_views[i].length = 0;
     }
 
     return raw;
 }
 
 void evt_raw_destroy(struct raw_event* raw) {
-    free(raw->__buffer);
-    free(raw);
+    /* Only messages that did not fit in the event have their own buffer */
+    if (raw->__buffer != raw->line) {
+        free(raw->__buffer);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    raw->__next = pool.free;
+    pool.free = raw;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+void evt_pool_destroy() {
+    struct evt_chunk* chunk;
+
+    pthread_mutex_lock(&pool.lock);
+    while ((chunk = pool.chunks) != NULL) {
+        pool.chunks = chunk->next;
+        free(chunk);
+    }
+    pool.free = NULL;
+    pthread_mutex_unlock(&pool.lock);
 }
 
 /* ************** */
@@ -104,6 +178,7 @@ ErrorEvent evt_error(struct raw_event *raw) {
     }
 
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.code = raw->type;
     event.num_params = i;
     event.message = raw->params[raw->num_params - 1];
@@ -120,6 +195,7 @@ GenericEvent evt_generic(struct raw_event *raw) {
     }
 
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.code = raw->type;
     event.num_params = i;
     event.message = raw->params[raw->num_params - 1];
@@ -134,6 +210,7 @@ GenericEvent evt_generic(struct raw_event *raw) {
 NickEvent evt_nick(struct raw_event *raw) {
     NickEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.user = user_info(raw->prefix);
     event.new_nick = raw->params[0];
     return event;
@@ -142,6 +219,7 @@ NickEvent evt_nick(struct raw_event *raw) {
 QuitEvent evt_quit(struct raw_event *raw) {
     QuitEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.user = user_info(raw->prefix);
     event.message = raw->params[0];
     return event;
@@ -154,6 +232,7 @@ QuitEvent evt_quit(struct raw_event *raw) {
 JoinEvent evt_join(struct raw_event *raw) {
     JoinEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.user = user_info(raw->prefix);
     event.channel = raw->params[0];
     return event;
@@ -162,6 +241,7 @@ JoinEvent evt_join(struct raw_event *raw) {
 PartEvent evt_part(struct raw_event *raw) {
     PartEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.user = user_info(raw->prefix);
     event.channel = raw->params[0];
     event.message = raw->params[1];
@@ -171,6 +251,7 @@ PartEvent evt_part(struct raw_event *raw) {
 TopicEvent evt_topic(struct raw_event *raw) {
     TopicEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.user = user_info(raw->prefix);
     event.channel = raw->params[0];
     event.topic = raw->params[1];
@@ -181,6 +262,7 @@ NamesEvent evt_names(struct raw_event *raw) {
     char* token, *next = NULL;
     NamesEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.finished = s_eq(raw->type, RPL_ENDOFNAMES);
     event.channel = raw->params[event.finished? 1 : 2];
     event.num_names = 0;
@@ -197,6 +279,7 @@ NamesEvent evt_names(struct raw_event *raw) {
 ListEvent evt_list(struct raw_event *raw) {
     ListEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.channel = NULL;
     event.num_users = 0;
     event.topic = NULL;
@@ -212,6 +295,7 @@ ListEvent evt_list(struct raw_event *raw) {
 InviteEvent evt_invite(struct raw_event *raw) {
     InviteEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.user = user_info(raw->prefix);
     event.nick = raw->params[0];
     event.channel = raw->params[1];
@@ -221,6 +305,7 @@ InviteEvent evt_invite(struct raw_event *raw) {
 KickEvent evt_kick(struct raw_event *raw) {
     KickEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.user = user_info(raw->prefix);
     event.channel = raw->params[0];
     event.nick = raw->params[1];
@@ -231,8 +316,9 @@ KickEvent evt_kick(struct raw_event *raw) {
 MessageEvent evt_message(struct raw_event *raw) {
     MessageEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.user = user_info(raw->prefix);
-    event.is_channel = (raw->params[0][0] == '#');
+    event.is_channel = raw_is_channel(raw, raw->params[0]);
     event.to = raw->params[0];
     event.message = raw->params[1];
     return event;
@@ -246,7 +332,8 @@ ModeEvent evt_mode(struct raw_event *raw) {
     char* flags = raw->params[1];
 
     event.timestamp = &raw->timestamp;
-    event.is_channel = (raw->params[0][0] == '#');
+    event.conn = raw->conn;
+    event.is_channel = raw_is_channel(raw, raw->params[0]);
     event.user = user_info(event.is_channel? raw->prefix : NULL);
     event.target = raw->params[0];
     event.set_flags = 0x0000;
@@ -303,6 +390,7 @@ ModeEvent evt_mode(struct raw_event *raw) {
 PingEvent evt_ping(struct raw_event *raw) {
     PingEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.server = raw->params[0];
     return event;
 }
@@ -310,6 +398,7 @@ PingEvent evt_ping(struct raw_event *raw) {
 NoticeEvent evt_notice(struct raw_event *raw) {
     NoticeEvent event;
     event.timestamp = &raw->timestamp;
+    event.conn = raw->conn;
     event.to = raw->params[0];
     event.text = raw->params[1];
     return event;
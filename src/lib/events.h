@@ -28,18 +28,45 @@
 /* Maximum number of parameters in an IRC message */
 #define MAX_PARAMS 15
 
+/* Size of the line stored in each event: an IRC message plus the '\0'. Longer
+ * lines (from servers that advertise a LINELEN above it) get their own buffer */
+#define EVT_LINE_SIZE 513
+
+/* Number of events allocated at once when the event pool is empty */
+#define EVT_POOL_CHUNK 256
+
+/* A connection to an IRC server (see network.h) */
+struct net_conn;
+typedef struct net_conn Connection;
+
+/* A slice of the original message */
+struct raw_view {
+    unsigned short offset;      /* The position of the slice in the message buffer */
+    unsigned short length;      /* The length of the slice */
+};
+
 /* Raw IRC message */
 struct raw_event {
     struct timeval timestamp;   /* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the message was received */
     char* __buffer;             /* The tokenized original message */
     char* type;                 /* The IRC message type */
+    int   cmd;                  /* The identifier of the message type (see codes.h) */
     char* prefix;               /* The message prefix (if any) */
     int   num_params;           /* The number of parameters */
     char* params[MAX_PARAMS];   /* The parameter array */
+    struct raw_view type_view;                  /* Location of the message type in the buffer */
+    struct raw_view prefix_view;                /* Location of the prefix in the buffer */
+    struct raw_view param_views[MAX_PARAMS];    /* Location of each parameter in the buffer */
+    char line[EVT_LINE_SIZE];                   /* Storage for the message, used as the buffer if it fits */
+    void (*__task)(void*);                      /* A function to run instead of firing the event (such as an expired timer) */
+    void* __task_data;                          /* The argument of the task */
+    struct raw_event* __next;                   /* The next free event in the pool */
 };
 
-struct raw_event* evt_raw_create(void);         /* Creates a raw event */
-void evt_raw_destroy(struct raw_event* raw);    /* Destroys the raw event */
+struct raw_event* evt_raw_create(void);         /* Takes a raw event from the event pool */
+void evt_raw_destroy(struct raw_event* raw);    /* Returns the raw event to the event pool */
+void evt_pool_destroy(void);                    /* Frees the event pool (no event can be in use) */
 
 /* ********************************** */
 /* User information utility functions */
@@ -62,6 +89,7 @@ UserInfo user_info(char* user_ref);
 /* Fired when an error message arrives */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     char* code;                 /* The error code */
     int   num_params;           /* The number of parameters in the message */
     char* params[MAX_PARAMS];   /* The parameters of the message */
@@ -71,6 +99,7 @@ typedef struct {
 /* Fired when no specific parsing is defined fot the reveiced event */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     char* code;                 /* The message code */
     int   num_params;           /* The number of parameters in the message */
     char* params[MAX_PARAMS];   /* The parameters of the message */
@@ -84,6 +113,7 @@ typedef struct {
 /* Fired when the nick is changed */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     UserInfo user;              /* The user who generates the event */
     char* new_nick;             /* The new nick for the user */
 } NickEvent;
@@ -91,6 +121,7 @@ typedef struct {
 /* Fired when someone quits */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     UserInfo user;              /* The user who generates the event */
     char* message;              /* The quit message */
 } QuitEvent;
@@ -102,6 +133,7 @@ typedef struct {
 /* Fired when a user joins a channel */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     UserInfo user;              /* The user who joined a channel */
     char* channel;              /* The channel name */
 } JoinEvent;
@@ -109,6 +141,7 @@ typedef struct {
 /* Fired when a user leaves a channel */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     UserInfo user;              /* The user who leaved the channel */
     char* channel;              /* The channel name */
     char* message;              /* The part message */
@@ -117,6 +150,7 @@ typedef struct {
 /* Fired when someone changes the topic of a channel */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     UserInfo user;              /* The user who has changed the topic */
     char* channel;              /* The channel name */
     char* topic;                /* The new topic */
@@ -125,6 +159,7 @@ typedef struct {
 /* Fired when the response to the NAMES arrives */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     int finished;               /* If there are no more users to process (NAMES response is multi-message) */
     char* channel;              /* The channel */
     int num_names;              /* The number of names in the current names list */
@@ -134,6 +169,7 @@ typedef struct {
 /* Fired when the response to the NAMES arrives */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     int finished;               /* If there are no more channels to process (LIST response is multi-message) */
     char* channel;              /* The name of the current channel */
     int num_users;              /* The number of users in the channel */
@@ -143,6 +179,7 @@ typedef struct {
 /* Fired when someone invites to a channel */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     UserInfo user;              /* The user who generates the event */
     char* nick;                 /* The user being invited to the channel */
     char* channel;              /* The chanel where the user is invited */
@@ -151,6 +188,7 @@ typedef struct {
 /* Fired when someone is kicked in a channel */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     UserInfo user;              /* The user performing the kick */
     char* channel;              /* The channel where the user is kicked from */
     char* nick;                 /* The nick of the user being kicked */
@@ -160,6 +198,7 @@ typedef struct {
 /* Fired when a message is sent to a channel or to a user */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     UserInfo user;              /* The user who sends the message */
     int is_channel;             /* If the message is sent to a channel */
     char* to;                   /* The destination of the event (nick or channel) */
@@ -169,6 +208,7 @@ typedef struct {
 /* Fired when someone sets a mode in a channel */
 typedef struct {
     struct timeval* timestamp;	        /* The timestamp when the event was generated */
+    Connection* conn;                   /* The connection where the event was received */
     UserInfo user;                      /* The user who is changing the mode */
     int is_channel;                     /* If the mode applies to a channel or to a user. */
     char* target;                       /* The affected channel or user */
@@ -186,12 +226,14 @@ typedef struct {
 /* Fired when a ping message arrives */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     char* server;               /* Server where the pong response must be sent */
 } PingEvent;
 
 /* Fired when a notice arrives */
 typedef struct {
     struct timeval* timestamp;	/* The timestamp when the event was generated */
+    Connection* conn;           /* The connection where the event was received */
     char* to;                   /* The destination of the message */
     char* text;                 /* The text of the message */
 } NoticeEvent;
@@ -223,6 +265,15 @@ NoticeEvent     evt_notice(struct raw_event *raw);
 /* Generic callback pointer */
 typedef void (*Callback)(void);
 
+/* Generic handler pointer. Handlers are callbacks that decide if the event goes on to the next handler */
+typedef int (*Handler)(void);
+
+/* Values returned by the handlers */
+enum evt_propagation {
+    EVT_CONTINUE = 0,       /* Let the handlers with lower priority handle the event */
+    EVT_STOP = 1            /* Do not invoke the rest of handlers of the event */
+};
+
 /* Macros to convert to the appropriate function pointer type for each event */
 #define ErrorCallback(callback) ((void (*)(ErrorEvent*)) callback)
 #define GenericCallback(callback) ((void (*)(GenericEvent*)) callback)
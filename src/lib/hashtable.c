@@ -25,51 +25,113 @@
 #include <string.h>
 #include "debug.h"
 #include "utils.h"
+#include "intern.h"
 #include "hashtable.h"
 
+#define HT_MASK(ht) ((ht)->size - 1)
+#define HT_MAX_LOAD(size) ((size) / 4 * 3)      /* Grow the table when it is 3/4 full */
+
 
 /* ****************** */
 /* Hast table helpers */
 /* ****************** */
 
-/* Compute the hash of the given key */
-static unsigned char ht_hash(char* key) {
-    unsigned char hash = 0;
+/* Compute the FNV-1a hash of the given key. 0 is reserved to mark empty slots */
+static unsigned int ht_hash(char* key) {
+    unsigned int hash = 2166136261u;
     char* str = key;
     while (*str) {
-        hash += *str++;
+        hash ^= (unsigned char) *str++;
+        hash *= 16777619u;
     }
-    return hash;
+    return hash == 0 ? 1 : hash;
 }
 
-/* Create the structure that will hold a key and its values */
-static struct ht_data* ht_data_create(char* key, void* value, Function function) {
-    struct ht_data* data;
+/* Allocate the given number of empty slots */
+static struct ht_entry* ht_entries_create(int size) {
+    struct ht_entry* entries;
 
-    if ((data = malloc(sizeof(struct ht_data))) == 0) {
-        perror("Out of memory (ht_data_create)");
+    if ((entries = calloc(size, sizeof(struct ht_entry))) == 0) {
+        perror("Out of memory (ht_entries_create)");
         exit(EXIT_FAILURE);
     }
 
-    /* Allocate length + 1 to make space for the '\0' character */
-    if ((data->key = malloc((strlen(key) + 1) * sizeof(char))) == 0) {
-        perror("Out of memory (ht_data_create: key)");
+    return entries;
+}
+
+/* Store a copy of the key in the slot. Short keys do not need an allocation.
+ * Interned keys are shared instead */
+static void ht_key_set(struct ht_entry* entry, char* key, int interned) {
+    size_t len = strlen(key);
+
+    if ((entry->interned = interned)) {
+        entry->data.key = (char*) str_retain(key);
+        return;
+    }
+
+    if (len < HT_KEY_INLINE) {
+        entry->data.key = entry->inline_key;
+    } else if ((entry->data.key = malloc((len + 1) * sizeof(char))) == 0) {
+        perror("Out of memory (ht_key_set)");
         exit(EXIT_FAILURE);
     }
 
-    strncpy(data->key, key, strlen(key) + 1);
-    data->value = value;
-    data->function = function;
+    memcpy(entry->data.key, key, len + 1);
+}
 
-    return data;
+/* Free the key of the slot, if it was allocated */
+static void ht_key_free(struct ht_entry* entry) {
+    if (entry->interned) {
+        str_release(entry->data.key);
+    } else if (entry->data.key != entry->inline_key) {
+        free(entry->data.key);
+    }
 }
 
-/* Destruy a ht_data structure */
-static void ht_data_destroy(struct ht_data* data) {
-    if (data != NULL) {
-        free(data->key);
-        free(data);
+/* Move the contents of a slot, keeping the key pointing to its own slot if inline */
+static void ht_entry_move(struct ht_entry* dst, struct ht_entry* src) {
+    *dst = *src;
+    if (src->data.key == src->inline_key) {
+        dst->data.key = dst->inline_key;
     }
+    src->hash = 0;
+}
+
+/* Find the slot of the key, or the empty slot where it should be added */
+static int ht_slot(struct ht_table* ht, char* key, unsigned int hash) {
+    int idx = hash & HT_MASK(ht);
+
+    while (ht->entries[idx].hash != 0) {
+        if (ht->entries[idx].hash == hash && (ht->entries[idx].data.key == key || s_eq(ht->entries[idx].data.key, key))) {
+            break;
+        }
+        idx = (idx + 1) & HT_MASK(ht);
+    }
+
+    return idx;
+}
+
+/* Move all entries to a table with the given number of slots */
+static void ht_resize(struct ht_table* ht, int size) {
+    struct ht_entry* old = ht->entries;
+    int i, idx, old_size = ht->size;
+
+    debug(("hashtable: Resizing table to %d\n", size));
+
+    ht->entries = ht_entries_create(size);
+    ht->size = size;
+
+    for (i = 0; i < old_size; i++) {
+        if (old[i].hash != 0) {
+            idx = old[i].hash & HT_MASK(ht);
+            while (ht->entries[idx].hash != 0) {
+                idx = (idx + 1) & HT_MASK(ht);
+            }
+            ht_entry_move(&ht->entries[idx], &old[i]);
+        }
+    }
+
+    free(old);
 }
 
 /* ************************* */
@@ -77,7 +139,6 @@ static void ht_data_destroy(struct ht_data* data) {
 /* ************************* */
 
 struct ht_table* ht_create() {
-    int i;
     struct ht_table* ht;
 
     debug(("hashtable: Creating table of size %d\n", HT_SIZE));
@@ -87,15 +148,7 @@ struct ht_table* ht_create() {
         exit(EXIT_FAILURE);
     }
 
-    if ((ht->entries = malloc(HT_SIZE * sizeof(struct ht_entry*))) == 0) {
-        perror("Out of memory (ht_create: entries)");
-        exit(EXIT_FAILURE);
-    }
-
-    for (i = 0; i < HT_SIZE; i++) {
-        ht->entries[i] = NULL;
-    }
-
+    ht->entries = ht_entries_create(HT_SIZE);
     ht->num_entries = 0;
     ht->size = HT_SIZE;
 
@@ -103,20 +156,13 @@ struct ht_table* ht_create() {
 }
 
 void ht_destroy(struct ht_table* ht) {
-    struct ht_entry* current, *previous;
     int i = 0;
 
     debug(("hashtable: Destroying\n"));
 
     for (i = 0; i < ht->size; i++) {
-        if (ht->entries[i] != NULL) {
-            current = ht->entries[i];
-            while (current != NULL) {
-                previous = current;
-                current = current->next;
-                ht_data_destroy(previous->data);
-                free(previous);
-            }
+        if (ht->entries[i].hash != 0) {
+            ht_key_free(&ht->entries[i]);
         }
     }
 
@@ -124,109 +170,126 @@ void ht_destroy(struct ht_table* ht) {
     free(ht);
 }
 
-static void ht_add(struct ht_table* ht, char* key, void* value, void(*function)(void)) {
-    struct ht_entry *current, *old;
-    unsigned char idx;
-    struct ht_data* data;
+struct ht_table* ht_copy(struct ht_table* ht) {
+    struct ht_table* copy;
+    int i;
 
-    debug(("hashtable: Adding entry with key %s\n", key));
+    debug(("hashtable: Copying table of size %d\n", ht->size));
 
-    idx = ht_hash(key);
-    current = ht->entries[idx];
+    if ((copy = malloc(sizeof(struct ht_table))) == 0) {
+        perror("Out of memory (ht_copy)");
+        exit(EXIT_FAILURE);
+    }
 
-    /* Find the key (if already exists) */
-    while (current != NULL && s_ne(current->data->key, key)) {
-        old = current;
-        current = current->next;
+    if ((copy->entries = malloc(ht->size * sizeof(struct ht_entry))) == 0) {
+        perror("Out of memory (ht_copy: entries)");
+        exit(EXIT_FAILURE);
     }
 
-    /* If key does not exist or it must not be overriden,
-     * add the new element at the beginning of the list. */
-    data = ht_data_create(key, value, function);
+    memcpy(copy->entries, ht->entries, ht->size * sizeof(struct ht_entry));
+    copy->num_entries = ht->num_entries;
+    copy->size = ht->size;
 
-    if (current == NULL) {  /* Add element */
-        if ((current = malloc(sizeof(struct ht_entry))) == 0) {
-            perror("Out of memory (ht_add)");
-            exit(EXIT_FAILURE);
+    /* Each table owns its keys */
+    for (i = 0; i < ht->size; i++) {
+        if (ht->entries[i].hash != 0) {
+            ht_key_set(&copy->entries[i], ht->entries[i].data.key, ht->entries[i].interned);
         }
+    }
+
+    return copy;
+}
+
+static void ht_add(struct ht_table* ht, char* key, int interned, void* value, void(*function)(void)) {
+    struct ht_entry* entry;
+    unsigned int hash;
+
+    debug(("hashtable: Adding entry with key %s\n", key));
+
+    /* Grow before probing, so there is always an empty slot to stop the search */
+    if (ht->num_entries + 1 > HT_MAX_LOAD(ht->size)) {
+        ht_resize(ht, ht->size * 2);
+    }
 
-        old = ht->entries[idx];
-        ht->entries[idx] = current;
-        current->next = old;
-        current->data = data;
+    hash = interned ? str_hash(key) : ht_hash(key);
+    entry = &ht->entries[ht_slot(ht, key, hash)];
+
+    if (entry->hash == 0) {     /* Add element */
+        entry->hash = hash;
+        ht_key_set(entry, key, interned);
         ht->num_entries++;
-    } else {    /* Overwrite */
-        ht_data_destroy(current->data);
-        current->data = data;
     }
+
+    /* Overwrite the values if the key already exists */
+    entry->data.value = value;
+    entry->data.function = function;
 }
 
 void ht_add_value(struct ht_table* ht, char* key, void* value) {
-    ht_add(ht, key, value, NULL);
+    ht_add(ht, key, 0, value, NULL);
 }
 
 void ht_add_function(struct ht_table* ht, char* key, void(*function)(void)) {
-    ht_add(ht, key, NULL, function);
+    ht_add(ht, key, 0, NULL, function);
+}
+
+void ht_add_str(struct ht_table* ht, const char* str, void* value) {
+    ht_add(ht, (char*) str, 1, value, NULL);
 }
 
 void ht_del(struct ht_table* ht, char* key) {
-    struct ht_entry *current, *old;
-    unsigned char idx;
+    int idx, next, home;
 
     debug(("hashtable: Deleting entry with key %s\n", key));
 
-    /* Find entry */
-    old = 0;
-    idx = ht_hash(key);
-    current = ht->entries[idx];
-
-    while (current != NULL && s_ne(current->data->key, key)) {
-        old = current;
-        current = current->next;
+    idx = ht_slot(ht, key, ht_hash(key));
+    if (ht->entries[idx].hash == 0) {
+        return;
     }
 
-    if (current != NULL) {
-        if (old != NULL) {
-            old->next = current->next;          /* Not first node, old points to previous node */
-        } else {
-            ht->entries[idx] = current->next;   /* First node on chain */
-        }
+    ht_key_free(&ht->entries[idx]);
+    ht->entries[idx].hash = 0;
+    ht->num_entries--;
+
+    /* Shift back the entries of the same probe sequence so
+     * lookups never stop at the hole left by the deleted entry */
+    next = idx;
+    while (ht->entries[next = (next + 1) & HT_MASK(ht)].hash != 0) {
+        home = ht->entries[next].hash & HT_MASK(ht);
 
-        ht_data_destroy(current->data);
-        free(current);
-        ht->num_entries--;
+        /* Move the entry only if its home slot is not between the hole and its position */
+        if ((next > idx && (home <= idx || home > next)) || (next < idx && home <= idx && home > next)) {
+            ht_entry_move(&ht->entries[idx], &ht->entries[next]);
+            idx = next;
+        }
     }
 }
 
 struct ht_data* ht_find(struct ht_table* ht, char* key) {
     struct ht_entry *current;
-    
+
     debug(("hashtable: Looking for key %s\n", key));
 
-    current = ht->entries[ht_hash(key)];
-    while (current != NULL && s_ne(current->data->key, key)) {
-        current = current->next;
-    }
+    current = &ht->entries[ht_slot(ht, key, ht_hash(key))];
 
-    debug(("hashtable: Key %s %sfound\n", key, current == NULL? "not " : ""));
+    debug(("hashtable: Key %s %sfound\n", key, current->hash == 0? "not " : ""));
 
-    return current == NULL? NULL : current->data;
+    return current->hash == 0? NULL : &current->data;
+}
+
+struct ht_data* ht_find_str(struct ht_table* ht, const char* str) {
+    struct ht_entry *current = &ht->entries[ht_slot(ht, (char*) str, str_hash(str))];
+    return current->hash == 0? NULL : &current->data;
 }
 
 void ht_print_keys(struct ht_table* ht) {
-    struct ht_entry* current;
     int i = 0;
 
     debug(("hashtable: Dumping keys\n"));
 
     for (i = 0; i < ht->size; i++) {
-        if (ht->entries[i] != NULL) {
-            current = ht->entries[i];
-            while (current != NULL) {
-                printf("Key: %s\n", current->data->key);
-                current = current->next;
-            }
+        if (ht->entries[i].hash != 0) {
+            printf("Key: %s\n", ht->entries[i].data.key);
         }
     }
 }
-
@@ -23,7 +23,8 @@
 #ifndef __HASHTABLE_H__
 #define __HASHTABLE_H__
 
-#define HT_SIZE 256             /* Number of entries in the hash table */
+#define HT_SIZE 16              /* Initial number of slots in the hash table (power of 2) */
+#define HT_KEY_INLINE 32        /* Keys shorter than this are stored inside the slot */
 
 /*************************/
 /* Hash table definition */
@@ -39,15 +40,17 @@ struct ht_data {
     Function function;      /* The function pointer of the data, if value is a function pointer */
 };
 
-/* An entry in the hash table */
+/* A slot in the hash table. Collisions are resolved with linear probing */
 struct ht_entry {
-    struct ht_entry *next;      /* Pointer for the next entry of the same hash */
-    struct ht_data* data;       /* Data stored in the current entry */
+    unsigned int hash;              /* The hash of the key, or 0 if the slot is empty */
+    char interned;                  /* If the key is a shared interned string instead of a copy */
+    struct ht_data data;            /* Data stored in the current slot */
+    char inline_key[HT_KEY_INLINE]; /* Storage for short keys, to avoid allocating them */
 };
 
 /* Hash table data structure */
 struct ht_table {
-    struct ht_entry** entries;	    /* The hash table */
+    struct ht_entry* entries;       /* The hash table slots */
     int size;                       /* The size of the hash table */
     int num_entries;                /* The number of current entries */
 };
@@ -58,10 +61,13 @@ struct ht_table {
 
 struct ht_table*    ht_create();			        /* Creates a new hash table */
 void                ht_destroy(struct ht_table* ht);            /* Destroy the given hash table */
+struct ht_table*    ht_copy(struct ht_table* ht);               /* Creates a copy of the given hash table */
 void                ht_add_value(struct ht_table* ht, char* key, void* value);              /* Add a value to the hash table */
 void                ht_add_function(struct ht_table* ht, char* key, Function function);     /* Add a function to the hash table */
+void                ht_add_str(struct ht_table* ht, const char* str, void* value);          /* Add a value with an interned key, which is kept instead of copied */
 void                ht_del(struct ht_table* ht, char* key);     /* Remove an entry from the hash table */
-struct ht_data*     ht_find(struct ht_table* ht, char* key);	/* Find an entry in the hash table */
+struct ht_data*     ht_find(struct ht_table* ht, char* key);	/* Find an entry in the hash table (valid until the table is modified) */
+struct ht_data*     ht_find_str(struct ht_table* ht, const char* str);  /* Find an entry by an interned key, without hashing it again */
 void                ht_print_keys(struct ht_table* ht);         /* Print all keys in the table */
 
 #endif
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include "debug.h"
+#include "casemap.h"
+#include "intern.h"
+
+#define STR_MAPPINGS (ISP_ASCII + 1)    /* Number of case mappings */
+
+/* An interned string. Handles point to its text */
+struct str_entry {
+    struct str_entry* next;             /* The next string in the same bucket */
+    const char* folded[STR_MAPPINGS];   /* The lowercase form in each case mapping, once requested */
+    unsigned int hash;                  /* The FNV-1a hash of the text */
+    unsigned int len;                   /* The length of the text */
+    int refs;                           /* The number of users of the string */
+    char text[1];                       /* The text, allocated along with the entry */
+};
+
+/* A part of the string table with its own lock, so threads rarely wait for each other */
+struct str_shard {
+    pthread_mutex_t lock;
+    struct str_entry** buckets;         /* The strings, chained by hash */
+    unsigned int size;                  /* Number of buckets */
+    unsigned int count;                 /* Number of strings */
+};
+
+static struct str_shard shards[STR_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+#define STR_ENTRY(str) ((struct str_entry*) ((str) - offsetof(struct str_entry, text)))
+#define STR_SHARD(hash) (&shards[((hash) >> 24) & (STR_SHARDS - 1)])
+
+
+/* ************** */
+/* Table handling */
+/* ************** */
+
+/* Allocate the given number of empty buckets */
+static struct str_entry** str_buckets(unsigned int size) {
+    struct str_entry** buckets;
+
+    if ((buckets = calloc(size, sizeof(struct str_entry*))) == NULL) {
+        perror("Out of memory (str_buckets)");
+        exit(EXIT_FAILURE);
+    }
+
+    return buckets;
+}
+
+static void str_init() {
+    int i;
+
+    for (i = 0; i < STR_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        shards[i].buckets = str_buckets(STR_BUCKETS);
+        shards[i].size = STR_BUCKETS;
+        shards[i].count = 0;
+    }
+}
+
+/* Double the buckets of a shard. Must be called with the shard lock held */
+static void str_grow(struct str_shard* shard) {
+    struct str_entry** old = shard->buckets, *entry, *next;
+    unsigned int i, size = shard->size;
+
+    shard->buckets = str_buckets(size * 2);
+    shard->size = size * 2;
+
+    for (i = 0; i < size; i++) {
+        for (entry = old[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            entry->next = shard->buckets[entry->hash & (shard->size - 1)];
+            shard->buckets[entry->hash & (shard->size - 1)] = entry;
+        }
+    }
+
+    free(old);
+}
+
+/* Compute the FNV-1a hash of the text. 0 is avoided, as in the hash table */
+static unsigned int str_hash_text(const char* text, unsigned int len) {
+    unsigned int hash = 2166136261u, i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char) text[i];
+        hash *= 16777619u;
+    }
+
+    return hash == 0 ? 1 : hash;
+}
+
+
+/* **************** */
+/* Interned strings */
+/* **************** */
+
+const char* str_intern_len(const char* text, unsigned int len) {
+    unsigned int hash = str_hash_text(text, len);
+    struct str_shard* shard = STR_SHARD(hash);
+    struct str_entry* entry;
+
+    pthread_once(&shards_once, str_init);
+    pthread_mutex_lock(&shard->lock);
+
+    for (entry = shard->buckets[hash & (shard->size - 1)]; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->len == len && memcmp(entry->text, text, len) == 0) {
+            __atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&shard->lock);
+            return entry->text;
+        }
+    }
+
+    if ((entry = malloc(sizeof(struct str_entry) + len)) == NULL) {
+        perror("Out of memory (str_intern_len)");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(entry->folded, 0, sizeof(entry->folded));
+    memcpy(entry->text, text, len);
+    entry->text[len] = '\0';
+    entry->hash = hash;
+    entry->len = len;
+    entry->refs = 1;
+
+    if (++shard->count > shard->size) {
+        str_grow(shard);
+    }
+    entry->next = shard->buckets[hash & (shard->size - 1)];
+    shard->buckets[hash & (shard->size - 1)] = entry;
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return entry->text;
+}
+
+const char* str_intern(const char* text) {
+    return str_intern_len(text, strlen(text));
+}
+
+const char* str_retain(const char* str) {
+    __atomic_add_fetch(&STR_ENTRY(str)->refs, 1, __ATOMIC_RELAXED);
+    return str;
+}
+
+void str_release(const char* str) {
+    struct str_entry* entry = STR_ENTRY(str), **pos;
+    struct str_shard* shard = STR_SHARD(entry->hash);
+    int i;
+
+    /* The last reference is dropped with the lock held, so the string
+     * cannot be found and retained again while it is being removed */
+    pthread_mutex_lock(&shard->lock);
+    if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+
+    pos = &shard->buckets[entry->hash & (shard->size - 1)];
+    while (*pos != entry) {
+        pos = &(*pos)->next;
+    }
+    *pos = entry->next;
+    shard->count--;
+    pthread_mutex_unlock(&shard->lock);
+
+    for (i = 0; i < STR_MAPPINGS; i++) {
+        if (entry->folded[i] != NULL && entry->folded[i] != entry->text) {
+            str_release(entry->folded[i]);
+        }
+    }
+
+    free(entry);
+}
+
+const char* str_fold(const char* str, enum isp_casemapping casemapping) {
+    struct str_entry* entry = STR_ENTRY(str);
+    const char* folded, *expected = NULL;
+    char* text;
+
+    if ((folded = __atomic_load_n(&entry->folded[casemapping], __ATOMIC_ACQUIRE)) != NULL) {
+        return folded;
+    }
+
+    if ((text = malloc(entry->len + 1)) == NULL) {
+        perror("Out of memory (str_fold)");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Strings already in lowercase are their own folded form */
+    cm_fold(text, str, entry->len + 1, casemapping);
+    folded = strcmp(text, str) == 0 ? str : str_intern_len(text, entry->len);
+    free(text);
+
+    /* Another thread may have folded the string first */
+    if (!__atomic_compare_exchange_n(&entry->folded[casemapping], &expected, folded, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        if (folded != str) {
+            str_release(folded);
+        }
+        folded = expected;
+    }
+
+    return folded;
+}
+
+unsigned int str_hash(const char* str) {
+    return STR_ENTRY(str)->hash;
+}
+
+int str_count() {
+    int i, count = 0;
+
+    pthread_once(&shards_once, str_init);
+    for (i = 0; i < STR_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        count += shards[i].count;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+
+    return count;
+}
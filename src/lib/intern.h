@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __INTERN_H__
+#define __INTERN_H__
+
+#include "isupport.h"
+
+#define STR_SHARDS 16           /* Independent locks of the string table (power of two) */
+#define STR_BUCKETS 64          /* Initial number of buckets of each shard (power of two) */
+
+/* Interned strings are shared, read only copies. The same text always returns the
+ * same pointer, so interned strings can be compared with ==. Each call to str_intern
+ * or str_retain must be balanced with a call to str_release. */
+
+const char* str_intern(const char* text);                       /* Get the shared copy of a string */
+const char* str_intern_len(const char* text, unsigned int len); /* Get the shared copy of the first characters of a string */
+const char* str_retain(const char* str);                        /* Keep an interned string for longer */
+void str_release(const char* str);                              /* Stop using an interned string */
+const char* str_fold(const char* str, enum isp_casemapping casemapping);   /* Get the interned lowercase form of an interned string (valid while the string is) */
+unsigned int str_hash(const char* str);                         /* Get the hash of an interned string (the same the hash table uses) */
+int str_count(void);                                            /* Get the number of interned strings */
+
+#endif
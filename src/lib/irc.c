@@ -28,17 +28,28 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <string.h>
+#include <pthread.h>
+#include <poll.h>
 #include "debug.h"
 #include "network.h"
 #include "listener.h"
 #include "dispatcher.h"
 #include "binding.h"
 #include "utils.h"
+#include "timer.h"
+#include "replay.h"
 #include "version.h"
 #include "irc.h"
 
-/* Flag used to close the connection */
-static int shutdown_requested = 0;
+/* Flag used to close the connection. Signal handlers only set it */
+static volatile sig_atomic_t shutdown_requested = 0;
+
+/* Number of threads that invoke the callbacks */
+static int num_workers = DSP_WORKERS;
+
+/* The scheduled callbacks */
+static struct tmr_wheel* timers = NULL;
+static pthread_once_t timers_once = PTHREAD_ONCE_INIT;
 
 
 /* *********************** */
@@ -53,54 +64,196 @@ void irc_unbind_event(char* event) {
     bnd_unbind(event);
 }
 
+int irc_add_handler(char* event, Handler handler, int priority) {
+    return bnd_add_handler(event, handler, priority);
+}
+
+int irc_remove_handler(char* event, Handler handler) {
+    return bnd_remove_handler(event, handler);
+}
+
 void irc_bind_command(char* command, Callback callback) {
-    char key[50];
-    memset(key, '\0', 50);
-    build_command_key(key, command);
-    bnd_bind(key, callback);
+    bnd_bind_command(command, callback);
 }
 
 void irc_unbind_command(char* command) {
-    char key[50];
-    memset(key, '\0', 50);
-    build_command_key(key, command);
-    bnd_unbind(key);
+    bnd_unbind_command(command);
+}
+
+void irc_alias_command(char* alias, char* command) {
+    bnd_alias_command(alias, command);
+}
+
+void irc_command_prefix(char* prefix) {
+    bnd_command_syntax(prefix, -1, -1);
+}
+
+void irc_command_nick(int enable) {
+    bnd_command_syntax(NULL, enable != 0, -1);
+}
+
+void irc_command_abbrev(int min_len) {
+    bnd_command_syntax(NULL, -1, min_len > 0 ? min_len : 0);
 }
 
 /* ******************** */
 /* Connection functions */
 /* ******************** */
 
-void irc_connect(char* address, char* port) {
-    net_connect(address, port);
+Connection* irc_connect(char* address, char* port) {
+    Connection* conn = net_connect(address, port);
+    net_use(conn);
+    return conn;
 }
 
 void irc_disconnect() {
-    net_disconnect();
+    net_disconnect(net_current());
+}
+
+void irc_use(Connection* conn) {
+    net_use(conn);
+}
+
+Connection* irc_current() {
+    return net_current();
+}
+
+int irc_busy() {
+    return net_queued(net_current()) > NET_OUT_HIGH;
+}
+
+void irc_throttle(int burst, int interval_ms) {
+    if (net_current() != NULL) {
+        net_throttle(net_current(), burst, interval_ms);
+    }
+}
+
+void irc_keepalive(int interval_ms, int timeout_ms) {
+    if (net_current() != NULL) {
+        net_keepalive(net_current(), interval_ms, timeout_ms);
+    }
+}
+
+int irc_lag() {
+    return net_current() != NULL ? net_lag(net_current()) : -1;
+}
+
+void irc_reconnect(int min_ms, int max_ms) {
+    if (net_current() != NULL) {
+        net_reconnect(net_current(), min_ms, max_ms);
+    }
+}
+
+void irc_send_stats(struct sch_stats* stats) {
+    if (net_current() != NULL) {
+        net_stats(net_current(), stats);
+    } else {
+        memset(stats, 0, sizeof(struct sch_stats));
+    }
+}
+
+void irc_workers(int workers) {
+    num_workers = workers;
+}
+
+static void _timers_init() {
+    timers = tmr_create(tmr_now());
 }
 
+/* Get the timing wheel, which is created the first time a timer is added */
+static struct tmr_wheel* _timers() {
+    pthread_once(&timers_once, _timers_init);
+    return timers;
+}
+
+unsigned long irc_timer(int delay_ms, int period_ms, tmr_callback callback, void* data) {
+    unsigned long id = tmr_add(_timers(), tmr_now(), delay_ms, period_ms, callback, data);
+    net_wake();     /* The event loop may be sleeping until a later timer */
+    return id;
+}
+
+int irc_cancel_timer(unsigned long id) {
+    return tmr_cancel(_timers(), id);
+}
+
+/* Release the event loop resources once it has stopped */
 static void _shutdown() {
     printf("Shutting down...\n");
-    shutdown_requested = 1;     /* Stop listening to the network */
     dsp_shutdown();             /* Terminate the event dispatcher thread */
+    evt_pool_destroy();         /* Free the recycled events, now that none is queued */
     bnd_destroy();              /* Destroy the binding table */
 }
 
+/* The loop that is running stops and shuts down by itself, so a signal in
+ * the middle of dispatching or draining does not free what it is using */
 void shutdown_handler(int signal) {
     switch (signal) {
         case SIGHUP:
         case SIGTERM:
         case SIGINT:
-            _shutdown();
+            shutdown_requested = 1;
             break;
         default:
             break;
     }
 }
 
+/* Close a lost connection and let the application know. It
+ * comes back by itself unless reconnecting has been disabled */
+static void _disconnected(Connection* conn, char* reason) {
+    char msg[READ_BUF];
+
+    net_lost(conn);
+    snprintf(msg, READ_BUF, "%s :%s", DISCONNECT, reason);
+    lst_handle(conn, msg);
+}
+
+/* Ping the servers that have been silent and close the dead connections.
+ * Returns the milliseconds until the next check */
+static int _heartbeat() {
+    Connection* dead[NET_EVENTS];
+    int num_dead, i, next;
+
+    next = net_heartbeat(dead, &num_dead);
+    for (i = 0; i < num_dead; i++) {
+        _disconnected(dead[i], "Ping timeout");
+    }
+
+    return next;
+}
+
+/* Read all the lines received in the given connection */
+static void _receive(Connection* conn) {
+    char msg[READ_BUF];
+    int ret;
+
+    /* A single read may bring several lines. Handle all of them
+     * before waiting for more data */
+    do {
+        ret = net_recv(conn, msg);
+        if (ret > 0) {
+            lst_handle(conn, msg);
+        } else if (ret < 0) {
+            debug(("irc: Connection closed\n"));
+            _disconnected(conn, "Connection closed");
+            break;
+        }
+    } while (net_pending(conn));
+}
+
+/* Copy the features advertised by the server of the current connection */
+static void _isupport(struct isp_table* isp) {
+    if (net_current() != NULL) {
+        trk_isupport(net_tracker(net_current()), isp);  /* The listener may be updating them */
+    } else {
+        memcpy(isp, isp_defaults(), sizeof(struct isp_table));
+    }
+}
+
 void irc_listen() {
     enum net_status status;
-    char msg[READ_BUF];
+    Connection* ready[NET_EVENTS];
+    int num_ready, i, timeout, next;
 
     /* Register shutdown signals */
     signal(SIGHUP, shutdown_handler);
@@ -110,10 +263,21 @@ void irc_listen() {
     printf("Starting %s %s...\n  Git: %s\n  Build: %s\n  Platform: %s\n",
         lib_name, lib_version, git_revision, build_date, build_platform);
 
-    dsp_start();     /* Start the event dispatcher thread */
+    dsp_start(num_workers);     /* Start the event dispatcher threads */
+    shutdown_requested = 0;
 
     while (shutdown_requested == 0) {
-        status = net_listen();
+        /* Run the expired timers in the dispatcher, after the messages received before them */
+        tmr_advance(_timers(), tmr_now(), dsp_call);
+        timeout = _heartbeat();
+
+        /* Wake up for the first timer, keepalive check or reconnection that is due */
+        next = tmr_next(_timers(), tmr_now());
+        timeout = timeout < 0 || (next >= 0 && next < timeout) ? next : timeout;
+        next = net_retry();
+        timeout = timeout < 0 || (next >= 0 && next < timeout) ? next : timeout;
+
+        status = net_listen(ready, &num_ready, timeout);
 
         switch(status) {
             case NET_ERROR:
@@ -122,15 +286,21 @@ void irc_listen() {
                 break;
             case NET_CLOSE:
                 debug(("irc: Connection closed. Shutting down...\n"));
-                _shutdown();
+                shutdown_requested = 1;
                 break;
             case NET_READY:
-                net_recv(msg);
-                lst_handle(msg);
+                for (i = 0; i < num_ready; i++) {
+                    _receive(ready[i]);
+                }
+
+                /* Stop when the last server closes its connection and it will not come back */
+                if (net_count() == 0 && net_waiting() == 0) {
+                    debug(("irc: All connections closed. Shutting down...\n"));
+                    shutdown_requested = 1;
+                }
                 break;
             case NET_TIMEOUT:
-                debug(("irc: Timeout. Socket dead?\n"));
-                /* Do nothing. The loop should continue and try again. */
+                /* A timer or a keepalive check is due, or a timer has been added. The loop runs them */
                 break;
             default:
                 break;
@@ -138,18 +308,86 @@ void irc_listen() {
     }
 
     debug(("irc: Exiting network listen loop\n"));
+    _shutdown();
+}
+
+/* Wait until the given millisecond, running the timers that expire meanwhile */
+static void _replay_wait(unsigned long until) {
+    unsigned long now;
+    int next;
+
+    while (shutdown_requested == 0 && (now = tmr_now()) < until) {
+        tmr_advance(_timers(), now, dsp_call);
+        next = tmr_next(_timers(), now);
+        poll(NULL, 0, next >= 0 && (unsigned long) next < until - now ? next : (int) (until - now));
+    }
+}
+
+long int irc_replay(char* path, int timed) {
+    struct rep_source* source;
+    Connection* conn;
+    char msg[READ_BUF];
+    double when, first = -1;
+    unsigned long start = 0;
+    long int lines = 0;
+
+    if ((source = rep_open(path)) == NULL) {
+        return -1;
+    }
+
+    /* Register shutdown signals */
+    signal(SIGHUP, shutdown_handler);
+    signal(SIGTERM, shutdown_handler);
+    signal(SIGINT, shutdown_handler);
+
+    /* The recorded lines go through the same tracking and dispatching as
+     * the received ones, and the answers of the callbacks are dropped */
+    conn = net_offline();
+    net_use(conn);
+    dsp_start(num_workers);
+    shutdown_requested = 0;
+
+    while (shutdown_requested == 0 && rep_next(source, msg, &when)) {
+        if (timed && when >= 0) {
+            if (first < 0) {
+                first = when;
+                start = tmr_now();
+            }
+            _replay_wait(start + (unsigned long) ((when - first) * 1000 + 0.5));
+        }
+
+        lst_handle(conn, msg);
+        lines++;
+    }
+
+    debug(("irc: Replayed %ld lines\n", lines));
+    if (shutdown_requested == 0) {
+        dsp_drain();    /* Let the callbacks handle all the lines before stopping */
+    }
+    dsp_shutdown();
+    evt_pool_destroy();
+    net_free(conn);
+    rep_close(source);
+
+    return lines;
 }
 
 void irc_nick(char* nick) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s", NICK, nick);
-    net_send(msg);
+    if (net_current() != NULL) {
+        net_session(net_current(), msg);    /* Registered again with the same nick when reconnecting */
+    }
+    net_send(net_current(), msg);
 }
 
 void irc_user(char* user_name, char* real_name) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s hostname server :%s", USER, user_name, real_name);
-    net_send(msg);
+    if (net_current() != NULL) {
+        net_session(net_current(), msg);
+    }
+    net_send(net_current(), msg);
 }
 
 void irc_login(char* nick, char* user_name, char* real_name) {
@@ -160,7 +398,10 @@ void irc_login(char* nick, char* user_name, char* real_name) {
 void irc_quit(char* message) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s :%s", QUIT, message);
-    net_send(msg);
+    if (net_current() != NULL) {
+        net_reconnect(net_current(), 0, 0);     /* The server closes the connection on purpose */
+    }
+    net_send(net_current(), msg);
 }
 
 /* ****************** */
@@ -170,123 +411,211 @@ void irc_quit(char* message) {
 void irc_join(char* channel) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s", JOIN, channel);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_join_pass(char* channel, char* pass) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s %s", JOIN, channel, pass);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_part(char* channel) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s", PART, channel);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_topic(char* channel, char* topic) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s :%s", TOPIC, channel, topic);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_names(char* channel) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s", NAMES, channel);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_list() {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s", LIST);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_invite(char* nick, char* channel) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s %s", INVITE, nick, channel);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_message(char* target, char* message) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s :%s", PRIVMSG, target, message);
-    net_send(msg);
+    net_send(net_current(), msg);
+}
+
+void irc_message_many(char** targets, int count, char* message) {
+    char msg[WRITE_BUF];
+    struct isp_table isp;
+    int i, next, max_targets, max_len, pos;
+
+    _isupport(&isp);
+    max_targets = isp_targmax(&isp, CMD_PRIVMSG);
+    max_len = isp.linelen - (int) strlen(MSG_SEP);
+    max_len = (max_len < WRITE_BUF - 1 ? max_len : WRITE_BUF - 1) - (int) strlen(message) - 2;
+
+    for (i = 0; i < count; i = next) {
+        /* Take targets while they fit, leaving room for the message. Each one adds a comma and itself */
+        pos = snprintf(msg, WRITE_BUF, "%s %s", PRIVMSG, targets[i]);
+        for (next = i + 1; next < count && next - i < max_targets; next++) {
+            if (pos + 1 + (int) strlen(targets[next]) > max_len) {
+                break;
+            }
+            pos += snprintf(msg + pos, WRITE_BUF - pos, ",%s", targets[next]);
+        }
+
+        if (pos < WRITE_BUF) {
+            snprintf(msg + pos, WRITE_BUF - pos, " :%s", message);
+        }
+
+        net_send(net_current(), msg);
+    }
 }
 
 void irc_op(char* channel, char* nick) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s +o %s", MODE, channel, nick);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_deop(char* channel, char* nick) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s -o %s", MODE, channel, nick);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_voice(char* channel, char* nick) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s +v %s", MODE, channel, nick);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_devoice(char* channel, char* nick) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s -v %s", MODE, channel, nick);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_kick(char* channel, char* nick, char* message) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s %s :%s", KICK, channel, nick, message);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_ban(char* channel, char* mask) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s +b %s", MODE, channel, mask);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_unban(char* channel, char* mask) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s -b %s", MODE, channel, mask);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_ban_list(char* channel) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s +b", MODE, channel);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_limit(char* channel, int limit) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s +l %d", MODE, channel, limit);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_channel_key(char* channel, char* key) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s +k %s", MODE, channel, key);
-    net_send(msg);
+    net_send(net_current(), msg);
+}
+
+/* Set or unset a mode for each argument, packing as many of them in each
+ * MODE line as the server allows */
+static void _mode_many(char* channel, char* mode, char** args, int count) {
+    char msg[WRITE_BUF];
+    struct isp_table isp;
+    int i, k, next, num_modes, max_len, len, pos;
+
+    _isupport(&isp);
+    num_modes = isp.modes > 0 ? isp.modes : 1;
+    max_len = isp.linelen - (int) strlen(MSG_SEP);
+    max_len = max_len < WRITE_BUF - 1 ? max_len : WRITE_BUF - 1;     /* Leave room for the terminator */
+
+    for (i = 0; i < count; i = next) {
+        /* Take arguments while they fit. Each one adds its mode letter, a space and itself */
+        len = strlen(MODE) + strlen(channel) + 3;
+        for (next = i; next < count && next - i < num_modes; next++) {
+            if (next > i && len + 2 + (int) strlen(args[next]) > max_len) {
+                break;
+            }
+            len += 2 + strlen(args[next]);
+        }
+
+        pos = snprintf(msg, WRITE_BUF, "%s %s %c", MODE, channel, mode[0]);
+        pos = pos < WRITE_BUF ? pos : WRITE_BUF - 1;    /* Long channel names are cut */
+        for (k = i; k < next && pos < WRITE_BUF - 1; k++) {
+            msg[pos++] = mode[1];
+        }
+        msg[pos] = '\0';
+        for (k = i; k < next && pos < WRITE_BUF; k++) {
+            pos += snprintf(msg + pos, WRITE_BUF - pos, " %s", args[k]);
+        }
+
+        net_send(net_current(), msg);
+    }
+}
+
+void irc_op_many(char* channel, char** nicks, int count) {
+    _mode_many(channel, "+o", nicks, count);
+}
+
+void irc_deop_many(char* channel, char** nicks, int count) {
+    _mode_many(channel, "-o", nicks, count);
+}
+
+void irc_voice_many(char* channel, char** nicks, int count) {
+    _mode_many(channel, "+v", nicks, count);
+}
+
+void irc_devoice_many(char* channel, char** nicks, int count) {
+    _mode_many(channel, "-v", nicks, count);
+}
+
+void irc_ban_many(char* channel, char** masks, int count) {
+    _mode_many(channel, "+b", masks, count);
+}
+
+void irc_unban_many(char* channel, char** masks, int count) {
+    _mode_many(channel, "-b", masks, count);
 }
 
 void irc_channel_set(char* channel, unsigned short int flags) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s +", MODE, channel);
     append_channel_flags(msg, flags);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_channel_unset(char* channel, unsigned short int flags) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s -", MODE, channel);
     append_channel_flags(msg, flags);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 /* *************** */
@@ -297,14 +626,14 @@ void irc_user_set(char* user, unsigned short int flags) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s +", MODE, user);
     append_user_flags(msg, flags);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 void irc_user_unset(char* user, unsigned short int flags) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s -", MODE, user);
     append_user_flags(msg, flags);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 /* *********************** */
@@ -314,7 +643,7 @@ void irc_user_unset(char* user, unsigned short int flags) {
 void irc_pong(char* server) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, "%s %s", PONG, server);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
 /* **************** */
@@ -324,6 +653,6 @@ void irc_pong(char* server) {
 void irc_raw(char* prefix, char* type, char* message) {
     char msg[WRITE_BUF];
     snprintf(msg, WRITE_BUF, ":%s %s %s", prefix, type, message);
-    net_send(msg);
+    net_send(net_current(), msg);
 }
 
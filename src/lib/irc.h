@@ -25,6 +25,8 @@
 
 #include "codes.h"
 #include "events.h"
+#include "scheduler.h"
+#include "timer.h"
 
 /* Channel flags */
 enum channel_flags {
@@ -52,12 +54,30 @@ enum user_flags {
 void irc_bind_event(char* event, Callback callback);        /* Bind an IRC event to a callback function */
 void irc_bind_command(char* command, Callback callback);    /* Bind a channel or private chat command to a callback function */
 void irc_unbind_event(char* event);                         /* Unbind an IRC event */
+int irc_add_handler(char* event, Handler handler, int priority);  /* Add a handler to the chain of an IRC event (higher priority runs first). Returns 0 if the chain is full */
+int irc_remove_handler(char* event, Handler handler);               /* Remove a handler from the chain of an IRC event */
 void irc_unbind_command(char* command);                     /* Unbind a channel or private message chat command */
+void irc_alias_command(char* alias, char* command);         /* Make another name run a bound command */
+void irc_command_prefix(char* prefix);                      /* Accept commands after a prefix (such as "!"), so they can be bound without it ("" removes the prefixes) */
+void irc_command_nick(int enable);                          /* Accept commands addressed to the bot ("circus: help") */
+void irc_command_abbrev(int min_len);                       /* Accept unique abbreviations of commands of at least min_len characters (0 disables them) */
 
 /* Connection registration */
-void irc_connect(char* address, char* port);                    /* Connect to the IRC server */
-void irc_disconnect(void);                                      /* Disconnect from the IRC server */
-void irc_listen(void);                                          /* Listen to IRC server messages (blocks until quit signal is received) */
+Connection* irc_connect(char* address, char* port);             /* Connect to an IRC server (it becomes the current connection, NULL if it can not be reached) */
+void irc_disconnect(void);                                      /* Disconnect from the IRC server of the current connection */
+void irc_use(Connection* conn);                                 /* Set the connection used by the calling thread to send messages */
+Connection* irc_current(void);                                  /* Get the connection used by the calling thread to send messages */
+int irc_busy(void);                                             /* Check if the messages to the current connection are being queued faster than they are sent */
+void irc_throttle(int burst, int interval_ms);                  /* Limit the send rate of the current connection to avoid being killed for flooding */
+void irc_send_stats(struct sch_stats* stats);                   /* Get the send counters of the current connection */
+void irc_keepalive(int interval_ms, int timeout_ms);            /* Ping the server of the current connection after interval_ms of silence and close it after timeout_ms (0 disables them) */
+int irc_lag(void);                                              /* Get the round trip time to the server of the current connection in ms (-1 if not measured yet) */
+void irc_reconnect(int min_ms, int max_ms);                     /* Set the backoff between reconnection attempts of the current connection (a min_ms of 0 disables reconnecting) */
+void irc_listen(void);                                          /* Listen to the messages of all servers (blocks until quit signal is received or all connections are closed) */
+long int irc_replay(char* path, int timed);                     /* Handle the lines of a recorded log as if they were received, at the recorded times or as fast as possible. Returns how many (-1 if the log can not be read) */
+void irc_workers(int workers);                                  /* Set the number of threads that invoke the callbacks, or 0 to invoke them in the listener (call before irc_listen) */
+unsigned long irc_timer(int delay_ms, int period_ms, tmr_callback callback, void* data);   /* Run a callback in the dispatcher after delay_ms, and then every period_ms if not 0. Returns the timer id */
+int irc_cancel_timer(unsigned long id);                         /* Cancel a timer. Returns 0 if it has already run (periodic timers never do) */
 void irc_nick(char* nick);                                      /* Set or change the nick of the user */
 void irc_user(char* user_name, char* real_name);                /* Set the user information */
 void irc_login(char* nick, char* user_name, char* real_name);   /* Sets the nick and the user information */
@@ -72,6 +92,7 @@ void irc_names(char* channel);                                      /* List the
 void irc_list(void);                                                /* List channels and their topics */
 void irc_invite(char* nick, char* channel);                         /* Invite a user to a channel */
 void irc_message(char* target, char* messge);                       /* Send a message to a nick or channel */
+void irc_message_many(char** targets, int count, char* message);    /* Send a message to several nicks or channels with as few messages as possible */
 void irc_op(char* channel, char* nick);                             /* Give operator to a user */
 void irc_deop(char* channel, char* nick);                           /* Take operator from a user */
 void irc_voice(char* channel, char* nick);                          /* Give voice to a user */
@@ -82,6 +103,12 @@ void irc_unban(char* channel, char* mask);                          /* Remove a
 void irc_ban_list(char* channel);                                   /* List ban masks set for the given channel */
 void irc_limit(char* channel, int limit);                           /* The the channel limit */
 void irc_channel_key(char* channel, char* key);                     /* Set a key for the given channel */
+void irc_op_many(char* channel, char** nicks, int count);          /* Give operator to several users with as few messages as possible */
+void irc_deop_many(char* channel, char** nicks, int count);        /* Take operator from several users with as few messages as possible */
+void irc_voice_many(char* channel, char** nicks, int count);       /* Give voice to several users with as few messages as possible */
+void irc_devoice_many(char* channel, char** nicks, int count);     /* Take voice from several users with as few messages as possible */
+void irc_ban_many(char* channel, char** masks, int count);         /* Add several ban masks with as few messages as possible */
+void irc_unban_many(char* channel, char** masks, int count);       /* Remove several ban masks with as few messages as possible */
 void irc_channel_set(char* channel, unsigned short int flags);      /* Set the given channel flags */
 void irc_channel_unset(char* channel, unsigned short int flags);    /* Unset the given channel flags */
 
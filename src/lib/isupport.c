@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "debug.h"
+#include "codes.h"
+#include "isupport.h"
+
+static struct isp_table defaults;                       /* Table returned when there is no connection */
+static pthread_once_t defaults_once = PTHREAD_ONCE_INIT;
+
+
+/* Get the value of a numeric token, or the given default if it has no value */
+static int isp_number(char* value, int absent) {
+    int number;
+
+    if (value == NULL || *value == '\0') {
+        return absent;
+    }
+
+    number = atoi(value);
+    return number > 0 ? number : absent;
+}
+
+/* Set the characters that start a channel name */
+static void set_chantypes(struct isp_table* isp, char* value) {
+    memset(isp->chantypes, 0, sizeof(isp->chantypes));
+    for (; value != NULL && *value != '\0'; value++) {
+        isp->chantypes[(unsigned char) *value] = 1;
+    }
+}
+
+/* Set the membership modes and their prefixes, with the form '(ov)@+' */
+static void set_prefix(struct isp_table* isp, char* value) {
+    char* symbols;
+    int i;
+
+    for (i = 0; isp->prefix[i] != '\0'; i++) {
+        isp->mode_types[(unsigned char) isp->prefix[i]] = ISP_MODE_UNKNOWN;
+    }
+    memset(isp->prefix_symbols, 0, sizeof(isp->prefix_symbols));
+    memset(isp->prefix_modes, 0, sizeof(isp->prefix_modes));
+    memset(isp->prefix, 0, sizeof(isp->prefix));
+
+    /* An empty value means that there are no membership modes */
+    if (value == NULL || *value != '(' || (symbols = strchr(value, ')')) == NULL) {
+        return;
+    }
+
+    for (i = 0, value++, symbols++; value[i] != ')' && symbols[i] != '\0' && i < ISP_PREFIX_SIZE - 1; i++) {
+        isp->prefix[i] = value[i];
+        isp->prefix_symbols[(unsigned char) value[i]] = symbols[i];
+        isp->prefix_modes[(unsigned char) symbols[i]] = value[i];
+        isp->mode_types[(unsigned char) value[i]] = ISP_MODE_PREFIX;
+    }
+}
+
+/* Set the kind of each channel mode, with the form 'A,B,C,D' */
+static void set_chanmodes(struct isp_table* isp, char* value) {
+    int i, type = ISP_MODE_LIST;
+
+    for (i = 0; i < 256; i++) {
+        if (isp->mode_types[i] != ISP_MODE_PREFIX) {
+            isp->mode_types[i] = ISP_MODE_UNKNOWN;
+        }
+    }
+
+    for (; value != NULL && *value != '\0' && type <= ISP_MODE_FLAG; value++) {
+        if (*value == ',') {
+            type++;
+        } else if (isp->mode_types[(unsigned char) *value] != ISP_MODE_PREFIX) {
+            isp->mode_types[(unsigned char) *value] = type;
+        }
+    }
+}
+
+/* Set the maximum number of targets of each command, with the form 'PRIVMSG:4,JOIN:' */
+static void set_targmax(struct isp_table* isp, char* value) {
+    char* end, *limit;
+    int i, id;
+
+    for (i = 0; i < CMD_MAX - CMD_UNKNOWN; i++) {
+        isp->targmax[i] = ISP_TARGETS;
+    }
+
+    while (value != NULL && *value != '\0') {
+        if ((end = strchr(value, ',')) == NULL) {
+            end = value + strlen(value);
+        }
+
+        /* Commands without a number have no limit */
+        if ((limit = memchr(value, ':', end - value)) != NULL) {
+            id = cmd_id(value, limit - value);
+            if (id > CMD_UNKNOWN && id < CMD_MAX) {
+                isp->targmax[id - CMD_UNKNOWN] = limit + 1 < end ? atoi(limit + 1) : ISP_TARGETS_MAX;
+                if (isp->targmax[id - CMD_UNKNOWN] <= 0) {
+                    isp->targmax[id - CMD_UNKNOWN] = ISP_TARGETS_MAX;
+                }
+            }
+        }
+
+        value = *end != '\0' ? end + 1 : end;
+    }
+}
+
+/* Set the rules to compare nicks and channel names */
+static void set_casemapping(struct isp_table* isp, char* value) {
+    if (value != NULL && strcmp(value, "ascii") == 0) {
+        isp->casemapping = ISP_ASCII;
+    } else if (value != NULL && strcmp(value, "strict-rfc1459") == 0) {
+        isp->casemapping = ISP_STRICT_RFC1459;
+    } else {
+        isp->casemapping = ISP_RFC1459;
+    }
+}
+
+static void init_defaults(void) {
+    isp_init(&defaults);
+}
+
+void isp_init(struct isp_table* isp) {
+    char prefix[] = ISP_PREFIX, chantypes[] = ISP_CHANTYPES, chanmodes[] = ISP_CHANMODES;
+
+    memset(isp, 0, sizeof(struct isp_table));
+    isp->modes = ISP_MODES;
+    isp->linelen = ISP_LINELEN;
+    isp->nicklen = ISP_NICKLEN;
+    set_casemapping(isp, NULL);
+    set_chantypes(isp, chantypes);
+    set_prefix(isp, prefix);
+    set_chanmodes(isp, chanmodes);
+    set_targmax(isp, NULL);
+}
+
+void isp_parse(struct isp_table* isp, int num_tokens, char** tokens) {
+    char name[32], *value;
+    char prefix[] = ISP_PREFIX, chantypes[] = ISP_CHANTYPES, chanmodes[] = ISP_CHANMODES;
+    unsigned int len;
+    int negated, i;
+
+    for (i = 0; i < num_tokens; i++) {
+        /* Tokens look like NAME, NAME=value or -NAME (back to the default value) */
+        negated = tokens[i][0] == '-';
+        value = strchr(tokens[i] + negated, '=');
+        len = value != NULL ? value - (tokens[i] + negated) : strlen(tokens[i] + negated);
+        if (len >= sizeof(name)) {
+            continue;
+        }
+
+        memcpy(name, tokens[i] + negated, len);
+        name[len] = '\0';
+        value = value != NULL ? value + 1 : NULL;
+
+        if (strcmp(name, "MODES") == 0) {
+            isp->modes = negated ? ISP_MODES : isp_number(value, ISP_MODES_MAX);
+        } else if (strcmp(name, "LINELEN") == 0) {
+            isp->linelen = negated ? ISP_LINELEN : isp_number(value, ISP_LINELEN);
+        } else if (strcmp(name, "NICKLEN") == 0) {
+            isp->nicklen = negated ? ISP_NICKLEN : isp_number(value, ISP_NICKLEN);
+        } else if (strcmp(name, "CASEMAPPING") == 0) {
+            set_casemapping(isp, negated ? NULL : value);
+        } else if (strcmp(name, "CHANTYPES") == 0) {
+            set_chantypes(isp, negated ? chantypes : value);
+        } else if (strcmp(name, "PREFIX") == 0) {
+            set_prefix(isp, negated ? prefix : value);
+        } else if (strcmp(name, "CHANMODES") == 0) {
+            set_chanmodes(isp, negated ? chanmodes : value);
+        } else if (strcmp(name, "TARGMAX") == 0) {
+            set_targmax(isp, negated ? NULL : value);
+        } else {
+            continue;
+        }
+
+        debug(("isupport: %s\n", tokens[i]));
+    }
+}
+
+const struct isp_table* isp_defaults(void) {
+    pthread_once(&defaults_once, init_defaults);
+    return &defaults;
+}
+
+int isp_is_channel(const struct isp_table* isp, const char* name) {
+    return isp->chantypes[(unsigned char) name[0]];
+}
+
+enum isp_mode_type isp_mode_type(const struct isp_table* isp, char mode) {
+    return isp->mode_types[(unsigned char) mode];
+}
+
+char isp_prefix_mode(const struct isp_table* isp, char symbol) {
+    return isp->prefix_modes[(unsigned char) symbol];
+}
+
+int isp_targmax(const struct isp_table* isp, int command) {
+    return (command > CMD_UNKNOWN && command < CMD_MAX) ? isp->targmax[command - CMD_UNKNOWN] : ISP_TARGETS;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __ISUPPORT_H__
+#define __ISUPPORT_H__
+
+#include "codes.h"
+
+#define ISP_MODES 3             /* Modes with a parameter allowed in each MODE command if the server does not tell (RFC 2812) */
+#define ISP_MODES_MAX 100       /* Modes with a parameter allowed when the server does not set a limit */
+#define ISP_LINELEN 512         /* Maximum length of a line, including the separator, if the server does not tell */
+#define ISP_NICKLEN 9           /* Maximum length of a nick if the server does not tell (RFC 2812) */
+#define ISP_CHANTYPES "#&"      /* Characters that start a channel name if the server does not tell */
+#define ISP_PREFIX "(ov)@+"     /* Channel membership modes and their nick prefixes if the server does not tell */
+#define ISP_CHANMODES "b,k,l,imnpst"    /* Channel modes of each kind if the server does not tell */
+#define ISP_PREFIX_SIZE 16      /* Maximum number of channel membership modes */
+#define ISP_TARGETS 1           /* Targets allowed in each command if the server does not tell */
+#define ISP_TARGETS_MAX 100     /* Targets allowed when the server does not set a limit */
+
+/* Rules used by the server to compare nicks and channel names */
+enum isp_casemapping {
+    ISP_RFC1459,                /* a-z are the lowercase of A-Z and {}|~ the lowercase of []\^ */
+    ISP_STRICT_RFC1459,         /* a-z are the lowercase of A-Z and {}| the lowercase of []\ */
+    ISP_ASCII                   /* Only a-z are the lowercase of A-Z */
+};
+
+/* Kinds of channel modes, by the parameter they take */
+enum isp_mode_type {
+    ISP_MODE_UNKNOWN = 0,       /* The server did not advertise the mode */
+    ISP_MODE_LIST,              /* Adds or removes an address from a list (always has a parameter) */
+    ISP_MODE_PARAM,             /* Changes a setting (always has a parameter) */
+    ISP_MODE_PARAM_SET,         /* Changes a setting (only has a parameter when set) */
+    ISP_MODE_FLAG,              /* Changes a setting (never has a parameter) */
+    ISP_MODE_PREFIX             /* Gives or takes a channel privilege to a nick */
+};
+
+/* Features advertised by the server in the RPL_ISUPPORT (005) replies.
+ * Every lookup is a direct array access so it can be used when parsing each message. */
+struct isp_table {
+    int modes;                  /* Maximum number of modes with a parameter in a MODE command */
+    int linelen;                /* Maximum length of a line, including the separator */
+    int nicklen;                /* Maximum length of a nick */
+    enum isp_casemapping casemapping;           /* Rules to compare nicks and channel names */
+    unsigned char chantypes[256];               /* Non-zero for the characters that start a channel name */
+    unsigned char mode_types[256];              /* The kind of each channel mode letter (enum isp_mode_type) */
+    char prefix_symbols[256];                   /* The nick prefix of each membership mode letter */
+    char prefix_modes[256];                     /* The membership mode letter of each nick prefix */
+    char prefix[ISP_PREFIX_SIZE];               /* The membership mode letters, from the highest privilege */
+    int targmax[CMD_MAX - CMD_UNKNOWN];         /* Maximum number of targets of each command, by its identifier */
+};
+
+void isp_init(struct isp_table* isp);                                   /* Set the default values */
+void isp_parse(struct isp_table* isp, int num_tokens, char** tokens);   /* Update the table with the tokens of a RPL_ISUPPORT reply */
+const struct isp_table* isp_defaults(void);                             /* Get a table with the default values, for messages without a connection */
+int isp_is_channel(const struct isp_table* isp, const char* name);      /* Check if the given name is a channel */
+enum isp_mode_type isp_mode_type(const struct isp_table* isp, char mode);   /* Get the kind of a channel mode */
+char isp_prefix_mode(const struct isp_table* isp, char symbol);         /* Get the membership mode of a nick prefix, or '\0' */
+int isp_targmax(const struct isp_table* isp, int command);              /* Get the maximum number of targets of a command */
+
+#endif
@@ -20,11 +20,10 @@
  * THE SOFTWARE.
  */
 
-#define _XOPEN_SOURCE   /* Support strtok_r in POSIX and BSD environments */
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "codes.h"
 #include "events.h"
 #include "listener.h"
 #include "dispatcher.h"
@@ -34,69 +33,102 @@
 /* Message parsing */
 /* *************** */
 
+/* Terminate the token that starts at the given position and record its location.
+ * Returns the position where the token ends. */
+static size_t lst_token(char* buffer, size_t pos, size_t len, struct raw_view* view) {
+    char* end = memchr(buffer + pos, ' ', len - pos);
+    size_t token_end = (end == NULL)? len : (size_t) (end - buffer);
+
+    view->offset = pos;
+    view->length = token_end - pos;
+    buffer[token_end] = '\0';
+
+    return token_end;
+}
+
+/* Parse the message in the event buffer in a single pass. Tokens are terminated
+ * in place, so the parsed values point directly into the buffer. */
+static void lst_tokenize(struct raw_event* raw, size_t len) {
+    char* buffer = raw->__buffer;
+    size_t pos = 0;
+    int i = 0;
+
+    /* Ignore the line termination */
+    while (len > 0 && (buffer[len - 1] == '\n' || buffer[len - 1] == '\r')) {
+        buffer[--len] = '\0';
+    }
+
+    while (pos < len && buffer[pos] == ' ') pos++;
+
+    /* The prefix is the first token only if it begins with ':' */
+    if (pos < len && buffer[pos] == ':') {
+        pos = lst_token(buffer, pos + 1, len, &raw->prefix_view);   /* Ignore the ':' */
+        raw->prefix = buffer + raw->prefix_view.offset;
+        while (pos < len && buffer[++pos] == ' ');
+    }
+
+    if (pos >= len) {
+        return;
+    }
+
+    pos = lst_token(buffer, pos, len, &raw->type_view);
+    raw->type = buffer + raw->type_view.offset;
+    raw->cmd = cmd_id(raw->type, raw->type_view.length);
+
+    while (pos < len) {
+        while (pos < len && buffer[++pos] == ' ');
+        if (pos >= len) {
+            break;
+        }
+
+        /* If a parameter begins with ':' it is the last parameter and it is all
+         * the remaining message. The last allowed parameter also takes the rest
+         * of the message. */
+        if (buffer[pos] == ':' || i == MAX_PARAMS - 1) {
+            if (buffer[pos] == ':') {
+                pos++;  /* Ignore the ':' */
+            }
+            raw->param_views[i].offset = pos;
+            raw->param_views[i].length = len - pos;
+            raw->params[i++] = buffer + pos;
+            break;
+        }
+
+        pos = lst_token(buffer, pos, len, &raw->param_views[i]);
+        raw->params[i] = buffer + raw->param_views[i].offset;
+        i++;
+    }
+
+    raw->num_params = i;
+}
+
 struct raw_event* lst_parse(char* msg) {
-    int i = 0, is_last_parameter = 0;
     size_t msg_len;
     struct raw_event* raw = evt_raw_create();
-    char* token, *token_end = NULL;
 
     if (msg != NULL && (msg_len = strlen(msg)) > 0) {
 
-        if ((raw->__buffer = malloc((msg_len + 1) * sizeof(char))) == 0) {
+        /* Lines within the RFC limit fit in the event. Only the longer lines
+         * allowed by LINELEN (up to NET_LINE_MAX) need to be allocated */
+        if (msg_len < EVT_LINE_SIZE) {
+            raw->__buffer = raw->line;
+        } else if ((raw->__buffer = malloc((msg_len + 1) * sizeof(char))) == 0) {
             perror("Out of memory (parse)");
             exit(EXIT_FAILURE);
         }
 
-        memset(raw->__buffer, '\0', msg_len + 1);
-        strncpy(raw->__buffer, msg, msg_len);
-
-        token = strtok_r(raw->__buffer, PARAM_SEP, &token_end);
-        while(token != NULL)
-        {
-            if (raw->type == NULL) {
-                /* If type is not set, we must check if there
-                 * is a message prefix. */
-                if (token[0] == ':') {
-                    raw->prefix = token + 1; /* Ignore the ':' */
-                } else {
-                    raw->type = token;
-                }
-            } else { /* If the type is set the token is a parameter */
-                /* If a parameter begins with ':' then it is
-                 * the last parameter and it is all the remaining message. */
-                if (is_last_parameter == 0 && token[0] == ':') {
-                    /* Do not increment the parameter count */
-                    raw->params[i] = token + 1; /* Ignore the ':' */
-                    is_last_parameter = 1;       /* Set the last parameter flag */
-                } else {
-                    if (is_last_parameter == 0) {
-                        raw->params[i++] = token;
-                    } else {
-                        /* If it is the last parameter, just concatenate
-                         * the tokens. */
-                        sprintf(raw->params[i], "%s %s", raw->params[i], token);
-                    }
-                }
-            }
-
-            /* Continue with the next token */
-            token = strtok_r(NULL, PARAM_SEP, &token_end);
-        }
-
-        /* If we have a last parameter we should increment now the parameter
-         * counter. */
-        raw->num_params = (is_last_parameter == 0)? i : i + 1;
+        memcpy(raw->__buffer, msg, msg_len + 1);
+        lst_tokenize(raw, msg_len);
     }
 
     return raw;
 }
 
-void lst_handle(char* msg) {
+void lst_handle(Connection* conn, char* msg) {
     struct raw_event* raw;
 
-    msg[strlen(msg) - 2] = '\0';    /* Remove the line terminaion before parsing */
-    raw = lst_parse(msg);           /* Parse the input and get the raw event */
+    raw = lst_parse(msg);   /* Parse the input and get the raw event */
+    raw->conn = conn;       /* Callbacks will answer through the same connection */
 
     dsp_dispatch(raw);      /* Send the event to the dispatcher thread */
 }
-
@@ -23,9 +23,11 @@
 #ifndef __LISTENER_H__
 #define __LISTENER_H__
 
+#include "events.h"
+
 #define PARAM_SEP   " "         /* IRC parameter separator */
 
-void lst_handle(char* msg);                 /* Parse each line of an IRC message */
+void lst_handle(Connection* conn, char* msg);   /* Parse each line of an IRC message */
 struct raw_event* lst_parse(char* msg);     /* Parse one single line of an IRC message */
 
 #endif
@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L      /* Use snprintf and pthread_rwlock_t */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "hashtable.h"
+#include "casemap.h"
+#include "mask.h"
+
+#define MSK_WILD(c) ((c) == '*' || (c) == '?')
+#define MSK_GRAM_SIZE 3             /* Characters of the literal part that index masks with wildcards everywhere */
+
+/* The literal parts of a mask tell which prefixes it can match. Each mask is
+ * indexed by the most selective one, so a prefix only tests the masks that
+ * share a literal part with it. */
+enum msk_index {
+    MSK_HOST,           /* The host is literal, or ends in a literal domain (*.example.net) */
+    MSK_HEAD,           /* The host starts with a literal address (10.0.*) */
+    MSK_NICK,           /* The nick is literal (nick!*@*) */
+    MSK_USER,           /* The user is literal (*!user@*) */
+    MSK_GRAM,           /* Some characters are literal (*spam*!*@*), wherever they are in the prefix */
+    MSK_OTHER           /* Nothing literal to index it by (*!*@*). It is tested with every prefix */
+};
+
+/* A mask in the set */
+struct msk_entry {
+    struct msk_entry* prev, *next;  /* The other masks with the same key */
+    void* value;                    /* The value the mask was added with */
+    enum msk_index index;           /* Where the mask is indexed */
+    unsigned int min_len;           /* Characters other than '*': the shortest prefix it can match */
+    char* folded;                   /* The mask in lowercase, stored after the mask */
+    char mask[1];                   /* The mask as it was added */
+};
+
+struct msk_set {
+    enum isp_casemapping casemapping;   /* How the server compares nicks and hosts */
+    struct ht_table* masks;             /* All masks, by their lowercase form */
+    struct ht_table* keys[MSK_OTHER];   /* The first mask of each literal part, for each index */
+    struct msk_entry* others;           /* The masks without a literal part */
+    pthread_rwlock_t lock;              /* Callbacks match prefixes while others add and remove masks */
+};
+
+
+/* ************* */
+/* Mask indexing */
+/* ************* */
+
+/* Copy the characters from start to end as a key */
+static char* msk_copy(char* key, const char* start, const char* end) {
+    memcpy(key, start, end - start);
+    key[end - start] = '\0';
+    return key;
+}
+
+/* Check if a part of a mask has no wildcards */
+static int msk_literal(const char* start, const char* end) {
+    for (; start < end; start++) {
+        if (MSK_WILD(*start)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Get the index and the key of a lowercase mask. The host is preferred,
+ * since nicks and users are often wildcards in ban masks */
+static enum msk_index msk_key(const char* mask, char* key) {
+    const char* user = strchr(mask, '!'), *host = strchr(mask, '@'), *end, *p, *run = NULL;
+    int run_len = 0;
+
+    if (host != NULL && *++host != '\0') {
+        end = host + strlen(host);
+        for (p = end; p > host && !MSK_WILD(p[-1]); p--) {
+            continue;
+        }
+
+        if (p == host) {
+            msk_copy(key, host, end);   /* The whole host */
+            return MSK_HOST;
+        } else if ((p = strchr(p, '.')) != NULL) {
+            msk_copy(key, p, end);      /* The domains after the last wildcard */
+            return MSK_HOST;
+        }
+
+        for (p = host; *p != '\0' && !MSK_WILD(*p); p++) {
+            continue;
+        }
+        for (; p > host && p[-1] != '.'; p--) {
+            continue;
+        }
+        if (p > host) {
+            msk_copy(key, host, p);     /* The address parts before the first wildcard */
+            return MSK_HEAD;
+        }
+    }
+
+    if (user != NULL && user > mask && msk_literal(mask, user)) {
+        msk_copy(key, mask, user);
+        return MSK_NICK;
+    }
+
+    if (user != NULL && host != NULL && host - 1 > user + 1 && msk_literal(user + 1, host - 1)) {
+        msk_copy(key, user + 1, host - 1);
+        return MSK_USER;
+    }
+
+    /* The last characters of the longest literal part */
+    for (p = mask; *p != '\0'; p = end) {
+        for (; MSK_WILD(*p); p++) {
+            continue;
+        }
+        for (end = p; *end != '\0' && !MSK_WILD(*end); end++) {
+            continue;
+        }
+        if (end - p > run_len) {
+            run = p;
+            run_len = end - p;
+        }
+    }
+    if (run_len >= MSK_GRAM_SIZE) {
+        msk_copy(key, run + run_len - MSK_GRAM_SIZE, run + run_len);
+        return MSK_GRAM;
+    }
+
+    return MSK_OTHER;
+}
+
+/* Match a lowercase string against a lowercase mask. When a '*' cannot be
+ * extended any further, only the last one needs to be retried */
+static int msk_glob(const char* mask, const char* str) {
+    const char* star = NULL, *retry = NULL;
+
+    while (*str != '\0') {
+        if (*mask == '*') {
+            star = ++mask;
+            retry = str;
+        } else if (*mask == *str || *mask == '?') {
+            mask++;
+            str++;
+        } else if (star != NULL) {
+            mask = star;
+            str = ++retry;
+        } else {
+            return 0;
+        }
+    }
+
+    while (*mask == '*') {
+        mask++;
+    }
+
+    return *mask == '\0';
+}
+
+/* Test the masks of a list against a lowercase prefix */
+static int msk_test(struct msk_entry* entry, const char* prefix, unsigned int len, msk_visitor visit, void* data) {
+    int count = 0;
+
+    for (; entry != NULL; entry = entry->next) {
+        if (entry->min_len <= len && msk_glob(entry->folded, prefix)) {
+            if (visit != NULL) {
+                visit(entry->mask, entry->value, data);
+            }
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/* Test the masks indexed by a literal part of the prefix */
+static int msk_test_key(struct msk_set* set, enum msk_index index, char* key,
+        const char* prefix, unsigned int len, msk_visitor visit, void* data) {
+    struct ht_data* found = ht_find(set->keys[index], key);
+    return found != NULL ? msk_test(found->value, prefix, len, visit, data) : 0;
+}
+
+/* Check if the group of characters at pos is also found before it */
+static int msk_repeated(const char* prefix, const char* pos) {
+    for (; prefix < pos; prefix++) {
+        if (memcmp(prefix, pos, MSK_GRAM_SIZE) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Get the first mask with the same key, or a pointer to where it must be stored */
+static struct msk_entry** msk_head(struct msk_set* set, struct msk_entry* entry, char* key) {
+    struct ht_data* found;
+
+    if (entry->index == MSK_OTHER) {
+        return &set->others;
+    }
+
+    msk_key(entry->folded, key);
+    if ((found = ht_find(set->keys[entry->index], key)) == NULL) {
+        return NULL;
+    }
+
+    return (struct msk_entry**) &found->value;
+}
+
+
+/* ************** */
+/* Mask functions */
+/* ************** */
+
+struct msk_set* msk_create(enum isp_casemapping casemapping) {
+    struct msk_set* set;
+    int i;
+
+    if ((set = malloc(sizeof(struct msk_set))) == NULL) {
+        perror("Out of memory (msk_create)");
+        exit(EXIT_FAILURE);
+    }
+
+    set->casemapping = casemapping;
+    set->masks = ht_create();
+    for (i = 0; i < MSK_OTHER; i++) {
+        set->keys[i] = ht_create();
+    }
+    set->others = NULL;
+    pthread_rwlock_init(&set->lock, NULL);
+
+    return set;
+}
+
+void msk_destroy(struct msk_set* set) {
+    int i;
+
+    for (i = 0; i < set->masks->size; i++) {
+        if (set->masks->entries[i].hash != 0) {
+            free(set->masks->entries[i].data.value);
+        }
+    }
+
+    ht_destroy(set->masks);
+    for (i = 0; i < MSK_OTHER; i++) {
+        ht_destroy(set->keys[i]);
+    }
+    pthread_rwlock_destroy(&set->lock);
+    free(set);
+}
+
+int msk_add(struct msk_set* set, const char* mask, void* value) {
+    char normal[MSK_SIZE], folded[MSK_SIZE], key[MSK_SIZE];
+    struct msk_entry* entry, **head;
+    struct ht_data* found;
+    unsigned int len, i;
+
+    msk_normalize(normal, mask, MSK_SIZE);
+    cm_fold(folded, normal, MSK_SIZE, set->casemapping);
+
+    pthread_rwlock_wrlock(&set->lock);
+
+    if ((found = ht_find(set->masks, folded)) != NULL) {
+        ((struct msk_entry*) found->value)->value = value;
+        pthread_rwlock_unlock(&set->lock);
+        return 0;
+    }
+
+    len = strlen(normal);
+    if ((entry = malloc(sizeof(struct msk_entry) + 2 * len + 1)) == NULL) {
+        perror("Out of memory (msk_add)");
+        exit(EXIT_FAILURE);
+    }
+
+    strcpy(entry->mask, normal);
+    entry->folded = entry->mask + len + 1;
+    strcpy(entry->folded, folded);
+    entry->value = value;
+    for (entry->min_len = 0, i = 0; i < len; i++) {
+        entry->min_len += folded[i] != '*';
+    }
+
+    entry->index = msk_key(folded, key);
+    entry->prev = NULL;
+    if ((head = msk_head(set, entry, key)) != NULL) {
+        if ((entry->next = *head) != NULL) {
+            entry->next->prev = entry;
+        }
+        *head = entry;
+    } else {
+        entry->next = NULL;
+        ht_add_value(set->keys[entry->index], key, entry);
+    }
+
+    ht_add_value(set->masks, folded, entry);
+
+    pthread_rwlock_unlock(&set->lock);
+
+    return 1;
+}
+
+int msk_del(struct msk_set* set, const char* mask) {
+    char normal[MSK_SIZE], folded[MSK_SIZE], key[MSK_SIZE];
+    struct msk_entry* entry, **head;
+    struct ht_data* found;
+
+    msk_normalize(normal, mask, MSK_SIZE);
+    cm_fold(folded, normal, MSK_SIZE, set->casemapping);
+
+    pthread_rwlock_wrlock(&set->lock);
+
+    if ((found = ht_find(set->masks, folded)) == NULL) {
+        pthread_rwlock_unlock(&set->lock);
+        return 0;
+    }
+
+    entry = found->value;
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    }
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else if ((head = msk_head(set, entry, key)) != NULL) {
+        if ((*head = entry->next) == NULL && entry->index != MSK_OTHER) {
+            ht_del(set->keys[entry->index], key);
+        }
+    }
+
+    ht_del(set->masks, folded);
+    free(entry);
+
+    pthread_rwlock_unlock(&set->lock);
+
+    return 1;
+}
+
+int msk_count(struct msk_set* set) {
+    int count;
+
+    pthread_rwlock_rdlock(&set->lock);
+    count = set->masks->num_entries;
+    pthread_rwlock_unlock(&set->lock);
+
+    return count;
+}
+
+int msk_match(struct msk_set* set, const char* prefix, msk_visitor visit, void* data) {
+    char folded[MSK_SIZE], key[MSK_SIZE];
+    char* user, *host, *p;
+    unsigned int len;
+    int count = 0;
+
+    cm_fold(folded, prefix, MSK_SIZE, set->casemapping);
+    len = strlen(folded);
+    user = strchr(folded, '!');
+    host = strchr(folded, '@');
+
+    pthread_rwlock_rdlock(&set->lock);
+
+    if (host != NULL && *++host != '\0') {
+        /* The whole host and each of its parent domains */
+        count += msk_test_key(set, MSK_HOST, host, folded, len, visit, data);
+        for (p = host + 1; (p = strchr(p, '.')) != NULL; p++) {
+            count += msk_test_key(set, MSK_HOST, p, folded, len, visit, data);
+        }
+
+        /* Each leading part of the address */
+        for (p = host; (p = strchr(p, '.')) != NULL; p++) {
+            count += msk_test_key(set, MSK_HEAD, msk_copy(key, host, p + 1), folded, len, visit, data);
+        }
+    }
+
+    if (user != NULL && user > folded) {
+        count += msk_test_key(set, MSK_NICK, msk_copy(key, folded, user), folded, len, visit, data);
+    }
+
+    if (user != NULL && host != NULL && host - 1 > user + 1) {
+        count += msk_test_key(set, MSK_USER, msk_copy(key, user + 1, host - 1), folded, len, visit, data);
+    }
+
+    /* Each group of characters of the prefix, skipping the repeated ones */
+    if (set->keys[MSK_GRAM]->num_entries > 0) {
+        for (p = folded; p + MSK_GRAM_SIZE <= folded + len; p++) {
+            if (ht_find(set->keys[MSK_GRAM], msk_copy(key, p, p + MSK_GRAM_SIZE)) != NULL && !msk_repeated(folded, p)) {
+                count += msk_test_key(set, MSK_GRAM, key, folded, len, visit, data);
+            }
+        }
+    }
+
+    count += msk_test(set->others, folded, len, visit, data);
+
+    pthread_rwlock_unlock(&set->lock);
+
+    return count;
+}
+
+int msk_matches(const char* mask, const char* prefix, enum isp_casemapping casemapping) {
+    char normal[MSK_SIZE], folded_mask[MSK_SIZE], folded[MSK_SIZE];
+
+    msk_normalize(normal, mask, MSK_SIZE);
+    cm_fold(folded_mask, normal, MSK_SIZE, casemapping);
+    cm_fold(folded, prefix, MSK_SIZE, casemapping);
+
+    return msk_glob(folded_mask, folded);
+}
+
+char* msk_normalize(char* dst, const char* mask, unsigned int size) {
+    int has_user = strchr(mask, '!') != NULL, has_host = strchr(mask, '@') != NULL;
+
+    if (*mask == '\0') {
+        snprintf(dst, size, "*!*@*");
+    } else if (!has_user && !has_host) {
+        snprintf(dst, size, "%s!*@*", mask);    /* A nick */
+    } else if (!has_user) {
+        snprintf(dst, size, "*!%s", mask);      /* A user and a host */
+    } else if (!has_host) {
+        snprintf(dst, size, "%s@*", mask);      /* A nick and a user */
+    } else {
+        snprintf(dst, size, "%s", mask);
+    }
+
+    return dst;
+}
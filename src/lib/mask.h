@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __MASK_H__
+#define __MASK_H__
+
+#include "isupport.h"
+
+#define MSK_SIZE 512            /* Longest mask or prefix that can be matched */
+
+/* A set of wildcard masks (such as "*!*@*.example.net") indexed to find the
+ * ones that match a message prefix (nick!user@host) without testing them all.
+ * '*' matches any number of characters and '?' matches exactly one.
+ * Masks are compared with the case mapping of the server. The set can be
+ * used from several threads (defined in mask.c). */
+struct msk_set;
+
+/* Callback invoked for each matching mask, with the value it was added with */
+typedef void (*msk_visitor)(const char* mask, void* value, void* data);
+
+struct msk_set* msk_create(enum isp_casemapping casemapping);  /* Create an empty mask set */
+void msk_destroy(struct msk_set* set);                          /* Free the set and its masks (not their values) */
+int msk_add(struct msk_set* set, const char* mask, void* value);    /* Add a mask, or change its value. Returns 1 if it is new */
+int msk_del(struct msk_set* set, const char* mask);                 /* Remove a mask. Returns 1 if it was in the set */
+int msk_count(struct msk_set* set);                                 /* Get the number of masks in the set */
+int msk_match(struct msk_set* set, const char* prefix, msk_visitor visit, void* data);  /* Visit the masks matching a prefix (visit can be NULL). Returns how many matched */
+int msk_matches(const char* mask, const char* prefix, enum isp_casemapping casemapping);  /* Check a single mask against a prefix */
+char* msk_normalize(char* dst, const char* mask, unsigned int size);    /* Complete a partial mask as servers do ("nick" is "nick!*@*") */
+
+#endif
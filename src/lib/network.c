@@ -20,125 +20,1392 @@
  * THE SOFTWARE.
  */
 
-#define _POSIX_C_SOURCE 200112L      /* Use addr structs and fdopen */
+#define _POSIX_C_SOURCE 200112L      /* Use addr structs */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <errno.h>
 #include <err.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #include "debug.h"
+#include "codes.h"
+#include "scheduler.h"
+#include "isupport.h"
+#include "tracker.h"
+#include "intern.h"
 #include "network.h"
 
 
-int _socket = -1;           /* The socket to the IRC server */
-static FILE* _sd = NULL;    /* A file pointer to be able to read from the socket line by line */
+#define RING_MASK (NET_RING_SIZE - 1)
 
-void net_connect(char* address, char* port) {
-    struct addrinfo addr_in;            /* Remote address configuration */
-    struct addrinfo *addr_out, *addr;   /* Resolved addresses */
-    int error;                          /* Error number when resolving host name */
+/* Do not get killed by SIGPIPE when the server has closed the connection */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Receive and send buffer. Data is read from the socket in large chunks and
+ * consumed line by line, and outgoing lines are queued until the event loop
+ * sends them all at once. Positions are free running counters that must be
+ * masked to get the actual index in the data array. */
+struct net_ring {
+    char data[NET_RING_SIZE];   /* The received data */
+    unsigned int head;          /* Position of the first unconsumed byte */
+    unsigned int tail;          /* Position where the next received byte will be stored */
+    unsigned int scan;          /* Position where the search for the line terminator continues */
+};
+
+/* A reconnection attempt running in a helper thread, so resolving the
+ * address and waiting for the server do not stop the event loop */
+struct net_dial {
+    char* address;              /* The address of the server */
+    char* port;                 /* The port of the server */
+    int socket;                 /* The connected socket, or -1 */
+    int done;                   /* If the attempt has finished */
+    int refs;                   /* The thread and the connection (the last one frees the attempt) */
+};
+
+/* A connection to an IRC server */
+struct net_conn {
+    int socket;                 /* The socket to the IRC server, or -1 if disconnected */
+    int index;                  /* Position in the list of open connections, or -1 if not open */
+    struct net_ring ring;       /* The receive buffer for the socket */
+    struct net_ring out;        /* The outgoing lines not sent yet */
+    int writing;                /* If the event loop is waiting to send the outgoing lines */
+    struct sch_queue sched;     /* The outgoing lines waiting for the rate limit */
+    int throttled;              /* If there are lines waiting for the rate limit */
+    struct isp_table isupport;  /* The features advertised by the server */
+    struct trk_table* tracker;  /* The joined channels and their users */
+    pthread_mutex_t send_lock;  /* Serializes the outgoing lines */
+    double last_recv;           /* When data was last received (only used by the event loop) */
+    double last_ping;           /* When the last keepalive ping was sent (only used by the event loop) */
+    int ping_interval;          /* Milliseconds of silence before pinging the server (0 disables the keepalive) */
+    int ping_timeout;           /* Milliseconds of silence before the connection is dead (0 never) */
+    int lag;                    /* The last round trip time measured with a keepalive ping (ms), or -1 */
+    char* address;              /* The address of the server, or NULL if the socket was attached */
+    char* port;                 /* The port of the server */
+    int retry_min;              /* Milliseconds to wait after the second failed reconnection (0 disables reconnecting) */
+    int retry_max;              /* Longest wait between reconnection attempts */
+    int attempts;               /* Failed reconnection attempts since the connection was lost */
+    double retry;               /* When to try to reconnect, if waiting */
+    int waiting;                /* Position in the list of connections waiting to reconnect, or -1 */
+    struct net_dial* dial;      /* The reconnection attempt in progress, or NULL */
+    char session[NET_SESSION_LINES][WRITE_BUF];     /* The lines that registered the connection */
+    char* rejoin;               /* The channels to join again once registered ("#a,#b"), or NULL */
+};
+
+/* The open connections. They are all watched by the same event loop */
+static struct net_conns {
+    struct net_conn** list;     /* The open connections */
+    int count;                  /* Number of open connections */
+    int size;                   /* Capacity of the list */
+    int poller;                 /* The epoll instance watching the connections */
+    int throttled;              /* Number of connections with lines waiting for the rate limit */
+    int wake[2];                /* A pipe watched by the event loop, to wake it up from other threads */
+    struct net_conn** waiting;  /* The lost connections waiting to reconnect */
+    int num_waiting;            /* Number of connections waiting to reconnect */
+    int waiting_size;           /* Capacity of the waiting list */
+    pthread_mutex_t lock;       /* Connections may be closed from the dispatcher threads */
+    struct pollfd* fds;         /* The sockets polled without epoll, and the wake up pipe */
+    struct net_conn** polled;   /* The connections of the polled sockets */
+    int polled_size;            /* Capacity of the polled arrays */
+    int next_ready;             /* The polled position to report first, so all connections get their turn */
+} conns = { NULL, 0, 0, -1, 0, { -1, -1 }, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+/* The connection used by each thread to send messages, and the default one */
+static __thread struct net_conn* current = NULL;
+static struct net_conn* last_connected = NULL;
+
+
+/* ******************* */
+/* Receive ring buffer */
+/* ******************* */
+
+/* Discard all buffered data */
+static void ring_reset(struct net_ring* ring) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->scan = 0;
+}
+
+/* Get the length of the next complete line in the buffer (including the
+ * line terminator), or 0 if there is no complete line yet */
+static unsigned int ring_line(struct net_ring* ring, unsigned int max) {
+    while (ring->scan != ring->tail) {
+        unsigned int pos = ring->scan & RING_MASK;
+        unsigned int len = ring->tail - ring->scan;
+        char* found;
+
+        /* Only search the contiguous part of the buffer */
+        if (len > NET_RING_SIZE - pos) {
+            len = NET_RING_SIZE - pos;
+        }
+
+        if ((found = memchr(ring->data + pos, '\n', len)) != NULL) {
+            ring->scan += found - (ring->data + pos);
+            len = ring->scan - ring->head + 1;
+            return len < max ? len : max;
+        }
+
+        ring->scan += len;
+    }
+
+    /* Lines that do not fit in a message are returned in chunks,
+     * as fgets would do */
+    return (ring->tail - ring->head >= max)? max : 0;
+}
+
+/* Read as much data as possible from the socket into the free space of the buffer */
+static int ring_fill(struct net_ring* ring, int socket) {
+    struct iovec iov[2];
+    unsigned int pos = ring->tail & RING_MASK;
+    unsigned int free_space = NET_RING_SIZE - (ring->tail - ring->head);
+    int count = 1, ret;
+
+    iov[0].iov_base = ring->data + pos;
+    iov[0].iov_len = NET_RING_SIZE - pos;
+
+    /* If the free space wraps around the end of the array, fill both parts at once */
+    if (iov[0].iov_len >= free_space) {
+        iov[0].iov_len = free_space;
+    } else {
+        iov[1].iov_base = ring->data;
+        iov[1].iov_len = free_space - iov[0].iov_len;
+        count = 2;
+    }
+
+    do {
+        ret = readv(socket, iov, count);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret > 0) {
+        ring->tail += ret;
+    }
+
+    return ret;
+}
+
+/* Move the given number of bytes out of the buffer */
+static void ring_take(struct net_ring* ring, char* dest, unsigned int len) {
+    unsigned int pos = ring->head & RING_MASK;
+    unsigned int first = (len > NET_RING_SIZE - pos)? NET_RING_SIZE - pos : len;
+
+    memcpy(dest, ring->data + pos, first);
+    memcpy(dest + first, ring->data, len - first);
+
+    ring->head += len;
+    if ((int) (ring->scan - ring->head) < 0) {
+        ring->scan = ring->head;
+    }
+}
+
+/* Append the given bytes at the end of the buffer (there must be enough free space) */
+static void ring_put(struct net_ring* ring, const char* src, unsigned int len) {
+    unsigned int pos = ring->tail & RING_MASK;
+    unsigned int first = (len > NET_RING_SIZE - pos)? NET_RING_SIZE - pos : len;
+
+    memcpy(ring->data + pos, src, first);
+    memcpy(ring->data, src + first, len - first);
+
+    ring->tail += len;
+}
+
+/* Write as much buffered data as possible to the socket without blocking */
+static int ring_flush(struct net_ring* ring, int socket) {
+    struct iovec iov[2];
+    struct msghdr hdr;
+    unsigned int pos = ring->head & RING_MASK;
+    unsigned int used = ring->tail - ring->head;
+    int ret;
+
+    iov[0].iov_base = ring->data + pos;
+    iov[0].iov_len = NET_RING_SIZE - pos;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = 1;
+
+    /* If the data wraps around the end of the array, send both parts at once */
+    if (iov[0].iov_len >= used) {
+        iov[0].iov_len = used;
+    } else {
+        iov[1].iov_base = ring->data;
+        iov[1].iov_len = used - iov[0].iov_len;
+        hdr.msg_iovlen = 2;
+    }
+
+    do {
+        ret = sendmsg(socket, &hdr, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret > 0) {
+        ring->head += ret;
+    }
+
+    return (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))? 0 : ret;
+}
+
+
+/* ******************** */
+/* Connection functions */
+/* ******************** */
+
+/* Create a connection object for the given socket */
+static struct net_conn* conn_create(int socket) {
+    struct net_conn* conn;
+    int i;
+
+    if ((conn = malloc(sizeof(struct net_conn))) == 0) {
+        perror("Out of memory (conn_create)");
+        exit(EXIT_FAILURE);
+    }
+
+    conn->socket = socket;
+    conn->index = -1;
+    conn->writing = 0;
+    conn->throttled = 0;
+    ring_reset(&conn->ring);    /* Start with empty buffers */
+    ring_reset(&conn->out);
+    sch_init(&conn->sched);     /* No rate limit by default */
+    isp_init(&conn->isupport);
+    conn->tracker = trk_create(&conn->isupport);
+    pthread_mutex_init(&conn->send_lock, NULL);
+    conn->last_recv = conn->last_ping = sch_now();
+    conn->ping_interval = NET_PING_INTERVAL;
+    conn->ping_timeout = NET_PING_TIMEOUT;
+    conn->lag = -1;
+    conn->address = NULL;
+    conn->port = NULL;
+    conn->retry_min = 0;
+    conn->retry_max = 0;
+    conn->attempts = 0;
+    conn->retry = 0;
+    conn->waiting = -1;
+    conn->dial = NULL;
+    conn->rejoin = NULL;
+    for (i = 0; i < NET_SESSION_LINES; i++) {
+        conn->session[i][0] = '\0';
+    }
+
+    /* Senders must never block. Lines are queued and sent by the event loop */
+    if (socket != -1) {
+        fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+    }
+
+    return conn;
+}
+
+/* Add the connection to the event loop */
+static void conn_open(struct net_conn* conn) {
+    pthread_mutex_lock(&conns.lock);
+
+    if (conns.count == conns.size) {
+        conns.size = conns.size == 0 ? 16 : conns.size * 2;
+        if ((conns.list = realloc(conns.list, conns.size * sizeof(struct net_conn*))) == 0) {
+            perror("Out of memory (conn_open)");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    conn->index = conns.count;
+    conns.list[conns.count++] = conn;
+
+    if (conns.wake[0] == -1) {
+        if (pipe(conns.wake) == -1) {
+            perror("Error creating the wake up pipe");
+            exit(EXIT_FAILURE);
+        }
+        fcntl(conns.wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(conns.wake[1], F_SETFL, O_NONBLOCK);
+    }
+
+#ifdef __linux__
+    {
+        struct epoll_event event;
+
+        if (conns.poller == -1) {
+            if ((conns.poller = epoll_create(NET_EVENTS)) == -1) {
+                perror("Error creating the event loop");
+                exit(EXIT_FAILURE);
+            }
+
+            /* The wake up pipe is the only entry without a connection */
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.ptr = NULL;
+            epoll_ctl(conns.poller, EPOLL_CTL_ADD, conns.wake[0], &event);
+        }
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+        if (epoll_ctl(conns.poller, EPOLL_CTL_ADD, conn->socket, &event) == -1) {
+            perror("Error watching the connection");
+            exit(EXIT_FAILURE);
+        }
+    }
+#endif
+
+    last_connected = conn;
+    pthread_mutex_unlock(&conns.lock);
+}
+
+/* Remove the connection from the event loop */
+static void conn_close(struct net_conn* conn) {
+    struct net_conn* moved;
+
+    pthread_mutex_lock(&conns.lock);
+
+    if (conn->index != -1) {
+        /* Keep the list compact by moving the last connection to the free position */
+        moved = conns.list[--conns.count];
+        conns.list[conn->index] = moved;
+        moved->index = conn->index;
+        conn->index = -1;
+
+#ifdef __linux__
+        epoll_ctl(conns.poller, EPOLL_CTL_DEL, conn->socket, NULL);
+#endif
+    }
+
+    if (last_connected == conn) {
+        last_connected = conns.count > 0 ? conns.list[conns.count - 1] : NULL;
+    }
+
+    pthread_mutex_unlock(&conns.lock);
+}
+
+
+/* Set if the event loop must wake up when the connection can send data.
+ * Must be called with the send lock held. */
+static void conn_watch(struct net_conn* conn, int writing) {
+    if (conn->writing == writing || conn->socket == -1) {
+        return;
+    }
+
+    conn->writing = writing;
+#ifdef __linux__
+    {
+        struct epoll_event event;
+
+        memset(&event, 0, sizeof(event));
+        event.events = writing ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        event.data.ptr = conn;
+        epoll_ctl(conns.poller, EPOLL_CTL_MOD, conn->socket, &event);
+    }
+#endif
+}
+
+
+/* Set if the connection has lines waiting for the rate limit.
+ * Must be called with the send lock held. */
+static void conn_throttle(struct net_conn* conn, int throttled) {
+    if (conn->throttled != throttled) {
+        conn->throttled = throttled;
+        __atomic_add_fetch(&conns.throttled, throttled ? 1 : -1, __ATOMIC_RELEASE);
+        conn_watch(conn, 1);    /* Wake up the event loop so it schedules the lines */
+    }
+}
+
+/* Move the lines allowed by the rate limit to the output queue.
+ * Returns the seconds until the next line can be sent, or -1 if there are no lines left. */
+static double conn_release(struct net_conn* conn, double now, int force) {
+    char line[SCH_LINE_SIZE];
+    int len, released = 0;
+    double wait;
+
+    pthread_mutex_lock(&conn->send_lock);
+    while ((len = force ? sch_force(&conn->sched, line, now) : sch_pop(&conn->sched, line, now)) > 0) {
+        ring_put(&conn->out, line, len);
+        ring_put(&conn->out, MSG_SEP, strlen(MSG_SEP));
+        released = 1;
+    }
+
+    if (released) {
+        conn_watch(conn, 1);
+    }
+
+    if ((wait = sch_wait(&conn->sched, now)) < 0) {
+        conn_throttle(conn, 0);
+    }
+    pthread_mutex_unlock(&conn->send_lock);
+
+    return wait;
+}
+
+/* Release the lines of all the throttled connections.
+ * Returns the milliseconds until the next line can be sent, or -1 if there are no lines waiting. */
+static int conns_release() {
+    double now, wait, next = -1;
+    int i;
+
+    if (__atomic_load_n(&conns.throttled, __ATOMIC_ACQUIRE) == 0) {
+        return -1;
+    }
+
+    now = sch_now();
+    pthread_mutex_lock(&conns.lock);
+    for (i = 0; i < conns.count; i++) {
+        if (conns.list[i]->throttled && (wait = conn_release(conns.list[i], now, 0)) >= 0) {
+            next = (next < 0 || wait < next) ? wait : next;
+        }
+    }
+    pthread_mutex_unlock(&conns.lock);
+
+    return next < 0 ? -1 : (int) (next * 1000) + 1;     /* Round up so the line is allowed when waking up */
+}
+
+/* Get the number of bytes waiting to be sent. Must be called with the send lock held */
+static unsigned int conn_queued(struct net_conn* conn) {
+    return conn->out.tail - conn->out.head
+        + conn->sched.stats.bytes + conn->sched.stats.depth * strlen(MSG_SEP);
+}
+
+/* Get the longest line the server may send */
+static unsigned int conn_linelen(struct net_conn* conn) {
+    unsigned int linelen = conn->isupport.linelen;
+    return linelen < MSG_SIZE ? MSG_SIZE : linelen < NET_LINE_MAX ? linelen : NET_LINE_MAX;
+}
+
+
+/* Remove the connection from the waiting list. Must be called with the connections lock held */
+static void conns_unwait(struct net_conn* conn) {
+    struct net_conn* moved;
+
+    if (conn->waiting != -1) {
+        moved = conns.waiting[--conns.num_waiting];
+        conns.waiting[conn->waiting] = moved;
+        moved->waiting = conn->waiting;
+        conn->waiting = -1;
+    }
+}
+
+/* Wait until the given time to reconnect */
+static void conn_wait(struct net_conn* conn, double when) {
+    pthread_mutex_lock(&conns.lock);
+
+    if (conn->waiting == -1) {
+        if (conns.num_waiting == conns.waiting_size) {
+            conns.waiting_size = conns.waiting_size == 0 ? 16 : conns.waiting_size * 2;
+            if ((conns.waiting = realloc(conns.waiting, conns.waiting_size * sizeof(struct net_conn*))) == 0) {
+                perror("Out of memory (conn_wait)");
+                exit(EXIT_FAILURE);
+            }
+        }
+        conn->waiting = conns.num_waiting;
+        conns.waiting[conns.num_waiting++] = conn;
+    }
+    conn->retry = when;
+
+    pthread_mutex_unlock(&conns.lock);
+}
+
+/* Stop using a reconnection attempt. The socket is closed if nobody took it */
+static void dial_release(struct net_dial* dial) {
+    if (__atomic_sub_fetch(&dial->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (dial->socket != -1) {
+            close(dial->socket);
+        }
+        free(dial->address);
+        free(dial->port);
+        free(dial);
+    }
+}
+
+/* Stop waiting to reconnect, abandoning the attempt in progress */
+static void conn_unwait(struct net_conn* conn) {
+    pthread_mutex_lock(&conns.lock);
+    conns_unwait(conn);
+    if (conn->dial != NULL) {
+        dial_release(conn->dial);
+        conn->dial = NULL;
+    }
+    pthread_mutex_unlock(&conns.lock);
+}
+
+
+/* ***************** */
+/* Network functions */
+/* ***************** */
+
+/* Order the resolved addresses alternating between families, starting with
+ * the preferred one, so a broken IPv6 (or IPv4) route does not delay the
+ * other. Returns the number of addresses */
+static int conn_interleave(struct addrinfo* list, struct addrinfo** addrs) {
+    struct addrinfo *first = list, *second = list;
+    int count = 0, family = list != NULL ? list->ai_family : AF_UNSPEC;
+
+    while (count < NET_DIAL_MAX && (first != NULL || second != NULL)) {
+        /* Each cursor skips the addresses of the other family */
+        while (first != NULL && first->ai_family != family) {
+            first = first->ai_next;
+        }
+        while (second != NULL && second->ai_family == family) {
+            second = second->ai_next;
+        }
+
+        if (first != NULL) {
+            addrs[count++] = first;
+            first = first->ai_next;
+        }
+        if (second != NULL && count < NET_DIAL_MAX) {
+            addrs[count++] = second;
+            second = second->ai_next;
+        }
+    }
+
+    return count;
+}
+
+/* Start a non-blocking connection to the address. Returns the socket, or -1
+ * if the attempt failed right away. The socket is connected once it is writable */
+static int conn_attempt(struct addrinfo* addr, int* connected) {
+    int sd;
+
+    if ((sd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol)) == -1) {
+        return -1;
+    }
+
+    fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
+    *connected = connect(sd, addr->ai_addr, addr->ai_addrlen) == 0;
+    if (!*connected && errno != EINPROGRESS) {
+        close(sd);
+        return -1;
+    }
+
+    return sd;
+}
+
+/* Resolve the address and race connections to the resolved servers. Each
+ * attempt starts NET_CONNECT_DELAY after the previous one (or as soon as it
+ * fails), so a dead server only costs that delay instead of a full TCP
+ * timeout. Returns the socket of the first that connects, or -1 */
+static int conn_dial(char* address, char* port) {
+    struct addrinfo hints;                  /* Remote address configuration */
+    struct addrinfo *list;                  /* Resolved addresses */
+    struct addrinfo *addrs[NET_DIAL_MAX];   /* The addresses in the order they are tried */
+    struct pollfd pending[NET_DIAL_MAX];    /* The attempts in progress */
+    int num_addrs, started = 0, num_pending = 0, error, connected, sd = -1, i, wait;
+    double now, deadline, next;
+    socklen_t len;
 
     /* Get remote host address */
     debug(("network: Resolving address: %s\n", address));
-    memset(&addr_in, 0, sizeof(addr_in));
-    addr_in.ai_family = AF_INET;
-    addr_in.ai_socktype = SOCK_STREAM;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
 
-    error = getaddrinfo(address, port, &addr_in, &addr_out);
+    error = getaddrinfo(address, port, &hints, &list);
     if (error) {
-        errx(EXIT_FAILURE, "%s", gai_strerror(error));
+        warnx("%s", gai_strerror(error));
+        return -1;
     }
 
     debug(("network: Connecting\n"));
-    for (addr = addr_out; addr && _socket == -1; addr = addr->ai_next) {
-        if ((_socket = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol)) != -1) {
-            if (connect(_socket, addr->ai_addr, addr->ai_addrlen) != -1) {
-                /* Create the file descriptor to read from the socket line by line
-                 * and turn off buffering to avoid blocking input */
-                _sd = fdopen(_socket, "r");
-                setvbuf(_sd, NULL, _IONBF, 0);
+    num_addrs = conn_interleave(list, addrs);
+    now = next = sch_now();
+    deadline = now + NET_CONNECT_TIMEOUT / 1000.0;
+
+    while (sd == -1 && (started < num_addrs || num_pending > 0) && now < deadline) {
+        /* Start the next attempt when it is due or when there is nothing left to wait for */
+        if (started < num_addrs && (num_pending == 0 || now >= next)) {
+            if ((pending[num_pending].fd = conn_attempt(addrs[started++], &connected)) != -1) {
+                if (connected) {
+                    sd = pending[num_pending].fd;
+                    break;
+                }
+                pending[num_pending++].events = POLLOUT;
+                next = now + NET_CONNECT_DELAY / 1000.0;
+            }
+            continue;
+        }
+
+        wait = (int) ((((started < num_addrs && next < deadline) ? next : deadline) - now) * 1000) + 1;
+        if (poll(pending, num_pending, wait) < 0 && errno != EINTR) {
+            break;
+        }
+
+        /* Keep the first that connects. A failed attempt lets the next one start right away */
+        for (i = 0; i < num_pending; ) {
+            if (pending[i].revents == 0) {
+                i++;
+                continue;
+            }
+
+            len = sizeof(error);
+            if (sd == -1 && getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0) {
+                sd = pending[i].fd;
             } else {
-                /* If connection fails, close the socket and try next resolved address */
-                close(_socket);
-                _socket = -1;
+                close(pending[i].fd);
+                next = 0;
             }
+            pending[i] = pending[--num_pending];
         }
+
+        now = sch_now();
+    }
+
+    /* The slower attempts lost the race */
+    for (i = 0; i < num_pending; i++) {
+        close(pending[i].fd);
     }
 
-    freeaddrinfo(addr_out);     /* Free the temporal address info */
+    freeaddrinfo(list);     /* Free the temporal address info */
 
-    if (_socket == -1) {
-        errx(EXIT_FAILURE, "Could not connect to: %s:%s\n", address, port);
+    if (sd == -1) {
+        warnx("Could not connect to: %s:%s", address, port);
     }
+
+    return sd;
+}
+
+/* Copy a string, exiting if there is no memory left */
+static char* conn_strdup(const char* str, const char* fn) {
+    char* copy;
+
+    if ((copy = malloc(strlen(str) + 1)) == 0) {
+        perror(fn);
+        exit(EXIT_FAILURE);
+    }
+
+    return strcpy(copy, str);
+}
+
+/* Close the socket and forget the state of the session with the server */
+static void conn_shutdown(struct net_conn* conn) {
+    /* Try to send the pending lines (such as a QUIT message) before closing */
+    conn_release(conn, sch_now(), 1);
+    pthread_mutex_lock(&conn->send_lock);
+    if (conn->socket != -1 && conn->out.tail != conn->out.head) {
+        ring_flush(&conn->out, conn->socket);
+    }
+    pthread_mutex_unlock(&conn->send_lock);
+
+    conn_close(conn);
+
+    pthread_mutex_lock(&conn->send_lock);
+    if (conn->socket != -1) {
+        close(conn->socket);
+        conn->socket = -1;
+        conn->writing = 0;
+        conn_throttle(conn, 0);
+        ring_reset(&conn->ring);
+        ring_reset(&conn->out);
+        sch_destroy(&conn->sched);
+        trk_clear(conn->tracker);
+    }
+    pthread_mutex_unlock(&conn->send_lock);
+}
+
+struct net_conn* net_connect(char* address, char* port) {
+    struct net_conn* conn;
+    int sd;
+
+    if ((sd = conn_dial(address, port)) == -1) {
+        return NULL;
+    }
+
+    conn = conn_create(sd);
+    conn->address = conn_strdup(address, "Out of memory (net_connect)");
+    conn->port = conn_strdup(port, "Out of memory (net_connect)");
+    conn->retry_min = NET_RETRY_MIN;    /* Connections to a known server come back when lost */
+    conn->retry_max = NET_RETRY_MAX;
+    conn_open(conn);
+
+    return conn;
+}
+
+struct net_conn* net_attach(int socket) {
+    struct net_conn* conn = conn_create(socket);
+    conn_open(conn);
+    return conn;
 }
 
-void net_disconnect() {
+struct net_conn* net_offline() {
+    return conn_create(-1);     /* Never watched by the event loop, so the messages sent are dropped */
+}
+
+void net_disconnect(struct net_conn* conn) {
+    if (conn == NULL) {
+        return;
+    }
+
+    conn_unwait(conn);     /* Disconnecting on purpose gives up reconnecting */
+    if (conn->socket == -1) {
+        return;
+    }
+
     debug(("network: Disconnecting\n"));
-    close(_socket);
-    _socket = -1;
-    _sd = NULL;
+    conn_shutdown(conn);
 }
 
-int net_send(char* msg) {
-    char out[READ_BUF];             /* The real size we can send in the socket, considering the '\0'*/
+void net_free(struct net_conn* conn) {
+    if (conn != NULL) {
+        net_disconnect(conn);
+        if (current == conn) {
+            current = NULL;
+        }
+        sch_destroy(&conn->sched);
+        trk_destroy(conn->tracker);
+        pthread_mutex_destroy(&conn->send_lock);
+        free(conn->address);
+        free(conn->port);
+        free(conn->rejoin);
+        free(conn);
+    }
+}
 
-    strncpy(out, msg, WRITE_BUF);   /* Cut the message to the maximum size */
-    out[WRITE_BUF]= '\0';           /* Make sure string is null terminated. Perhaps the '\0' was stripped) */
-    strcat(out, MSG_SEP);           /* Messages must end like this */
+int net_count() {
+    return __atomic_load_n(&conns.count, __ATOMIC_ACQUIRE);
+}
 
-    printf(">> %s", out);
+void net_use(struct net_conn* conn) {
+    current = conn;
+}
 
-    return send(_socket, out, strlen(out), 0);
+struct net_conn* net_current() {
+    return current != NULL ? current : last_connected;
 }
 
-void net_recv(char* msg) {
-    char* ret;
+int net_send(struct net_conn* conn, char* msg) {
+    unsigned int len, queued;
+    double now = sch_now();
+    char* end;
 
-    /* Read only a single line from the socket */
-    ret = fgets(msg, READ_BUF, _sd);
-    msg[READ_BUF - 1] = '\0';   /* Make sure the string is properly terminated */
+    if (conn == NULL) {
+        return -1;
+    }
 
-    if (ret == NULL) {
-        perror("Error reading from socket");
-        exit(EXIT_FAILURE);
+    /* Cut the message to the maximum size. Messages must end with the separator */
+    len = (end = memchr(msg, '\0', WRITE_BUF)) != NULL ? end - msg : WRITE_BUF;
+
+    /* Callbacks may send from several dispatcher threads. Do not interleave their lines */
+    pthread_mutex_lock(&conn->send_lock);
+
+    queued = conn_queued(conn);
+    if (conn->socket == -1 || NET_RING_SIZE - queued < len + strlen(MSG_SEP)) {
+        pthread_mutex_unlock(&conn->send_lock);
+        debug(("network: Output queue full. Dropping message\n"));
+        return -1;
     }
 
+    queued += len + strlen(MSG_SEP);
+
+    if (sch_admit(&conn->sched, now)) {
+        ring_put(&conn->out, msg, len);
+        ring_put(&conn->out, MSG_SEP, strlen(MSG_SEP));
+        conn_watch(conn, 1);    /* Let the event loop send the queued lines */
+    } else {
+        sch_push(&conn->sched, msg, len, now);
+        conn_throttle(conn, 1);
+    }
+    pthread_mutex_unlock(&conn->send_lock);
+
+    /* Printed without the lock, so a slow terminal does not hold back the other senders */
+    printf(">> %.*s%s", (int) len, msg, MSG_SEP);
+
+    return queued > NET_OUT_HIGH ? 0 : 1;
+}
+
+int net_flush(struct net_conn* conn) {
+    int ret = -1;
+
+    pthread_mutex_lock(&conn->send_lock);
+    if (conn->socket != -1) {
+        if (conn->out.tail == conn->out.head || ring_flush(&conn->out, conn->socket) >= 0) {
+            ret = conn->out.tail - conn->out.head;
+        }
+        conn_watch(conn, ret > 0);  /* Keep waiting only if the socket is full */
+    }
+    pthread_mutex_unlock(&conn->send_lock);
+
+    return ret;
+}
+
+int net_queued(struct net_conn* conn) {
+    int queued;
+
+    if (conn == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&conn->send_lock);
+    queued = conn_queued(conn);
+    pthread_mutex_unlock(&conn->send_lock);
+
+    return queued;
+}
+
+struct isp_table* net_isupport(struct net_conn* conn) {
+    return &conn->isupport;
+}
+
+struct trk_table* net_tracker(struct net_conn* conn) {
+    return conn->tracker;
+}
+
+void net_throttle(struct net_conn* conn, int burst, int interval_ms) {
+    pthread_mutex_lock(&conn->send_lock);
+    sch_rate(&conn->sched, burst, interval_ms);
+    conn_watch(conn, 1);    /* Queued lines may be allowed now */
+    pthread_mutex_unlock(&conn->send_lock);
+}
+
+void net_stats(struct net_conn* conn, struct sch_stats* stats) {
+    pthread_mutex_lock(&conn->send_lock);
+    *stats = conn->sched.stats;
+    pthread_mutex_unlock(&conn->send_lock);
+}
+
+int net_recv(struct net_conn* conn, char* msg) {
+    unsigned int len = ring_line(&conn->ring, conn_linelen(conn));
+    int ret;
+
+    /* Only read from the socket if there are no buffered lines */
+    if (len == 0) {
+        if (conn->socket == -1 || (ret = ring_fill(&conn->ring, conn->socket)) == 0
+                || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            debug(("network: Connection closed by the server\n"));
+            return -1;
+        }
+
+        if (ret > 0) {
+            conn->last_recv = sch_now();    /* The server is alive */
+        }
+
+        /* The line may still be incomplete. The rest will come in the next read */
+        if ((len = ring_line(&conn->ring, conn_linelen(conn))) == 0) {
+            return 0;
+        }
+    }
+
+    ring_take(&conn->ring, msg, len);
+    msg[len] = '\0';   /* Make sure the string is properly terminated */
+
     printf("<< %s", msg);
+
+    return 1;
+}
+
+int net_pending(struct net_conn* conn) {
+    return ring_line(&conn->ring, conn_linelen(conn)) > 0;
+}
+
+/* Ping the server if it is due and get the seconds until the connection
+ * must be checked again, or -1 if it does not use the keepalive. Pings are
+ * sent after an interval of silence, so busy connections do not need them,
+ * and every NET_LAG_PROBE intervals to keep the lag up to date */
+static double conn_heartbeat(struct net_conn* conn, double now, int* dead) {
+    double interval = __atomic_load_n(&conn->ping_interval, __ATOMIC_RELAXED) / 1000.0;
+    double timeout = __atomic_load_n(&conn->ping_timeout, __ATOMIC_RELAXED) / 1000.0;
+    double ping, next;
+    char msg[WRITE_BUF];
+
+    *dead = 0;
+    if (interval <= 0) {
+        return -1;
+    }
+
+    if (timeout > 0 && now - conn->last_recv >= timeout) {
+        debug(("network: Nothing received in %.0f seconds. The connection is dead\n", now - conn->last_recv));
+        *dead = 1;
+        return -1;
+    }
+
+    /* Never ping more than once per interval, even if the answer has not come */
+    ping = conn->last_recv + interval;
+    if (ping > conn->last_ping + NET_LAG_PROBE * interval) {
+        ping = conn->last_ping + NET_LAG_PROBE * interval;
+    }
+    if (ping < conn->last_ping + interval) {
+        ping = conn->last_ping + interval;
+    }
+
+    if (now >= ping) {
+        conn->last_ping = now;
+        snprintf(msg, WRITE_BUF, "%s :%s%lu", PING, NET_PING_TOKEN, (unsigned long) (now * 1000));
+        net_send(conn, msg);
+        ping = now + interval;
+    }
+
+    next = timeout > 0 && conn->last_recv + timeout < ping ? conn->last_recv + timeout : ping;
+    return next - now;
+}
+
+int net_heartbeat(struct net_conn** dead, int* num_dead) {
+    double now = sch_now(), wait, next = -1;
+    int i, is_dead;
+
+    *num_dead = 0;
+    pthread_mutex_lock(&conns.lock);
+    for (i = 0; i < conns.count; i++) {
+        wait = conn_heartbeat(conns.list[i], now, &is_dead);
+        if (is_dead && *num_dead < NET_EVENTS) {
+            dead[(*num_dead)++] = conns.list[i];
+        } else if (wait >= 0) {
+            next = (next < 0 || wait < next) ? wait : next;
+        }
+    }
+    pthread_mutex_unlock(&conns.lock);
+
+    return next < 0 ? -1 : (int) (next * 1000) + 1;     /* Round up so the check is due when waking up */
+}
+
+void net_keepalive(struct net_conn* conn, int interval_ms, int timeout_ms) {
+    __atomic_store_n(&conn->ping_interval, interval_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&conn->ping_timeout, timeout_ms, __ATOMIC_RELAXED);
+    net_wake();     /* The event loop may be sleeping longer than the new interval */
+}
+
+void net_pong(struct net_conn* conn, const char* token) {
+    unsigned long sent, now = (unsigned long) (sch_now() * 1000);
+    char* end;
+
+    /* Answers to the pings of the application are not measured */
+    if (token == NULL || strncmp(token, NET_PING_TOKEN, strlen(NET_PING_TOKEN)) != 0) {
+        return;
+    }
+
+    sent = strtoul(token + strlen(NET_PING_TOKEN), &end, 10);
+    if (*end == '\0' && sent <= now) {
+        debug(("network: Lag is %lu ms\n", now - sent));
+        __atomic_store_n(&conn->lag, (int) (now - sent), __ATOMIC_RELAXED);
+    }
+}
+
+int net_lag(struct net_conn* conn) {
+    return __atomic_load_n(&conn->lag, __ATOMIC_RELAXED);
+}
+
+/* Empty the wake up pipe */
+static void conns_woken() {
+    char buf[64];
+    while (read(conns.wake[0], buf, sizeof(buf)) > 0);
+}
+
+void net_wake() {
+    /* If the pipe is full, the event loop is already going to wake up */
+    if (conns.wake[1] != -1 && write(conns.wake[1], "", 1) < 0) {
+        debug(("network: The event loop has pending wake ups\n"));
+    }
 }
 
-enum net_status net_listen() {
-    int read, ret;
-    fd_set read_fd_set;
+enum net_status net_listen(struct net_conn** ready, int* num_ready, int timeout_ms) {
+    int read, ret, i, timeout, woken = 0;
+    double deadline = timeout_ms >= 0 ? sch_now() + timeout_ms / 1000.0 : -1, left;
 
-    /* Initialize the set of active sockets */
-    FD_ZERO(&read_fd_set);
-    FD_SET(_socket, &read_fd_set);
+    /* Send the queued lines as the connections become writable and the rate
+     * limit allows it, and only return once some connection has data to be read,
+     * the timeout expires or the loop is woken up */
+    do {
+        debug(("network: Waiting for incoming messages...\n"));
+
+        if (net_count() == 0 && net_waiting() == 0) {
+            debug(("network: There are no open connections\n"));
+            return NET_CLOSE;
+        }
+
+        timeout = conns_release();  /* Wake up when the next throttled line can be sent */
+
+        /* Do not sleep beyond the timeout of the caller (rounding up, so it has expired when waking up) */
+        if (deadline >= 0) {
+            left = deadline - sch_now();
+            i = left > 0 ? (int) (left * 1000) + 1 : 0;
+            timeout = timeout < 0 || i < timeout ? i : timeout;
+        }
+
+#ifdef __linux__
+        {
+            struct epoll_event events[NET_EVENTS];
+
+            read = epoll_wait(conns.poller, events, NET_EVENTS, timeout);
+            for (i = 0, ret = 0; i < read; i++) {
+                if (events[i].data.ptr == NULL) {
+                    conns_woken();
+                    woken = 1;
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    net_flush(events[i].data.ptr);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    ready[ret++] = events[i].data.ptr;
+                }
+            }
+        }
+#else
+        {
+            struct pollfd* fds;
+            struct net_conn** polled;
+            int count, first, k;
+
+            /* Watch all the connections. The arrays grow with the list */
+            pthread_mutex_lock(&conns.lock);
+            if (conns.polled_size < conns.count + 1) {
+                conns.polled_size = conns.size + 1;
+                if ((conns.fds = realloc(conns.fds, conns.polled_size * sizeof(struct pollfd))) == 0) {
+                    perror("Out of memory (net_listen)");
+                    exit(EXIT_FAILURE);
+                }
+                if ((conns.polled = realloc(conns.polled, conns.polled_size * sizeof(struct net_conn*))) == 0) {
+                    perror("Out of memory (net_listen: polled)");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            fds = conns.fds;
+            polled = conns.polled;
+            for (count = 0; count < conns.count; count++) {
+                polled[count] = conns.list[count];
+                fds[count].fd = polled[count]->socket;
+                fds[count].events = polled[count]->writing ? POLLIN | POLLOUT : POLLIN;
+            }
+            pthread_mutex_unlock(&conns.lock);
 
-    debug(("network: Waiting for incoming messages...\n"));
+            /* The wake up pipe goes after the connections */
+            fds[count].fd = conns.wake[0];
+            fds[count].events = POLLIN;
 
-    /* Check if there is some data to be read */
-    read = select(_socket + 1, &read_fd_set, NULL, NULL, NULL);
+            /* Only NET_EVENTS connections are returned at once. The next call
+             * starts after the last one returned, so none of them starves */
+            read = poll(fds, count + 1, timeout);
+            first = count > 0 ? conns.next_ready % count : 0;
+            for (k = 0, ret = 0; read > 0 && k < count; k++) {
+                i = (first + k) % count;
+                if (fds[i].revents & POLLOUT) {
+                    net_flush(polled[i]);
+                }
+                if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && ret < NET_EVENTS) {
+                    ready[ret++] = polled[i];
+                    conns.next_ready = i + 1;
+                }
+            }
+            if (read > 0 && (fds[count].revents & POLLIN)) {
+                conns_woken();
+                woken = 1;
+            }
+        }
+#endif
+    } while (!woken && ((read > 0 && ret == 0) || (read == 0 && timeout >= 0 && (deadline < 0 || sch_now() < deadline))));
 
-    /* If there is an error in select, abort except
+    /* If there is an error in the event loop, abort except
      * if the error is an interrupt signal. We'll just
      * ignore it since we are handling the signals. */
     if (read < 0) {
-        debug(("network: Select returned %d\n", errno));
+        debug(("network: Event loop returned %d\n", errno));
         ret = (errno == EINTR)? NET_CLOSE : NET_ERROR;
-    } else if (read > 0 && FD_ISSET(_socket, &read_fd_set)) {
+    } else if (ret > 0) {
+        *num_ready = ret;
         ret = NET_READY;
     } else {
-        /* This should never be raised, because no timeout is defined */
-        debug(("network: Timeout. Socket dead?\n"));
+        debug(("network: No connection has data after the timeout\n"));
+        *num_ready = 0;
         ret = NET_TIMEOUT;
     }
 
     return ret;
 }
 
+
+/* ********************** */
+/* Reconnection functions */
+/* ********************** */
+
+/* The channels joined before losing the connection */
+struct conn_channels {
+    char* list;     /* Comma separated channel names */
+    size_t len;     /* Length of the list */
+};
+
+/* Add a joined channel to the list */
+static void conn_add_channel(const char* name, const char* modes, void* data) {
+    struct conn_channels* channels = data;
+    size_t len = strlen(name);
+
+    if ((channels->list = realloc(channels->list, channels->len + len + 2)) == 0) {
+        perror("Out of memory (conn_add_channel)");
+        exit(EXIT_FAILURE);
+    }
+
+    if (channels->len > 0) {
+        channels->list[channels->len++] = ',';
+    }
+    memcpy(channels->list + channels->len, name, len + 1);
+    channels->len += len;
+}
+
+/* Remember the joined channels before the tracker forgets them. If the
+ * connection is lost again before registering, the previous list is kept */
+static void conn_remember(struct net_conn* conn) {
+    struct conn_channels channels = { NULL, 0 };
+    const char* me;
+
+    if ((me = trk_me(conn->tracker)) == NULL) {
+        return;
+    }
+
+    trk_channels(conn->tracker, me, conn_add_channel, &channels);
+    str_release(me);
+
+    if (channels.list != NULL) {
+        pthread_mutex_lock(&conn->send_lock);
+        free(conn->rejoin);
+        conn->rejoin = channels.list;
+        pthread_mutex_unlock(&conn->send_lock);
+    }
+}
+
+/* Get the seconds to wait after a failed attempt. The wait doubles with
+ * each failure, and half of it is random so clients that lost the same
+ * server do not all come back at the same time */
+static double conn_backoff(struct net_conn* conn) {
+    double delay = __atomic_load_n(&conn->retry_min, __ATOMIC_RELAXED);
+    double max = __atomic_load_n(&conn->retry_max, __ATOMIC_RELAXED);
+    int i;
+
+    for (i = 1; i < conn->attempts && delay < max; i++) {
+        delay *= 2;
+    }
+    if (delay > max) {
+        delay = max;
+    }
+
+    delay = delay / 2 + (delay / 2) * (rand() / (RAND_MAX + 1.0));
+    return delay / 1000;
+}
+
+/* Watch the new socket and register again with the server */
+static void conn_resume(struct net_conn* conn, int socket) {
+    char session[NET_SESSION_LINES][WRITE_BUF];
+    int i;
+
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+
+    pthread_mutex_lock(&conn->send_lock);
+    conn->socket = socket;
+    memcpy(session, conn->session, sizeof(session));
+    pthread_mutex_unlock(&conn->send_lock);
+
+    conn->last_recv = conn->last_ping = sch_now();
+    __atomic_store_n(&conn->lag, -1, __ATOMIC_RELAXED);
+    conn->attempts = 0;
+    conn_open(conn);
+
+    /* A line sent before the socket was watched could not ask to wake up
+     * when it can be written. Ask again now that the event loop knows it */
+    pthread_mutex_lock(&conn->send_lock);
+    if (conn->writing) {
+        conn->writing = 0;
+        conn_watch(conn, 1);
+    }
+    pthread_mutex_unlock(&conn->send_lock);
+
+    debug(("network: Reconnected to %s:%s\n", conn->address, conn->port));
+    for (i = 0; i < NET_SESSION_LINES && session[i][0] != '\0'; i++) {
+        net_send(conn, session[i]);
+    }
+}
+
+void net_lost(struct net_conn* conn) {
+    if (conn == NULL || conn->socket == -1) {
+        return;
+    }
+
+    debug(("network: Connection lost\n"));
+    conn_remember(conn);
+    conn_shutdown(conn);
+
+    /* The first attempt is immediate. Only servers that keep failing are waited for */
+    if (conn->address != NULL && __atomic_load_n(&conn->retry_min, __ATOMIC_RELAXED) > 0) {
+        conn->attempts = 0;
+        conn_wait(conn, sch_now());
+    }
+}
+
+/* Connect in a helper thread and wake up the event loop with the result */
+static void* dial_run(void* arg) {
+    struct net_dial* dial = arg;
+
+    dial->socket = conn_dial(dial->address, dial->port);
+    __atomic_store_n(&dial->done, 1, __ATOMIC_RELEASE);
+    net_wake();
+    dial_release(dial);
+
+    return NULL;
+}
+
+/* Start reconnecting in a helper thread. Must be called with the connections lock held */
+static void conn_redial(struct net_conn* conn) {
+    struct net_dial* dial;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int error;
+
+    if ((dial = malloc(sizeof(struct net_dial))) == 0) {
+        perror("Out of memory (conn_redial)");
+        exit(EXIT_FAILURE);
+    }
+
+    dial->address = conn_strdup(conn->address, "Out of memory (conn_redial)");
+    dial->port = conn_strdup(conn->port, "Out of memory (conn_redial)");
+    dial->socket = -1;
+    dial->done = 0;
+    dial->refs = 2;
+    conn->dial = dial;
+
+    debug(("network: Reconnecting to %s:%s\n", conn->address, conn->port));
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if ((error = pthread_create(&thread, &attr, dial_run, dial)) != 0) {
+        /* Neither the thread nor the connection will use it. Try again
+         * later, as if the attempt had failed */
+        errno = error;
+        perror("Error creating the reconnection thread");
+        dial_release(dial);
+        dial_release(dial);
+        conn->dial = NULL;
+        conn->attempts++;
+        conn->retry = sch_now() + conn_backoff(conn);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+int net_retry() {
+    struct net_conn* finished[NET_EVENTS];
+    int sockets[NET_EVENTS];
+    double now = sch_now(), next = -1;
+    struct net_conn* conn;
+    int num_finished = 0, i;
+
+    if (net_waiting() == 0) {
+        return -1;
+    }
+
+    /* Start the attempts that are due and collect the finished ones. The
+     * threads wake up the event loop when they finish */
+    pthread_mutex_lock(&conns.lock);
+    for (i = conns.num_waiting - 1; i >= 0; i--) {
+        conn = conns.waiting[i];
+        if (conn->dial != NULL && __atomic_load_n(&conn->dial->done, __ATOMIC_ACQUIRE) && num_finished < NET_EVENTS) {
+            sockets[num_finished] = conn->dial->socket;
+            conn->dial->socket = -1;
+            dial_release(conn->dial);
+            conn->dial = NULL;
+            finished[num_finished++] = conn;
+            conns_unwait(conn);
+        } else if (conn->dial == NULL && conn->retry <= now) {
+            conn_redial(conn);
+        }
+    }
+    pthread_mutex_unlock(&conns.lock);
+
+    for (i = 0; i < num_finished; i++) {
+        if (sockets[i] != -1) {
+            conn_resume(finished[i], sockets[i]);
+        } else {
+            finished[i]->attempts++;
+            conn_wait(finished[i], sch_now() + conn_backoff(finished[i]));
+        }
+    }
+
+    /* Wait for the next attempt that is not in progress */
+    now = sch_now();
+    pthread_mutex_lock(&conns.lock);
+    for (i = 0; i < conns.num_waiting; i++) {
+        if (conns.waiting[i]->dial == NULL && (next < 0 || conns.waiting[i]->retry - now < next)) {
+            next = conns.waiting[i]->retry - now;
+        }
+    }
+    pthread_mutex_unlock(&conns.lock);
+
+    return next < 0 ? -1 : next > 0 ? (int) (next * 1000) + 1 : 0;
+}
+
+int net_waiting() {
+    return __atomic_load_n(&conns.num_waiting, __ATOMIC_ACQUIRE);
+}
+
+void net_reconnect(struct net_conn* conn, int min_ms, int max_ms) {
+    __atomic_store_n(&conn->retry_min, min_ms > 0 ? min_ms : 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&conn->retry_max, max_ms > min_ms ? max_ms : min_ms, __ATOMIC_RELAXED);
+    if (min_ms <= 0) {
+        conn_unwait(conn);
+    }
+}
+
+void net_session(struct net_conn* conn, const char* line) {
+    size_t cmd = strcspn(line, " ");
+    int i, slot = -1;
+
+    pthread_mutex_lock(&conn->send_lock);
+
+    /* A new line for the same command (such as a nick change) replaces the old one */
+    for (i = 0; i < NET_SESSION_LINES && slot == -1; i++) {
+        if (strncmp(conn->session[i], line, cmd) == 0
+                && (conn->session[i][cmd] == ' ' || conn->session[i][cmd] == '\0')) {
+            slot = i;
+        }
+    }
+    for (i = 0; i < NET_SESSION_LINES && slot == -1; i++) {
+        if (conn->session[i][0] == '\0') {
+            slot = i;
+        }
+    }
+
+    if (slot != -1) {
+        strncpy(conn->session[slot], line, WRITE_BUF - 1);
+        conn->session[slot][WRITE_BUF - 1] = '\0';
+    } else {
+        debug(("network: Too many session lines. Dropping %s\n", line));
+    }
+
+    pthread_mutex_unlock(&conn->send_lock);
+}
+
+void net_registered(struct net_conn* conn) {
+    char msg[WRITE_BUF];
+    char *channels, *channel, *next;
+    size_t len = 0, size;
+
+    pthread_mutex_lock(&conn->send_lock);
+    channels = conn->rejoin;
+    conn->rejoin = NULL;
+    pthread_mutex_unlock(&conn->send_lock);
+
+    if (channels == NULL) {
+        return;
+    }
+
+    /* Join as many channels as fit in each line */
+    for (channel = channels; channel != NULL; channel = next) {
+        if ((next = strchr(channel, ',')) != NULL) {
+            *next++ = '\0';
+        }
+
+        size = strlen(channel);
+        if (len > 0 && len + size + 1 >= WRITE_BUF) {
+            net_send(conn, msg);
+            len = 0;
+        }
+
+        len += len == 0 ? snprintf(msg, WRITE_BUF, "%s %s", JOIN, channel)
+            : snprintf(msg + len, WRITE_BUF - len, ",%s", channel);
+        len = len < WRITE_BUF ? len : WRITE_BUF - 1;
+    }
+
+    if (len > 0) {
+        net_send(conn, msg);
+    }
+
+    debug(("network: Joining the channels again\n"));
+    free(channels);
+}
@@ -23,29 +23,82 @@
 #ifndef __NETWORK_H__
 #define __NETWORK_H__
 
+#include "scheduler.h"
+#include "isupport.h"
+#include "tracker.h"
+
 #define MSG_SIZE 512    /* The maximum message size of an IRC message */
 #define MSG_SEP "\r\n"  /* The message separator */
 
-#define READ_BUF (MSG_SIZE + 1)     /* The read buffer size */
+#define NET_LINE_MAX 4096           /* The longest line received, when the server advertises a LINELEN above MSG_SIZE */
+
+#define READ_BUF (NET_LINE_MAX + 1) /* The read buffer size */
 #define WRITE_BUF (MSG_SIZE - 3)    /* The write buffer size */
 
+#define NET_RING_SIZE 16384         /* Size of the receive ring buffer (must be a power of two) */
+#define NET_EVENTS 64               /* Maximum number of ready connections returned by each listen call */
+#define NET_OUT_HIGH (NET_RING_SIZE / 2)    /* Queued output size above which senders should slow down */
+
+#define NET_PING_INTERVAL 30000     /* Default milliseconds of silence before pinging the server */
+#define NET_PING_TIMEOUT 120000     /* Default milliseconds of silence before the connection is dead */
+#define NET_LAG_PROBE 4             /* Busy connections are pinged every few intervals to measure the lag */
+#define NET_PING_TOKEN "LAG"        /* Prefix of the keepalive pings, to tell their answers apart */
+
+#define NET_CONNECT_DELAY 250      /* Milliseconds before racing the next resolved address against the slower ones */
+#define NET_CONNECT_TIMEOUT 30000   /* Longest time to wait for any resolved address to connect */
+#define NET_DIAL_MAX 16             /* Maximum number of resolved addresses tried by each connection attempt */
+
+#define NET_RETRY_MIN 1000          /* Default milliseconds to wait after the first failed reconnection */
+#define NET_RETRY_MAX 300000        /* Default longest wait between reconnection attempts */
+#define NET_SESSION_LINES 3         /* Registration lines sent again when reconnecting (PASS, NICK and USER) */
+
 /* Network status */
 enum net_status {
     NET_READY,      /* There is data to be read from the socket */
     NET_ERROR,      /* Unexpected error while reading */
     NET_CLOSE,      /* The connection must terminate */
-    NET_TIMEOUT     /* The connection timed out */
+    NET_TIMEOUT     /* No connection had data before the timeout expired or the event loop was woken up */
 };
 
-/* The socket to the IRC server */
-extern int _socket;
+/* A connection to an IRC server */
+struct net_conn;
+
+/* Connection functions */
+struct net_conn* net_connect(char* address, char* port);    /* Connect to an IRC server (NULL if it can not be reached) */
+struct net_conn* net_attach(int socket);                    /* Watch an already connected socket */
+struct net_conn* net_offline();                             /* Create a connection without a server, to handle recorded messages (what is sent is dropped) */
+void net_disconnect(struct net_conn* conn);                 /* Disconnect from the server (the connection can still be referenced) */
+void net_free(struct net_conn* conn);                       /* Free the connection once nothing references it */
+int net_count();                                            /* Get the number of open connections */
+void net_use(struct net_conn* conn);                        /* Set the connection used by the calling thread */
+struct net_conn* net_current();                             /* Get the connection used by the calling thread */
 
 /* Network functions  */
-void net_connect(char* address, char* port);    /* Connect to the IRC server */
-void net_disconnect();                          /* Disconnect from the server */
-void net_recv(char* msg);                       /* Receive a message from the server */
-enum net_status net_listen();                   /* Listen for incoming messages */
-int net_send(char* msg);                        /* Send a message to the server */
+int net_recv(struct net_conn* conn, char* msg);             /* Receive a message into a READ_BUF buffer (1 if received, 0 if no complete line is available, -1 if closed) */
+int net_pending(struct net_conn* conn);                     /* Check if there are complete lines already buffered */
+enum net_status net_listen(struct net_conn** ready, int* num_ready, int timeout_ms);  /* Wait until some connections have data to be read (a timeout of -1 waits forever) */
+void net_wake();                                            /* Make the event loop return from net_listen, from any thread */
+int net_send(struct net_conn* conn, char* msg);             /* Queue a message (1 if queued, 0 if queued above the high-water mark, -1 if dropped) */
+int net_flush(struct net_conn* conn);                       /* Send the queued messages without blocking (returns the bytes still queued, or -1) */
+int net_queued(struct net_conn* conn);                      /* Get the number of bytes waiting to be sent */
+void net_throttle(struct net_conn* conn, int burst, int interval_ms);   /* Limit the send rate (a burst of 0 lines disables the limit) */
+void net_stats(struct net_conn* conn, struct sch_stats* stats);         /* Get the send counters */
+struct isp_table* net_isupport(struct net_conn* conn);                  /* Get the features advertised by the server (the tracker guards them once connected) */
+struct trk_table* net_tracker(struct net_conn* conn);                   /* Get the joined channels and their users */
+
+/* Keepalive functions */
+void net_keepalive(struct net_conn* conn, int interval_ms, int timeout_ms); /* Ping the server after interval_ms of silence (0 disables it) and give up after timeout_ms (0 never) */
+int net_heartbeat(struct net_conn** dead, int* num_dead);   /* Send the pings that are due and find the dead connections. Returns the ms until the next check (-1 if none) */
+void net_pong(struct net_conn* conn, const char* token);    /* Measure the lag with the answer to a keepalive ping */
+int net_lag(struct net_conn* conn);                         /* Get the last round trip time to the server in ms (-1 if not measured yet) */
+
+/* Reconnection functions */
+void net_lost(struct net_conn* conn);                       /* Close a broken connection and reconnect it if it is enabled */
+int net_retry();                                            /* Start the reconnections that are due and resume the connected ones. Returns the ms until the next attempt (-1 if none is waiting to start) */
+int net_waiting();                                          /* Get the number of lost connections waiting to reconnect */
+void net_reconnect(struct net_conn* conn, int min_ms, int max_ms);  /* Set the backoff between reconnection attempts (a min_ms of 0 disables reconnecting) */
+void net_session(struct net_conn* conn, const char* line);  /* Remember a registration line to send again when reconnecting */
+void net_registered(struct net_conn* conn);                 /* Join again the channels of the lost connection once registered */
 
 #endif
 
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L      /* Use posix_memalign */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "debug.h"
+#include "queue.h"
+
+
+/* Atomic access to the positions shared between the producer and the consumer */
+#define load_acquire(ptr)           __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define load_seq_cst(ptr)           __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define store_release(ptr, value)   __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define store_seq_cst(ptr, value)   __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST)
+
+
+/* ************** */
+/* Wakeup helpers */
+/* ************** */
+
+/* Create the descriptors used to wake up the consumer. An eventfd is used
+ * when available, and a pipe otherwise. */
+static void wakeup_create(struct q_ring* q) {
+#ifdef __linux__
+    if ((q->wakeup[0] = eventfd(0, 0)) == -1) {
+        perror("Could not create the queue eventfd");
+        exit(EXIT_FAILURE);
+    }
+    q->wakeup[1] = q->wakeup[0];
+#else
+    if (pipe(q->wakeup) == -1) {
+        perror("Could not create the queue pipe");
+        exit(EXIT_FAILURE);
+    }
+    /* The producer must never block when notifying */
+    fcntl(q->wakeup[1], F_SETFL, O_NONBLOCK);
+#endif
+}
+
+static void wakeup_destroy(struct q_ring* q) {
+    close(q->wakeup[0]);
+    if (q->wakeup[1] != q->wakeup[0]) {
+        close(q->wakeup[1]);
+    }
+}
+
+/* Wake up the consumer. Pending notifications are merged, so notifying
+ * several times before the consumer wakes up costs a single wakeup. */
+static void wakeup_signal(struct q_ring* q) {
+#ifdef __linux__
+    eventfd_write(q->wakeup[1], 1);
+#else
+    char c = 0;
+    if (write(q->wakeup[1], &c, 1) == -1) {
+        debug(("queue: Wakeup already pending\n"));
+    }
+#endif
+}
+
+/* Block until the consumer is notified. Interruptions are treated as
+ * spurious wakeups, and the caller must check the queue again. */
+static void wakeup_wait(struct q_ring* q) {
+#ifdef __linux__
+    eventfd_t value;
+    eventfd_read(q->wakeup[0], &value);
+#else
+    char buffer[64];
+    if (read(q->wakeup[0], buffer, sizeof(buffer)) == -1) {
+        debug(("queue: Wait interrupted\n"));
+    }
+#endif
+}
+
+
+/* ******************** */
+/* Queue implementation */
+/* ******************** */
+
+struct q_ring* q_create(unsigned long size) {
+    unsigned long capacity = 1;
+    struct q_ring* q;
+    void* memory;
+
+    /* Round the size up to a power of two to use a mask instead of a modulo */
+    while (capacity < size) {
+        capacity <<= 1;
+    }
+
+    debug(("queue: Creating queue of size %lu\n", capacity));
+
+    /* Align the queue so the padding keeps each side in its own cache line */
+    if (posix_memalign(&memory, CACHE_LINE, sizeof(struct q_ring)) != 0) {
+        perror("Out of memory (q_create)");
+        exit(EXIT_FAILURE);
+    }
+
+    q = (struct q_ring*) memory;
+
+    if ((q->items = malloc(capacity * sizeof(void*))) == 0) {
+        perror("Out of memory (q_create: items)");
+        exit(EXIT_FAILURE);
+    }
+
+    q->tail = 0;
+    q->head_cache = 0;
+    q->head = 0;
+    q->tail_cache = 0;
+    q->parked = 0;
+    q->mask = capacity - 1;
+    wakeup_create(q);
+
+    return q;
+}
+
+void q_destroy(struct q_ring* q) {
+    if (q != NULL) {
+        debug(("queue: Destroying queue\n"));
+        wakeup_destroy(q);
+        free(q->items);
+        free(q);
+    }
+}
+
+int q_push(struct q_ring* q, void* item) {
+    unsigned long tail = q->tail;
+
+    /* Only look at the consumer position when the queue seems to be full */
+    if (tail - q->head_cache > q->mask) {
+        q->head_cache = load_acquire(&q->head);
+        if (tail - q->head_cache > q->mask) {
+            return 0;
+        }
+    }
+
+    q->items[tail & q->mask] = item;
+    store_seq_cst(&q->tail, tail + 1);
+
+    /* Only notify if the consumer is waiting. The first producer that sees
+     * the consumer parked takes care of waking it up. */
+    if (load_seq_cst(&q->parked) && __sync_bool_compare_and_swap(&q->parked, 1, 0)) {
+        wakeup_signal(q);
+    }
+
+    return 1;
+}
+
+void* q_pop(struct q_ring* q) {
+    unsigned long head = q->head;
+    void* item;
+
+    /* Only look at the producer position when the queue seems to be empty */
+    if (head == q->tail_cache) {
+        q->tail_cache = load_acquire(&q->tail);
+        if (head == q->tail_cache) {
+            return NULL;
+        }
+    }
+
+    item = q->items[head & q->mask];
+    store_release(&q->head, head + 1);
+
+    return item;
+}
+
+unsigned long q_size(struct q_ring* q) {
+    unsigned long head = load_acquire(&q->head);
+    return load_acquire(&q->tail) - head;
+}
+
+void q_wait(struct q_ring* q) {
+    store_seq_cst(&q->parked, 1);
+
+    /* Check again once parked, as the producer may have added items
+     * before seeing the flag */
+    if (load_seq_cst(&q->tail) == q->head) {
+        debug(("queue: Waiting for items\n"));
+        wakeup_wait(q);
+    }
+
+    store_release(&q->parked, 0);
+}
+
+void q_wake(struct q_ring* q) {
+    wakeup_signal(q);
+}
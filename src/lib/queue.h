@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+#define Q_SIZE 4096         /* Default capacity of a queue (must be a power of two) */
+#define CACHE_LINE 64       /* Size of a cache line, used to avoid false sharing */
+
+/* Bounded single-producer/single-consumer queue. The producer and the
+ * consumer positions live in different cache lines so each thread only
+ * writes to its own line. */
+struct q_ring {
+    unsigned long tail;             /* Next position to write (only written by the producer) */
+    unsigned long head_cache;       /* Last known consumer position (producer local) */
+    char __producer_pad[CACHE_LINE - 2 * sizeof(unsigned long)];
+
+    unsigned long head;             /* Next position to read (only written by the consumer) */
+    unsigned long tail_cache;       /* Last known producer position (consumer local) */
+    int parked;                     /* If the consumer is waiting for items */
+    char __consumer_pad[CACHE_LINE - 2 * sizeof(unsigned long) - sizeof(int)];
+
+    unsigned long mask;             /* Capacity - 1, used to get the position in the array */
+    void** items;                   /* The queued items */
+    int wakeup[2];                  /* Read and write endpoints used to wake up the consumer */
+};
+
+struct q_ring*  q_create(unsigned long size);               /* Create a queue of the given capacity */
+void            q_destroy(struct q_ring* q);                /* Destroy the queue */
+int             q_push(struct q_ring* q, void* item);       /* Add an item to the queue (0 if the queue is full) */
+void*           q_pop(struct q_ring* q);                    /* Get the next item from the queue (NULL if empty) */
+unsigned long   q_size(struct q_ring* q);                   /* Get the number of queued items */
+void            q_wait(struct q_ring* q);                   /* Block the consumer until there are items or it is woken up */
+void            q_wake(struct q_ring* q);                   /* Wake up the consumer, even if it is not waiting */
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L     /* Use mmap and posix_madvise */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "debug.h"
+#include "network.h"
+#include "replay.h"
+
+
+/* A mapped log file */
+struct rep_source {
+    char* data;         /* The contents of the file (NULL if it is empty) */
+    size_t size;        /* The size of the file */
+    size_t pos;         /* Where the next line starts */
+};
+
+
+/* Parse the time at the start of the line. Returns the length of the
+ * time and the space after it, or 0 if the line does not start with one */
+static size_t rep_time(const char* line, size_t len, double* when) {
+    size_t i = 0, frac;
+    double value = 0, scale = 1;
+
+    while (i < len && isdigit((unsigned char) line[i])) {
+        value = value * 10 + (line[i++] - '0');
+    }
+    if (i == 0) {
+        return 0;
+    }
+
+    if (i < len && line[i] == '.') {
+        for (frac = ++i; i < len && isdigit((unsigned char) line[i]); i++) {
+            scale /= 10;
+            value += (line[i] - '0') * scale;
+        }
+        if (i == frac) {
+            return 0;
+        }
+    }
+
+    /* Numbers not followed by a space belong to the message */
+    if (i == len || line[i] != ' ') {
+        return 0;
+    }
+
+    *when = value;
+    return i + 1;
+}
+
+struct rep_source* rep_open(const char* path) {
+    struct rep_source* source;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        perror("Error opening the log");
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        perror("Error reading the log");
+        close(fd);
+        return NULL;
+    }
+
+    if ((source = malloc(sizeof(struct rep_source))) == 0) {
+        perror("Out of memory (rep_open)");
+        exit(EXIT_FAILURE);
+    }
+
+    source->data = NULL;
+    source->size = st.st_size;
+    source->pos = 0;
+
+    if (source->size > 0) {
+        if ((source->data = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+            perror("Error mapping the log");
+            close(fd);
+            free(source);
+            return NULL;
+        }
+
+        /* The file is read once from start to end. Let the kernel read ahead */
+        posix_madvise(source->data, source->size, POSIX_MADV_SEQUENTIAL);
+    }
+
+    close(fd);      /* The mapping keeps the file open */
+    debug(("replay: Mapped %lu bytes\n", (unsigned long) source->size));
+
+    return source;
+}
+
+void rep_close(struct rep_source* source) {
+    if (source != NULL) {
+        if (source->data != NULL) {
+            munmap(source->data, source->size);
+        }
+        free(source);
+    }
+}
+
+int rep_next(struct rep_source* source, char* msg, double* when) {
+    char *line, *end;
+    size_t len, skip;
+
+    while (source->pos < source->size) {
+        line = source->data + source->pos;
+        end = memchr(line, '\n', source->size - source->pos);
+        len = end != NULL ? (size_t) (end - line) + 1 : source->size - source->pos;
+        source->pos += len;
+
+        *when = -1;
+        skip = rep_time(line, len, when);
+        line += skip;
+        len -= skip;
+
+        /* Only the lines received from the server are replayed */
+        if (len >= strlen(REP_SENT) && strncmp(line, REP_SENT, strlen(REP_SENT)) == 0) {
+            continue;
+        }
+        if (len >= strlen(REP_RECEIVED) && strncmp(line, REP_RECEIVED, strlen(REP_RECEIVED)) == 0) {
+            line += strlen(REP_RECEIVED);
+            len -= strlen(REP_RECEIVED);
+        }
+        if (len == 0 || line[0] == '\r' || line[0] == '\n') {
+            continue;
+        }
+
+        /* Lines longer than the read buffer are cut */
+        len = len < READ_BUF - 1 ? len : READ_BUF - 1;
+        memcpy(msg, line, len);
+        msg[len] = '\0';
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#define REP_RECEIVED "<< "      /* Marker of the received lines in the output of the library */
+#define REP_SENT ">> "          /* Marker of the sent lines, which are skipped */
+
+/* A recorded log of the lines received from a server, mapped in memory so
+ * captures larger than the memory can be read without copying them. Each
+ * line may start with the time it was received in seconds (such as
+ * "1318000000.25 :nick!user@host PRIVMSG #channel :hi"), and with the
+ * markers that the library prints for the received and sent lines. */
+struct rep_source;
+
+struct rep_source* rep_open(const char* path);      /* Map a log file (NULL if it can not be read) */
+void rep_close(struct rep_source* source);          /* Unmap the file */
+int rep_next(struct rep_source* source, char* msg, double* when);   /* Copy the next received line into a READ_BUF buffer and its time in seconds (-1 if not recorded). Returns 0 at the end */
+
+#endif
@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+#include "router.h"
+
+#define RTR_LOWER(c) ((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+#define RTR_END(c) ((c) == ' ' || (c) == '\0')
+
+/* A bound command or an alias */
+struct rtr_entry {
+    char* name;                 /* The lowercase name */
+    char* target;               /* The lowercase name of the command run by an alias, or NULL */
+    Callback callback;          /* The callback of a command */
+};
+
+/* A name and the callback it runs, once aliases are resolved */
+struct rtr_route {
+    const char* name;
+    Callback callback;
+};
+
+/* A node of the trie. Its children are a slice of the slot table indexed by character */
+struct rtr_node {
+    Callback exact;             /* The command named by the characters up to this node */
+    Callback only;              /* The callback of all the commands below, or NULL if they differ */
+    int slots;                  /* The slot of the first child, or -1 without children */
+    unsigned char first, last;  /* The first and the last characters with children */
+};
+
+struct rtr_table {
+    struct rtr_entry* entries;  /* The commands and the aliases */
+    int num_entries, size;
+    char prefixes[RTR_PREFIXES][RTR_PREFIX_SIZE];   /* The prefixes commands can start with */
+    int num_prefixes;
+    int nick;                   /* If commands can be addressed to the nick of the bot */
+    int abbrev;                 /* The shortest abbreviation accepted, or 0 if they are not */
+    struct rtr_node* nodes;     /* The compiled trie. The root is the first node */
+    int num_nodes, max_nodes;
+    int* slots;                 /* The node of each child, or -1 if there is none */
+    int num_slots, max_slots;
+};
+
+
+/* ************* */
+/* Trie building */
+/* ************* */
+
+static char* rtr_name(const char* name) {
+    char* copy;
+    int i;
+
+    if ((copy = malloc(strlen(name) + 1)) == NULL) {
+        perror("Out of memory (rtr_name)");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; name[i] != '\0'; i++) {
+        copy[i] = RTR_LOWER(name[i]);
+    }
+    copy[i] = '\0';
+
+    return copy;
+}
+
+static int rtr_new_node(struct rtr_table* rtr) {
+    if (rtr->num_nodes == rtr->max_nodes) {
+        rtr->max_nodes *= 2;
+        if ((rtr->nodes = realloc(rtr->nodes, rtr->max_nodes * sizeof(struct rtr_node))) == NULL) {
+            perror("Out of memory (rtr_new_node)");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return rtr->num_nodes++;
+}
+
+/* Reserve the slots of count children */
+static int rtr_new_slots(struct rtr_table* rtr, int count) {
+    int first = rtr->num_slots, i;
+
+    while (rtr->num_slots + count > rtr->max_slots) {
+        rtr->max_slots *= 2;
+        if ((rtr->slots = realloc(rtr->slots, rtr->max_slots * sizeof(int))) == NULL) {
+            perror("Out of memory (rtr_new_slots)");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        rtr->slots[first + i] = -1;
+    }
+    rtr->num_slots += count;
+
+    return first;
+}
+
+static int rtr_route_cmp(const void* a, const void* b) {
+    return strcmp(((const struct rtr_route*) a)->name, ((const struct rtr_route*) b)->name);
+}
+
+/* Build the node for the sorted routes that share their first depth characters */
+static int rtr_build(struct rtr_table* rtr, struct rtr_route* routes, int count, int depth) {
+    int node = rtr_new_node(rtr), slots = -1, child, i, j, ambiguous = 0;
+    unsigned char first = 0, last = 0, c;
+    Callback exact = NULL, only;
+
+    /* The route that ends here sorts before the longer ones */
+    if (count > 0 && routes[0].name[depth] == '\0') {
+        exact = routes[0].callback;
+        routes++;
+        count--;
+    }
+    only = exact;
+
+    if (count > 0) {
+        first = routes[0].name[depth];
+        last = routes[count - 1].name[depth];
+        slots = rtr_new_slots(rtr, last - first + 1);
+
+        for (i = 0; i < count; i = j) {
+            c = routes[i].name[depth];
+            for (j = i + 1; j < count && (unsigned char) routes[j].name[depth] == c; j++) {
+                continue;
+            }
+
+            child = rtr_build(rtr, routes + i, j - i, depth + 1);
+            rtr->slots[slots + c - first] = child;
+
+            if (rtr->nodes[child].only == NULL || (only != NULL && only != rtr->nodes[child].only)) {
+                ambiguous = 1;
+            } else {
+                only = rtr->nodes[child].only;
+            }
+        }
+    }
+
+    /* The nodes may have moved while building the children */
+    rtr->nodes[node].exact = exact;
+    rtr->nodes[node].only = ambiguous ? NULL : only;
+    rtr->nodes[node].slots = slots;
+    rtr->nodes[node].first = first;
+    rtr->nodes[node].last = last;
+
+    return node;
+}
+
+/* Find a command or an alias by its lowercase name */
+static struct rtr_entry* rtr_find(const struct rtr_table* rtr, const char* name) {
+    int i;
+
+    for (i = 0; i < rtr->num_entries; i++) {
+        if (strcmp(rtr->entries[i].name, name) == 0) {
+            return &rtr->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Build the trie again after the commands change */
+static void rtr_compile(struct rtr_table* rtr) {
+    struct rtr_route* routes;
+    struct rtr_entry* target;
+    int i, count = 0;
+
+    if ((routes = malloc((rtr->num_entries + 1) * sizeof(struct rtr_route))) == NULL) {
+        perror("Out of memory (rtr_compile)");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Aliases of commands that are not bound are ignored */
+    for (i = 0; i < rtr->num_entries; i++) {
+        target = rtr->entries[i].target == NULL ? &rtr->entries[i] : rtr_find(rtr, rtr->entries[i].target);
+        if (target != NULL && target->target == NULL) {
+            routes[count].name = rtr->entries[i].name;
+            routes[count++].callback = target->callback;
+        }
+    }
+    qsort(routes, count, sizeof(struct rtr_route), rtr_route_cmp);
+
+    rtr->num_nodes = 0;
+    rtr->num_slots = 0;
+    rtr_build(rtr, routes, count, 0);
+
+    free(routes);
+}
+
+/* Add an entry, or get the existing one with the same name */
+static struct rtr_entry* rtr_entry(struct rtr_table* rtr, const char* command) {
+    char* name = rtr_name(command);
+    struct rtr_entry* entry;
+
+    if ((entry = rtr_find(rtr, name)) != NULL) {
+        free(name);
+        free(entry->target);
+        entry->target = NULL;
+        return entry;
+    }
+
+    if (rtr->num_entries == rtr->size) {
+        rtr->size *= 2;
+        if ((rtr->entries = realloc(rtr->entries, rtr->size * sizeof(struct rtr_entry))) == NULL) {
+            perror("Out of memory (rtr_entry)");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    entry = &rtr->entries[rtr->num_entries++];
+    entry->name = name;
+    entry->target = NULL;
+    entry->callback = NULL;
+
+    return entry;
+}
+
+
+/* ************* */
+/* Trie matching */
+/* ************* */
+
+/* Match the word that starts at text, and set where it ends */
+static Callback rtr_word(const struct rtr_table* rtr, const char* text, const char** end) {
+    const struct rtr_node* node = rtr->nodes;
+    const char* p;
+    int child;
+
+    for (p = text; !RTR_END(*p); p++) {
+        unsigned char c = RTR_LOWER(*p);
+        if (node->slots < 0 || c < node->first || c > node->last
+                || (child = rtr->slots[node->slots + c - node->first]) < 0) {
+            return NULL;
+        }
+        node = &rtr->nodes[child];
+    }
+
+    *end = p;
+    if (p == text) {
+        return NULL;
+    } else if (node->exact != NULL) {
+        return node->exact;
+    }
+
+    return rtr->abbrev > 0 && p - text >= rtr->abbrev ? node->only : NULL;
+}
+
+/* Get where the text after "nick:" or "nick," starts, or NULL if it is not addressed to nick */
+static const char* rtr_addressed(const char* text, const char* nick) {
+    for (; *nick != '\0'; text++, nick++) {
+        if (RTR_LOWER(*text) != RTR_LOWER(*nick)) {
+            return NULL;
+        }
+    }
+
+    if (*text != ':' && *text != ',') {
+        return NULL;
+    }
+
+    for (text++; *text == ' '; text++) {
+        continue;
+    }
+
+    return text;
+}
+
+
+/* **************** */
+/* Router functions */
+/* **************** */
+
+struct rtr_table* rtr_create() {
+    struct rtr_table* rtr;
+
+    if ((rtr = malloc(sizeof(struct rtr_table))) == NULL
+            || (rtr->entries = malloc(sizeof(struct rtr_entry))) == NULL
+            || (rtr->nodes = malloc(sizeof(struct rtr_node))) == NULL
+            || (rtr->slots = malloc(sizeof(int))) == NULL) {
+        perror("Out of memory (rtr_create)");
+        exit(EXIT_FAILURE);
+    }
+
+    rtr->num_entries = 0;
+    rtr->size = 1;
+    rtr->num_prefixes = 0;
+    rtr->nick = 0;
+    rtr->abbrev = 0;
+    rtr->max_nodes = 1;
+    rtr->max_slots = 1;
+    rtr_compile(rtr);
+
+    return rtr;
+}
+
+struct rtr_table* rtr_copy(const struct rtr_table* rtr) {
+    struct rtr_table* copy;
+    int i;
+
+    if ((copy = malloc(sizeof(struct rtr_table))) == NULL
+            || (copy->entries = malloc(rtr->size * sizeof(struct rtr_entry))) == NULL
+            || (copy->nodes = malloc(rtr->max_nodes * sizeof(struct rtr_node))) == NULL
+            || (copy->slots = malloc(rtr->max_slots * sizeof(int))) == NULL) {
+        perror("Out of memory (rtr_copy)");
+        exit(EXIT_FAILURE);
+    }
+
+    copy->num_entries = rtr->num_entries;
+    copy->size = rtr->size;
+    for (i = 0; i < rtr->num_entries; i++) {
+        copy->entries[i].name = rtr_name(rtr->entries[i].name);
+        copy->entries[i].target = rtr->entries[i].target != NULL ? rtr_name(rtr->entries[i].target) : NULL;
+        copy->entries[i].callback = rtr->entries[i].callback;
+    }
+
+    memcpy(copy->prefixes, rtr->prefixes, sizeof(rtr->prefixes));
+    copy->num_prefixes = rtr->num_prefixes;
+    copy->nick = rtr->nick;
+    copy->abbrev = rtr->abbrev;
+
+    memcpy(copy->nodes, rtr->nodes, rtr->num_nodes * sizeof(struct rtr_node));
+    copy->num_nodes = rtr->num_nodes;
+    copy->max_nodes = rtr->max_nodes;
+    memcpy(copy->slots, rtr->slots, rtr->num_slots * sizeof(int));
+    copy->num_slots = rtr->num_slots;
+    copy->max_slots = rtr->max_slots;
+
+    return copy;
+}
+
+void rtr_destroy(struct rtr_table* rtr) {
+    int i;
+
+    for (i = 0; i < rtr->num_entries; i++) {
+        free(rtr->entries[i].name);
+        free(rtr->entries[i].target);
+    }
+
+    free(rtr->entries);
+    free(rtr->nodes);
+    free(rtr->slots);
+    free(rtr);
+}
+
+void rtr_add(struct rtr_table* rtr, const char* command, Callback callback) {
+    rtr_entry(rtr, command)->callback = callback;
+    rtr_compile(rtr);
+}
+
+void rtr_alias(struct rtr_table* rtr, const char* alias, const char* command) {
+    rtr_entry(rtr, alias)->target = rtr_name(command);
+    rtr_compile(rtr);
+}
+
+int rtr_del(struct rtr_table* rtr, const char* command) {
+    char* name = rtr_name(command);
+    struct rtr_entry* entry = rtr_find(rtr, name);
+
+    free(name);
+    if (entry == NULL) {
+        return 0;
+    }
+
+    free(entry->name);
+    free(entry->target);
+    *entry = rtr->entries[--rtr->num_entries];
+    rtr_compile(rtr);
+
+    return 1;
+}
+
+int rtr_prefix(struct rtr_table* rtr, const char* prefix) {
+    int i;
+
+    if (*prefix == '\0') {
+        rtr->num_prefixes = 0;
+        return 1;
+    }
+
+    for (i = 0; i < rtr->num_prefixes; i++) {
+        if (strcmp(rtr->prefixes[i], prefix) == 0) {
+            return 1;
+        }
+    }
+
+    if (rtr->num_prefixes == RTR_PREFIXES || strlen(prefix) >= RTR_PREFIX_SIZE) {
+        debug(("router: Cannot add the command prefix %s\n", prefix));
+        return 0;
+    }
+
+    strcpy(rtr->prefixes[rtr->num_prefixes++], prefix);
+    return 1;
+}
+
+void rtr_nick(struct rtr_table* rtr, int enable) {
+    rtr->nick = enable;
+}
+
+void rtr_abbrev(struct rtr_table* rtr, int min_len) {
+    rtr->abbrev = min_len > 0 ? min_len : 0;
+}
+
+Callback rtr_match(const struct rtr_table* rtr, const char* text, const char* nick, const char** rest) {
+    Callback callback = NULL;
+    const char* start, *end = text;
+    int i, prefixed = 0;
+
+    while (*text == ' ') {
+        text++;
+    }
+
+    /* Commands after a prefix ("!help") or addressed to the bot ("bot: help") */
+    for (i = 0; i < rtr->num_prefixes && callback == NULL; i++) {
+        if (strncmp(text, rtr->prefixes[i], strlen(rtr->prefixes[i])) == 0) {
+            callback = rtr_word(rtr, text + strlen(rtr->prefixes[i]), &end);
+            prefixed = 1;
+        }
+    }
+    if (callback == NULL && rtr->nick && nick != NULL && (start = rtr_addressed(text, nick)) != NULL) {
+        callback = rtr_word(rtr, start, &end);
+    }
+
+    /* Commands bound with their prefix ("!help"). With prefixes, other words are just chat */
+    if (callback == NULL && (prefixed || rtr->num_prefixes == 0)) {
+        callback = rtr_word(rtr, text, &end);
+    }
+
+    if (callback != NULL && rest != NULL) {
+        *rest = *end == ' ' ? end + 1 : end;
+    }
+
+    return callback;
+}
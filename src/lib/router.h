@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __ROUTER_H__
+#define __ROUTER_H__
+
+#include "events.h"
+
+#define RTR_PREFIXES 8          /* Maximum number of command prefixes */
+#define RTR_PREFIX_SIZE 16      /* Longest command prefix */
+
+/* The bound commands, compiled into a trie that matches the first word of a
+ * message one character at a time, whatever the number of commands. Commands
+ * are case insensitive. A table is not modified while it is being read: the
+ * binding table copies it, changes the copy and publishes it (defined in router.c) */
+struct rtr_table;
+
+struct rtr_table* rtr_create(void);                             /* Create a router without commands */
+struct rtr_table* rtr_copy(const struct rtr_table* rtr);        /* Copy a router, to modify it while the original is read */
+void rtr_destroy(struct rtr_table* rtr);                        /* Free a router */
+void rtr_add(struct rtr_table* rtr, const char* command, Callback callback);   /* Bind a command, or replace its callback */
+void rtr_alias(struct rtr_table* rtr, const char* alias, const char* command); /* Make another name run a command */
+int rtr_del(struct rtr_table* rtr, const char* command);        /* Remove a command or an alias. Returns 1 if it existed */
+int rtr_prefix(struct rtr_table* rtr, const char* prefix);      /* Accept commands after a prefix (such as "!"), or none if it is "". Returns 0 if there are too many */
+void rtr_nick(struct rtr_table* rtr, int enable);               /* Accept commands addressed to the nick of the bot ("bot: help") */
+void rtr_abbrev(struct rtr_table* rtr, int min_len);            /* Accept unique abbreviations of at least min_len characters (0 disables them) */
+Callback rtr_match(const struct rtr_table* rtr, const char* text, const char* nick, const char** rest);  /* Get the command of a message and where its arguments start */
+
+#endif
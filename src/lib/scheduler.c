@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L      /* Use clock_gettime */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "codes.h"
+#include "utils.h"
+#include "casemap.h"
+#include "scheduler.h"
+
+
+/* ************** */
+/* Line recycling */
+/* ************** */
+
+/* Get an unused line */
+static struct sch_line* sch_line_get(struct sch_queue* q) {
+    struct sch_line* line = q->spare_lines;
+
+    if (line != NULL) {
+        q->spare_lines = line->next;
+    } else if ((line = malloc(sizeof(struct sch_line))) == 0) {
+        perror("Out of memory (sch_line_get)");
+        exit(EXIT_FAILURE);
+    }
+
+    line->next = NULL;
+    return line;
+}
+
+/* Keep the line to be reused */
+static void sch_line_put(struct sch_queue* q, struct sch_line* line) {
+    line->next = q->spare_lines;
+    q->spare_lines = line;
+}
+
+/* Free all the lines in the given list */
+static void sch_line_free(struct sch_line* line) {
+    struct sch_line* next;
+
+    for (; line != NULL; line = next) {
+        next = line->next;
+        free(line);
+    }
+}
+
+
+/* ******************* */
+/* Line classification */
+/* ******************* */
+
+/* Get the position and length of the given token (0 is the first one), skipping the prefix */
+static unsigned int sch_token(const char* line, unsigned int length, int index, const char** token) {
+    unsigned int pos = 0, end;
+
+    if (length > 0 && line[0] == ':') {
+        index++;    /* The prefix is not a token */
+    }
+
+    for (;;) {
+        for (end = pos; end < length && line[end] != ' ' && line[end] != '\r'; end++);
+        if (index-- == 0 || end >= length || line[end] == '\r') {
+            break;
+        }
+        pos = end + 1;
+    }
+
+    *token = line + pos;
+    return index < 0 ? end - pos : 0;
+}
+
+/* Check if the line must be sent before the regular traffic */
+static int sch_urgent(const char* line, unsigned int length) {
+    const char* command;
+    unsigned int len = sch_token(line, length, 0, &command);
+    int id = cmd_id(command, len);
+
+    return id == CMD_PING || id == CMD_PONG || id == CMD_QUIT;
+}
+
+/* Get the queue of the target of the line, creating it if needed */
+static struct sch_target* sch_target_get(struct sch_queue* q, const char* line, unsigned int length) {
+    struct sch_target* target;
+    char name[SCH_TARGET_SIZE];
+    const char* token;
+    unsigned int len = sch_token(line, length, 1, &token);
+
+    len = len < SCH_TARGET_SIZE ? len : SCH_TARGET_SIZE - 1;
+    memcpy(name, token, len);
+    name[len] = '\0';
+    cm_fold(name, name, SCH_TARGET_SIZE, ISP_RFC1459);   /* Nicks and channels are case insensitive */
+
+    /* The number of targets with queued lines is usually small */
+    if ((target = q->last_target) != NULL) {
+        do {
+            if (s_eq(target->name, name)) {
+                return target;
+            }
+            target = target->next;
+        } while (target != q->last_target);
+    }
+
+    if ((target = q->spare_targets) != NULL) {
+        q->spare_targets = target->next;
+    } else if ((target = malloc(sizeof(struct sch_target))) == 0) {
+        perror("Out of memory (sch_target_get)");
+        exit(EXIT_FAILURE);
+    }
+
+    strcpy(target->name, name);
+    target->first = NULL;
+    target->last = NULL;
+
+    /* New targets wait for the end of the current round */
+    if (q->last_target == NULL) {
+        target->next = target;
+    } else {
+        target->next = q->last_target->next;
+        q->last_target->next = target;
+    }
+    q->last_target = target;
+
+    return target;
+}
+
+
+/* ************ */
+/* Token bucket */
+/* ************ */
+
+/* Take a token if there is one available */
+static int sch_token_take(struct sch_queue* q, double now) {
+    double tat;
+
+    if (q->burst == 0) {
+        return 1;
+    }
+
+    tat = q->tat > now ? q->tat : now;
+    if (tat - now > (q->burst - 1) * q->interval) {
+        return 0;
+    }
+
+    q->tat = tat + q->interval;
+    return 1;
+}
+
+
+/* ******************* */
+/* Scheduler functions */
+/* ******************* */
+
+double sch_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void sch_init(struct sch_queue* q) {
+    memset(q, 0, sizeof(struct sch_queue));
+}
+
+void sch_destroy(struct sch_queue* q) {
+    struct sch_target *target, *next;
+    int burst = q->burst, interval_ms = q->interval_ms;
+
+    sch_line_free(q->urgent);
+    sch_line_free(q->spare_lines);
+
+    if (q->last_target != NULL) {
+        target = q->last_target->next;
+        q->last_target->next = NULL;    /* Break the ring */
+        for (; target != NULL; target = next) {
+            next = target->next;
+            sch_line_free(target->first);
+            free(target);
+        }
+    }
+
+    for (target = q->spare_targets; target != NULL; target = next) {
+        next = target->next;
+        free(target);
+    }
+
+    sch_init(q);
+    sch_rate(q, burst, interval_ms);
+}
+
+void sch_rate(struct sch_queue* q, int burst, int interval_ms) {
+    q->burst = burst > 0 ? burst : 0;
+    q->interval_ms = interval_ms;
+    q->interval = interval_ms / 1000.0;
+    q->tat = 0;
+}
+
+int sch_admit(struct sch_queue* q, double now) {
+    /* Queued lines go first */
+    if (q->stats.depth > 0 || !sch_token_take(q, now)) {
+        return 0;
+    }
+
+    q->stats.sent++;
+    return 1;
+}
+
+void sch_push(struct sch_queue* q, const char* text, unsigned int length, double now) {
+    struct sch_line* line = sch_line_get(q);
+    struct sch_target* target;
+
+    length = length < SCH_LINE_SIZE ? length : SCH_LINE_SIZE - 1;
+    memcpy(line->text, text, length);
+    line->text[length] = '\0';
+    line->length = length;
+    line->queued = now;
+
+    if (sch_urgent(text, length)) {
+        if (q->urgent_last != NULL) {
+            q->urgent_last->next = line;
+        } else {
+            q->urgent = line;
+        }
+        q->urgent_last = line;
+    } else {
+        target = sch_target_get(q, text, length);
+        if (target->last != NULL) {
+            target->last->next = line;
+        } else {
+            target->first = line;
+        }
+        target->last = line;
+    }
+
+    q->stats.bytes += length;
+    if (++q->stats.depth > q->stats.max_depth) {
+        q->stats.max_depth = q->stats.depth;
+    }
+}
+
+int sch_pop(struct sch_queue* q, char* text, double now) {
+    if (q->stats.depth == 0 || !sch_token_take(q, now)) {
+        return 0;
+    }
+
+    return sch_force(q, text, now);
+}
+
+int sch_force(struct sch_queue* q, char* text, double now) {
+    struct sch_line* line;
+    struct sch_target* target;
+    unsigned int length;
+    double delay;
+
+    if (q->stats.depth == 0) {
+        return 0;
+    }
+
+    if ((line = q->urgent) != NULL) {
+        if ((q->urgent = line->next) == NULL) {
+            q->urgent_last = NULL;
+        }
+    } else {
+        /* Take the next line of the target whose turn is next */
+        target = q->last_target->next;
+        line = target->first;
+        if ((target->first = line->next) == NULL) {
+            /* Drop the target from the round until it has new lines */
+            target->last = NULL;
+            if (target == q->last_target) {
+                q->last_target = NULL;
+            } else {
+                q->last_target->next = target->next;
+            }
+            target->next = q->spare_targets;
+            q->spare_targets = target;
+        } else {
+            q->last_target = target;
+        }
+    }
+
+    length = line->length;
+    memcpy(text, line->text, length + 1);
+
+    delay = now - line->queued;
+    q->stats.depth--;
+    q->stats.bytes -= length;
+    q->stats.sent++;
+    q->stats.delayed++;
+    q->stats.total_delay += delay;
+    if (delay > q->stats.max_delay) {
+        q->stats.max_delay = delay;
+    }
+
+    sch_line_put(q, line);
+    return length;
+}
+
+double sch_wait(struct sch_queue* q, double now) {
+    double wait;
+
+    if (q->stats.depth == 0) {
+        return -1;
+    }
+
+    if (q->burst == 0) {
+        return 0;
+    }
+
+    wait = (q->tat > now ? q->tat : now) - (q->burst - 1) * q->interval - now;
+    return wait > 0 ? wait : 0;
+}
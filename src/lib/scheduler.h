@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#define SCH_LINE_SIZE 513   /* Size of a queued line: an IRC message plus the '\0' */
+#define SCH_TARGET_SIZE 64  /* Maximum length of the target used to share the output fairly */
+
+/* A line waiting to be sent */
+struct sch_line {
+    double queued;                  /* When the line was queued (seconds of the monotonic clock) */
+    unsigned int length;            /* The length of the line */
+    char text[SCH_LINE_SIZE];       /* The line, including the message separator */
+    struct sch_line* next;          /* The next line in the queue */
+};
+
+/* The lines waiting to be sent to the same target */
+struct sch_target {
+    char name[SCH_TARGET_SIZE];     /* The channel or nick the lines are sent to */
+    struct sch_line* first;         /* The oldest line */
+    struct sch_line* last;          /* The newest line */
+    struct sch_target* next;        /* The next target in the round robin */
+};
+
+/* Send counters */
+struct sch_stats {
+    unsigned long depth;            /* Number of lines waiting for the rate limit */
+    unsigned long max_depth;        /* Maximum number of lines that have been waiting at once */
+    unsigned long bytes;            /* Number of bytes waiting for the rate limit */
+    unsigned long sent;             /* Number of lines released to be sent */
+    unsigned long delayed;          /* Number of released lines that had to wait */
+    double total_delay;             /* Total time the released lines have waited (seconds) */
+    double max_delay;               /* Maximum time a released line has waited (seconds) */
+};
+
+/* Output scheduler. A token bucket limits the send rate, urgent lines
+ * (PING, PONG and QUIT) go first and the rest of the lines are taken in
+ * turns from each target. */
+struct sch_queue {
+    int burst;                      /* Lines that can be sent at once (0 to disable the rate limit) */
+    int interval_ms;                /* Milliseconds needed to earn each new line */
+    double interval;                /* Seconds needed to earn each new line */
+    double tat;                     /* Theoretical arrival time of the next line (token bucket state) */
+    struct sch_line* urgent;        /* The oldest urgent line */
+    struct sch_line* urgent_last;   /* The newest urgent line */
+    struct sch_target* last_target; /* The target served last (the targets form a ring) */
+    struct sch_line* spare_lines;   /* Lines ready to be reused */
+    struct sch_target* spare_targets;   /* Targets ready to be reused */
+    struct sch_stats stats;         /* Send counters */
+};
+
+double  sch_now(void);                                          /* Get the current time in seconds of the monotonic clock */
+void    sch_init(struct sch_queue* q);                          /* Initialize an unlimited scheduler */
+void    sch_destroy(struct sch_queue* q);                       /* Free all the queued lines (the rate limit is kept) */
+void    sch_rate(struct sch_queue* q, int burst, int interval_ms);  /* Allow bursts of the given lines and then one line per interval */
+int     sch_admit(struct sch_queue* q, double now);             /* Check if a new line can skip the queue (and take its token) */
+void    sch_push(struct sch_queue* q, const char* line, unsigned int length, double now);   /* Queue a line */
+int     sch_pop(struct sch_queue* q, char* line, double now);   /* Take the next line allowed to be sent (returns its length, or 0) */
+int     sch_force(struct sch_queue* q, char* line, double now); /* Take the next line ignoring the rate limit (returns its length, or 0) */
+double  sch_wait(struct sch_queue* q, double now);              /* Get the seconds until the next line can be sent (-1 if nothing is queued) */
+
+#endif
@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L     /* Use clock_gettime and POSIX threads */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include "debug.h"
+#include "timer.h"
+
+#define TMR_ROOT_SIZE (1 << TMR_ROOT_BITS)
+#define TMR_LEVEL_SIZE (1 << TMR_LEVEL_BITS)
+#define TMR_SLOTS (TMR_ROOT_SIZE + (TMR_LEVELS - 1) * TMR_LEVEL_SIZE)
+#define TMR_MAX_DELAY 0xffffffffUL      /* Longer delays are shortened to what the wheel can hold */
+#define TMR_MAX_WAIT (1 << 30)          /* Longest wait returned by tmr_next */
+
+/* Timer ids are the position of the timer in the pool and the generation of
+ * that position, so the id of an expired timer does not cancel a new one */
+#define TMR_INDEX_BITS 24
+#define TMR_INDEX_MASK ((1UL << TMR_INDEX_BITS) - 1)
+#define TMR_GENERATION_MASK (ULONG_MAX >> TMR_INDEX_BITS)
+
+
+/* A timer. Timers are linked by their position in the pool, so it can grow */
+struct tmr_entry {
+    unsigned long expires;      /* The millisecond when the timer expires */
+    unsigned long period;       /* The milliseconds between expirations, or 0 if it runs once */
+    tmr_callback callback;      /* The function to invoke */
+    void* data;                 /* The argument of the function */
+    unsigned long generation;   /* Changes each time the position is reused */
+    int slot;                   /* The slot where the timer waits, or -1 if it is not pending */
+    int prev;                   /* The previous timer in the slot, or -1 */
+    int next;                   /* The next timer in the slot or in the free list, or -1 */
+};
+
+/* The timing wheel. Slots are the lists of the timers that expire in each
+ * period: the first TMR_ROOT_SIZE are the milliseconds of the first level and
+ * then come the TMR_LEVEL_SIZE slots of each of the other levels */
+struct tmr_wheel {
+    unsigned long current;                  /* The next millisecond to process */
+    unsigned long cascaded;                 /* The last millisecond whose upper slots were moved down */
+    struct tmr_entry* entries;              /* The pool of timers */
+    int size;                               /* The capacity of the pool */
+    int used;                               /* The positions of the pool used at least once */
+    int free;                               /* The first free position that has been used, or -1 */
+    int count;                              /* The number of pending timers */
+    int slots[TMR_SLOTS];                   /* The first timer of each slot, or -1 */
+    unsigned int occupied[TMR_SLOTS / 32];  /* A bit for each slot that has timers */
+    pthread_mutex_t lock;                   /* Timers can be added from any thread */
+};
+
+/* An expired timer waiting to be run */
+struct tmr_expired {
+    tmr_callback callback;
+    void* data;
+};
+
+
+/* ************* */
+/* Wheel helpers */
+/* ************* */
+
+static int level_shift(int level) {
+    return level == 0 ? 0 : TMR_ROOT_BITS + (level - 1) * TMR_LEVEL_BITS;
+}
+
+static int level_size(int level) {
+    return level == 0 ? TMR_ROOT_SIZE : TMR_LEVEL_SIZE;
+}
+
+static int level_offset(int level) {
+    return level == 0 ? 0 : TMR_ROOT_SIZE + (level - 1) * TMR_LEVEL_SIZE;
+}
+
+/* Get the slot of the level where a timer must wait. Timers go to the finest
+ * level that covers the time until they expire */
+static int tmr_slot(struct tmr_wheel* wheel, unsigned long expires) {
+    unsigned long delta = expires - wheel->current;
+    int level;
+
+    for (level = 0; level < TMR_LEVELS - 1; level++) {
+        if (delta < (unsigned long) level_size(level) << level_shift(level)) {
+            break;
+        }
+    }
+
+    return level_offset(level) + ((expires >> level_shift(level)) & (level_size(level) - 1));
+}
+
+/* Put a timer in the slot where it must wait */
+static void tmr_link(struct tmr_wheel* wheel, int i) {
+    struct tmr_entry* entry = &wheel->entries[i];
+    int slot = tmr_slot(wheel, entry->expires);
+
+    entry->slot = slot;
+    entry->prev = -1;
+    entry->next = wheel->slots[slot];
+    if (entry->next != -1) {
+        wheel->entries[entry->next].prev = i;
+    }
+    wheel->slots[slot] = i;
+    wheel->occupied[slot / 32] |= 1U << (slot % 32);
+}
+
+/* Take a timer out of its slot */
+static void tmr_unlink(struct tmr_wheel* wheel, int i) {
+    struct tmr_entry* entry = &wheel->entries[i];
+
+    if (entry->prev != -1) {
+        wheel->entries[entry->prev].next = entry->next;
+    } else if ((wheel->slots[entry->slot] = entry->next) == -1) {
+        wheel->occupied[entry->slot / 32] &= ~(1U << (entry->slot % 32));
+    }
+    if (entry->next != -1) {
+        wheel->entries[entry->next].prev = entry->prev;
+    }
+    entry->slot = -1;
+}
+
+/* Return a timer to the pool */
+static void tmr_release(struct tmr_wheel* wheel, int i) {
+    struct tmr_entry* entry = &wheel->entries[i];
+
+    entry->generation = (entry->generation + 1) & TMR_GENERATION_MASK;
+    if (entry->generation == 0) {
+        entry->generation = 1;      /* Ids are never 0 */
+    }
+    entry->next = wheel->free;
+    wheel->free = i;
+    wheel->count--;
+}
+
+/* Take a timer from the pool, or return -1 if it is full */
+static int tmr_take(struct tmr_wheel* wheel) {
+    int i;
+
+    if (wheel->free != -1) {
+        i = wheel->free;
+        wheel->free = wheel->entries[i].next;
+    } else if (wheel->used < wheel->size || wheel->size <= (int) (TMR_INDEX_MASK >> 1)) {
+        if (wheel->used == wheel->size) {
+            wheel->size *= 2;
+            if ((wheel->entries = realloc(wheel->entries, wheel->size * sizeof(struct tmr_entry))) == 0) {
+                perror("Out of memory (tmr_take)");
+                exit(EXIT_FAILURE);
+            }
+        }
+        i = wheel->used++;
+        wheel->entries[i].generation = 1;
+    } else {
+        return -1;
+    }
+
+    wheel->count++;
+    return i;
+}
+
+/* Move the timers of the upper slots that start at the current millisecond
+ * to the finer levels. Each level is only moved when the lower one wraps */
+static void tmr_cascade(struct tmr_wheel* wheel) {
+    int level, index, slot, i, next;
+
+    for (level = 1; level < TMR_LEVELS; level++) {
+        index = (wheel->current >> level_shift(level)) & (TMR_LEVEL_SIZE - 1);
+        slot = level_offset(level) + index;
+
+        i = wheel->slots[slot];
+        wheel->slots[slot] = -1;
+        wheel->occupied[slot / 32] &= ~(1U << (slot % 32));
+        while (i != -1) {
+            next = wheel->entries[i].next;
+            tmr_link(wheel, i);
+            i = next;
+        }
+
+        if (index != 0) {
+            break;
+        }
+    }
+}
+
+/* Get the distance from an index to the next slot of a level with timers, or -1 if there are none */
+static int tmr_find(struct tmr_wheel* wheel, int level, int from) {
+    int size = level_size(level), i, slot, found;
+    unsigned int bits;
+
+    /* Levels are aligned to the words of the bitmap */
+    for (i = 0; i < size; i += 32 - slot % 32) {
+        slot = level_offset(level) + ((from + i) & (size - 1));
+        if ((bits = wheel->occupied[slot / 32] >> (slot % 32)) != 0) {
+            found = i + __builtin_ctz(bits);
+            return found < size ? found : -1;
+        }
+    }
+
+    return -1;
+}
+
+
+/* *************** */
+/* Timer functions */
+/* *************** */
+
+unsigned long tmr_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+struct tmr_wheel* tmr_create(unsigned long now) {
+    struct tmr_wheel* wheel;
+    int i;
+
+    if ((wheel = malloc(sizeof(struct tmr_wheel))) == 0) {
+        perror("Out of memory (tmr_create)");
+        exit(EXIT_FAILURE);
+    }
+
+    wheel->size = 64;
+    if ((wheel->entries = malloc(wheel->size * sizeof(struct tmr_entry))) == 0) {
+        perror("Out of memory (tmr_create: entries)");
+        exit(EXIT_FAILURE);
+    }
+
+    wheel->current = now;
+    wheel->cascaded = now - 1;
+    wheel->used = 0;
+    wheel->free = -1;
+    wheel->count = 0;
+    for (i = 0; i < TMR_SLOTS; i++) {
+        wheel->slots[i] = -1;
+    }
+    for (i = 0; i < TMR_SLOTS / 32; i++) {
+        wheel->occupied[i] = 0;
+    }
+    pthread_mutex_init(&wheel->lock, NULL);
+
+    return wheel;
+}
+
+void tmr_destroy(struct tmr_wheel* wheel) {
+    pthread_mutex_destroy(&wheel->lock);
+    free(wheel->entries);
+    free(wheel);
+}
+
+unsigned long tmr_add(struct tmr_wheel* wheel, unsigned long now, unsigned long delay, unsigned long period,
+        tmr_callback callback, void* data) {
+    struct tmr_entry* entry;
+    unsigned long id;
+    int i;
+
+    pthread_mutex_lock(&wheel->lock);
+    if ((i = tmr_take(wheel)) == -1) {
+        pthread_mutex_unlock(&wheel->lock);
+        debug(("timer: There are too many pending timers\n"));
+        return 0;
+    }
+
+    entry = &wheel->entries[i];
+    entry->expires = now + (delay < TMR_MAX_DELAY ? delay : TMR_MAX_DELAY);
+    entry->period = period < TMR_MAX_DELAY ? period : TMR_MAX_DELAY;
+    entry->callback = callback;
+    entry->data = data;
+
+    /* The wheel may have already processed the current millisecond */
+    if ((long) (entry->expires - wheel->current) < 0) {
+        entry->expires = wheel->current;
+    }
+
+    tmr_link(wheel, i);
+    id = entry->generation << TMR_INDEX_BITS | i;
+    pthread_mutex_unlock(&wheel->lock);
+
+    return id;
+}
+
+int tmr_cancel(struct tmr_wheel* wheel, unsigned long id) {
+    int i = id & TMR_INDEX_MASK, canceled = 0;
+
+    pthread_mutex_lock(&wheel->lock);
+    if (i < wheel->used && wheel->entries[i].slot != -1 && wheel->entries[i].generation == id >> TMR_INDEX_BITS) {
+        tmr_unlink(wheel, i);
+        tmr_release(wheel, i);
+        canceled = 1;
+    }
+    pthread_mutex_unlock(&wheel->lock);
+
+    return canceled;
+}
+
+int tmr_count(struct tmr_wheel* wheel) {
+    int count;
+
+    pthread_mutex_lock(&wheel->lock);
+    count = wheel->count;
+    pthread_mutex_unlock(&wheel->lock);
+
+    return count;
+}
+
+int tmr_next(struct tmr_wheel* wheel, unsigned long now) {
+    unsigned long base, next = 0, start;
+    long wait = -1;
+    int level, shift, found = 0, distance;
+
+    pthread_mutex_lock(&wheel->lock);
+    if (wheel->count > 0) {
+        /* The wheel has to advance when a timer expires or when its upper slot is moved down */
+        for (level = 0; level < TMR_LEVELS; level++) {
+            shift = level_shift(level);
+            base = (wheel->current + (1UL << shift) - 1) >> shift;
+            if ((distance = tmr_find(wheel, level, base & (level_size(level) - 1))) != -1) {
+                start = (base + distance) << shift;
+                if (!found || start - wheel->current < next - wheel->current) {
+                    next = start;
+                    found = 1;
+                }
+            }
+        }
+
+        wait = (long) (next - now);
+        wait = wait < 0 ? 0 : wait > TMR_MAX_WAIT ? TMR_MAX_WAIT : wait;
+    }
+    pthread_mutex_unlock(&wheel->lock);
+
+    return (int) wait;
+}
+
+int tmr_advance(struct tmr_wheel* wheel, unsigned long now, tmr_runner run) {
+    struct tmr_expired expired[TMR_BATCH];
+    struct tmr_entry* entry;
+    int i, count, total = 0, distance;
+
+    do {
+        count = 0;
+        pthread_mutex_lock(&wheel->lock);
+
+        while (count < TMR_BATCH && (long) (now - wheel->current) >= 0) {
+            if (wheel->count == 0) {
+                wheel->current = now + 1;   /* Nothing to do until the next timer is added */
+                break;
+            }
+
+            if ((wheel->current & (TMR_ROOT_SIZE - 1)) == 0 && wheel->cascaded != wheel->current) {
+                tmr_cascade(wheel);
+                wheel->cascaded = wheel->current;
+            }
+
+            /* All the timers in the slot of the current millisecond expire now */
+            if ((i = wheel->slots[wheel->current & (TMR_ROOT_SIZE - 1)]) != -1) {
+                entry = &wheel->entries[i];
+                tmr_unlink(wheel, i);
+                expired[count].callback = entry->callback;
+                expired[count].data = entry->data;
+                count++;
+
+                if (entry->period > 0) {
+                    /* Periods missed while the wheel was not advanced are skipped */
+                    entry->expires += entry->period;
+                    if ((long) (entry->expires - now) <= 0) {
+                        entry->expires = now + entry->period;
+                    }
+                    tmr_link(wheel, i);
+                } else {
+                    tmr_release(wheel, i);
+                }
+                continue;
+            }
+
+            /* Skip the empty slots up to the next one with timers or the next cascade */
+            distance = tmr_find(wheel, 0, wheel->current & (TMR_ROOT_SIZE - 1));
+            if (distance == -1 || distance > TMR_ROOT_SIZE - (int) (wheel->current & (TMR_ROOT_SIZE - 1))) {
+                distance = TMR_ROOT_SIZE - (wheel->current & (TMR_ROOT_SIZE - 1));
+            }
+            if ((unsigned long) distance > now - wheel->current + 1) {
+                distance = now - wheel->current + 1;
+            }
+            wheel->current += distance;
+        }
+
+        pthread_mutex_unlock(&wheel->lock);
+
+        /* Callbacks run without the lock, so they can add and cancel timers */
+        for (i = 0; i < count; i++) {
+            debug(("timer: Running expired timer\n"));
+            if (run != NULL) {
+                run(expired[i].callback, expired[i].data);
+            } else {
+                expired[i].callback(expired[i].data);
+            }
+        }
+        total += count;
+    } while (count == TMR_BATCH);
+
+    return total;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#define TMR_ROOT_BITS 8         /* The first level of the wheel has a slot per millisecond of the next 256 */
+#define TMR_LEVEL_BITS 6        /* Each of the other levels has 64 slots, each one as long as a whole lower level */
+#define TMR_LEVELS 5            /* Number of levels, which cover the next 2^32 milliseconds (about 49 days) */
+#define TMR_BATCH 64            /* Maximum number of expired timers collected at once */
+
+/* A hierarchical timing wheel. Timers are kept in the slot of the period
+ * where they expire, so adding and canceling them takes constant time, and
+ * they move to finer levels as their time approaches. The wheel can be used
+ * from several threads (defined in timer.c). */
+struct tmr_wheel;
+
+/* Function invoked when a timer expires */
+typedef void (*tmr_callback)(void* data);
+
+/* Function that invokes the callbacks of the expired timers (such as the dispatcher) */
+typedef void (*tmr_runner)(tmr_callback callback, void* data);
+
+unsigned long tmr_now(void);                                    /* Get the current time in milliseconds of the monotonic clock */
+struct tmr_wheel* tmr_create(unsigned long now);                /* Create an empty wheel that starts at the given time */
+void tmr_destroy(struct tmr_wheel* wheel);                      /* Free the wheel and the pending timers (not their data) */
+unsigned long tmr_add(struct tmr_wheel* wheel, unsigned long now, unsigned long delay, unsigned long period,
+        tmr_callback callback, void* data);                     /* Add a timer that expires after delay ms, and then every period ms if not 0. Returns its id */
+int tmr_cancel(struct tmr_wheel* wheel, unsigned long id);      /* Cancel a pending timer. Returns 0 if it had already expired */
+int tmr_count(struct tmr_wheel* wheel);                         /* Get the number of pending timers */
+int tmr_next(struct tmr_wheel* wheel, unsigned long now);       /* Get the milliseconds until the wheel must advance again (-1 if there are no timers) */
+int tmr_advance(struct tmr_wheel* wheel, unsigned long now, tmr_runner run);    /* Run the timers expired until now (run can be NULL). Returns how many expired */
+
+#endif
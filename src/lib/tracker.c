@@ -0,0 +1,677 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L      /* Support read-write locks */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "debug.h"
+#include "codes.h"
+#include "events.h"
+#include "hashtable.h"
+#include "casemap.h"
+#include "intern.h"
+#include "tracker.h"
+
+
+/* A user seen in some of the joined channels. Each nick is stored once */
+struct trk_user {
+    const char* nick;               /* The current nick of the user (interned) */
+    struct trk_member* channels;    /* The memberships of the user */
+    int num_channels;               /* Number of channels of the user */
+};
+
+/* A joined channel */
+struct trk_channel {
+    const char* name;               /* The name of the channel (interned) */
+    struct trk_member* members;     /* The memberships of the channel */
+    int num_members;                /* Number of users in the channel */
+    struct msk_set* bans;           /* The ban masks, from MODE +b and RPL_BANLIST (NULL until there is one) */
+};
+
+/* A user in a channel. It is linked both from the channel and from the
+ * user, so a user can leave all channels without looking them up */
+struct trk_member {
+    struct trk_user* user;
+    struct trk_channel* channel;
+    struct trk_member* prev_member, *next_member;     /* The other members of the channel */
+    struct trk_member* prev_channel, *next_channel;   /* The other channels of the user */
+    unsigned short modes;           /* The membership modes of the user, by their position in PREFIX */
+};
+
+struct trk_table {
+    struct isp_table* isp;          /* The features of the server, to parse nick prefixes and modes */
+    struct ht_table* users;         /* The users, by their case folded nick */
+    struct ht_table* channels;      /* The channels, by their case folded name */
+    struct trk_user* me;            /* The user of the connection, once the server has welcomed it */
+    pthread_rwlock_t lock;          /* Callbacks read the state while the listener updates it */
+};
+
+
+/* ************* */
+/* State helpers */
+/* ************* */
+
+/* Fold the case of a nick or channel name as the server does, to use it as a key */
+static char* trk_key(struct trk_table* trk, char* key, const char* name) {
+    return cm_fold(key, name, TRK_NAME_SIZE, trk->isp->casemapping);
+}
+
+/* Get the interned key of an interned nick or channel name */
+static const char* trk_str_key(struct trk_table* trk, const char* name) {
+    return str_fold(name, trk->isp->casemapping);
+}
+
+/* Copy the nick of a message prefix or a name list entry (nick!user@host) */
+static char* trk_nick(char* nick, const char* prefix) {
+    int i;
+
+    for (i = 0; prefix[i] != '\0' && strchr("!@ ", prefix[i]) == NULL && i < TRK_NAME_SIZE - 1; i++) {
+        nick[i] = prefix[i];
+    }
+    nick[i] = '\0';
+
+    return nick;
+}
+
+/* Get the bit of a membership mode, or 0 if the server does not define it */
+static unsigned short trk_mode_bit(struct trk_table* trk, char mode) {
+    char* pos = mode != '\0' ? strchr(trk->isp->prefix, mode) : NULL;
+    return pos != NULL ? 1 << (pos - trk->isp->prefix) : 0;
+}
+
+/* Write the letters of the membership modes, from the highest privilege */
+static char* trk_mode_letters(struct trk_table* trk, char* letters, unsigned short modes) {
+    int i, len = 0;
+
+    for (i = 0; trk->isp->prefix[i] != '\0'; i++) {
+        if (modes & (1 << i)) {
+            letters[len++] = trk->isp->prefix[i];
+        }
+    }
+    letters[len] = '\0';
+
+    return letters;
+}
+
+static struct trk_user* find_user(struct trk_table* trk, const char* nick) {
+    char key[TRK_NAME_SIZE];
+    struct ht_data* data = ht_find(trk->users, trk_key(trk, key, nick));
+    return data != NULL ? data->value : NULL;
+}
+
+static struct trk_channel* find_channel(struct trk_table* trk, const char* name) {
+    char key[TRK_NAME_SIZE];
+    struct ht_data* data = ht_find(trk->channels, trk_key(trk, key, name));
+    return data != NULL ? data->value : NULL;
+}
+
+static struct trk_member* find_member(struct trk_user* user, struct trk_channel* channel) {
+    struct trk_member* member;
+
+    for (member = user->channels; member != NULL; member = member->next_channel) {
+        if (member->channel == channel) {
+            return member;
+        }
+    }
+
+    return NULL;
+}
+
+/* Find a user, or start tracking it */
+static struct trk_user* add_user(struct trk_table* trk, const char* nick) {
+    struct trk_user* user;
+
+    if ((user = find_user(trk, nick)) != NULL) {
+        return user;
+    }
+
+    if ((user = malloc(sizeof(struct trk_user))) == NULL) {
+        perror("Out of memory (add_user)");
+        exit(EXIT_FAILURE);
+    }
+
+    user->nick = str_intern(nick);
+    user->channels = NULL;
+    user->num_channels = 0;
+    ht_add_str(trk->users, trk_str_key(trk, user->nick), user);
+
+    return user;
+}
+
+/* Find a channel, or start tracking it */
+static struct trk_channel* add_channel(struct trk_table* trk, const char* name) {
+    struct trk_channel* channel;
+
+    if ((channel = find_channel(trk, name)) != NULL) {
+        return channel;
+    }
+
+    if ((channel = malloc(sizeof(struct trk_channel))) == NULL) {
+        perror("Out of memory (add_channel)");
+        exit(EXIT_FAILURE);
+    }
+
+    channel->name = str_intern(name);
+    channel->members = NULL;
+    channel->num_members = 0;
+    channel->bans = NULL;
+    ht_add_str(trk->channels, trk_str_key(trk, channel->name), channel);
+
+    debug(("tracker: Tracking %s\n", name));
+
+    return channel;
+}
+
+/* Add a user to a channel, if it is not there yet */
+static struct trk_member* add_member(struct trk_user* user, struct trk_channel* channel) {
+    struct trk_member* member;
+
+    if ((member = find_member(user, channel)) != NULL) {
+        return member;
+    }
+
+    if ((member = malloc(sizeof(struct trk_member))) == NULL) {
+        perror("Out of memory (add_member)");
+        exit(EXIT_FAILURE);
+    }
+
+    member->user = user;
+    member->channel = channel;
+    member->modes = 0;
+
+    member->prev_member = NULL;
+    member->next_member = channel->members;
+    if (channel->members != NULL) {
+        channel->members->prev_member = member;
+    }
+    channel->members = member;
+    channel->num_members++;
+
+    member->prev_channel = NULL;
+    member->next_channel = user->channels;
+    if (user->channels != NULL) {
+        user->channels->prev_channel = member;
+    }
+    user->channels = member;
+    user->num_channels++;
+
+    return member;
+}
+
+/* Unlink a user from a channel. Empty users and channels are released by the caller */
+static void del_member(struct trk_member* member) {
+    if (member->prev_member != NULL) {
+        member->prev_member->next_member = member->next_member;
+    } else {
+        member->channel->members = member->next_member;
+    }
+    if (member->next_member != NULL) {
+        member->next_member->prev_member = member->prev_member;
+    }
+    member->channel->num_members--;
+
+    if (member->prev_channel != NULL) {
+        member->prev_channel->next_channel = member->next_channel;
+    } else {
+        member->user->channels = member->next_channel;
+    }
+    if (member->next_channel != NULL) {
+        member->next_channel->prev_channel = member->prev_channel;
+    }
+    member->user->num_channels--;
+
+    free(member);
+}
+
+/* Stop tracking a user that is not in any joined channel */
+static void release_user(struct trk_table* trk, struct trk_user* user) {
+
+    if (user->num_channels == 0 && user != trk->me) {
+        ht_del(trk->users, (char*) trk_str_key(trk, user->nick));
+        str_release(user->nick);
+        free(user);
+    }
+}
+
+/* Stop tracking a channel and its members */
+static void drop_channel(struct trk_table* trk, struct trk_channel* channel) {
+    struct trk_user* user;
+
+    debug(("tracker: Forgetting %s\n", channel->name));
+
+    while (channel->members != NULL) {
+        user = channel->members->user;
+        del_member(channel->members);
+        release_user(trk, user);
+    }
+
+    ht_del(trk->channels, (char*) trk_str_key(trk, channel->name));
+    if (channel->bans != NULL) {
+        msk_destroy(channel->bans);
+    }
+    str_release(channel->name);
+    free(channel);
+}
+
+/* Remove a user from a channel. If it is the user of the connection, forget the channel */
+static void leave(struct trk_table* trk, const char* name, const char* nick) {
+    struct trk_channel* channel = find_channel(trk, name);
+    struct trk_user* user = find_user(trk, nick);
+    struct trk_member* member;
+
+    if (channel == NULL || user == NULL) {
+        return;
+    }
+
+    if (user == trk->me) {
+        drop_channel(trk, channel);
+    } else if ((member = find_member(user, channel)) != NULL) {
+        del_member(member);
+        release_user(trk, user);
+        if (channel->num_members == 0) {
+            drop_channel(trk, channel);
+        }
+    }
+}
+
+/* Remove a user from all channels */
+static void quit(struct trk_table* trk, const char* nick) {
+    struct trk_user* user = find_user(trk, nick);
+    struct trk_channel* channel;
+
+    if (user == NULL) {
+        return;
+    }
+
+    while (user->channels != NULL) {
+        channel = user->channels->channel;
+        del_member(user->channels);
+        if (channel->num_members == 0) {
+            drop_channel(trk, channel);
+        }
+    }
+
+    release_user(trk, user);
+}
+
+/* Change the nick of a user, keeping its channels */
+static void rename_user(struct trk_table* trk, const char* nick, const char* new_nick) {
+    struct trk_user* user = find_user(trk, nick);
+
+    if (user == NULL) {
+        return;
+    }
+
+    ht_del(trk->users, (char*) trk_str_key(trk, user->nick));
+    str_release(user->nick);
+    user->nick = str_intern(new_nick);
+    ht_add_str(trk->users, trk_str_key(trk, user->nick), user);
+}
+
+/* Add the users of a RPL_NAMREPLY, with their membership prefixes (such as "@+nick") */
+static void add_names(struct trk_table* trk, const char* name, const char* list) {
+    struct trk_channel* channel = find_channel(trk, name);
+    struct trk_member* member;
+    char nick[TRK_NAME_SIZE];
+    unsigned short modes;
+
+    /* Only the joined channels are tracked */
+    if (channel == NULL) {
+        return;
+    }
+
+    while (*list != '\0') {
+        for (modes = 0; *list != '\0' && isp_prefix_mode(trk->isp, *list) != '\0'; list++) {
+            modes |= trk_mode_bit(trk, isp_prefix_mode(trk->isp, *list));
+        }
+
+        if (*trk_nick(nick, list) != '\0') {
+            member = add_member(add_user(trk, nick), channel);
+            member->modes = modes;
+        }
+
+        while (*list != '\0' && *list != ' ') {
+            list++;
+        }
+        while (*list == ' ') {
+            list++;
+        }
+    }
+}
+
+/* Add a ban to a channel. Most channels have none, so the set is created with the first one */
+static void add_ban(struct trk_table* trk, struct trk_channel* channel, const char* mask) {
+    if (channel->bans == NULL) {
+        channel->bans = msk_create(trk->isp->casemapping);
+    }
+    msk_add(channel->bans, mask, NULL);
+}
+
+/* Apply the membership modes and the bans of a channel MODE message */
+static void apply_modes(struct trk_table* trk, struct raw_event* raw) {
+    struct trk_channel* channel = find_channel(trk, raw->params[0]);
+    struct trk_user* user;
+    struct trk_member* member;
+    char* flags = raw->params[1], op = '+';
+    int next = 2;
+
+    if (channel == NULL) {
+        return;
+    }
+
+    for (; *flags != '\0'; flags++) {
+        if (*flags == '+' || *flags == '-') {
+            op = *flags;
+            continue;
+        }
+
+        switch (isp_mode_type(trk->isp, *flags)) {
+            case ISP_MODE_PREFIX:
+                if (next < raw->num_params && (user = find_user(trk, raw->params[next])) != NULL
+                        && (member = find_member(user, channel)) != NULL) {
+                    if (op == '+') {
+                        member->modes |= trk_mode_bit(trk, *flags);
+                    } else {
+                        member->modes &= ~trk_mode_bit(trk, *flags);
+                    }
+                }
+                next++;
+                break;
+            case ISP_MODE_LIST:
+                if (*flags == 'b' && next < raw->num_params) {
+                    if (op == '+') {
+                        add_ban(trk, channel, raw->params[next]);
+                    } else if (channel->bans != NULL) {
+                        msk_del(channel->bans, raw->params[next]);
+                    }
+                }
+                next++;
+                break;
+            case ISP_MODE_PARAM:
+                next++;
+                break;
+            case ISP_MODE_PARAM_SET:
+                next += op == '+';
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/* Free all channels, users and memberships. The tables must be created again to reuse the state */
+static void trk_free(struct trk_table* trk) {
+    int i;
+
+    for (i = 0; i < trk->channels->size; i++) {
+        if (trk->channels->entries[i].hash != 0) {
+            struct trk_channel* channel = trk->channels->entries[i].data.value;
+            while (channel->members != NULL) {
+                del_member(channel->members);
+            }
+            if (channel->bans != NULL) {
+                msk_destroy(channel->bans);
+            }
+            str_release(channel->name);
+            free(channel);
+        }
+    }
+
+    for (i = 0; i < trk->users->size; i++) {
+        if (trk->users->entries[i].hash != 0) {
+            struct trk_user* user = trk->users->entries[i].data.value;
+            str_release(user->nick);
+            free(user);
+        }
+    }
+
+    ht_destroy(trk->channels);
+    ht_destroy(trk->users);
+}
+
+/* Forget all channels and users */
+static void trk_reset(struct trk_table* trk) {
+    trk_free(trk);
+    trk->users = ht_create();
+    trk->channels = ht_create();
+    trk->me = NULL;
+}
+
+
+/* ******************** */
+/* Tracker construction */
+/* ******************** */
+
+struct trk_table* trk_create(struct isp_table* isp) {
+    struct trk_table* trk;
+
+    if ((trk = malloc(sizeof(struct trk_table))) == NULL) {
+        perror("Out of memory (trk_create)");
+        exit(EXIT_FAILURE);
+    }
+
+    trk->isp = isp;
+    trk->users = ht_create();
+    trk->channels = ht_create();
+    trk->me = NULL;
+    pthread_rwlock_init(&trk->lock, NULL);
+
+    return trk;
+}
+
+void trk_destroy(struct trk_table* trk) {
+    trk_free(trk);
+    pthread_rwlock_destroy(&trk->lock);
+    free(trk);
+}
+
+void trk_clear(struct trk_table* trk) {
+    pthread_rwlock_wrlock(&trk->lock);
+    trk_reset(trk);
+    isp_init(trk->isp);     /* The next server may advertise other features */
+    pthread_rwlock_unlock(&trk->lock);
+}
+
+/* The features change under the write lock, so the queries never see a
+ * half parsed table. Channels and bans already tracked keep their keys */
+void trk_features(struct trk_table* trk, int num_tokens, char** tokens) {
+    pthread_rwlock_wrlock(&trk->lock);
+    isp_parse(trk->isp, num_tokens, tokens);
+    pthread_rwlock_unlock(&trk->lock);
+}
+
+void trk_update(struct trk_table* trk, struct raw_event* raw) {
+    char nick[TRK_NAME_SIZE];
+    struct trk_channel* channel;
+    struct trk_user* me;
+    int cmd = raw->cmd;
+
+    /* Most messages do not change the state. Do not lock for them */
+    if (cmd != CMD_JOIN && cmd != CMD_PART && cmd != CMD_KICK && cmd != CMD_QUIT && cmd != CMD_NICK
+            && cmd != CMD_MODE && cmd != atoi(RPL_NAMREPLY) && cmd != atoi(RPL_BANLIST) && cmd != atoi(RPL_WELCOME)) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&trk->lock);
+
+    if (cmd == atoi(RPL_WELCOME) && raw->num_params > 0) {
+        if ((me = trk->me) != NULL) {
+            trk->me = NULL;
+            release_user(trk, me);
+        }
+        trk->me = add_user(trk, raw->params[0]);
+    } else if (cmd == atoi(RPL_NAMREPLY) && raw->num_params > 3) {
+        add_names(trk, raw->params[2], raw->params[3]);
+    } else if (cmd == atoi(RPL_BANLIST) && raw->num_params > 2) {
+        if ((channel = find_channel(trk, raw->params[1])) != NULL) {
+            add_ban(trk, channel, raw->params[2]);     /* Bans set later arrive as MODE +b */
+        }
+    } else if (cmd == CMD_MODE && raw->num_params > 1) {
+        apply_modes(trk, raw);
+    } else if (cmd == CMD_KICK && raw->num_params > 1) {
+        leave(trk, raw->params[0], raw->params[1]);
+    } else if (cmd == CMD_QUIT && raw->prefix != NULL) {
+        trk_nick(nick, raw->prefix);    /* The quit message is optional */
+        if (trk->me != NULL && find_user(trk, nick) == trk->me) {
+            trk_reset(trk);     /* The connection is closing */
+        } else {
+            quit(trk, nick);
+        }
+    } else if (raw->prefix != NULL && raw->num_params > 0) {
+        trk_nick(nick, raw->prefix);
+        if (cmd == CMD_JOIN) {
+            add_member(add_user(trk, nick), add_channel(trk, raw->params[0]));
+        } else if (cmd == CMD_PART) {
+            leave(trk, raw->params[0], nick);
+        } else if (cmd == CMD_NICK) {
+            rename_user(trk, nick, raw->params[0]);
+        }
+    }
+
+    pthread_rwlock_unlock(&trk->lock);
+}
+
+
+/* *************** */
+/* Tracker queries */
+/* *************** */
+
+const char* trk_me(struct trk_table* trk) {
+    const char* nick;
+
+    pthread_rwlock_rdlock(&trk->lock);
+    nick = trk->me != NULL ? str_retain(trk->me->nick) : NULL;
+    pthread_rwlock_unlock(&trk->lock);
+
+    return nick;
+}
+
+int trk_is_member(struct trk_table* trk, const char* channel, const char* nick) {
+    struct trk_channel* found_channel;
+    struct trk_user* user;
+    int member;
+
+    pthread_rwlock_rdlock(&trk->lock);
+    member = (user = find_user(trk, nick)) != NULL && (found_channel = find_channel(trk, channel)) != NULL
+        && find_member(user, found_channel) != NULL;
+    pthread_rwlock_unlock(&trk->lock);
+
+    return member;
+}
+
+int trk_has_mode(struct trk_table* trk, const char* channel, const char* nick, char mode) {
+    struct trk_channel* found_channel;
+    struct trk_member* member = NULL;
+    struct trk_user* user;
+    int has_mode;
+
+    pthread_rwlock_rdlock(&trk->lock);
+    if ((user = find_user(trk, nick)) != NULL && (found_channel = find_channel(trk, channel)) != NULL) {
+        member = find_member(user, found_channel);
+    }
+    has_mode = member != NULL && (member->modes & trk_mode_bit(trk, mode)) != 0;
+    pthread_rwlock_unlock(&trk->lock);
+
+    return has_mode;
+}
+
+int trk_num_members(struct trk_table* trk, const char* channel) {
+    struct trk_channel* found;
+    int num_members;
+
+    pthread_rwlock_rdlock(&trk->lock);
+    num_members = (found = find_channel(trk, channel)) != NULL ? found->num_members : -1;
+    pthread_rwlock_unlock(&trk->lock);
+
+    return num_members;
+}
+
+int trk_num_channels(struct trk_table* trk, const char* nick) {
+    struct trk_user* user;
+    int num_channels;
+
+    pthread_rwlock_rdlock(&trk->lock);
+    num_channels = (user = find_user(trk, nick)) != NULL ? user->num_channels : 0;
+    pthread_rwlock_unlock(&trk->lock);
+
+    return num_channels;
+}
+
+void trk_members(struct trk_table* trk, const char* channel, trk_visitor visit, void* data) {
+    char letters[ISP_PREFIX_SIZE];
+    struct trk_channel* found;
+    struct trk_member* member;
+
+    pthread_rwlock_rdlock(&trk->lock);
+    if ((found = find_channel(trk, channel)) != NULL) {
+        for (member = found->members; member != NULL; member = member->next_member) {
+            visit(member->user->nick, trk_mode_letters(trk, letters, member->modes), data);
+        }
+    }
+    pthread_rwlock_unlock(&trk->lock);
+}
+
+void trk_channels(struct trk_table* trk, const char* nick, trk_visitor visit, void* data) {
+    char letters[ISP_PREFIX_SIZE];
+    struct trk_member* member;
+    struct trk_user* user;
+
+    pthread_rwlock_rdlock(&trk->lock);
+    if ((user = find_user(trk, nick)) != NULL) {
+        for (member = user->channels; member != NULL; member = member->next_channel) {
+            visit(member->channel->name, trk_mode_letters(trk, letters, member->modes), data);
+        }
+    }
+    pthread_rwlock_unlock(&trk->lock);
+}
+
+void trk_isupport(struct trk_table* trk, struct isp_table* copy) {
+    pthread_rwlock_rdlock(&trk->lock);
+    memcpy(copy, trk->isp, sizeof(struct isp_table));
+    pthread_rwlock_unlock(&trk->lock);
+}
+
+int trk_is_channel(struct trk_table* trk, const char* name) {
+    int is_channel;
+
+    pthread_rwlock_rdlock(&trk->lock);
+    is_channel = isp_is_channel(trk->isp, name);
+    pthread_rwlock_unlock(&trk->lock);
+
+    return is_channel;
+}
+
+int trk_bans(struct trk_table* trk, const char* channel, const char* prefix, msk_visitor visit, void* data) {
+    struct trk_channel* found;
+    int count = 0;
+
+    pthread_rwlock_rdlock(&trk->lock);
+    if ((found = find_channel(trk, channel)) != NULL && found->bans != NULL) {
+        count = msk_match(found->bans, prefix, visit, data);
+    }
+    pthread_rwlock_unlock(&trk->lock);
+
+    return count;
+}
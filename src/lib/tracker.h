@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __TRACKER_H__
+#define __TRACKER_H__
+
+#include "isupport.h"
+#include "mask.h"
+
+#define TRK_NAME_SIZE 256       /* Longest nick or channel name used to look up the state */
+
+struct raw_event;
+
+/* The channels joined in a connection and the users in them (defined in tracker.c) */
+struct trk_table;
+
+/* Callback invoked for each channel or member. Modes are the membership mode letters (such as "ov") */
+typedef void (*trk_visitor)(const char* name, const char* modes, void* data);
+
+struct trk_table* trk_create(struct isp_table* isp);            /* Create an empty state that parses prefixes and modes with the given server features (guarded by its lock from then on) */
+void trk_destroy(struct trk_table* trk);                        /* Free the state */
+void trk_clear(struct trk_table* trk);                          /* Forget all channels and users, and reset the server features */
+void trk_update(struct trk_table* trk, struct raw_event* raw);  /* Update the state with a received message */
+void trk_features(struct trk_table* trk, int num_tokens, char** tokens);    /* Update the server features with the tokens of a RPL_ISUPPORT reply */
+
+void trk_isupport(struct trk_table* trk, struct isp_table* copy);   /* Copy the server features */
+int trk_is_channel(struct trk_table* trk, const char* name);        /* Check if a name is a channel with the server features */
+
+const char* trk_me(struct trk_table* trk);                      /* Get the nick of the connection (interned, to release with str_release), or NULL before the welcome */
+int trk_is_member(struct trk_table* trk, const char* channel, const char* nick);               /* Check if a user is in a channel */
+int trk_has_mode(struct trk_table* trk, const char* channel, const char* nick, char mode);     /* Check if a user has a membership mode (such as 'o') in a channel */
+int trk_num_members(struct trk_table* trk, const char* channel);        /* Get the number of users in a channel (-1 if not joined) */
+int trk_num_channels(struct trk_table* trk, const char* nick);          /* Get the number of joined channels where the user is */
+void trk_members(struct trk_table* trk, const char* channel, trk_visitor visit, void* data);  /* Visit the users in a channel */
+void trk_channels(struct trk_table* trk, const char* nick, trk_visitor visit, void* data);   /* Visit the joined channels where the user is */
+int trk_bans(struct trk_table* trk, const char* channel, const char* prefix, msk_visitor visit, void* data);  /* Visit the bans of a channel matching a prefix (nick!user@host). Returns how many matched */
+
+#endif
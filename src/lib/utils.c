@@ -20,43 +20,32 @@
  * THE SOFTWARE.
  */
 
-#define _POSIX_C_SOURCE 200112L      /* Use snprintf */
-
-#include <stdio.h>
 #include <string.h>
-#include <ctype.h>
 #include "irc.h"
+#include "casemap.h"
 
 /* ************************ */
 /* String utility functions */
 /* ************************ */
 
+/* IRC commands are ASCII, so the locale is not used */
+
 void upper(char* str) {
-    int i;
     if (str != NULL) {
-        for (i = 0; i < strlen(str); i++) {
-            str[i] = toupper(str[i]);
+        for (; *str != '\0'; str++) {
+            if (*str >= 'a' && *str <= 'z') {
+                *str -= 'a' - 'A';
+            }
         }
     }
 }
 
 void lower(char* str) {
-    int i;
     if (str != NULL) {
-        for (i = 0; i < strlen(str); i++) {
-            str[i] = tolower(str[i]);
-        }
+        cm_fold(str, str, strlen(str) + 1, ISP_ASCII);
     }
 }
 
-/* ************************* */
-/* Binding utility functions */
-/* ************************* */
-
-void build_command_key(char* key, char* command) {
-    snprintf(key, 50, "%s#%s", PRIVMSG, command);
-}
-
 /* ********************* */
 /* IRC utility functions */
 /* ********************* */
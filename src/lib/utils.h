@@ -30,9 +30,6 @@
 void upper(char* str);      /* Modify the given string and make it upper case */
 void lower(char* str);      /* Modify the given string and make it lower case */
 
-/* Binding utils */
-void build_command_key(char* key, char* command);   /* Build the binding key for a command binding */
-
 /* IRC utils */
 void append_channel_flags(char* str, unsigned short int flags);     /* Append given flags to the given string */
 void append_user_flags(char* str, unsigned short int flags);        /* Append the flags to the given string */
@@ -24,48 +24,95 @@
  * Circus benchmark tool.
  */
 
+#define _POSIX_C_SOURCE 200112L      /* Use fdopen, clock_gettime and sched_yield */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/socket.h>
 #include <poll.h>
 #include "../lib/binding.h"
+#include "../lib/casemap.h"
 #include "../lib/events.h"
+#include "../lib/hashtable.h"
+#include "../lib/irc.h"
 #include "../lib/codes.h"
 #include "../lib/dispatcher.h"
 #include "../lib/listener.h"
+#include "../lib/mask.h"
+#include "../lib/network.h"
+#include "../lib/queue.h"
+#include "../lib/router.h"
+#include "../lib/timer.h"
+#include "../lib/tracker.h"
+#include "../lib/utils.h"
+
+#define BNCHK_LINE ":nick!~user@server PRIVMSG #test :This is a benchmark message\r\n"
+#define BNCHK_WORD "lorem "     /* Word used to build long messages */
+#define BNCHK_REPLY "PRIVMSG #test :This is a benchmark reply"
+#define BNCHK_BURST 50          /* Lines sent by each callback in the send benchmark */
 
 long int evt_total = 0;
 double avg_sec = 0.0;
 
+/* Elapsed time in microseconds */
+static long int elapsed(struct timeval* start, struct timeval* end) {
+    return (end->tv_sec - start->tv_sec) * 1000000 + ((int) end->tv_usec - (int) start->tv_usec);
+}
+
+/* Redirect the standard output to /dev/null and return the original one */
+static int disable_stdout() {
+    int original, quiet;
+    fflush(stdout);
+    original = dup(1);
+    quiet = open("/dev/null", O_WRONLY);
+    dup2(quiet, 1);
+    close(quiet);
+    return original;
+}
+
+/* Restore the standard output */
+static void enable_stdout(int original) {
+    fflush(stdout);
+    dup2(original, 1);
+    close(original);
+}
+
+
+/* ****************** */
+/* Dispatch benchmark */
+/* ****************** */
+
 void on_event(GenericEvent* event) {
     struct timeval current_time;
     long int avg;
     gettimeofday(&current_time, NULL);
-    avg = (current_time.tv_sec - event->timestamp->tv_sec) * 1000000 + ((int) current_time.tv_usec - (int) event->timestamp->tv_usec);
+    avg = elapsed(event->timestamp, &current_time);
     avg_sec = (avg_sec > 0 ? (avg_sec + avg) / (double) 2 : avg) / 1000000;
     evt_total++;
 }
 
-int main(int argc, char **argv) {
-    long int i, evt_max, el_usec;
+static void bnchk_dispatch(long int evt_max) {
+    long int i, el_usec;
     struct timeval start, end;
 
-    if (argc != 2) {
-        printf("Usage: %s <num_events>\n", argv[0]);
-        exit(EXIT_FAILURE);
-    }
-
-    evt_max = strtol(argv[1], NULL, 0);
-
     bnd_bind(ALL, (Callback) on_event);
-    dsp_start();
+    dsp_start(DSP_WORKERS);
 
-    printf("Starting benchmark with %ld events\n", evt_max);
+    printf("Starting dispatch benchmark with %ld events\n", evt_max);
     gettimeofday(&start, NULL);
 
     for (i = 0; i < evt_max; i++) {
         char event[100] = ":nick!~user@server MODE #test +inm\r\n";
-        lst_handle(event);
+        lst_handle(NULL, event);
     }
 
     while (evt_total < evt_max) {
@@ -73,15 +120,1235 @@ int main(int argc, char **argv) {
     }
 
     gettimeofday(&end, NULL);
-    el_usec = (end.tv_sec - start.tv_sec) * 1000000 + ((int) end.tv_usec - (int) start.tv_usec);
-    
+    el_usec = elapsed(&start, &end);
+
     dsp_shutdown();
     bnd_destroy();
 
     printf("  Run time (secs): %f\n",  el_usec / (double) 1000000);
     printf("  Processed events: %ld\n", evt_total);
     printf("  Process time per event (secs): %f\n", avg_sec);
+}
 
-    return 0;
+
+/* ***************** */
+/* Network benchmark */
+/* ***************** */
+
+/* Arguments for the thread that writes to the socket */
+struct net_writer_args {
+    int socket;         /* The socket to write to */
+    long int lines;     /* The number of lines to write */
+};
+
+/* Get the number of read syscalls performed by the process (Linux only) */
+static long int read_syscalls() {
+    FILE* f;
+    char line[64];
+    long int count = -1;
+
+    if ((f = fopen("/proc/self/io", "r")) != NULL) {
+        while (fgets(line, 64, f) != NULL) {
+            if (sscanf(line, "syscr: %ld", &count) == 1) {
+                break;
+            }
+        }
+        fclose(f);
+    }
+
+    return count;
+}
+
+/* Write the benchmark lines to the socket in large chunks, as an IRC server would */
+static void* net_writer(void* arg) {
+    struct net_writer_args* args = (struct net_writer_args*) arg;
+    char chunk[8192];
+    long int i, lines_per_chunk, remaining = args->lines;
+    size_t line_len = strlen(BNCHK_LINE);
+
+    lines_per_chunk = sizeof(chunk) / line_len;
+    for (i = 0; i < lines_per_chunk; i++) {
+        memcpy(chunk + i * line_len, BNCHK_LINE, line_len);
+    }
+
+    while (remaining > 0) {
+        long int count = remaining < lines_per_chunk? remaining : lines_per_chunk;
+        if (send(args->socket, chunk, count * line_len, 0) == -1) {
+            perror("send error");
+            exit(EXIT_FAILURE);
+        }
+        remaining -= count;
+    }
+
+    pthread_exit(NULL);
+}
+
+/* Read the given number of lines using the previous unbuffered stdio reader */
+static void net_read_stdio(int socket, long int lines) {
+    char msg[READ_BUF];
+    long int i;
+    FILE* in = fdopen(socket, "r");
+
+    setvbuf(in, NULL, _IONBF, 0);
+    for (i = 0; i < lines; i++) {
+        if (fgets(msg, READ_BUF, in) == NULL) {
+            perror("fgets error");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Read the given number of lines using the network module */
+static void net_read_ring(int socket, long int lines) {
+    char msg[READ_BUF];
+    long int count = 0;
+    struct net_conn* conn = net_attach(dup(socket));   /* The caller closes the original socket */
+    struct net_conn* ready[NET_EVENTS];
+    int num_ready;
+
+    while (count < lines) {
+        if (net_listen(ready, &num_ready, -1) == NET_READY) {
+            do {
+                count += net_recv(conn, msg);
+            } while (net_pending(conn) && count < lines);
+        }
+    }
+
+    net_free(conn);
+}
+
+static void bnchk_network_run(char* name, void (*reader)(int, long int), long int lines) {
+    int socks[2], _stdout;
+    long int syscalls, el_usec;
+    struct timeval start, end;
+    struct net_writer_args args;
+    pthread_t writer;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    args.socket = socks[0];
+    args.lines = lines;
+
+    _stdout = disable_stdout();     /* The network module logs every received line */
+    syscalls = read_syscalls();
+    gettimeofday(&start, NULL);
+
+    pthread_create(&writer, NULL, net_writer, &args);
+    reader(socks[1], lines);
+    pthread_join(writer, NULL);
+
+    gettimeofday(&end, NULL);
+    syscalls = read_syscalls() - syscalls;
+    enable_stdout(_stdout);
+
+    close(socks[0]);
+    close(socks[1]);
+
+    el_usec = elapsed(&start, &end);
+    printf("  %s reader\n", name);
+    printf("    Run time (secs): %f\n",  el_usec / (double) 1000000);
+    printf("    Lines per second: %.0f\n", lines / (el_usec / (double) 1000000));
+    if (syscalls >= 0) {
+        printf("    Read syscalls per line: %f\n", syscalls / (double) lines);
+    } else {
+        printf("    Read syscalls per line: n/a\n");
+    }
+}
+
+static void bnchk_network(long int evt_max) {
+    printf("Starting network benchmark with %ld lines\n", evt_max);
+    bnchk_network_run("Unbuffered stdio", net_read_stdio, evt_max);
+    bnchk_network_run("Ring buffer", net_read_ring, evt_max);
+}
+
+
+/* ************** */
+/* Send benchmark */
+/* ************** */
+
+/* Arguments for the thread that drains the socket */
+struct net_drain_args {
+    int socket;         /* The socket to read from */
+    long int lines;     /* The number of lines to read */
+};
+
+/* Read the given number of lines from the socket, as an IRC server would */
+static void* net_drain(void* arg) {
+    struct net_drain_args* args = (struct net_drain_args*) arg;
+    char chunk[8192], *pos;
+    long int lines = 0;
+    int ret;
+
+    while (lines < args->lines && (ret = recv(args->socket, chunk, sizeof(chunk), 0)) > 0) {
+        for (pos = chunk; (pos = memchr(pos, '\n', ret - (pos - chunk))) != NULL; pos++) {
+            lines++;
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+/* Send each line with its own blocking syscall, as the previous net_send did.
+ * Returns the number of send calls. */
+static long int net_send_line(int socket, long int lines) {
+    char out[READ_BUF];
+    long int i;
+
+    for (i = 0; i < lines; i++) {
+        strncpy(out, BNCHK_REPLY, WRITE_BUF);
+        out[WRITE_BUF] = '\0';
+        strcat(out, MSG_SEP);
+        if (send(socket, out, strlen(out), 0) == -1) {
+            perror("send error");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return lines;
+}
+
+/* Queue the lines and flush them after each burst, as the event loop does.
+ * Returns the number of flush calls (each one sends at most once). */
+static long int net_send_queue(int socket, long int lines) {
+    struct net_conn* conn = net_attach(dup(socket));   /* The caller closes the original socket */
+    long int i, flushes = 0;
+
+    for (i = 0; i < lines; i++) {
+        /* Wait for the reader if the queue is full */
+        while (net_send(conn, BNCHK_REPLY) < 0) {
+            net_flush(conn);
+            flushes++;
+            sched_yield();
+        }
+
+        if ((i + 1) % BNCHK_BURST == 0) {
+            net_flush(conn);
+            flushes++;
+        }
+    }
+
+    do {
+        flushes++;
+    } while (net_flush(conn) > 0 && sched_yield() == 0);
+
+    net_free(conn);
+    return flushes;
+}
+
+static void bnchk_send_run(char* name, long int (*sender)(int, long int), long int lines) {
+    int socks[2], _stdout;
+    long int syscalls, el_usec;
+    struct timeval start, end;
+    struct net_drain_args args;
+    pthread_t drain;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    args.socket = socks[1];
+    args.lines = lines;
+
+    _stdout = disable_stdout();     /* The network module logs every sent line */
+    gettimeofday(&start, NULL);
+
+    pthread_create(&drain, NULL, net_drain, &args);
+    syscalls = sender(socks[0], lines);
+    pthread_join(drain, NULL);
+
+    gettimeofday(&end, NULL);
+    enable_stdout(_stdout);
+
+    close(socks[0]);
+    close(socks[1]);
+
+    el_usec = elapsed(&start, &end);
+    printf("  %s sender\n", name);
+    printf("    Run time (secs): %f\n",  el_usec / (double) 1000000);
+    printf("    Lines per second: %.0f\n", lines / (el_usec / (double) 1000000));
+    printf("    Send syscalls per line: %f\n", syscalls / (double) lines);
+}
+
+static void bnchk_send(long int evt_max) {
+    printf("Starting send benchmark with %ld lines\n", evt_max);
+    bnchk_send_run("Line per syscall", net_send_line, evt_max);
+    bnchk_send_run("Output queue", net_send_queue, evt_max);
+}
+
+
+/* **************** */
+/* Parser benchmark */
+/* **************** */
+
+/* The previous strtok_r based parser, kept as a reference */
+static struct raw_event* legacy_parse(char* msg) {
+    int i = 0, is_last_parameter = 0;
+    size_t msg_len;
+    struct raw_event* raw = evt_raw_create();
+    char* token, *token_end = NULL;
+
+    if (msg != NULL && (msg_len = strlen(msg)) > 0) {
+        if ((raw->__buffer = malloc((msg_len + 1) * sizeof(char))) == 0) {
+            perror("Out of memory (parse)");
+            exit(EXIT_FAILURE);
+        }
+
+        memset(raw->__buffer, '\0', msg_len + 1);
+        memcpy(raw->__buffer, msg, msg_len);
+
+        token = strtok_r(raw->__buffer, " ", &token_end);
+        while(token != NULL) {
+            if (raw->type == NULL) {
+                if (token[0] == ':') {
+                    raw->prefix = token + 1;
+                } else {
+                    raw->type = token;
+                }
+            } else {
+                if (is_last_parameter == 0 && token[0] == ':') {
+                    raw->params[i] = token + 1;
+                    is_last_parameter = 1;
+                } else {
+                    if (is_last_parameter == 0) {
+                        raw->params[i++] = token;
+                    } else {
+                        /* Same work as the old sprintf(params[i], "%s %s", params[i], token)
+                         * without writing over its own input */
+                        size_t len = strlen(raw->params[i]);
+                        raw->params[i][len] = ' ';
+                        memmove(raw->params[i] + len + 1, token, strlen(token) + 1);
+                    }
+                }
+            }
+            token = strtok_r(NULL, " ", &token_end);
+        }
+
+        raw->num_params = (is_last_parameter == 0)? i : i + 1;
+    }
+
+    return raw;
 }
 
+static void bnchk_parser_run(char* name, struct raw_event* (*parser)(char*), char* line, long int lines) {
+    long int i, el_usec;
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < lines; i++) {
+        evt_raw_destroy(parser(line));
+    }
+    gettimeofday(&end, NULL);
+
+    el_usec = elapsed(&start, &end);
+    printf("  %s parser\n", name);
+    printf("    Run time (secs): %f\n",  el_usec / (double) 1000000);
+    printf("    Time per line (usecs): %f\n", el_usec / (double) lines);
+}
+
+static void bnchk_parser(long int evt_max) {
+    char line[READ_BUF];
+    size_t len;
+
+    /* Build a PRIVMSG line as long as an IRC message can be */
+    strcpy(line, ":nick!~user@server PRIVMSG #test :");
+    for (len = strlen(line); len + strlen(BNCHK_WORD) < MSG_SIZE - 2; len += strlen(BNCHK_WORD)) {
+        strcat(line, BNCHK_WORD);
+    }
+    strcat(line, "\r\n");
+
+    printf("Starting parser benchmark with %ld lines of %lu bytes\n", evt_max, (unsigned long) strlen(line));
+    bnchk_parser_run("strtok_r", legacy_parse, line, evt_max);
+    bnchk_parser_run("Single pass", lst_parse, line, evt_max);
+}
+
+
+/* *************** */
+/* Queue benchmark */
+/* *************** */
+
+#define BNCHK_PACE 20000        /* Nanoseconds between events in the paced runs */
+#define BNCHK_PACED_MAX 20000   /* Maximum number of events in the paced runs */
+
+/* Item handed from the producer to the consumer */
+struct bnchk_item {
+    struct timespec enqueued;   /* When the item was added to the queue */
+};
+
+static long int* latencies;     /* Enqueue to callback latency of each item, in nanoseconds */
+static long int consumed;       /* Number of items processed by the consumer */
+static long int expected;       /* Number of items the consumer has to process */
+
+/* Nanoseconds elapsed since the given time */
+static long int nsecs_since(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
+
+/* Callback invoked by the consumers for each item */
+static void on_item(struct bnchk_item* item) {
+    latencies[consumed++] = nsecs_since(&item->enqueued);
+}
+
+/* The previous dispatcher queue, kept as a reference: a linked list that
+ * allocates a node per item, protected by a mutex and a condition variable
+ * that is signaled for every item. */
+struct legacy_node {
+    struct bnchk_item* item;
+    struct legacy_node* next;
+};
+
+static struct legacy_queue {
+    struct legacy_node* top;
+    struct legacy_node* bottom;
+    int size;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} legacy;
+
+static void legacy_push(struct bnchk_item* item) {
+    struct legacy_node* node;
+
+    pthread_mutex_lock(&legacy.lock);
+
+    if ((node = malloc(sizeof(struct legacy_node))) == 0) {
+        perror("Out of memory (legacy_push)");
+        exit(EXIT_FAILURE);
+    }
+
+    node->item = item;
+    node->next = NULL;
+    if (legacy.top == NULL) {
+        legacy.top = node;
+    } else {
+        legacy.bottom->next = node;
+    }
+    legacy.bottom = node;
+    legacy.size++;
+
+    pthread_cond_signal(&legacy.ready);
+    pthread_mutex_unlock(&legacy.lock);
+}
+
+static void* legacy_consumer(void* arg) {
+    while (consumed < expected) {
+        struct legacy_node* node;
+
+        pthread_mutex_lock(&legacy.lock);
+        while (legacy.size == 0) {
+            pthread_cond_wait(&legacy.ready, &legacy.lock);
+        }
+        node = legacy.top;
+        legacy.top = node->next;
+        legacy.size--;
+        pthread_mutex_unlock(&legacy.lock);
+
+        on_item(node->item);
+        free(node);
+    }
+
+    pthread_exit(NULL);
+}
+
+static struct q_ring* ring = NULL;
+
+static void ring_push(struct bnchk_item* item) {
+    while (!q_push(ring, item)) {
+        sched_yield();
+    }
+}
+
+static void* ring_consumer(void* arg) {
+    while (consumed < expected) {
+        struct bnchk_item* item = q_pop(ring);
+        if (item != NULL) {
+            on_item(item);
+        } else {
+            q_wait(ring);
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+/* Compare latencies to sort them */
+static int latency_cmp(const void* a, const void* b) {
+    long int la = *(const long int*) a, lb = *(const long int*) b;
+    return (la > lb) - (la < lb);
+}
+
+/* Push the given number of items, optionally waiting the given nanoseconds between
+ * them, and return the time needed to consume all of them in nanoseconds */
+static long int bnchk_queue_run(void* (*consumer)(void*), void (*push)(struct bnchk_item*),
+        struct bnchk_item* items, long int count, long int pace) {
+    long int i;
+    struct timespec start;
+    pthread_t thread;
+
+    consumed = 0;
+    expected = count;
+    pthread_create(&thread, NULL, consumer, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < count; i++) {
+        if (pace > 0) {
+            struct timespec last;
+            clock_gettime(CLOCK_MONOTONIC, &last);
+            while (nsecs_since(&last) < pace);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &items[i].enqueued);
+        push(&items[i]);
+    }
+
+    pthread_join(thread, NULL);
+    qsort(latencies, count, sizeof(long int), latency_cmp);
+
+    return nsecs_since(&start);
+}
+
+static void bnchk_queue_report(char* name, void* (*consumer)(void*), void (*push)(struct bnchk_item*),
+        struct bnchk_item* items, long int count) {
+    long int el_nsec, paced = count < BNCHK_PACED_MAX? count : BNCHK_PACED_MAX;
+
+    printf("  %s queue\n", name);
+
+    el_nsec = bnchk_queue_run(consumer, push, items, count, 0);
+    printf("    Events per second: %.0f\n", count / (el_nsec / (double) 1000000000));
+    printf("    Latency under full load p50/p99 (usecs): %.3f / %.3f\n",
+            latencies[count / 2] / (double) 1000, latencies[count * 99 / 100] / (double) 1000);
+
+    bnchk_queue_run(consumer, push, items, paced, BNCHK_PACE);
+    printf("    Latency at one event every %ld usecs p50/p99 (usecs): %.3f / %.3f\n", BNCHK_PACE / 1000L,
+            latencies[paced / 2] / (double) 1000, latencies[paced * 99 / 100] / (double) 1000);
+}
+
+static void bnchk_queue(long int evt_max) {
+    struct bnchk_item* items;
+
+    if ((items = malloc(evt_max * sizeof(struct bnchk_item))) == 0
+            || (latencies = malloc(evt_max * sizeof(long int))) == 0) {
+        perror("Out of memory (bnchk_queue)");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Starting queue benchmark with %ld events\n", evt_max);
+
+    legacy.top = legacy.bottom = NULL;
+    legacy.size = 0;
+    pthread_mutex_init(&legacy.lock, NULL);
+    pthread_cond_init(&legacy.ready, NULL);
+    bnchk_queue_report("Mutex and condition variable", legacy_consumer, legacy_push, items, evt_max);
+    pthread_mutex_destroy(&legacy.lock);
+    pthread_cond_destroy(&legacy.ready);
+
+    ring = q_create(Q_SIZE);
+    bnchk_queue_report("Single-producer/single-consumer ring", ring_consumer, ring_push, items, evt_max);
+    q_destroy(ring);
+
+    free(latencies);
+    free(items);
+}
+
+
+/* ******************************* */
+/* Dispatch mode latency benchmark */
+/* ******************************* */
+
+static struct timespec* sent;   /* When each line was handed to the listener */
+static long int fired;          /* Number of callbacks invoked */
+
+/* Callback that measures the time since its line was handled */
+static void on_latency(GenericEvent* event) {
+    long int seq = atol(event->message);
+    latencies[seq] = nsecs_since(&sent[seq]);
+    __atomic_add_fetch(&fired, 1, __ATOMIC_RELEASE);
+}
+
+/* Handle the given number of lines, optionally waiting the given nanoseconds
+ * between them, and return the time needed to fire all callbacks in nanoseconds */
+static long int bnchk_latency_run(int workers, long int count, long int pace) {
+    long int i;
+    char line[100];
+    struct timespec start;
+
+    fired = 0;
+    dsp_start(workers);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < count; i++) {
+        sprintf(line, ":server 305 circus-bot :%ld", i);
+        if (pace > 0) {
+            struct timespec last;
+            clock_gettime(CLOCK_MONOTONIC, &last);
+            while (nsecs_since(&last) < pace);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &sent[i]);
+        lst_handle(NULL, line);
+    }
+
+    while (__atomic_load_n(&fired, __ATOMIC_ACQUIRE) < count) {
+        sched_yield();
+    }
+
+    dsp_shutdown();
+    qsort(latencies, count, sizeof(long int), latency_cmp);
+
+    return nsecs_since(&start);
+}
+
+static void bnchk_latency_report(char* name, int workers, long int count) {
+    long int el_nsec, paced = count < BNCHK_PACED_MAX? count : BNCHK_PACED_MAX;
+
+    printf("  %s\n", name);
+
+    el_nsec = bnchk_latency_run(workers, count, 0);
+    printf("    Events per second: %.0f\n", count / (el_nsec / (double) 1000000000));
+    printf("    Latency under full load p50/p99 (usecs): %.3f / %.3f\n",
+            latencies[count / 2] / (double) 1000, latencies[count * 99 / 100] / (double) 1000);
+
+    bnchk_latency_run(workers, paced, BNCHK_PACE);
+    printf("    Latency at one event every %ld usecs p50/p99 (usecs): %.3f / %.3f\n", BNCHK_PACE / 1000L,
+            latencies[paced / 2] / (double) 1000, latencies[paced * 99 / 100] / (double) 1000);
+}
+
+static void bnchk_latency(long int evt_max) {
+    if ((sent = malloc(evt_max * sizeof(struct timespec))) == 0
+            || (latencies = malloc(evt_max * sizeof(long int))) == 0) {
+        perror("Out of memory (bnchk_latency)");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Starting dispatch mode latency benchmark with %ld events\n", evt_max);
+
+    bnd_bind(RPL_UNAWAY, (Callback) on_latency);
+    bnchk_latency_report("Inline dispatch", DSP_INLINE, evt_max);
+    bnchk_latency_report("Dispatcher thread", DSP_WORKERS, evt_max);
+    bnd_destroy();
+
+    free(latencies);
+    free(sent);
+}
+
+
+/* ******************* */
+/* Hashtable benchmark */
+/* ******************* */
+
+#define BNCHK_KEYS 10000        /* Number of keys in the tables */
+
+/* The previous chained table with an additive hash, kept as a reference */
+struct legacy_entry {
+    struct legacy_entry* next;
+    char* key;
+    Function function;
+};
+
+static struct legacy_entry* legacy_table[256];
+
+static unsigned char legacy_hash(char* key) {
+    unsigned char hash = 0;
+    while (*key) {
+        hash += *key++;
+    }
+    return hash;
+}
+
+static void legacy_add(char* key, Function function) {
+    struct legacy_entry* entry;
+    unsigned char idx = legacy_hash(key);
+
+    if ((entry = malloc(sizeof(struct legacy_entry))) == 0
+            || (entry->key = malloc(strlen(key) + 1)) == 0) {
+        perror("Out of memory (legacy_add)");
+        exit(EXIT_FAILURE);
+    }
+
+    strcpy(entry->key, key);
+    entry->function = function;
+    entry->next = legacy_table[idx];
+    legacy_table[idx] = entry;
+}
+
+static Function legacy_find(char* key) {
+    struct legacy_entry* current = legacy_table[legacy_hash(key)];
+    while (current != NULL && s_ne(current->key, key)) {
+        current = current->next;
+    }
+    return current == NULL ? NULL : current->function;
+}
+
+static void legacy_destroy() {
+    struct legacy_entry* current, *next;
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        for (current = legacy_table[i]; current != NULL; current = next) {
+            next = current->next;
+            free(current->key);
+            free(current);
+        }
+        legacy_table[i] = NULL;
+    }
+}
+
+static struct ht_table* table = NULL;
+
+static void table_add(char* key, Function function) {
+    ht_add_function(table, key, function);
+}
+
+static Function table_find(char* key) {
+    struct ht_data* data = ht_find(table, key);
+    return data == NULL ? NULL : data->function;
+}
+
+static void bnchk_hashtable_run(char* name, void (*add)(char*, Function), Function (*find)(char*),
+        char (*keys)[20], long int lookups) {
+    long int i, found = 0, el_usec;
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < BNCHK_KEYS; i++) {
+        add(keys[i], (Function) bnchk_hashtable_run);
+    }
+    gettimeofday(&end, NULL);
+    el_usec = elapsed(&start, &end);
+
+    printf("  %s\n", name);
+    printf("    Insert time per key (usecs): %f\n", el_usec / (double) BNCHK_KEYS);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < lookups; i++) {
+        /* Half of the lookups miss, like events without a binding */
+        if (find(keys[i % (BNCHK_KEYS * 2)]) != NULL) {
+            found++;
+        }
+    }
+    gettimeofday(&end, NULL);
+    el_usec = elapsed(&start, &end);
+
+    printf("    Lookup time per key (usecs): %f (%ld found)\n", el_usec / (double) lookups, found);
+}
+
+static void bnchk_hashtable(long int evt_max) {
+    char (*keys)[20];
+    int i;
+
+    if ((keys = malloc(BNCHK_KEYS * 2 * sizeof(*keys))) == 0) {
+        perror("Out of memory (bnchk_hashtable)");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Command binding keys. The second half are never added */
+    for (i = 0; i < BNCHK_KEYS * 2; i++) {
+        sprintf(keys[i], "PRIVMSG!cmd%d", i);
+    }
+
+    printf("Starting hashtable benchmark with %d keys and %ld lookups\n", BNCHK_KEYS, evt_max);
+
+    bnchk_hashtable_run("Chained table with additive hash", legacy_add, legacy_find, keys, evt_max);
+    legacy_destroy();
+
+    table = ht_create();
+    bnchk_hashtable_run("Open addressing with FNV-1a", table_add, table_find, keys, evt_max);
+    ht_destroy(table);
+
+    free(keys);
+}
+
+
+/* ***************** */
+/* Tracker benchmark */
+/* ***************** */
+
+#define BNCHK_CHANNELS 100      /* Number of channels joined by the bot */
+#define BNCHK_USER_CHANNELS 3   /* Number of channels of each user */
+
+/* Get the resident memory of the process in KB (Linux only) */
+static long int resident_kb() {
+    FILE* f;
+    long int pages = -1, resident = -1;
+
+    if ((f = fopen("/proc/self/statm", "r")) != NULL) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = -1;
+        }
+        fclose(f);
+    }
+
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Parse a line and update the state, returning the nanoseconds spent in the update */
+static long int tracker_update(struct trk_table* trk, char* line) {
+    struct raw_event* raw = lst_parse(line);
+    struct timespec start;
+    long int nsecs;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    trk_update(trk, raw);
+    nsecs = nsecs_since(&start);
+    evt_raw_destroy(raw);
+
+    return nsecs;
+}
+
+static void bnchk_tracker(long int evt_max) {
+    struct isp_table isp;
+    struct trk_table* trk;
+    char line[READ_BUF];
+    long int i, k, nsecs, memory;
+
+    printf("Starting tracker benchmark with %ld users in %d channels\n", evt_max, BNCHK_CHANNELS);
+
+    isp_init(&isp);
+    trk = trk_create(&isp);
+    tracker_update(trk, ":server 001 bnchk :Welcome");
+    for (i = 0; i < BNCHK_CHANNELS; i++) {
+        sprintf(line, ":bnchk!~bnchk@server JOIN #channel%ld", i);
+        tracker_update(trk, line);
+    }
+
+    /* Each user joins a few channels spread over all of them */
+    memory = resident_kb();
+    for (i = 0, nsecs = 0; i < evt_max; i++) {
+        for (k = 0; k < BNCHK_USER_CHANNELS; k++) {
+            sprintf(line, ":user%ld!~user@server JOIN #channel%ld", i, (i + k * 37) % BNCHK_CHANNELS);
+            nsecs += tracker_update(trk, line);
+        }
+    }
+    memory = resident_kb() - memory;
+
+    printf("  JOIN time per message (usecs): %f\n", nsecs / 1000.0 / (evt_max * BNCHK_USER_CHANNELS));
+    printf("  Memory per membership (bytes): %f\n", memory * 1024.0 / (evt_max * BNCHK_USER_CHANNELS));
+
+    for (i = 0, nsecs = 0; i < evt_max; i++) {
+        sprintf(line, ":user%ld!~user@server NICK renamed%ld", i, i);
+        nsecs += tracker_update(trk, line);
+    }
+    printf("  NICK time per message (usecs): %f\n", nsecs / 1000.0 / evt_max);
+
+    for (i = 0, nsecs = 0; i < evt_max; i++) {
+        sprintf(line, ":renamed%ld!~user@server QUIT :Bye", i);
+        nsecs += tracker_update(trk, line);
+    }
+    printf("  QUIT time per message (usecs): %f\n", nsecs / 1000.0 / evt_max);
+
+    trk_destroy(trk);
+}
+
+
+/* ********************** */
+/* Case mapping benchmark */
+/* ********************** */
+
+/* The previous lower, which called strlen for every character */
+static void legacy_lower(char* str) {
+    int i;
+    for (i = 0; i < strlen(str); i++) {
+        str[i] = tolower(str[i]);
+    }
+}
+
+static void cm_fold_rfc1459(char* str) {
+    cm_fold(str, str, MSG_SIZE, ISP_RFC1459);
+}
+
+static void bnchk_casemap_run(char* name, void (*fold)(char*), const char* text, long int count) {
+    char buf[MSG_SIZE];
+    long int i, el_usec;
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++) {
+        strcpy(buf, text);
+        fold(buf);
+    }
+    gettimeofday(&end, NULL);
+
+    el_usec = elapsed(&start, &end);
+    printf("  %s\n", name);
+    printf("    Run time (secs): %f\n",  el_usec / (double) 1000000);
+    printf("    Time per string (usecs): %f\n", el_usec / (double) count);
+}
+
+static void bnchk_casemap(long int evt_max) {
+    char text[MSG_SIZE];
+    long int i, el_usec;
+    struct timeval start, end;
+
+    /* A string as long as a message, mixing cases and the rfc1459 characters */
+    for (i = 0; i < MSG_SIZE - 1; i++) {
+        text[i] = "Circus[IRC]^lib_"[i % 16];
+    }
+    text[MSG_SIZE - 1] = '\0';
+
+    printf("Starting case mapping benchmark with %ld strings of %lu bytes\n", evt_max, (unsigned long) strlen(text));
+    bnchk_casemap_run("strlen and tolower per character", legacy_lower, text, evt_max);
+    bnchk_casemap_run("cm_fold", cm_fold_rfc1459, text, evt_max);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < evt_max; i++) {
+        if (cm_hash(text, ISP_RFC1459) == 0) {
+            printf("  cm_hash returned 0\n");    /* Never happens, but the result is used */
+        }
+    }
+    gettimeofday(&end, NULL);
+
+    el_usec = elapsed(&start, &end);
+    printf("  cm_hash\n");
+    printf("    Run time (secs): %f\n",  el_usec / (double) 1000000);
+    printf("    Time per string (usecs): %f\n", el_usec / (double) evt_max);
+}
+
+
+/* ************** */
+/* Mask benchmark */
+/* ************** */
+
+#define BNCHK_LOOKUPS 100000    /* Prefixes matched against the indexed set */
+#define BNCHK_SCANS 100         /* Prefixes matched against every mask, one at a time */
+
+/* Build the mask number i. Most bans are domains, addresses, nicks or idents,
+ * and a few have no literal part at all */
+static void bnchk_mask(char* mask, long int i) {
+    switch (i % 5) {
+        case 0:
+        case 1: sprintf(mask, "*!*@*.host%ld.example.net", i); break;
+        case 2: sprintf(mask, "*!*@10.%ld.%ld.*", (i / 256) % 256, i % 256); break;
+        case 3: sprintf(mask, "nick%ld!*@*", i); break;
+        default: sprintf(mask, i % 1000 == 4 ? "*spam%ld*!*@*" : "*!~user%ld@*", i); break;
+    }
+}
+
+/* Build the prefix of a user that may be banned */
+static void bnchk_prefix(char* prefix, long int i) {
+    sprintf(prefix, "nick%ld!~user%ld@www.host%ld.example.net", i, i * 7, i * 3);
+}
+
+static void bnchk_masks(long int evt_max) {
+    struct msk_set* set = msk_create(ISP_RFC1459);
+    char** masks, prefix[MSK_SIZE];
+    long int i, k, nsecs, memory, matches, sample;
+    struct timespec start;
+
+    if ((masks = malloc(evt_max * sizeof(char*))) == NULL) {
+        perror("Out of memory (bnchk_masks)");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Starting mask benchmark with %ld masks\n", evt_max);
+
+    memory = resident_kb();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < evt_max; i++) {
+        bnchk_mask(prefix, i);
+        msk_add(set, prefix, NULL);
+    }
+    nsecs = nsecs_since(&start);
+    memory = resident_kb() - memory;
+
+    printf("  Add time per mask (usecs): %f\n", nsecs / 1000.0 / evt_max);
+    printf("  Memory per mask (bytes): %f\n", memory * 1024.0 / evt_max);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0, matches = 0, sample = 0; i < BNCHK_LOOKUPS; i++) {
+        bnchk_prefix(prefix, i % evt_max);
+        matches = msk_match(set, prefix, NULL, NULL);
+        sample += i < BNCHK_SCANS ? matches : 0;
+    }
+    nsecs = nsecs_since(&start);
+
+    printf("  Indexed set\n");
+    printf("    Time per prefix (usecs): %f\n", nsecs / 1000.0 / BNCHK_LOOKUPS);
+    printf("    Matches in the first %d prefixes: %ld\n", BNCHK_SCANS, sample);
+
+    /* The usual loop in a callback: every mask, one after the other */
+    for (i = 0; i < evt_max; i++) {
+        bnchk_mask(prefix, i);
+        masks[i] = malloc(strlen(prefix) + 1);
+        strcpy(masks[i], prefix);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0, matches = 0; i < BNCHK_SCANS; i++) {
+        bnchk_prefix(prefix, i % evt_max);
+        for (k = 0; k < evt_max; k++) {
+            matches += fnmatch(masks[k], prefix, 0) == 0;
+        }
+    }
+    nsecs = nsecs_since(&start);
+
+    printf("  fnmatch loop\n");
+    printf("    Time per prefix (usecs): %f\n", nsecs / 1000.0 / BNCHK_SCANS);
+    printf("    Matches in the first %d prefixes: %ld\n", BNCHK_SCANS, matches);
+
+    for (i = 0; i < evt_max; i++) {
+        free(masks[i]);
+    }
+    free(masks);
+    msk_destroy(set);
+}
+
+
+/* **************** */
+/* Router benchmark */
+/* **************** */
+
+#define BNCHK_MESSAGE "!cmd%ld and some arguments"
+
+/* The previous lookup: cut the first word, build its binding key and hash it */
+static Callback legacy_command(struct ht_table* commands, char* text) {
+    char key[50], *end = strchr(text, ' ');
+    struct ht_data* data;
+
+    if (end != NULL) {
+        *end = '\0';
+    }
+    snprintf(key, 50, "%s#%s", PRIVMSG, text);
+    lower(key + strlen(PRIVMSG) + 1);
+    data = ht_find(commands, key);
+    if (end != NULL) {
+        *end = ' ';
+    }
+
+    return data != NULL ? data->function : NULL;
+}
+
+static void bnchk_router_run(long int commands, long int lookups) {
+    struct ht_table* legacy = ht_create();
+    struct rtr_table* rtr = rtr_create();
+    char text[MSG_SIZE], key[50];
+    long int i, found, nsecs;
+    struct timespec start;
+    const char* rest;
+
+    for (i = 0; i < commands; i++) {
+        sprintf(key, "%s#!cmd%ld", PRIVMSG, i);
+        ht_add_function(legacy, key, (Function) bnchk_router_run);
+        sprintf(key, "!cmd%ld", i);
+        rtr_add(rtr, key, (Callback) bnchk_router_run);
+    }
+
+    printf("  %ld commands\n", commands);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0, found = 0; i < lookups; i++) {
+        sprintf(text, BNCHK_MESSAGE, i % (commands * 2));  /* Half of the messages are not commands */
+        found += legacy_command(legacy, text) != NULL;
+    }
+    nsecs = nsecs_since(&start);
+    printf("    Binding key lookup time per message (usecs): %f (%ld found)\n", nsecs / 1000.0 / lookups, found);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0, found = 0; i < lookups; i++) {
+        sprintf(text, BNCHK_MESSAGE, i % (commands * 2));
+        found += rtr_match(rtr, text, NULL, &rest) != NULL;
+    }
+    nsecs = nsecs_since(&start);
+    printf("    Router lookup time per message (usecs): %f (%ld found)\n", nsecs / 1000.0 / lookups, found);
+
+    ht_destroy(legacy);
+    rtr_destroy(rtr);
+}
+
+static void bnchk_router(long int evt_max) {
+    printf("Starting router benchmark with %ld messages (time includes formatting them)\n", evt_max);
+    bnchk_router_run(10, evt_max);
+    bnchk_router_run(1000, evt_max);
+}
+
+
+/* *************** */
+/* Timer benchmark */
+/* *************** */
+
+#define BNCHK_TIMER_SPAN 3600000    /* Timers expire during the next hour */
+
+static long int timer_runs = 0;
+
+static void on_timer(void* data) {
+    timer_runs++;
+}
+
+static void bnchk_timer(long int evt_max) {
+    struct tmr_wheel* wheel = tmr_create(0);
+    unsigned long* ids, now = 0;
+    long int i, nsecs, wakeups = 0;
+    struct timespec start;
+    int next;
+
+    if ((ids = malloc(evt_max * sizeof(unsigned long))) == 0) {
+        perror("Out of memory (bnchk_timer)");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Starting timer benchmark with %ld pending timers\n", evt_max);
+    srand(1);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < evt_max; i++) {
+        ids[i] = tmr_add(wheel, now, rand() % BNCHK_TIMER_SPAN, 0, on_timer, NULL);
+    }
+    nsecs = nsecs_since(&start);
+    printf("  Add time per timer (usecs): %f\n", nsecs / 1000.0 / evt_max);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < evt_max; i += 2) {
+        tmr_cancel(wheel, ids[i]);
+    }
+    nsecs = nsecs_since(&start);
+    printf("  Cancel time per timer (usecs): %f (%d still pending)\n", nsecs / 1000.0 / ((evt_max + 1) / 2), tmr_count(wheel));
+
+    /* Advance as the event loop would, waking up only when the wheel needs it */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ((next = tmr_next(wheel, now)) != -1) {
+        now += next;
+        tmr_advance(wheel, now, NULL);
+        wakeups++;
+    }
+    nsecs = nsecs_since(&start);
+    printf("  Expire time per timer (usecs): %f (%ld run in %ld wake ups)\n", nsecs / 1000.0 / timer_runs, timer_runs, wakeups);
+
+    tmr_destroy(wheel);
+    free(ids);
+}
+
+
+/* **************** */
+/* Replay benchmark */
+/* **************** */
+
+#define BNCHK_REPLAY_CHANNELS 50    /* Channels of the generated capture */
+
+static long int replayed = 0;
+
+static void on_replayed(GenericEvent* event) {
+    __atomic_add_fetch(&replayed, 1, __ATOMIC_RELAXED);
+}
+
+/* Write a capture with the usual mix of channel traffic */
+static void replay_capture(char* path, long int lines) {
+    FILE* log;
+    long int i;
+
+    if ((log = fopen(path, "w")) == NULL) {
+        perror("Error writing the capture");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(log, "<< :irc.example.org 001 circus :Welcome to the network\r\n");
+    for (i = 0; i < lines - 1; i++) {
+        switch (i % 10) {
+            case 0:
+                fprintf(log, "<< :user%ld!~user@host%ld.example.org JOIN #chan%ld\r\n",
+                        i, i % 1000, i % BNCHK_REPLAY_CHANNELS);
+                break;
+            case 1:
+                fprintf(log, "<< :user%ld!~user@host%ld.example.org PART #chan%ld :Bye\r\n",
+                        i - 1, (i - 1) % 1000, (i - 1) % BNCHK_REPLAY_CHANNELS);
+                break;
+            case 2:
+                fprintf(log, "<< :nick!~user@server MODE #chan%ld +v nick\r\n", i % BNCHK_REPLAY_CHANNELS);
+                break;
+            case 3:
+                fprintf(log, "<< :nick%ld!~user@server NOTICE circus :Hello there\r\n", i % 100);
+                break;
+            default:
+                fprintf(log, "<< :nick%ld!~user@server PRIVMSG #chan%ld :This is message %ld of the capture\r\n",
+                        i % 100, i % BNCHK_REPLAY_CHANNELS, i);
+                break;
+        }
+        if (i % 1000 == 999) {
+            fprintf(log, ">> PONG :irc.example.org\r\n");     /* Sent lines are skipped */
+        }
+    }
+
+    fclose(log);
+}
+
+static void bnchk_replay(long int evt_max, char* path) {
+    char generated[64];
+    long int lines, nsecs;
+    struct timespec start;
+
+    if (path == NULL) {
+        path = generated;
+        sprintf(generated, "/tmp/circus-bnchk-%d.log", (int) getpid());
+        replay_capture(path, evt_max);
+    }
+
+    irc_bind_event(ALL, (Callback) on_replayed);
+
+    printf("Starting replay benchmark with %s\n", path);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    lines = irc_replay(path, 0);
+    nsecs = nsecs_since(&start);
+
+    irc_unbind_event(ALL);
+    if (path == generated) {
+        unlink(generated);
+    }
+
+    if (lines <= 0) {
+        printf("  No lines to replay\n");
+        return;
+    }
+
+    printf("  Run time (secs): %f\n", nsecs / 1000000000.0);
+    printf("  Replayed lines: %ld (%ld events fired)\n", lines, replayed);
+    printf("  Parse and dispatch time per line (usecs): %f\n", nsecs / 1000.0 / lines);
+    printf("  Lines per second: %.0f\n", lines / (nsecs / 1000000000.0));
+}
+
+int main(int argc, char **argv) {
+    long int evt_max;
+    char* name = "dispatch";
+
+    if (argc < 2 || argc > 4) {
+        printf("Usage: %s <num_events> [dispatch|network|send|parser|queue|latency|hashtable|tracker|casemap|mask|router|timer|replay [log]]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    evt_max = strtol(argv[1], NULL, 0);
+    if (argc >= 3) {
+        name = argv[2];
+    }
+
+    if (s_eq(name, "dispatch")) {
+        bnchk_dispatch(evt_max);
+    } else if (s_eq(name, "network")) {
+        bnchk_network(evt_max);
+    } else if (s_eq(name, "send")) {
+        bnchk_send(evt_max);
+    } else if (s_eq(name, "parser")) {
+        bnchk_parser(evt_max);
+    } else if (s_eq(name, "queue")) {
+        bnchk_queue(evt_max);
+    } else if (s_eq(name, "latency")) {
+        bnchk_latency(evt_max);
+    } else if (s_eq(name, "hashtable")) {
+        bnchk_hashtable(evt_max);
+    } else if (s_eq(name, "tracker")) {
+        bnchk_tracker(evt_max);
+    } else if (s_eq(name, "casemap")) {
+        bnchk_casemap(evt_max);
+    } else if (s_eq(name, "mask")) {
+        bnchk_masks(evt_max);
+    } else if (s_eq(name, "router")) {
+        bnchk_router(evt_max);
+    } else if (s_eq(name, "timer")) {
+        bnchk_timer(evt_max);
+    } else if (s_eq(name, "replay")) {
+        bnchk_replay(evt_max, argc == 4 ? argv[3] : NULL);
+    } else {
+        printf("Unknown benchmark: %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
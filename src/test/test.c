@@ -30,10 +30,20 @@
 void run_all_tests() {
     mu_suite(test_version);
     mu_suite(test_hashtable);
+    mu_suite(test_queue);
     mu_suite(test_binding);
     mu_suite(test_utils);
+    mu_suite(test_casemap);
+    mu_suite(test_mask);
+    mu_suite(test_router);
+    mu_suite(test_timer);
+    mu_suite(test_replay);
     mu_suite(test_codes);
     mu_suite(test_events);
+    mu_suite(test_scheduler);
+    mu_suite(test_isupport);
+    mu_suite(test_tracker);
+    mu_suite(test_intern);
     mu_suite(test_network);
     mu_suite(test_listener);
     mu_suite(test_irc);
@@ -26,10 +26,20 @@
 /* Unit test suites */
 void test_version();
 void test_hashtable();
+void test_queue();
 void test_binding();
 void test_utils();
+void test_casemap();
+void test_mask();
+void test_router();
+void test_timer();
+void test_replay();
 void test_codes();
 void test_events();
+void test_scheduler();
+void test_isupport();
+void test_tracker();
+void test_intern();
 void test_network();
 void test_listener();
 void test_dispatcher();
@@ -20,6 +20,8 @@
  * THE SOFTWARE.
  */
 
+#define _POSIX_C_SOURCE 200112L      /* Use POSIX threads in binding.c */
+
 #include <stdio.h>
 #include "minunit.h"
 #include "test.h"
@@ -29,6 +31,9 @@ void target(char* txt) {
     /* Target function to test hook methods */
 }
 
+int first(char* txt) { return EVT_CONTINUE; }
+int second(char* txt) { return EVT_STOP; }
+
 void test_bnd_init() {
     bnd_init();
 
@@ -49,6 +54,125 @@ void test_bnd_lookup() {
     mu_assert(callback == NULL, "test_bnd_lookup: callback should be NULL");
 }
 
+void test_bnd_snapshot() {
+    struct ht_table* table;
+    struct bnd_reader* reader;
+
+    table = bindings->table;
+    bnd_bind("test", (Callback) target);
+    mu_assert(bindings->table != table, "test_bnd_snapshot: binding should publish a new table");
+    mu_assert(bindings->retired == NULL, "test_bnd_snapshot: the old table should be freed without readers");
+
+    /* A reader in the middle of a lookup keeps the table alive */
+    reader = bnd_reader();
+    mu_assert(reader != NULL, "test_bnd_snapshot: reader should not be NULL");
+    mu_assert(bnd_reader() == reader, "test_bnd_snapshot: a thread should keep its reader slot");
+    reader->epoch = epoch;
+
+    table = bindings->table;
+    bnd_unbind("test");
+    mu_assert(bindings->retired != NULL, "test_bnd_snapshot: the old table should be retired");
+    mu_assert(bindings->retired->table == table, "test_bnd_snapshot: the retired table should be the old one");
+
+    /* Once the reader finishes, the next writer frees it */
+    reader->epoch = 0;
+    bnd_bind("test", (Callback) target);
+    mu_assert(bindings->retired == NULL, "test_bnd_snapshot: retired tables should be freed");
+
+    bnd_unbind("test");     /* Cleanup */
+}
+
+void test_bnd_handlers() {
+    struct bnd_handler chain[BND_HANDLERS];
+    int i;
+
+    mu_assert(bnd_handlers("test", chain) == 0, "test_bnd_handlers: unbound events should have no handlers");
+
+    bnd_bind("test", (Callback) target);
+    mu_assert(bnd_add_handler("test", (Handler) second, 10), "test_bnd_handlers: the handler should be added");
+    mu_assert(bnd_add_handler("test", (Handler) first, 10), "test_bnd_handlers: the handler should be added");
+    mu_assert(bnd_handlers("test", chain) == 3, "test_bnd_handlers: the chain should have 3 handlers");
+    mu_assert(chain[0].callback == (Callback) second, "test_bnd_handlers: handlers with the same priority should keep their order");
+    mu_assert(chain[1].callback == (Callback) first, "test_bnd_handlers: handlers with the same priority should keep their order");
+    mu_assert(chain[2].callback == (Callback) target && !chain[2].chained, "test_bnd_handlers: the bound callback should have the default priority");
+    mu_assert(bnd_lookup("test") == (Callback) target, "test_bnd_handlers: the bound callback should be found");
+
+    /* Adding a handler again changes its priority */
+    mu_assert(bnd_add_handler("test", (Handler) first, 20), "test_bnd_handlers: the handler should be moved");
+    mu_assert(bnd_handlers("test", chain) == 3, "test_bnd_handlers: handlers should not be duplicated");
+    mu_assert(chain[0].callback == (Callback) first, "test_bnd_handlers: the handler with higher priority should run first");
+    mu_assert(bnd_add_handler("test", (Handler) target, -1), "test_bnd_handlers: the bound callback can also be a handler");
+    mu_assert(bnd_handlers("test", chain) == 4, "test_bnd_handlers: the chain should have 4 handlers");
+    mu_assert(chain[3].callback == (Callback) target && chain[3].chained, "test_bnd_handlers: the handler should be the last one");
+
+    /* Binding replaces the bound callback only */
+    bnd_unbind("test");
+    mu_assert(bnd_lookup("test") == NULL, "test_bnd_handlers: the bound callback should be removed");
+    mu_assert(bnd_handlers("test", chain) == 3, "test_bnd_handlers: unbinding should keep the handlers");
+
+    mu_assert(bnd_remove_handler("test", (Handler) first), "test_bnd_handlers: the handler should be removed");
+    mu_assert(!bnd_remove_handler("test", (Handler) first), "test_bnd_handlers: the handler should not be found");
+    mu_assert(bnd_remove_handler("test", (Handler) second), "test_bnd_handlers: the handler should be removed");
+    mu_assert(bnd_remove_handler("test", (Handler) target), "test_bnd_handlers: the handler should be removed");
+    mu_assert(ht_find(bindings->table, "test") == NULL, "test_bnd_handlers: empty chains should be removed");
+
+    /* Chains have a limited size. Handlers are never invoked here, so any address is valid */
+    for (i = 1; i <= BND_HANDLERS; i++) {
+        mu_assert(bnd_add_handler("test", (Handler) (size_t) i, i), "test_bnd_handlers: the handler should be added");
+    }
+    mu_assert(!bnd_add_handler("test", (Handler) first, 0), "test_bnd_handlers: full chains should not grow");
+    mu_assert(bnd_add_handler("test", (Handler) (size_t) 1, 100), "test_bnd_handlers: handlers in full chains can be moved");
+    mu_assert(bnd_handlers("test", chain) == BND_HANDLERS, "test_bnd_handlers: the chain should be full");
+    mu_assert(chain[0].callback == (Callback) (size_t) 1, "test_bnd_handlers: the moved handler should be the first one");
+    for (i = 1; i <= BND_HANDLERS; i++) {
+        bnd_remove_handler("test", (Handler) (size_t) i);
+    }
+}
+
+static int bnd_stop = 0;
+
+/* Look up a binding while another thread binds and unbinds it */
+static void* bnd_lookup_thread(void* arg) {
+    Callback callback;
+    long int* errors = (long int*) arg;
+
+    while (!__atomic_load_n(&bnd_stop, __ATOMIC_ACQUIRE)) {
+        callback = bnd_lookup("test");
+        if (callback != NULL && callback != (Callback) target) {
+            (*errors)++;
+        }
+        if (bnd_lookup("test-static") != (Callback) target) {
+            (*errors)++;
+        }
+    }
+
+    return NULL;
+}
+
+void test_bnd_concurrent_lookup() {
+    pthread_t threads[4];
+    long int errors[4] = { 0, 0, 0, 0 };
+    int i;
+
+    bnd_bind("test-static", (Callback) target);
+    for (i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, bnd_lookup_thread, &errors[i]);
+    }
+
+    for (i = 0; i < 2000; i++) {
+        bnd_bind("test", (Callback) target);
+        bnd_unbind("test");
+    }
+
+    __atomic_store_n(&bnd_stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        mu_assert(errors[i] == 0, "test_bnd_concurrent_lookup: lookups should return the bound callback");
+    }
+
+    bnd_unbind("test-static");  /* Cleanup */
+}
+
 void test_lookup_unexisting_event() {
     Callback callback = bnd_lookup("test-unexisting");
     mu_assert(callback == NULL, "test_lookup_unexisting_event: Callback should be NULL");
@@ -57,11 +181,15 @@ void test_lookup_unexisting_event() {
 void test_bnd_destroy() {
     bnd_destroy();
     mu_assert(bindings == NULL, "test_bnd_destroy: Binding table should be NULL");
+    mu_assert(bnd_lookup("test") == NULL, "test_bnd_destroy: lookups should not find anything");
 }
 
 void test_binding() {
     mu_run(test_bnd_init);
     mu_run(test_bnd_lookup);
+    mu_run(test_bnd_snapshot);
+    mu_run(test_bnd_handlers);
+    mu_run(test_bnd_concurrent_lookup);
     mu_run(test_lookup_unexisting_event);
     mu_run(test_bnd_destroy);
 }
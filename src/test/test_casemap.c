@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "minunit.h"
+#include "test.h"
+#include "../lib/casemap.h"
+
+#define CM_LONG 300             /* Longer than the SIMD blocks and the hash chunks */
+
+void test_cm_fold() {
+    char dst[16];
+
+    cm_fold(dst, "Nick[1]\\^", sizeof(dst), ISP_RFC1459);
+    mu_assert(strcmp(dst, "nick{1}|~") == 0, "test_cm_fold: rfc1459 should fold []\\^");
+    cm_fold(dst, "Nick[1]\\^", sizeof(dst), ISP_STRICT_RFC1459);
+    mu_assert(strcmp(dst, "nick{1}|^") == 0, "test_cm_fold: strict-rfc1459 should fold []\\");
+    cm_fold(dst, "Nick[1]\\^", sizeof(dst), ISP_ASCII);
+    mu_assert(strcmp(dst, "nick[1]\\^") == 0, "test_cm_fold: ascii should only fold letters");
+
+    cm_fold(dst, "@\xc1_`Z", sizeof(dst), ISP_RFC1459);
+    mu_assert(strcmp(dst, "@\xc1_`z") == 0, "test_cm_fold: characters out of the range should not change");
+
+    cm_fold(dst, "#A-Very-Long-Channel", sizeof(dst), ISP_RFC1459);
+    mu_assert(strcmp(dst, "#a-very-long-ch") == 0, "test_cm_fold: the result should be truncated");
+
+    strcpy(dst, "#CIRCUS");
+    mu_assert(cm_fold(dst, dst, sizeof(dst), ISP_ASCII) == dst, "test_cm_fold: should return the destination");
+    mu_assert(strcmp(dst, "#circus") == 0, "test_cm_fold: should fold in place");
+}
+
+void test_cm_fold_long() {
+    char src[CM_LONG + 1], dst[CM_LONG + 1], expected[CM_LONG + 1];
+    int i, len;
+
+    /* Every byte, at every position of the blocks */
+    for (i = 0; i < CM_LONG; i++) {
+        src[i] = (char) (i % 255 + 1);
+        expected[i] = src[i] >= 'A' && src[i] <= '^' ? src[i] + 0x20 : src[i];
+    }
+
+    for (len = 0; len <= CM_LONG; len++) {
+        memcpy(dst, src, len);
+        dst[len] = '\0';
+        cm_fold(dst, dst, sizeof(dst), ISP_RFC1459);
+        mu_assert(memcmp(dst, expected, len) == 0 && dst[len] == '\0', "test_cm_fold_long: all lengths should be folded");
+    }
+}
+
+void test_cm_compare() {
+    char a[CM_LONG + 1], b[CM_LONG + 1];
+
+    mu_assert(cm_compare("#Circus[]", "#cIRCUS{}", ISP_RFC1459) == 0, "test_cm_compare: should ignore case");
+    mu_assert(cm_compare("#Circus[]", "#cIRCUS{}", ISP_ASCII) < 0, "test_cm_compare: ascii should not fold []");
+    mu_assert(cm_compare("nacx", "NAC", ISP_RFC1459) > 0, "test_cm_compare: longer strings should be greater");
+    mu_assert(cm_compare("", "a", ISP_RFC1459) < 0, "test_cm_compare: the empty string should be lower");
+    mu_assert(cm_compare("", "", ISP_RFC1459) == 0, "test_cm_compare: empty strings should be equal");
+
+    memset(a, 'A', CM_LONG);
+    memset(b, 'a', CM_LONG);
+    a[CM_LONG] = b[CM_LONG] = '\0';
+    mu_assert(cm_compare(a, b, ISP_ASCII) == 0, "test_cm_compare: long strings should ignore case");
+
+    b[CM_LONG - 5] = 'b';
+    mu_assert(cm_compare(a, b, ISP_ASCII) < 0, "test_cm_compare: should find the difference in long strings");
+    mu_assert(cm_compare(b, a, ISP_ASCII) > 0, "test_cm_compare: the order should be reversed");
+}
+
+void test_cm_equal() {
+    char a[CM_LONG + 1], b[CM_LONG + 1];
+
+    mu_assert(cm_equal("Nick^", "nick~", ISP_RFC1459), "test_cm_equal: rfc1459 should fold ^");
+    mu_assert(!cm_equal("Nick^", "nick~", ISP_STRICT_RFC1459), "test_cm_equal: strict-rfc1459 should not fold ^");
+    mu_assert(!cm_equal("nick", "nicks", ISP_RFC1459), "test_cm_equal: different lengths should not be equal");
+
+    memset(a, '[', CM_LONG);
+    memset(b, '{', CM_LONG);
+    a[CM_LONG] = b[CM_LONG] = '\0';
+    mu_assert(cm_equal(a, b, ISP_RFC1459), "test_cm_equal: long strings should ignore case");
+    a[CM_LONG - 1] = 'x';
+    mu_assert(!cm_equal(a, b, ISP_RFC1459), "test_cm_equal: the last character should be compared");
+}
+
+void test_cm_hash() {
+    char a[CM_LONG + 1], b[CM_LONG + 1];
+
+    mu_assert(cm_hash("#Circus[1]", ISP_RFC1459) == cm_hash("#cIRCUS{1}", ISP_RFC1459),
+            "test_cm_hash: the hash should ignore case");
+    mu_assert(cm_hash("#Circus[1]", ISP_ASCII) != cm_hash("#circus{1}", ISP_ASCII),
+            "test_cm_hash: ascii should not fold []");
+    mu_assert(cm_hash("", ISP_ASCII) != 0, "test_cm_hash: the hash should never be 0");
+
+    memset(a, 'X', CM_LONG);
+    memset(b, 'x', CM_LONG);
+    a[CM_LONG] = b[CM_LONG] = '\0';
+    mu_assert(cm_hash(a, ISP_ASCII) == cm_hash(b, ISP_ASCII), "test_cm_hash: long strings should ignore case");
+}
+
+void test_casemap() {
+    mu_run(test_cm_fold);
+    mu_run(test_cm_fold_long);
+    mu_run(test_cm_compare);
+    mu_run(test_cm_equal);
+    mu_run(test_cm_hash);
+}
@@ -20,6 +20,7 @@
  * THE SOFTWARE.
  */
 
+#include <string.h>
 #include "minunit.h"
 #include "test.h"
 #include "../lib/codes.h"
@@ -49,8 +50,39 @@ void test_is_numeric_response() {
     mu_assert(!is_numeric_response("403"), "test_is_numeric_response: 403 should not be a valid response");
 }
 
+void test_cmd_id_textual() {
+    char* names[] = { INVITE, JOIN, KICK, LIST, MODE, NAMES, NICK, NOTICE,
+        PART, PING, PONG, PRIVMSG, TOPIC, USER, QUIT };
+    int i, id;
+
+    /* Each known command must get its own identifier */
+    for (i = 0; i < 15; i++) {
+        id = cmd_id(names[i], strlen(names[i]));
+        mu_assert(id == CMD_INVITE + i, "test_cmd_id_textual: known commands should have their own identifier");
+    }
+
+    mu_assert(cmd_id("privmsg", 7) == CMD_PRIVMSG, "test_cmd_id_textual: commands should be case insensitive");
+    mu_assert(cmd_id("PRIVMSG extra", 7) == CMD_PRIVMSG, "test_cmd_id_textual: only the given length should be considered");
+    mu_assert(cmd_id("PRIVMSGS", 8) == CMD_UNKNOWN, "test_cmd_id_textual: PRIVMSGS should be unknown");
+    mu_assert(cmd_id("PRIV", 4) == CMD_UNKNOWN, "test_cmd_id_textual: PRIV should be unknown");
+    mu_assert(cmd_id("WALLOPS", 7) == CMD_UNKNOWN, "test_cmd_id_textual: WALLOPS should be unknown");
+    mu_assert(cmd_id("ERROR", 5) == CMD_UNKNOWN, "test_cmd_id_textual: ERROR should be unknown");
+    mu_assert(cmd_id("", 0) == CMD_UNKNOWN, "test_cmd_id_textual: empty commands should be unknown");
+}
+
+void test_cmd_id_numeric() {
+    mu_assert(cmd_id(RPL_NAMREPLY, 3) == 353, "test_cmd_id_numeric: 353 should be 353");
+    mu_assert(cmd_id("001", 3) == 1, "test_cmd_id_numeric: 001 should be 1");
+    mu_assert(cmd_id("999", 3) == 999, "test_cmd_id_numeric: 999 should be 999");
+    mu_assert(cmd_id("12", 2) == CMD_UNKNOWN, "test_cmd_id_numeric: 12 should be unknown");
+    mu_assert(cmd_id("1234", 4) == CMD_UNKNOWN, "test_cmd_id_numeric: 1234 should be unknown");
+    mu_assert(cmd_id("4a1", 3) == CMD_UNKNOWN, "test_cmd_id_numeric: 4a1 should be unknown");
+}
+
 void test_codes() {
     mu_run(test_is_error);
     mu_run(test_is_numeric_response);
+    mu_run(test_cmd_id_textual);
+    mu_run(test_cmd_id_numeric);
 }
 
@@ -20,15 +20,18 @@
  * THE SOFTWARE.
  */
 
-#define _XOPEN_SOURCE   /* Support strtok_r in POSIX and BSD environments */
+#define _POSIX_C_SOURCE 200112L      /* Support strtok_r and sched_yield in dispatcher.c */
 
 #include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "minunit.h"
 #include "test.h"
 #include "../lib/events.h"
 #include "../lib/binding.h"
 #include "../lib/irc.h"
 #include "../lib/listener.h"
+#include "../lib/network.h"
 #include "../lib/dispatcher.c"
 
 
@@ -49,6 +52,7 @@ int evt_notices = 0;
 int evt_errors = 0;
 int evt_generics = 0;
 int evt_dispatch = 0;
+char evt_command[100];
 
 /* Handler functions */
 void on_nick(NickEvent* event) { evt_nicks++; }
@@ -61,145 +65,128 @@ void on_list(ListEvent* event) { evt_lists++; }
 void on_invite(InviteEvent* event) { evt_invites++; }
 void on_kick(KickEvent* event) { evt_kicks++; }
 void on_message(MessageEvent* event) { evt_messages++; }
+int on_join_first(JoinEvent* event) { evt_joins *= 10; return EVT_CONTINUE; }
+int on_join_stop(JoinEvent* event) { evt_joins += 5; return EVT_STOP; }
+void on_command(MessageEvent* event) { strcpy(evt_command, event->message); }
 void on_mode(ModeEvent* event) { evt_modes++; }
 void on_ping(PingEvent* event) { evt_pings++; }
 void on_notice(NoticeEvent* event) { evt_notices++; }
 void on_error(ErrorEvent* event) { evt_errors++; }
 void on_generic(GenericEvent* event) { evt_generics++; }
-void on_dispatch(GenericEvent* event) { evt_dispatch++; }
+void on_dispatch(GenericEvent* event) { __sync_fetch_and_add(&evt_dispatch, 1); }
 
+/* Heap allocations. The test binary is linked with -Wl,--wrap=malloc */
+long int allocations = 0;
 
-void test_queue_create_destroy() {
-    q_create();
-    mu_assert(events != NULL, "test_queue_create_destroy: events should not be NULL");
-    mu_assert(events->lock != NULL, "test_queue_create_destroy: events->lock should not be NULL");
-    mu_assert(events->top == NULL, "test_queue_create_destroy: events->top shouldbe NULL");
-    mu_assert(events->bottom == NULL, "test_queue_create_destroy: events->bottom should be NULL");
-    mu_assert(events->size == 0, "test_queue_create_destroy: events size should be 0");
+void* __real_malloc(size_t size);
 
-    q_destroy();
-    mu_assert(events == NULL, "test_queue_create_destroy: events should be NULL");
+void* __wrap_malloc(size_t size) {
+    __sync_fetch_and_add(&allocations, 1);
+    return __real_malloc(size);
 }
 
-void test_queue_push_single() {
-    struct raw_event* raw;
+/* Per channel ordering checks */
+#define ORDERED_CHANNELS 16
+#define ORDERED_EVENTS (ORDERED_CHANNELS * 1000)
 
-    raw = lst_parse(":prefix TEST This is a message test with a :last parameter");
-    q_create();
-    q_push(raw);
+int evt_sequence[ORDERED_CHANNELS];
+int evt_disorders = 0;
+int evt_ordered = 0;
 
-    mu_assert(events->size == 1, "test_queue_push_single: events size should be 1");
-    mu_assert(events->top != NULL, "test_queue_push_single: events->top should not be NULL");
-    mu_assert(events->bottom != NULL, "test_queue_push_single: events->bottom should not be NULL");
-    mu_assert(events->top == events->bottom,
-            "test_queue_push_single: events->top and events->bottom should be the same");
-    mu_assert(events->top->event == raw, "test_queue_push_single: events->top->event should be the raw event");
-    mu_assert(events->top->prev == NULL, "test_queue_push_single: events->top->prev should be NULL");
-    mu_assert(events->top->next == NULL, "test_queue_push_single: events->top->next should be NULL");
+void on_ordered(MessageEvent* event) {
+    int channel = atoi(event->to + 5);      /* Skip the "#chan" prefix */
+    int sequence = atoi(event->message);
 
-    q_destroy();
-    evt_raw_destroy(raw);
+    /* Each channel is only touched by the worker that owns it */
+    if (sequence != evt_sequence[channel] + 1) {
+        __sync_fetch_and_add(&evt_disorders, 1);
+    }
+    evt_sequence[channel] = sequence;
+    __sync_fetch_and_add(&evt_ordered, 1);
 }
 
-void test_queue_push_many() {
-    struct raw_event* raw1, *raw2;
-
-    raw1 = lst_parse(":prefix TEST1 This is a message test with a :last parameter");
-    raw2 = lst_parse(":prefix TEST2 This is a message test with a :last parameter");
-    q_create();
-    q_push(raw1);
-    q_push(raw2);
-
-    mu_assert(events->size == 2, "test_queue_push_many: events size should be 2");
-    mu_assert(events->top != NULL, "test_queue_push_many: events->top should not be NULL");
-    mu_assert(events->bottom != NULL, "test_queue_push_many: events->bottom should not be NULL");
-    mu_assert(events->top != events->bottom,
-            "test_queue_push_many: events->top and events->bottom should not be the same");
-    mu_assert(events->top->next != NULL, "test_queue_push_many: events->top->next should not be NULL");
-    mu_assert(events->top->prev == NULL, "test_queue_push_many: events->top->prev should be NULL");
-    mu_assert(events->top->next->prev == events->top,
-            "test_queue_push_many: events->top->next->prev should not be the top");
-    mu_assert(events->top->next->next == NULL, "test_queue_push_many: events->top->next->next should be NULL");
-    mu_assert(events->top->event == raw1, "test_queue_push_many: events->top->event should be the raw1 event");
-    mu_assert(events->bottom->event == raw2, "test_queue_push_many: events->bottom->event should be the raw2 event");
-    mu_assert(events->top->next->event == raw2, "test_queue_push_many: events->top->next->event should be the raw2 event");
-
-    q_destroy();
-    evt_raw_destroy(raw1);
-    evt_raw_destroy(raw2);
-}
-
-void test_queue_pop_single() {
-    struct raw_event* raw, *result;
-
-    raw = lst_parse(":prefix TEST This is a message test with a :last parameter");
-    q_create();
-    q_push(raw);
-    result = q_pop();
-
-    mu_assert(events->size == 0, "test_queue_pop_single: events size should be 0");
-    mu_assert(events->top == NULL, "test_queue_pop_single: events->top should be NULL");
-    mu_assert(events->bottom == NULL, "test_queue_pop_single: events->bottom should be NULL");
-    mu_assert(result == raw, "test_queue_pop_single: the returned value should be the added event");
-
-    q_destroy();
-    evt_raw_destroy(raw);
-}
 
-void test_queue_pop_many() {
-    struct raw_event* raw1, *raw2, *result;
+void test_events_create_destroy() {
+    struct dsp_worker worker;
 
-    raw1 = lst_parse(":prefix TEST1 This is a message test with a :last parameter");
-    raw2 = lst_parse(":prefix TEST2 This is a message test with a :last parameter");
-    q_create();
-    q_push(raw1);
-    q_push(raw2);
-    result = q_pop();
+    events_create(&worker);
+    mu_assert(worker.events != NULL, "test_events_create_destroy: events should not be NULL");
+    mu_assert(q_size(worker.events) == 0, "test_events_create_destroy: events size should be 0");
 
-    mu_assert(result == raw1, "test_queue_pop_many: result should be raw1");
-    mu_assert(events->size == 1, "test_queue_pop_many: events size should be 1");
-    mu_assert(events->top != NULL, "test_queue_pop_many: events->top should not be NULL");
-    mu_assert(events->bottom != NULL, "test_queue_pop_many: events->bottom should not be NULL");
-    mu_assert(events->top == events->bottom,
-            "test_queue_pop_many: events->top and events->bottom should be the same");
-    mu_assert(events->top->next == NULL, "test_queue_pop_many: events->top->next should be NULL");
-    mu_assert(events->top->prev == NULL, "test_queue_pop_many: events->top->prev should be NULL");
-    mu_assert(events->top->event == raw2, "test_queue_pop_many: events->top->event should be the raw2 event");
-    mu_assert(events->bottom->event == raw2, "test_queue_pop_many: events->bottom->event should be the raw2 event");
+    events_destroy(&worker);
+    mu_assert(worker.events == NULL, "test_events_create_destroy: events should be NULL");
+}
+
+void test_events_destroy_pending() {
+    struct dsp_worker worker;
 
-    q_destroy();
-    evt_raw_destroy(raw1);
-    evt_raw_destroy(raw2);
+    events_create(&worker);
+    q_push(worker.events, lst_parse(":prefix TEST1 This is a message test with a :last parameter"));
+    q_push(worker.events, lst_parse(":prefix TEST2 This is a message test with a :last parameter"));
+    mu_assert(q_size(worker.events) == 2, "test_events_destroy_pending: events size should be 2");
+
+    events_destroy(&worker);   /* Pending events must be freed */
+    mu_assert(worker.events == NULL, "test_events_destroy_pending: events should be NULL");
 }
 
 void test_consumer_create_destroy() {
-    consumer_create();
+    int i;
+
+    consumer_create(4);
 
     mu_assert(consumer != NULL, "test_consumer_create_destroy: consumer should not be NULL");
-    mu_assert(consumer->worker != NULL, "test_consumer_create_destroy: consumer->worker should not be NULL");
-    mu_assert(consumer->lock != NULL, "test_consumer_create_destroy: consumer->lock should not be NULL");
-    mu_assert(consumer->ready != NULL, "test_consumer_create_destroy: consumer->ready should not be NULL");
-    mu_assert(consumer->terminate == 0, "test_consumer_create_destroy: consumer->terminate should not be '0'");
+    mu_assert(consumer->num_workers == 4, "test_consumer_create_destroy: consumer->num_workers should be '4'");
+    mu_assert(consumer->workers != NULL, "test_consumer_create_destroy: consumer->workers should not be NULL");
+    mu_assert(consumer->terminate == 0, "test_consumer_create_destroy: consumer->terminate should be '0'");
+    for (i = 0; i <= 4; i++) {
+        mu_assert(consumer->workers[i].events != NULL, "test_consumer_create_destroy: worker events should not be NULL");
+    }
 
     consumer_destroy();
     mu_assert(consumer == NULL, "test_consumer_create_destroy: consumer should be NULL");
 }
 
 void test_dsp_start_shutdown() {
-    dsp_start();
-    mu_assert(events != NULL, "test_dsp_start_shutdown: events should not be NULL");
+    dsp_start(DSP_WORKERS);
     mu_assert(consumer != NULL, "test_dsp_start_shutdown: consumer should not be NULL");
+    mu_assert(consumer->num_workers == DSP_WORKERS, "test_dsp_start_shutdown: consumer->num_workers should be DSP_WORKERS");
 
     dsp_shutdown();
     mu_assert(consumer == NULL, "test_dsp_start_shutdown: consumer should be NULL");
-    mu_assert(events == NULL, "test_dsp_start_shutdown: events should be NULL");
+
+    dsp_start(DSP_INLINE);
+    mu_assert(consumer == NULL, "test_dsp_start_shutdown: inline dispatch should not create consumers");
+    mu_assert(inline_dispatch == 1, "test_dsp_start_shutdown: inline_dispatch should be '1'");
+    dsp_shutdown();
+    mu_assert(inline_dispatch == 0, "test_dsp_start_shutdown: inline_dispatch should be '0'");
+}
+
+void test_dsp_route() {
+    struct raw_event* ping = lst_parse("PING :zelazny.freenode.net");
+    struct raw_event* lower = lst_parse(":nick!~user@server PRIVMSG #circus :Hi");
+    struct raw_event* upper = lst_parse(":nick!~user@server PRIVMSG #CIRCUS :Hi");
+    struct raw_event* none = lst_parse("QUIT");
+
+    consumer_create(8);
+
+    mu_assert(dsp_route(ping) == &consumer->workers[8], "test_dsp_route: PING should go to the fast lane");
+    mu_assert(dsp_route(lower) == dsp_route(upper), "test_dsp_route: targets should be case insensitive");
+    mu_assert(dsp_route(lower) != &consumer->workers[8], "test_dsp_route: PRIVMSG should not go to the fast lane");
+    mu_assert(dsp_route(none) == &consumer->workers[0], "test_dsp_route: events without target should go to the first worker");
+
+    consumer_destroy();
+
+    evt_raw_destroy(ping);
+    evt_raw_destroy(lower);
+    evt_raw_destroy(upper);
+    evt_raw_destroy(none);
 }
 
 void test_dsp_dispatch() {
     struct raw_event* raw = lst_parse(":nick!~user@server 305 circus-bot :Test message");
 
     irc_bind_event(RPL_UNAWAY, (Callback) on_dispatch);
-    dsp_start();
+    dsp_start(DSP_WORKERS);
     dsp_dispatch(raw);
 
     poll(0, 0, 1000);   /* Make sure the dispatcher thread process the event */
@@ -210,6 +197,160 @@ void test_dsp_dispatch() {
     mu_assert(evt_dispatch == 1, "test_dsp_dispatch: evt_dispatch should be '1'");
 }
 
+void test_dsp_dispatch_inline() {
+    evt_dispatch = 0;
+    irc_bind_event(RPL_UNAWAY, (Callback) on_dispatch);
+    dsp_start(DSP_INLINE);
+
+    /* The callback runs before dsp_dispatch returns */
+    dsp_dispatch(lst_parse(":nick!~user@server 305 circus-bot :Test message"));
+    mu_assert(evt_dispatch == 1, "test_dsp_dispatch_inline: evt_dispatch should be '1'");
+
+    dsp_shutdown();
+    irc_unbind_event(RPL_UNAWAY);
+}
+
+static void on_task(void* data) {
+    __atomic_add_fetch((int*) data, 1, __ATOMIC_RELEASE);
+}
+
+void test_dsp_call() {
+    int calls = 0, retries;
+
+    /* Tasks do not fire any binding */
+    evt_generics = 0;
+    irc_bind_event(ALL, (Callback) on_generic);
+    dsp_start(DSP_WORKERS);
+    dsp_call(on_task, &calls);
+
+    for (retries = 0; retries < 100 && __atomic_load_n(&calls, __ATOMIC_ACQUIRE) < 1; retries++) {
+        poll(0, 0, 10);
+    }
+
+    dsp_shutdown();
+    irc_unbind_event(ALL);
+
+    mu_assert(calls == 1, "test_dsp_call: the task should run in a worker");
+    mu_assert(evt_generics == 0, "test_dsp_call: tasks should not be events");
+}
+
+void test_dsp_dispatch_many() {
+    int i, retries;
+
+    evt_dispatch = 0;
+    irc_bind_event(RPL_UNAWAY, (Callback) on_dispatch);
+    dsp_start(DSP_WORKERS);
+
+    /* Dispatch more events than the queue can hold */
+    for (i = 0; i < Q_SIZE * 3; i++) {
+        dsp_dispatch(lst_parse(":nick!~user@server 305 circus-bot :Test message"));
+    }
+
+    for (retries = 0; retries < 100 && __atomic_load_n(&evt_dispatch, __ATOMIC_ACQUIRE) < Q_SIZE * 3; retries++) {
+        poll(0, 0, 10);
+    }
+
+    dsp_shutdown();
+    irc_unbind_event(RPL_UNAWAY);
+
+    mu_assert(evt_dispatch == Q_SIZE * 3, "test_dsp_dispatch_many: all events should be dispatched");
+}
+
+void test_dsp_drain() {
+    int i;
+
+    evt_dispatch = 0;
+    irc_bind_event(RPL_UNAWAY, (Callback) on_dispatch);
+    dsp_start(4);
+
+    /* Events for several targets, so all the workers have some */
+    for (i = 0; i < Q_SIZE; i++) {
+        char msg[100];
+        sprintf(msg, ":nick!~user@server 305 circus-bot%d :Test message", i % 16);
+        dsp_dispatch(lst_parse(msg));
+    }
+
+    dsp_drain();
+    mu_assert(__atomic_load_n(&evt_dispatch, __ATOMIC_ACQUIRE) == Q_SIZE, "test_dsp_drain: all events should be handled");
+
+    dsp_drain();    /* Draining again with nothing queued returns at once */
+    dsp_shutdown();
+
+    /* Stopped workers never reach the barriers, as when shutting down while draining */
+    dsp_start(4);
+    __atomic_store_n(&consumer->terminate, 1, __ATOMIC_RELEASE);
+    for (i = 0; i <= consumer->num_workers; i++) {
+        q_wake(consumer->workers[i].events);
+    }
+    dsp_drain();
+    mu_assert(consumer != NULL, "test_dsp_drain: draining should not stop the dispatcher");
+    dsp_shutdown();
+    irc_unbind_event(RPL_UNAWAY);
+}
+
+void test_dsp_dispatch_ordered() {
+    char msg[100];
+    int i, retries;
+
+    memset(evt_sequence, 0, sizeof(evt_sequence));
+    evt_disorders = 0;
+    evt_ordered = 0;
+    irc_bind_event(PRIVMSG, (Callback) on_ordered);
+    dsp_start(4);
+
+    /* Interleave the messages of several channels. Each channel must see its own in order */
+    for (i = 0; i < ORDERED_EVENTS; i++) {
+        sprintf(msg, ":nick!~user@server PRIVMSG #chan%d :%d", i % ORDERED_CHANNELS, i / ORDERED_CHANNELS + 1);
+        dsp_dispatch(lst_parse(msg));
+    }
+
+    for (retries = 0; retries < 100 && __atomic_load_n(&evt_ordered, __ATOMIC_ACQUIRE) < ORDERED_EVENTS; retries++) {
+        poll(0, 0, 10);
+    }
+
+    dsp_shutdown();
+    irc_unbind_event(PRIVMSG);
+
+    mu_assert(evt_ordered == ORDERED_EVENTS, "test_dsp_dispatch_ordered: all events should be dispatched");
+    mu_assert(evt_disorders == 0, "test_dsp_dispatch_ordered: events for the same channel should be ordered");
+}
+
+void test_dsp_dispatch_no_alloc() {
+    char event[] = ":nick!~user@server 305 circus-bot :Test message";
+    char command[] = ":nick!~user@server PRIVMSG #circus :!cmd Do it";
+    long int before;
+    int i, retries;
+
+    evt_dispatch = 0;
+    irc_bind_event(RPL_UNAWAY, (Callback) on_dispatch);
+    irc_bind_command("!cmd", (Callback) on_dispatch);
+    dsp_start(DSP_WORKERS);
+
+    /* The first events fill the event pool */
+    for (i = 0; i < 2000; i++) {
+        lst_handle(NULL, i % 2 == 0 ? event : command);
+    }
+    for (retries = 0; retries < 100 && __atomic_load_n(&evt_dispatch, __ATOMIC_ACQUIRE) < 2000; retries++) {
+        poll(0, 0, 10);
+    }
+
+    /* Once the pool is warm, dispatching does not touch the heap */
+    before = __atomic_load_n(&allocations, __ATOMIC_ACQUIRE);
+    for (i = 0; i < 2000; i++) {
+        lst_handle(NULL, i % 2 == 0 ? event : command);
+    }
+    for (retries = 0; retries < 100 && __atomic_load_n(&evt_dispatch, __ATOMIC_ACQUIRE) < 4000; retries++) {
+        poll(0, 0, 10);
+    }
+
+    mu_assert(evt_dispatch == 4000, "test_dsp_dispatch_no_alloc: all events should be dispatched");
+    mu_assert(allocations == before, "test_dsp_dispatch_no_alloc: dispatching should not allocate memory");
+
+    dsp_shutdown();
+    irc_unbind_event(RPL_UNAWAY);
+    irc_unbind_command("!cmd");
+}
+
 void test_fire_evt_nick() {
     struct raw_event* raw;
 
@@ -249,6 +390,40 @@ void test_fire_evt_join() {
     evt_raw_destroy(raw);
 }
 
+void test_fire_evt_chain() {
+    struct raw_event* raw;
+
+    evt_joins = 1;
+    irc_bind_event(JOIN, (Callback) on_join);
+    irc_add_handler(JOIN, (Handler) on_join_first, 10);
+    raw = lst_parse("JOIN #circus");
+    _fire_event(raw);
+    mu_assert(evt_joins == 11, "test_fire_evt_chain: handlers should run by priority");
+
+    /* A handler can stop the event before it gets to the bound callback */
+    evt_joins = 1;
+    irc_add_handler(JOIN, (Handler) on_join_stop, 5);
+    _fire_event(raw);
+    mu_assert(evt_joins == 15, "test_fire_evt_chain: the chain should stop");
+
+    /* Events with handlers do not fall back to the generic ones */
+    evt_generics = 0;
+    irc_unbind_event(JOIN);
+    irc_bind_event(ALL, (Callback) on_generic);
+    _fire_event(raw);
+    mu_assert(evt_generics == 0, "test_fire_evt_chain: generic callbacks should not run");
+
+    irc_remove_handler(JOIN, (Handler) on_join_first);
+    irc_remove_handler(JOIN, (Handler) on_join_stop);
+    _fire_event(raw);
+    mu_assert(evt_generics == 1, "test_fire_evt_chain: generic callbacks should run without handlers");
+
+    irc_unbind_event(ALL);
+    evt_raw_destroy(raw);
+    evt_joins = 1;
+    evt_generics = 0;
+}
+
 void test_fire_evt_part() {
     struct raw_event* raw;
 
@@ -441,19 +616,120 @@ void test_fire_evt_generic() {
     evt_raw_destroy(raw);
 }
 
+void test_fire_evt_isupport() {
+    int socks[2];
+    struct raw_event* raw;
+    Connection* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    conn = net_attach(socks[0]);
+    raw = lst_parse(":server 005 circus-bot CHANTYPES=# MODES=4 LINELEN=1024 :are supported by this server");
+    raw->conn = conn;
+
+    irc_bind_event(RPL_ISUPPORT, (Callback) on_generic);
+    _track_event(raw);
+    _fire_event(raw);
+
+    mu_assert(net_isupport(conn)->modes == 4, "test_fire_evt_isupport: modes should be '4'");
+    mu_assert(net_isupport(conn)->linelen == 1024, "test_fire_evt_isupport: linelen should be '1024'");
+    mu_assert(evt_generics == 3, "test_fire_evt_isupport: the user callback should be invoked");
+
+    irc_unbind_event(RPL_ISUPPORT);
+    evt_raw_destroy(raw);
+    net_free(conn);
+    close(socks[1]);
+}
+
+void test_track_evt_join() {
+    int socks[2];
+    struct raw_event* raw;
+    Connection* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    conn = net_attach(socks[0]);
+    raw = lst_parse(":nacx!~nacx@127.0.0.1 JOIN #circus");
+    raw->conn = conn;
+    _track_event(raw);
+
+    mu_assert(trk_is_member(net_tracker(conn), "#circus", "nacx"), "test_track_evt_join: nacx should be in #circus");
+
+    evt_raw_destroy(raw);
+    net_free(conn);
+    close(socks[1]);
+}
+
+void test_fire_evt_command() {
+    int socks[2];
+    struct raw_event* raw;
+    Connection* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    conn = net_attach(socks[0]);
+    raw = lst_parse(":server 001 circus-bot :Welcome");
+    raw->conn = conn;
+    _track_event(raw);
+    evt_raw_destroy(raw);
+
+    irc_bind_command("help", (Callback) on_command);
+    irc_command_prefix("!");
+    irc_command_nick(1);
+
+    *evt_command = '\0';
+    raw = lst_parse(":nacx!~nacx@127.0.0.1 PRIVMSG #circus :!HELP me please");
+    _fire_event(raw);
+    mu_assert(s_eq(evt_command, "me please"), "test_fire_evt_command: the prefixed command should get its arguments");
+    evt_raw_destroy(raw);
+
+    *evt_command = '\0';
+    raw = lst_parse(":nacx!~nacx@127.0.0.1 PRIVMSG #circus :Circus-Bot: help now");
+    raw->conn = conn;
+    _fire_event(raw);
+    mu_assert(s_eq(evt_command, "now"), "test_fire_evt_command: the command addressed to the bot should match");
+    evt_raw_destroy(raw);
+
+    *evt_command = '\0';
+    raw = lst_parse(":nacx!~nacx@127.0.0.1 PRIVMSG #circus :help without prefix");
+    _fire_event(raw);
+    mu_assert(*evt_command == '\0', "test_fire_evt_command: words without a prefix should not be commands");
+    evt_raw_destroy(raw);
+
+    irc_command_nick(0);
+    irc_command_prefix("");
+    irc_unbind_command("help");
+    net_free(conn);
+    close(socks[1]);
+}
+
 void test_dispatcher() {
-    mu_run(test_queue_create_destroy);
-    mu_run(test_queue_push_single);
-    mu_run(test_queue_push_many);
-    mu_run(test_queue_pop_single);
-    mu_run(test_queue_pop_many);
+    mu_run(test_events_create_destroy);
+    mu_run(test_events_destroy_pending);
     mu_run(test_consumer_create_destroy);
     mu_run(test_dsp_start_shutdown);
+    mu_run(test_dsp_route);
     mu_run(test_dsp_dispatch);
+    mu_run(test_dsp_dispatch_inline);
+    mu_run(test_dsp_call);
+    mu_run(test_dsp_dispatch_many);
+    mu_run(test_dsp_drain);
+    mu_run(test_dsp_dispatch_ordered);
+    mu_run(test_dsp_dispatch_no_alloc);
 
     mu_run(test_fire_evt_nick);
     mu_run(test_fire_evt_quit);
     mu_run(test_fire_evt_join);
+    mu_run(test_fire_evt_chain);
     mu_run(test_fire_evt_part);
     mu_run(test_fire_evt_topic);
     mu_run(test_fire_evt_names);
@@ -461,11 +737,14 @@ void test_dispatcher() {
     mu_run(test_fire_evt_invite);
     mu_run(test_fire_evt_kick);
     mu_run(test_fire_evt_message);
+    mu_run(test_fire_evt_command);
     mu_run(test_fire_evt_mode);
     mu_run(test_fire_evt_ping);
     mu_run(test_fire_evt_notice);
     mu_run(test_fire_evt_error);
     mu_run(test_fire_evt_generic);
+    mu_run(test_fire_evt_isupport);
+    mu_run(test_track_evt_join);
 
     bnd_destroy();
 }
@@ -22,12 +22,15 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "minunit.h"
 #include "test.h"
 #include "../lib/utils.h"
 #include "../lib/listener.h"
 #include "../lib/irc.h"
 #include "../lib/events.h"
+#include "../lib/network.h"
 
 
 void test_user_info() {
@@ -55,6 +58,29 @@ void test_evt_raw_create() {
     evt_raw_destroy(raw);
 }
 
+void test_evt_raw_recycle() {
+    int i;
+    struct raw_event* raw, *recycled;
+    struct raw_event* events[EVT_POOL_CHUNK + 1];
+
+    /* Destroyed events are reused */
+    raw = evt_raw_create();
+    evt_raw_destroy(raw);
+    recycled = evt_raw_create();
+    mu_assert(recycled == raw, "test_evt_raw_recycle: the destroyed event should be reused");
+    evt_raw_destroy(recycled);
+
+    /* The pool grows when all events are in use */
+    for (i = 0; i <= EVT_POOL_CHUNK; i++) {
+        events[i] = evt_raw_create();
+        mu_assert(i == 0 || events[i] != events[i - 1], "test_evt_raw_recycle: events in use should be different");
+    }
+
+    for (i = 0; i <= EVT_POOL_CHUNK; i++) {
+        evt_raw_destroy(events[i]);
+    }
+}
+
 void test_evt_error_one_param() {
     ErrorEvent event;
     struct raw_event* raw;
@@ -311,6 +337,39 @@ void test_evt_message_private() {
     evt_raw_destroy(raw);   /* Cleanup */
 }
 
+void test_evt_message_chantypes() {
+    MessageEvent event;
+    struct raw_event* raw;
+    struct net_conn* conn;
+    char* tokens[] = { "CHANTYPES=!" };
+    int socks[2];
+
+    /* Without a connection, the default channel types apply */
+    raw = lst_parse(":nacx!~nacx@127.0.0.1 PRIVMSG &circus :Hi there");
+    event = evt_message(raw);
+    mu_assert(event.is_channel, "test_evt_message_chantypes: '&circus' should be a channel by default");
+    evt_raw_destroy(raw);
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, socks);
+    conn = net_attach(socks[0]);
+    isp_parse(net_isupport(conn), 1, tokens);
+
+    raw = lst_parse(":nacx!~nacx@127.0.0.1 PRIVMSG #circus :Hi there");
+    raw->conn = conn;
+    event = evt_message(raw);
+    mu_assert(!event.is_channel, "test_evt_message_chantypes: '#circus' should not be a channel with CHANTYPES=!");
+    evt_raw_destroy(raw);
+
+    raw = lst_parse(":nacx!~nacx@127.0.0.1 PRIVMSG !circus :Hi there");
+    raw->conn = conn;
+    event = evt_message(raw);
+    mu_assert(event.is_channel, "test_evt_message_chantypes: '!circus' should be a channel with CHANTYPES=!");
+    evt_raw_destroy(raw);
+
+    net_free(conn);
+    close(socks[1]);
+}
+
 void test_evt_ping() {
     PingEvent event;
     struct raw_event* raw;
@@ -472,6 +531,7 @@ void test_user_evt_mode_setunset() {
 void test_events() {
     mu_run(test_user_info);
     mu_run(test_evt_raw_create);
+    mu_run(test_evt_raw_recycle);
     mu_run(test_evt_error_one_param);
     mu_run(test_evt_error_no_params);
     mu_run(test_evt_generic_one_param);
@@ -489,6 +549,7 @@ void test_events() {
     mu_run(test_evt_kick);
     mu_run(test_evt_message_channel);
     mu_run(test_evt_message_private);
+    mu_run(test_evt_message_chantypes);
     mu_run(test_evt_ping);
     mu_run(test_evt_notice);
     mu_run(test_channel_evt_mode_set);
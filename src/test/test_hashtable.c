@@ -21,6 +21,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "minunit.h"
 #include "test.h"
 #include "../lib/hashtable.c"
@@ -33,64 +34,88 @@ void test_ht_create() {
     mu_assert(ht->num_entries == 0, "test_ht_create: ht->num_entries should be 0");
 }
 
+void test_ht_hash() {
+    mu_assert(ht_hash("PRIVMSG#op") != ht_hash("PRIVMSG#po"), "test_ht_hash: anagrams should not collide");
+    mu_assert(ht_hash("") != 0, "test_ht_hash: 0 is reserved for empty slots");
+}
+
 void test_ht_add_value() {
-    unsigned char idx;
     char* key = "test-key";
+    struct ht_entry* entry;
 
     ht_add_value(ht, key, key);
-    idx = ht_hash(key);
+    entry = &ht->entries[ht_slot(ht, key, ht_hash(key))];
 
-    mu_assert(ht->entries[idx] != NULL, "test_ht_add: ht->entries[idx] should not be NULL");
+    mu_assert(entry->hash != 0, "test_ht_add: the entry should not be empty");
+    mu_assert(entry->data.key == entry->inline_key, "test_ht_add: short keys should be stored inline");
     mu_assert(ht->num_entries == 1, "test_ht_add: ht->num_entries should be 1");
 
     ht_del(ht, key);
 }
 
+void test_ht_add_long_key() {
+    char key[HT_KEY_INLINE * 2];
+    struct ht_data* data;
+
+    memset(key, 'k', sizeof(key) - 1);
+    key[sizeof(key) - 1] = '\0';
+    ht_add_value(ht, key, key);
+
+    data = ht_find(ht, key);
+    mu_assert(data != NULL, "test_ht_add_long_key: Entry should not be NULL");
+    mu_assert(s_eq(data->key, key), "test_ht_add_long_key: key does not match");
+    mu_assert(data->key != key, "test_ht_add_long_key: key should be copied");
+
+    ht_del(ht, key);
+    mu_assert(ht->num_entries == 0, "test_ht_add_long_key: ht->num_entries should be 0");
+}
+
 void test_ht_add_replace() {
     char* key = "test-key";
 
     ht_add_value(ht, key, key);
-    ht_add_value(ht, key, key);
+    ht_add_value(ht, key, ht);
 
     mu_assert(ht->num_entries == 1, "test_ht_add_replace: ht->num_entries should be 1");
+    mu_assert(ht_find(ht, key)->value == ht, "test_ht_add_replace: value should be replaced");
 
     ht_del(ht, key);
 }
 
 void test_ht_add_function() {
-    unsigned char idx;
     char* key = "test-key";
+    struct ht_data* data;
 
     ht_add_function(ht, key, test_ht_add_function);
-    idx = ht_hash(key);
+    data = ht_find(ht, key);
 
-    mu_assert(ht->entries[idx] != NULL, "test_ht_add: ht->entries[idx] should not be NULL");
-    mu_assert(ht->num_entries == 1, "test_ht_add: ht->num_entries should be 1");
+    mu_assert(data != NULL, "test_ht_add_function: Entry should not be NULL");
+    mu_assert(data->function == test_ht_add_function, "test_ht_add_function: function does not match");
+    mu_assert(ht->num_entries == 1, "test_ht_add_function: ht->num_entries should be 1");
 
     ht_del(ht, key);
 }
 
 void test_ht_del() {
-    unsigned char idx;
     char* key = "test-key";
+    int idx;
 
     ht_add_value(ht, key, key);
 
-    idx = ht_hash(key);
+    idx = ht_slot(ht, key, ht_hash(key));
     ht_del(ht, key);
 
-    mu_assert(ht->entries[idx] == NULL, "test_ht_del: ht->entries[idx] should be NULL");
+    mu_assert(ht->entries[idx].hash == 0, "test_ht_del: the entry should be empty");
     mu_assert(ht->num_entries == 0, "test_ht_del: ht->num_entries should be 0");
 }
 
 void test_ht_del_unexisting() {
     char* key = "test-key";
-    unsigned char idx;
 
-    idx = ht_hash(key);
     ht_del(ht, key);
 
-    mu_assert(ht->entries[idx] == NULL, "test_ht_del_unexisting: ht->entries[idx] should be NULL");
+    mu_assert(ht_find(ht, key) == NULL, "test_ht_del_unexisting: Entry should be NULL");
+    mu_assert(ht->num_entries == 0, "test_ht_del_unexisting: ht->num_entries should be 0");
 }
 
 void test_ht_find() {
@@ -114,19 +139,73 @@ void test_ht_find_unexisting() {
     mu_assert(data == NULL, "test_ht_find_unexisting: Entry should be NULL");
 }
 
+void test_ht_grow() {
+    char key[20];
+    int i, found = 0;
+
+    for (i = 0; i < 10000; i++) {
+        sprintf(key, "!cmd%d", i);
+        ht_add_value(ht, key, ht);
+    }
+
+    mu_assert(ht->num_entries == 10000, "test_ht_grow: ht->num_entries should be 10000");
+    mu_assert(ht->num_entries <= HT_MAX_LOAD(ht->size), "test_ht_grow: the table should have grown");
+
+    /* Delete half of the keys. The rest must still be reachable */
+    for (i = 0; i < 10000; i += 2) {
+        sprintf(key, "!cmd%d", i);
+        ht_del(ht, key);
+    }
+
+    for (i = 0; i < 10000; i++) {
+        sprintf(key, "!cmd%d", i);
+        if (ht_find(ht, key) != NULL) {
+            found++;
+            mu_assert(i % 2 == 1, "test_ht_grow: deleted keys should not be found");
+        }
+        ht_del(ht, key);
+    }
+
+    mu_assert(found == 5000, "test_ht_grow: remaining keys should be found");
+    mu_assert(ht->num_entries == 0, "test_ht_grow: ht->num_entries should be 0");
+}
+
+void test_ht_add_str() {
+    const char* key = str_intern("PRIVMSG!interned");
+    struct ht_data* data;
+    struct ht_table* copy;
+
+    ht_add_str(ht, key, "interned");
+    data = ht_find_str(ht, key);
+    mu_assert(data != NULL && data->key == key, "test_ht_add_str: the interned key should be shared");
+    mu_assert(ht_find(ht, "PRIVMSG!interned") == data, "test_ht_add_str: the key should be found by its text");
+
+    copy = ht_copy(ht);
+    mu_assert(ht_find_str(copy, key)->key == key, "test_ht_add_str: the copy should share the interned key");
+    ht_destroy(copy);
+
+    ht_del(ht, "PRIVMSG!interned");
+    mu_assert(ht_find_str(ht, key) == NULL, "test_ht_add_str: the key should be deleted");
+    str_release(key);
+}
+
 void test_ht_destroy() {
     ht_destroy(ht);
 }
 
 void test_hashtable() {
     mu_run(test_ht_create);
+    mu_run(test_ht_hash);
     mu_run(test_ht_add_value);
+    mu_run(test_ht_add_long_key);
     mu_run(test_ht_add_replace);
+    mu_run(test_ht_add_function);
     mu_run(test_ht_del);
     mu_run(test_ht_del_unexisting);
     mu_run(test_ht_find);
     mu_run(test_ht_find_unexisting);
+    mu_run(test_ht_grow);
+    mu_run(test_ht_add_str);
     mu_run(test_ht_destroy);
 
 }
-
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "minunit.h"
+#include "test.h"
+#include "../lib/intern.h"
+
+#define STR_THREADS 4           /* Threads interning the same strings at once */
+#define STR_KEYS 1000           /* Strings interned by each thread */
+
+void test_str_intern() {
+    int count = str_count();
+    const char* a = str_intern("nacx");
+    const char* b = str_intern("nacx");
+    const char* c = str_intern_len("nacx!~nacx@127.0.0.1", 4);
+    const char* d = str_intern("Nacx");
+
+    mu_assert(a == b && b == c, "test_str_intern: equal strings should be the same pointer");
+    mu_assert(a != d, "test_str_intern: strings with a different case should be different pointers");
+    mu_assert(strcmp(c, "nacx") == 0, "test_str_intern: the string should be terminated");
+    mu_assert(str_count() == count + 2, "test_str_intern: there should be two new strings");
+    mu_assert(str_retain(a) == a, "test_str_intern: retain should return the same string");
+
+    str_release(a);
+    str_release(b);
+    str_release(c);
+    mu_assert(str_count() == count + 2, "test_str_intern: the string should be kept while it is retained");
+    str_release(a);
+    str_release(d);
+    mu_assert(str_count() == count, "test_str_intern: released strings should be freed");
+}
+
+void test_str_fold() {
+    int count = str_count();
+    const char* a = str_intern("Nick[1]^");
+    const char* b = str_intern("NICK{1}~");
+    const char* lower = str_intern("nick{1}~");
+
+    mu_assert(str_fold(a, ISP_RFC1459) == str_fold(b, ISP_RFC1459), "test_str_fold: nicks should be equal with rfc1459");
+    mu_assert(str_fold(a, ISP_RFC1459) == lower, "test_str_fold: the folded form should be the interned lowercase string");
+    mu_assert(str_fold(lower, ISP_RFC1459) == lower, "test_str_fold: lowercase strings should be their own folded form");
+    mu_assert(str_fold(a, ISP_STRICT_RFC1459) != str_fold(b, ISP_STRICT_RFC1459), "test_str_fold: nicks should differ with strict-rfc1459");
+    mu_assert(strcmp(str_fold(a, ISP_ASCII), "nick[1]^") == 0, "test_str_fold: brackets should be kept with ascii");
+    mu_assert(str_hash(a) != str_hash(b), "test_str_fold: different strings should have different hashes");
+
+    str_release(a);
+    str_release(b);
+    str_release(lower);
+    mu_assert(str_count() == count, "test_str_fold: folded forms should be freed with their strings");
+}
+
+/* Intern and release the same strings as the other threads */
+static void* str_worker(void* arg) {
+    const char* strs[STR_KEYS];
+    char text[16];
+    int i, *same = (int*) arg;
+
+    for (i = 0; i < STR_KEYS; i++) {
+        sprintf(text, "nick%d", i);
+        strs[i] = str_intern(text);
+        *same += strs[i] == str_fold(strs[i], ISP_RFC1459);
+    }
+    for (i = 0; i < STR_KEYS; i++) {
+        str_release(strs[i]);
+    }
+
+    return NULL;
+}
+
+void test_str_threads() {
+    pthread_t threads[STR_THREADS];
+    int same[STR_THREADS], i, count = str_count();
+
+    for (i = 0; i < STR_THREADS; i++) {
+        same[i] = 0;
+        pthread_create(&threads[i], NULL, str_worker, &same[i]);
+    }
+    for (i = 0; i < STR_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        mu_assert(same[i] == STR_KEYS, "test_str_threads: lowercase strings should be their own folded form");
+    }
+
+    mu_assert(str_count() == count, "test_str_threads: all strings should be freed");
+}
+
+void test_intern() {
+    mu_run(test_str_intern);
+    mu_run(test_str_fold);
+    mu_run(test_str_threads);
+}
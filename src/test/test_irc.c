@@ -28,18 +28,27 @@
 #include <sys/socket.h>
 #include <signal.h>
 #include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 #include "minunit.h"
 #include "test.h"
 #include "../lib/binding.h"
 #include "../lib/irc.c"
 
 
+#define MANY_PORT "19877"      /* Port of the mock server used to test many connections */
+#define MANY_CONNS 1000         /* Number of simultaneous connections to the mock server */
+
 /* The mock socket where the messages will be read */
 FILE* mock_socket;
 
 /* Read the data from the mock socket */
 void read_mock(char* msg) {
-    char* ret = fgets(msg, READ_BUF, mock_socket);
+    char* ret;
+    net_flush(net_current());   /* Messages are queued until the event loop sends them */
+    ret = fgets(msg, READ_BUF, mock_socket);
     mu_assert(ret != NULL, "read_mock: fgets should not return NULL");
 }
 
@@ -79,7 +88,7 @@ void test_bind_command() {
     Callback binding = NULL;
 
     irc_bind_command("foo", (Callback) test_bind_command);
-    binding = bnd_lookup("PRIVMSG#foo");
+    binding = bnd_lookup_command("foo bar", NULL, NULL);
     mu_assert(binding == (Callback) test_bind_command, "test_bind_command: bound function is not the same");
 }
 
@@ -87,7 +96,7 @@ void test_unbind_command() {
     irc_bind_command("foo", (Callback) test_bnd_bind);
     irc_unbind_command("foo");
 
-    mu_assert(bnd_lookup("PRIVMSG#foo") == NULL, "test_unbind_command: binding should be null");
+    mu_assert(bnd_lookup_command("foo", NULL, NULL) == NULL, "test_unbind_command: binding should be null");
 }
 
 void test_irc_nick() {
@@ -191,6 +200,62 @@ void test_irc_message() {
             "test_irc_message: msg should be 'PRIVMSG #circus :Foo bar\\r\\n'");
 }
 
+void test_irc_message_many() {
+    char msg[READ_BUF];
+    char* targets[] = { "#circus", "#clowns", "nacx" };
+    char* tokens[] = { "TARGMAX=NOTICE:4,PRIVMSG:2" };
+
+    /* Without RPL_ISUPPORT, send one line per target */
+    irc_message_many(targets, 2, "Foo bar");
+    read_mock(msg);
+    mu_assert(s_eq(msg, "PRIVMSG #circus :Foo bar\r\n"), "test_irc_message_many: msg should be 'PRIVMSG #circus :Foo bar\\r\\n'");
+    read_mock(msg);
+    mu_assert(s_eq(msg, "PRIVMSG #clowns :Foo bar\r\n"), "test_irc_message_many: msg should be 'PRIVMSG #clowns :Foo bar\\r\\n'");
+
+    isp_parse(net_isupport(net_current()), 1, tokens);
+    irc_message_many(targets, 3, "Foo bar");
+    isp_init(net_isupport(net_current()));
+
+    read_mock(msg);
+    mu_assert(s_eq(msg, "PRIVMSG #circus,#clowns :Foo bar\r\n"),
+            "test_irc_message_many: msg should be 'PRIVMSG #circus,#clowns :Foo bar\\r\\n'");
+    read_mock(msg);
+    mu_assert(s_eq(msg, "PRIVMSG nacx :Foo bar\r\n"), "test_irc_message_many: msg should be 'PRIVMSG nacx :Foo bar\\r\\n'");
+}
+
+void test_irc_message_many_limit() {
+    char msg[READ_BUF], first[201], second[292], expected[READ_BUF];
+    char* targets[2];
+    char* tokens[] = { "TARGMAX=PRIVMSG:4" };
+
+    targets[0] = first;
+    targets[1] = second;
+    memset(first, 'a', sizeof(first) - 1);
+    first[sizeof(first) - 1] = '\0';
+    memset(second, 'b', sizeof(second) - 1);
+    second[sizeof(second) - 1] = '\0';
+    isp_parse(net_isupport(net_current()), 1, tokens);
+
+    /* A line that fills the buffer exactly keeps the whole message */
+    second[290] = '\0';
+    irc_message_many(targets, 2, "Foo bar");
+    read_mock(msg);
+    sprintf(expected, "PRIVMSG %s,%s :Foo bar\r\n", first, second);
+    mu_assert(strlen(expected) == WRITE_BUF - 1 + strlen(MSG_SEP), "test_irc_message_many_limit: the line should fill the buffer");
+    mu_assert(s_eq(msg, expected), "test_irc_message_many_limit: both targets should fit in the line");
+
+    /* One more character sends the targets apart instead of cutting the message */
+    second[290] = 'b';
+    irc_message_many(targets, 2, "Foo bar");
+    isp_init(net_isupport(net_current()));
+    read_mock(msg);
+    sprintf(expected, "PRIVMSG %s :Foo bar\r\n", first);
+    mu_assert(s_eq(msg, expected), "test_irc_message_many_limit: the first target should be alone");
+    read_mock(msg);
+    sprintf(expected, "PRIVMSG %s :Foo bar\r\n", second);
+    mu_assert(s_eq(msg, expected), "test_irc_message_many_limit: the message should not be cut");
+}
+
 void test_irc_op() {
     char msg[READ_BUF];
 
@@ -245,6 +310,111 @@ void test_irc_ban() {
     mu_assert(s_eq(msg, "MODE #circus +b *!*@*\r\n"), "test_irc_ban: msg should be 'MODE #circus +b *!*@*\\r\\n'");
 }
 
+void test_irc_op_many() {
+    char msg[READ_BUF];
+    char* nicks[] = { "a", "b", "c", "d", "e", "f", "g" };
+
+    /* Without RPL_ISUPPORT, use the RFC limit of three modes per message */
+    irc_op_many("#circus", nicks, 7);
+    read_mock(msg);
+    mu_assert(s_eq(msg, "MODE #circus +ooo a b c\r\n"), "test_irc_op_many: msg should be 'MODE #circus +ooo a b c\\r\\n'");
+    read_mock(msg);
+    mu_assert(s_eq(msg, "MODE #circus +ooo d e f\r\n"), "test_irc_op_many: msg should be 'MODE #circus +ooo d e f\\r\\n'");
+    read_mock(msg);
+    mu_assert(s_eq(msg, "MODE #circus +o g\r\n"), "test_irc_op_many: msg should be 'MODE #circus +o g\\r\\n'");
+}
+
+void test_irc_op_many_longer() {
+    char msg[READ_BUF], channel[600];
+    char* nicks[] = { "a" };
+
+    /* A channel name longer than a message must not overflow it */
+    channel[0] = '#';
+    memset(channel + 1, 'c', sizeof(channel) - 2);
+    channel[sizeof(channel) - 1] = '\0';
+
+    irc_op_many(channel, nicks, 1);
+    read_mock(msg);
+    mu_assert(strncmp(msg, "MODE #ccc", 9) == 0, "test_irc_op_many_longer: msg should start with 'MODE #ccc'");
+    mu_assert(strlen(msg) <= MSG_SIZE, "test_irc_op_many_longer: msg should be cut to the message size");
+}
+
+void test_irc_op_many_limit() {
+    char msg[READ_BUF], first[201], second[297], expected[READ_BUF];
+    char* nicks[2];
+
+    nicks[0] = first;
+    nicks[1] = second;
+    memset(first, 'a', sizeof(first) - 1);
+    first[sizeof(first) - 1] = '\0';
+    memset(second, 'b', sizeof(second) - 1);
+    second[sizeof(second) - 1] = '\0';
+
+    /* A line that fills the buffer exactly keeps the last nick whole */
+    second[295] = '\0';
+    irc_op_many("#c", nicks, 2);
+    read_mock(msg);
+    sprintf(expected, "MODE #c +oo %s %s\r\n", first, second);
+    mu_assert(strlen(expected) == WRITE_BUF - 1 + strlen(MSG_SEP), "test_irc_op_many_limit: the line should fill the buffer");
+    mu_assert(s_eq(msg, expected), "test_irc_op_many_limit: both nicks should fit in the line");
+
+    /* One more character goes to the next line instead of being cut */
+    second[295] = 'b';
+    irc_op_many("#c", nicks, 2);
+    read_mock(msg);
+    sprintf(expected, "MODE #c +o %s\r\n", first);
+    mu_assert(s_eq(msg, expected), "test_irc_op_many_limit: the first nick should be alone");
+    read_mock(msg);
+    sprintf(expected, "MODE #c +o %s\r\n", second);
+    mu_assert(s_eq(msg, expected), "test_irc_op_many_limit: the second nick should not be cut");
+}
+
+void test_irc_voice_many_isupport() {
+    char msg[READ_BUF], names[200][8];
+    char* nicks[200];
+    struct sch_stats before, after;
+    int i, lines = 0;
+
+    for (i = 0; i < 200; i++) {
+        sprintf(names[i], "nick%d", i);
+        nicks[i] = names[i];
+    }
+
+    net_isupport(net_current())->modes = 6;
+    irc_send_stats(&before);
+    irc_voice_many("#circus", nicks, 200);
+    irc_send_stats(&after);
+    net_flush(net_current());
+    isp_init(net_isupport(net_current()));
+
+    read_mock(msg);
+    mu_assert(s_eq(msg, "MODE #circus +vvvvvv nick0 nick1 nick2 nick3 nick4 nick5\r\n"),
+            "test_irc_voice_many_isupport: msg should have six modes");
+
+    for (lines = 1; lines < 34; lines++) {
+        read_mock(msg);
+    }
+    mu_assert(s_eq(msg, "MODE #circus +vv nick198 nick199\r\n"), "test_irc_voice_many_isupport: the last line should have two modes");
+    mu_assert(after.sent - before.sent == 34, "test_irc_voice_many_isupport: there should be 34 lines");
+}
+
+void test_irc_ban_many_linelen() {
+    char msg[READ_BUF];
+    char* masks[] = { "*!*@one.example.org", "*!*@two.example.org", "*!*@three.example.org" };
+
+    /* Only two masks fit in a line of 60 characters */
+    net_isupport(net_current())->modes = 10;
+    net_isupport(net_current())->linelen = 60;
+    irc_ban_many("#circus", masks, 3);
+    isp_init(net_isupport(net_current()));
+
+    read_mock(msg);
+    mu_assert(s_eq(msg, "MODE #circus +bb *!*@one.example.org *!*@two.example.org\r\n"),
+            "test_irc_ban_many_linelen: msg should have two masks");
+    read_mock(msg);
+    mu_assert(s_eq(msg, "MODE #circus +b *!*@three.example.org\r\n"), "test_irc_ban_many_linelen: msg should have one mask");
+}
+
 void test_irc_unban() {
     char msg[READ_BUF];
 
@@ -335,8 +505,108 @@ void test_irc_raw() {
     mu_assert(s_eq(msg, ":prefix type message\r\n"), "test_irc_raw: msg should be ':prefix type message\\r\\n'");
 }
 
+/* Mock server that pings all the connections and checks their answers.
+ * It exits with status 0 if all connections answered properly. */
+void many_server(int ready) {
+    int sockfd, socks[MANY_CONNS], i, len, reuse = 1, failed = 0;
+    struct sockaddr_in serv_addr;
+    char msg[READ_BUF], expected[READ_BUF];
+
+    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        _exit(2);
+    }
+
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = htons(atoi(MANY_PORT));
+
+    if (bind(sockfd, (struct sockaddr*) &serv_addr, sizeof(serv_addr)) == -1
+            || listen(sockfd, MANY_CONNS) == -1
+            || write(ready, "", 1) != 1) {
+        _exit(2);
+    }
+
+    for (i = 0; i < MANY_CONNS; i++) {
+        if ((socks[i] = accept(sockfd, NULL, NULL)) == -1) {
+            _exit(2);
+        }
+    }
+
+    /* Ping every connection before reading any answer */
+    for (i = 0; i < MANY_CONNS; i++) {
+        len = snprintf(msg, READ_BUF, "PING :%d\r\n", i);
+        if (send(socks[i], msg, len, 0) != len) {
+            _exit(2);
+        }
+    }
+
+    for (i = 0; i < MANY_CONNS; i++) {
+        len = snprintf(expected, READ_BUF, "PONG %d\r\n", i);
+        if (recv(socks[i], msg, len, MSG_WAITALL) != len || strncmp(msg, expected, len) != 0) {
+            failed = 1;
+        }
+        close(socks[i]);
+    }
+
+    close(sockfd);
+    _exit(failed);
+}
+
+void test_irc_listen_many() {
+    int pid, ready[2], status, i;
+    struct rlimit limit;
+    Connection* conns[MANY_CONNS];
+    char c;
+
+    /* Each process needs a descriptor per connection */
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < MANY_CONNS + 64) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    if (pipe(ready) == -1) {
+        perror("pipe error");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout);
+    pid = fork();
+
+    if (pid == 0) { /* Child process */
+        close(ready[0]);
+        many_server(ready[1]);
+    }
+
+    close(ready[1]);
+    if (read(ready[0], &c, 1) != 1) {   /* Wait until the server is listening */
+        perror("read error");
+        exit(EXIT_FAILURE);
+    }
+    close(ready[0]);
+
+    for (i = 0; i < MANY_CONNS; i++) {
+        conns[i] = irc_connect("localhost", MANY_PORT);
+        irc_reconnect(0, 0);    /* Do not come back once the server closes the connections */
+    }
+
+    irc_listen();   /* Returns when the server closes all the connections */
+
+    waitpid(pid, &status, 0);
+
+    mu_assert(net_count() == 0, "test_irc_listen_many: all connections should be closed");
+    mu_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "test_irc_listen_many: all connections should answer the ping");
+
+    for (i = 0; i < MANY_CONNS; i++) {
+        net_free(conns[i]);
+    }
+}
+
 void test_irc() {
     int socks[2];
+    Connection* conn;
 
     mu_run(test_shutdown_handler);
     mu_run(test_bnd_bind);
@@ -350,7 +620,8 @@ void test_irc() {
         exit(EXIT_FAILURE);
     }
 
-    _socket = socks[0];
+    conn = net_attach(socks[0]);
+    irc_use(conn);
     mock_socket = fdopen(socks[1], "r");
 
     mu_run(test_irc_nick);
@@ -365,6 +636,8 @@ void test_irc() {
     mu_run(test_irc_invite);
     mu_run(test_irc_message);
     mu_run(test_irc_message);
+    mu_run(test_irc_message_many);
+    mu_run(test_irc_message_many_limit);
     mu_run(test_irc_op);
     mu_run(test_irc_deop);
     mu_run(test_irc_voice);
@@ -372,6 +645,11 @@ void test_irc() {
     mu_run(test_irc_kick);
     mu_run(test_irc_ban);
     mu_run(test_irc_unban);
+    mu_run(test_irc_op_many);
+    mu_run(test_irc_op_many_longer);
+    mu_run(test_irc_op_many_limit);
+    mu_run(test_irc_voice_many_isupport);
+    mu_run(test_irc_ban_many_linelen);
     mu_run(test_irc_ban_list);
     mu_run(test_irc_limit);
     mu_run(test_irc_channel_key);
@@ -382,7 +660,9 @@ void test_irc() {
     mu_run(test_irc_pong);
     mu_run(test_irc_raw);
 
-    close(socks[0]);
-    close(socks[1]);
+    net_free(conn);
+    fclose(mock_socket);
+
+    mu_run(test_irc_listen_many);
 }
 
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include "minunit.h"
+#include "test.h"
+#include "../lib/utils.h"
+#include "../lib/isupport.c"
+
+void test_isp_init() {
+    struct isp_table isp;
+
+    isp_init(&isp);
+    mu_assert(isp.modes == ISP_MODES, "test_isp_init: modes should be ISP_MODES");
+    mu_assert(isp.linelen == ISP_LINELEN, "test_isp_init: linelen should be ISP_LINELEN");
+    mu_assert(isp.nicklen == ISP_NICKLEN, "test_isp_init: nicklen should be ISP_NICKLEN");
+    mu_assert(isp.casemapping == ISP_RFC1459, "test_isp_init: casemapping should be rfc1459");
+    mu_assert(isp_is_channel(&isp, "#circus"), "test_isp_init: '#circus' should be a channel");
+    mu_assert(isp_is_channel(&isp, "&circus"), "test_isp_init: '&circus' should be a channel");
+    mu_assert(!isp_is_channel(&isp, "circus"), "test_isp_init: 'circus' should not be a channel");
+    mu_assert(isp_prefix_mode(&isp, '@') == 'o', "test_isp_init: '@' should be the prefix of 'o'");
+    mu_assert(isp_mode_type(&isp, 'b') == ISP_MODE_LIST, "test_isp_init: 'b' should be a list mode");
+    mu_assert(isp_mode_type(&isp, 't') == ISP_MODE_FLAG, "test_isp_init: 't' should be a flag");
+    mu_assert(isp_targmax(&isp, CMD_PRIVMSG) == ISP_TARGETS, "test_isp_init: PRIVMSG targets should be ISP_TARGETS");
+    mu_assert(isp_defaults()->modes == ISP_MODES, "test_isp_init: the default table should have the default values");
+}
+
+void test_isp_parse() {
+    struct isp_table isp;
+    char* tokens[] = { "CHANTYPES=#&", "MODES=6", "LINELEN=1024", "are supported by this server" };
+
+    isp_init(&isp);
+    isp_parse(&isp, 4, tokens);
+
+    mu_assert(isp.modes == 6, "test_isp_parse: modes should be 6");
+    mu_assert(isp.linelen == 1024, "test_isp_parse: linelen should be 1024");
+}
+
+void test_isp_parse_no_value() {
+    struct isp_table isp;
+    char* unlimited[] = { "MODES" };
+    char* negated[] = { "-MODES", "-LINELEN" };
+    char* invalid[] = { "MODES=none", "LINELEN=" };
+
+    isp_init(&isp);
+    isp_parse(&isp, 1, unlimited);
+    mu_assert(isp.modes == ISP_MODES_MAX, "test_isp_parse_no_value: modes without value should be unlimited");
+
+    isp.linelen = 1024;
+    isp_parse(&isp, 2, negated);
+    mu_assert(isp.modes == ISP_MODES, "test_isp_parse_no_value: negated modes should be the default");
+    mu_assert(isp.linelen == ISP_LINELEN, "test_isp_parse_no_value: negated linelen should be the default");
+
+    isp_parse(&isp, 2, invalid);
+    mu_assert(isp.modes == ISP_MODES_MAX, "test_isp_parse_no_value: invalid modes should be unlimited");
+    mu_assert(isp.linelen == ISP_LINELEN, "test_isp_parse_no_value: invalid linelen should be the default");
+}
+
+void test_isp_parse_chantypes() {
+    struct isp_table isp;
+    char* tokens[] = { "CHANTYPES=!+" };
+    char* empty[] = { "CHANTYPES=" };
+    char* negated[] = { "-CHANTYPES" };
+
+    isp_init(&isp);
+    isp_parse(&isp, 1, tokens);
+    mu_assert(isp_is_channel(&isp, "!circus"), "test_isp_parse_chantypes: '!circus' should be a channel");
+    mu_assert(isp_is_channel(&isp, "+circus"), "test_isp_parse_chantypes: '+circus' should be a channel");
+    mu_assert(!isp_is_channel(&isp, "#circus"), "test_isp_parse_chantypes: '#circus' should not be a channel");
+
+    isp_parse(&isp, 1, empty);
+    mu_assert(!isp_is_channel(&isp, "!circus"), "test_isp_parse_chantypes: there should be no channels");
+
+    isp_parse(&isp, 1, negated);
+    mu_assert(isp_is_channel(&isp, "#circus"), "test_isp_parse_chantypes: negated chantypes should be the default");
+}
+
+void test_isp_parse_modes() {
+    struct isp_table isp;
+    char* tokens[] = { "PREFIX=(qaohv)~&@%+", "CHANMODES=beI,k,l,imnpst" };
+    char* prefix[] = { "PREFIX=" };
+
+    isp_init(&isp);
+    isp_parse(&isp, 2, tokens);
+    mu_assert(s_eq(isp.prefix, "qaohv"), "test_isp_parse_modes: prefix should be 'qaohv'");
+    mu_assert(isp_prefix_mode(&isp, '~') == 'q', "test_isp_parse_modes: '~' should be the prefix of 'q'");
+    mu_assert(isp_prefix_mode(&isp, '%') == 'h', "test_isp_parse_modes: '%' should be the prefix of 'h'");
+    mu_assert(isp.prefix_symbols['a'] == '&', "test_isp_parse_modes: the prefix of 'a' should be '&'");
+    mu_assert(isp_mode_type(&isp, 'h') == ISP_MODE_PREFIX, "test_isp_parse_modes: 'h' should be a prefix mode");
+    mu_assert(isp_mode_type(&isp, 'I') == ISP_MODE_LIST, "test_isp_parse_modes: 'I' should be a list mode");
+    mu_assert(isp_mode_type(&isp, 'k') == ISP_MODE_PARAM, "test_isp_parse_modes: 'k' should always have a parameter");
+    mu_assert(isp_mode_type(&isp, 'l') == ISP_MODE_PARAM_SET, "test_isp_parse_modes: 'l' should have a parameter when set");
+    mu_assert(isp_mode_type(&isp, 'n') == ISP_MODE_FLAG, "test_isp_parse_modes: 'n' should be a flag");
+    mu_assert(isp_mode_type(&isp, 'z') == ISP_MODE_UNKNOWN, "test_isp_parse_modes: 'z' should be unknown");
+
+    isp_parse(&isp, 1, prefix);
+    mu_assert(isp_prefix_mode(&isp, '@') == '\0', "test_isp_parse_modes: there should be no prefixes");
+    mu_assert(isp_mode_type(&isp, 'o') == ISP_MODE_UNKNOWN, "test_isp_parse_modes: 'o' should be unknown");
+    mu_assert(isp_mode_type(&isp, 'b') == ISP_MODE_LIST, "test_isp_parse_modes: 'b' should still be a list mode");
+}
+
+void test_isp_parse_limits() {
+    struct isp_table isp;
+    char* tokens[] = { "NICKLEN=30", "CASEMAPPING=ascii", "TARGMAX=NAMES:1,PRIVMSG:4,NOTICE:,FOO:2" };
+    char* strict[] = { "CASEMAPPING=strict-rfc1459" };
+
+    isp_init(&isp);
+    isp_parse(&isp, 3, tokens);
+    mu_assert(isp.nicklen == 30, "test_isp_parse_limits: nicklen should be 30");
+    mu_assert(isp.casemapping == ISP_ASCII, "test_isp_parse_limits: casemapping should be ascii");
+    mu_assert(isp_targmax(&isp, CMD_PRIVMSG) == 4, "test_isp_parse_limits: PRIVMSG targets should be 4");
+    mu_assert(isp_targmax(&isp, CMD_NOTICE) == ISP_TARGETS_MAX, "test_isp_parse_limits: NOTICE targets should be unlimited");
+    mu_assert(isp_targmax(&isp, CMD_JOIN) == ISP_TARGETS, "test_isp_parse_limits: JOIN targets should be the default");
+    mu_assert(isp_targmax(&isp, CMD_UNKNOWN) == ISP_TARGETS, "test_isp_parse_limits: unknown commands should have the default");
+
+    isp_parse(&isp, 1, strict);
+    mu_assert(isp.casemapping == ISP_STRICT_RFC1459, "test_isp_parse_limits: casemapping should be strict-rfc1459");
+}
+
+void test_isupport() {
+    mu_run(test_isp_init);
+    mu_run(test_isp_parse);
+    mu_run(test_isp_parse_no_value);
+    mu_run(test_isp_parse_chantypes);
+    mu_run(test_isp_parse_modes);
+    mu_run(test_isp_parse_limits);
+}
@@ -20,16 +20,17 @@
  * THE SOFTWARE.
  */
 
-#define _XOPEN_SOURCE   /* Support strtok_r in POSIX and BSD environments */
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "minunit.h"
 #include "test.h"
 #include "../lib/utils.h"
+#include "../lib/network.h"
 #include "../lib/listener.c"
 
+extern long int allocations;    /* Heap allocations counted by the test binary */
+
 
 void test_parse_empty_message() {
     struct raw_event* raw;
@@ -46,6 +47,7 @@ void test_parse_empty_message() {
 
     mu_assert(raw->prefix == NULL, "test_parse_empty_message: prefix should be NULL"); 
     mu_assert(raw->type == NULL, "test_parse_empty_message: type should be NULL"); 
+    mu_assert(raw->cmd == CMD_UNKNOWN, "test_parse_empty_message: cmd should be CMD_UNKNOWN");
     mu_assert(raw->num_params == 0, "test_parse_empty_message: there should be 0 parameters");
 
     evt_raw_destroy(raw);   /* Cleanup */
@@ -58,6 +60,7 @@ void test_parse() {
 
     mu_assert(raw->prefix == NULL, "test_parse: prefix should be NULL"); 
     mu_assert(s_eq(raw->type, "TEST"), "test_parse: type should be TEST"); 
+    mu_assert(raw->cmd == CMD_UNKNOWN, "test_parse: cmd should be CMD_UNKNOWN");
     mu_assert(raw->num_params == 7, "test_parse: there should be 7 parameters");
 
     evt_raw_destroy(raw);   /* Cleanup */
@@ -135,7 +138,98 @@ void test_parse_with_prefix_only_last_param() {
     evt_raw_destroy(raw);   /* Cleanup */
 }
 
+void test_parse_views() {
+    struct raw_event* raw;
+
+    raw = lst_parse(":nick!~user@server PRIVMSG #circus :Hello  there\r\n");
+
+    mu_assert(raw->prefix_view.offset == 1, "test_parse_views: prefix offset should be 1");
+    mu_assert(raw->prefix_view.length == 17, "test_parse_views: prefix length should be 17");
+    mu_assert(raw->type_view.offset == 19, "test_parse_views: type offset should be 19");
+    mu_assert(raw->type_view.length == 7, "test_parse_views: type length should be 7");
+    mu_assert(raw->cmd == CMD_PRIVMSG, "test_parse_views: cmd should be CMD_PRIVMSG");
+    mu_assert(raw->num_params == 2, "test_parse_views: there should be 2 parameters");
+    mu_assert(raw->param_views[0].offset == 27, "test_parse_views: params[0] offset should be 27");
+    mu_assert(raw->param_views[0].length == 7, "test_parse_views: params[0] length should be 7");
+    mu_assert(raw->param_views[1].offset == 36, "test_parse_views: params[1] offset should be 36");
+    mu_assert(raw->param_views[1].length == 12, "test_parse_views: params[1] length should be 12");
+    mu_assert(raw->params[1] == raw->__buffer + 36, "test_parse_views: params[1] should point to the buffer");
+    mu_assert(s_eq(raw->params[1], "Hello  there"), "test_parse_views: last parameter should keep the spaces");
+
+    evt_raw_destroy(raw);   /* Cleanup */
+}
+
+void test_parse_max_params() {
+    char* last_param;
+    struct raw_event* raw;
+
+    raw = lst_parse("TEST 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17");
+    last_param = raw->params[raw->num_params - 1];
+
+    mu_assert(raw->num_params == MAX_PARAMS, "test_parse_max_params: there should be MAX_PARAMS parameters");
+    mu_assert(s_eq(last_param, "15 16 17"), "test_parse_max_params: last parameter should be '15 16 17'");
+
+    evt_raw_destroy(raw);   /* Cleanup */
+}
+
+void test_parse_extra_spaces() {
+    struct raw_event* raw;
+
+    raw = lst_parse(":prefix  TEST  first   second :last");
+
+    mu_assert(s_eq(raw->prefix, "prefix"), "test_parse_extra_spaces: prefix should be 'prefix'");
+    mu_assert(s_eq(raw->type, "TEST"), "test_parse_extra_spaces: type should be 'TEST'");
+    mu_assert(raw->num_params == 3, "test_parse_extra_spaces: there should be 3 parameters");
+    mu_assert(s_eq(raw->params[1], "second"), "test_parse_extra_spaces: params[1] should be 'second'");
+    mu_assert(s_eq(raw->params[2], "last"), "test_parse_extra_spaces: params[2] should be 'last'");
+
+    evt_raw_destroy(raw);   /* Cleanup */
+}
+
 
+void test_parse_buffer() {
+    char msg[EVT_LINE_SIZE * 2];
+    struct raw_event* raw;
+
+    raw = lst_parse("TEST :Short message");
+    mu_assert(raw->__buffer == raw->line, "test_parse_buffer: short messages should be stored in the event");
+    evt_raw_destroy(raw);
+
+    /* Longer lines must still be parsed */
+    memset(msg, 'a', sizeof(msg) - 1);
+    msg[sizeof(msg) - 1] = '\0';
+    memcpy(msg, "TEST :", 6);
+
+    raw = lst_parse(msg);
+    mu_assert(raw->__buffer != raw->line, "test_parse_buffer: long messages should have their own buffer");
+    mu_assert(strlen(raw->params[0]) == sizeof(msg) - 7, "test_parse_buffer: the whole message should be parsed");
+    evt_raw_destroy(raw);
+}
+
+void test_parse_linelen() {
+    char msg[READ_BUF];
+    struct raw_event* raw;
+    long int before;
+    int len;
+
+    /* Servers that advertise a LINELEN send lines up to NET_LINE_MAX */
+    len = sprintf(msg, ":nick!~user@host PRIVMSG #circus :");
+    memset(msg + len, 'a', NET_LINE_MAX - len - 2);
+    strcpy(msg + NET_LINE_MAX - 2, "\r\n");
+
+    before = allocations;
+    raw = lst_parse(msg);
+    mu_assert(allocations - before == 1, "test_parse_linelen: the long line should have its own buffer");
+    mu_assert(s_eq(raw->prefix, "nick!~user@host") && s_eq(raw->type, "PRIVMSG"), "test_parse_linelen: the prefix and the type should be parsed");
+    mu_assert(raw->num_params == 2 && s_eq(raw->params[0], "#circus"), "test_parse_linelen: the target should be parsed");
+    mu_assert(strlen(raw->params[1]) == (size_t) (NET_LINE_MAX - len - 2), "test_parse_linelen: the whole text should be parsed");
+    evt_raw_destroy(raw);
+
+    /* The event goes back to the pool with its own line buffer */
+    raw = lst_parse("PING :short");
+    mu_assert(raw->__buffer == raw->line && s_eq(raw->params[0], "short"), "test_parse_linelen: the event should be reused");
+    evt_raw_destroy(raw);
+}
 
 void test_listener() {
     mu_run(test_parse_empty_message);
@@ -145,5 +239,10 @@ void test_listener() {
     mu_run(test_parse_with_prefix_and_last_param);
     mu_run(test_parse_only_last_param);
     mu_run(test_parse_with_prefix_only_last_param);
+    mu_run(test_parse_views);
+    mu_run(test_parse_max_params);
+    mu_run(test_parse_extra_spaces);
+    mu_run(test_parse_buffer);
+    mu_run(test_parse_linelen);
 }
 
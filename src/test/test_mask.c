@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "minunit.h"
+#include "test.h"
+#include "../lib/mask.h"
+
+/* Append the matching masks and their values */
+static void collect(const char* mask, void* value, void* data) {
+    char* list = data;
+    sprintf(list + strlen(list), "%s%s=%s", *list != '\0' ? " " : "", mask, value != NULL ? (char*) value : "");
+}
+
+void test_msk_normalize() {
+    char mask[MSK_SIZE];
+
+    mu_assert(strcmp(msk_normalize(mask, "nick", MSK_SIZE), "nick!*@*") == 0, "test_msk_normalize: a nick should be completed");
+    mu_assert(strcmp(msk_normalize(mask, "*@host", MSK_SIZE), "*!*@host") == 0, "test_msk_normalize: a host should be completed");
+    mu_assert(strcmp(msk_normalize(mask, "nick!user", MSK_SIZE), "nick!user@*") == 0, "test_msk_normalize: a user should be completed");
+    mu_assert(strcmp(msk_normalize(mask, "", MSK_SIZE), "*!*@*") == 0, "test_msk_normalize: an empty mask should match all");
+    mu_assert(strcmp(msk_normalize(mask, "a!b@c", MSK_SIZE), "a!b@c") == 0, "test_msk_normalize: full masks should not change");
+}
+
+void test_msk_matches() {
+    mu_assert(msk_matches("*!*@*.example.net", "nick!user@host.example.net", ISP_RFC1459), "test_msk_matches: the domain should match");
+    mu_assert(!msk_matches("*!*@*.example.net", "nick!user@example.net", ISP_RFC1459), "test_msk_matches: '*.' needs a subdomain");
+    mu_assert(msk_matches("n?ck!*@*", "NICK!user@host", ISP_RFC1459), "test_msk_matches: '?' should match one character");
+    mu_assert(!msk_matches("n?ck!*@*", "nck!user@host", ISP_RFC1459), "test_msk_matches: '?' should not match nothing");
+    mu_assert(msk_matches("*a*b*c!u@h", "xaxxbxbxc!u@h", ISP_ASCII), "test_msk_matches: stars should be retried");
+    mu_assert(!msk_matches("*a*b*c!u@h", "xaxxbxbxcx!u@h", ISP_ASCII), "test_msk_matches: the mask should match the end");
+    mu_assert(msk_matches("nick[1]", "NICK{1}!u@h", ISP_RFC1459), "test_msk_matches: nicks should follow the case mapping");
+    mu_assert(!msk_matches("nick[1]", "NICK{1}!u@h", ISP_ASCII), "test_msk_matches: ascii should not fold []");
+}
+
+void test_msk_match() {
+    struct msk_set* set = msk_create(ISP_RFC1459);
+    char found[200];
+
+    /* One mask for each kind of index */
+    mu_assert(msk_add(set, "*!*@*.Example.net", "domain"), "test_msk_match: the mask should be new");
+    msk_add(set, "*!*@gw.example.net", "host");
+    msk_add(set, "*!*@10.0.*", "address");
+    msk_add(set, "Bob", "nick");
+    msk_add(set, "*!~eve@*", "user");
+    msk_add(set, "*b?b*!*@*", "other");
+    mu_assert(msk_count(set) == 6, "test_msk_match: there should be 6 masks");
+
+    *found = '\0';
+    mu_assert(msk_match(set, "bob!~bob@a.b.EXAMPLE.net", collect, found) == 3, "test_msk_match: bob should match 3 masks");
+    mu_assert(strstr(found, "*!*@*.Example.net=domain") != NULL, "test_msk_match: the domain should match");
+    mu_assert(strstr(found, "Bob!*@*=nick") != NULL, "test_msk_match: the nick should match");
+    mu_assert(strstr(found, "*b?b*!*@*=other") != NULL, "test_msk_match: the wildcards should match");
+
+    mu_assert(msk_match(set, "eve!~eve@10.0.3.4", NULL, NULL) == 2, "test_msk_match: eve should match the user and the address");
+    mu_assert(msk_match(set, "eve!~eve@gw.example.net", NULL, NULL) == 3, "test_msk_match: eve should match the host");
+    mu_assert(msk_match(set, "eve!eve@10.1.0.1", NULL, NULL) == 0, "test_msk_match: eve should match nothing");
+    mu_assert(msk_match(set, "server.example.net", NULL, NULL) == 0, "test_msk_match: server prefixes should match nothing");
+
+    /* Adding a mask again changes its value */
+    mu_assert(!msk_add(set, "bob!*@*", "again"), "test_msk_match: the mask should not be new");
+    *found = '\0';
+    msk_match(set, "bob!x@y", collect, found);
+    mu_assert(strstr(found, "Bob!*@*=again") != NULL, "test_msk_match: the value should change");
+
+    msk_destroy(set);
+}
+
+void test_msk_del() {
+    struct msk_set* set = msk_create(ISP_RFC1459);
+
+    msk_add(set, "*!*@*.example.net", NULL);
+    msk_add(set, "*!*@*.mirror.example.net", NULL);
+    msk_add(set, "*!*@*", NULL);
+
+    mu_assert(msk_match(set, "a!b@www.mirror.example.net", NULL, NULL) == 3, "test_msk_del: all masks should match");
+    mu_assert(msk_del(set, "*!*@*.EXAMPLE.net"), "test_msk_del: the mask should be removed");
+    mu_assert(!msk_del(set, "*!*@*.example.net"), "test_msk_del: the mask should not be there");
+    mu_assert(msk_match(set, "a!b@www.mirror.example.net", NULL, NULL) == 2, "test_msk_del: two masks should match");
+    mu_assert(msk_del(set, ""), "test_msk_del: normalized masks should be removed");
+    mu_assert(msk_del(set, "*!*@*.mirror.example.net"), "test_msk_del: the last mask should be removed");
+    mu_assert(msk_count(set) == 0, "test_msk_del: the set should be empty");
+    mu_assert(msk_match(set, "a!b@www.mirror.example.net", NULL, NULL) == 0, "test_msk_del: nothing should match");
+
+    /* Masks sharing a key are removed from any position of the list */
+    msk_add(set, "a*!*@*.net", NULL);
+    msk_add(set, "b*!*@*.net", NULL);
+    msk_add(set, "c*!*@*.net", NULL);
+    msk_del(set, "b*!*@*.net");
+    msk_del(set, "c*!*@*.net");
+    mu_assert(msk_match(set, "abc!d@e.net", NULL, NULL) == 1, "test_msk_del: the first mask should be kept");
+
+    msk_destroy(set);
+}
+
+void test_mask() {
+    mu_run(test_msk_normalize);
+    mu_run(test_msk_matches);
+    mu_run(test_msk_match);
+    mu_run(test_msk_del);
+}
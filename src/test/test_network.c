@@ -20,18 +20,20 @@
  * THE SOFTWARE.
  */
 
-#define _POSIX_C_SOURCE 200112L      /* Use addr structs and fdopen in network.c */
+#define _POSIX_C_SOURCE 200112L      /* Use addr structs in network.c and fdopen */
 
 #include <stdio.h>
 #include <errno.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <pthread.h>
 #include <poll.h>
 #include "minunit.h"
 #include "test.h"
 #include "../lib/utils.h"
+#include "../lib/listener.h"
 #include "../lib/network.c"
 
 #define TEST_PORT "19876"
@@ -41,12 +43,16 @@ void* mock_server() {
     int sockfd, newsockfd;
     struct sockaddr_in serv_addr, cli_addr;
     unsigned int clilen;
+    int reuse = 1;
 
     if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
         perror("socket creation error");
         exit(EXIT_FAILURE);
     }
 
+    /* Allow running the tests again while the previous socket is in TIME_WAIT */
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     memset(&serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = INADDR_ANY;
@@ -80,36 +86,71 @@ void mock_handler(int signal) {
 
 void test_connection() {
     pthread_t thread;
+    struct net_conn* conn;
     pthread_create(&thread, NULL, mock_server, NULL);
 
     poll(0, 0, 1000);   /* Make sure server is running */
-    net_connect("localhost", TEST_PORT);
-    mu_assert(_socket > 0, "test_connection: _socket should be > 0");
-    mu_assert(_sd != NULL, "test_connection: _sd should not be NULL");
+    conn = net_connect("localhost", TEST_PORT);
+    mu_assert(conn->socket > 0, "test_connection: socket should be > 0");
+    mu_assert(conn->ring.head == conn->ring.tail, "test_connection: the receive buffer should be empty");
+    mu_assert(net_count() == 1, "test_connection: there should be one open connection");
+    mu_assert(net_current() == conn, "test_connection: the connection should be the default one");
+
+    net_disconnect(conn);
+    mu_assert(conn->socket == -1, "test_connection: socket should be -1");
+    mu_assert(conn->ring.head == 0 && conn->ring.tail == 0, "test_connection: the receive buffer should be reset");
+    mu_assert(net_count() == 0, "test_connection: there should be no open connections");
+    mu_assert(net_current() == NULL, "test_connection: there should be no default connection");
+
+    net_disconnect(conn);   /* Disconnecting twice must be harmless */
+    net_free(conn);
+    pthread_join(thread, NULL);
+}
+
+void test_current() {
+    int socks[2];
+    struct net_conn *first, *second;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    first = net_attach(socks[0]);
+    second = net_attach(socks[1]);
+    mu_assert(net_current() == second, "test_current: the last connection should be the default one");
+
+    net_use(first);
+    mu_assert(net_current() == first, "test_current: the selected connection should be the current one");
 
-    net_disconnect();
-    mu_assert(_socket == -1, "test_connection: _socket should be -1");
-    mu_assert(_sd == NULL, "test_connection: _sd should be NULL");
+    net_free(first);
+    mu_assert(net_current() == second, "test_current: the default connection should be used when the current is freed");
+
+    net_free(second);
+    mu_assert(net_current() == NULL, "test_current: there should be no current connection");
 }
 
 void test_send() {
     int socks[2];
     FILE* in;
     char msg[READ_BUF], *ret;
+    struct net_conn* conn;
 
     if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
         perror("socketpair error");
         exit(EXIT_FAILURE);
     }
 
-    _socket = socks[0];   /* Override the socket the net_send will use */
-    net_send("Outgoing message");
+    conn = net_attach(socks[0]);
+    net_send(conn, "Outgoing message");
+    mu_assert(net_queued(conn) == strlen("Outgoing message\r\n"), "test_send: the message should be queued");
+    mu_assert(net_flush(conn) == 0, "test_send: there should be no queued messages after flushing");
 
     in = fdopen(socks[1], "r");
     ret = fgets(msg, READ_BUF, in);
 
-    close(socks[0]);
-    close(socks[1]);
+    net_free(conn);
+    fclose(in);
 
     mu_assert(ret != NULL, "test_send: fgets should not return NULL");
     mu_assert(s_eq(msg, "Outgoing message\r\n"), "test_send: Message should be 'Outgoing message\\r\\n'");
@@ -119,21 +160,24 @@ void test_send_longer() {
     int socks[2];
     FILE* in;
     char out[WRITE_BUF + 10], msg[WRITE_BUF + 10], *ret;
+    struct net_conn* conn;
 
     if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
         perror("socketpair error");
         exit(EXIT_FAILURE);
     }
 
-    _socket = socks[0];   /* Override the socket the net_send will use */
+    conn = net_attach(socks[0]);
     memset(out, 'a', WRITE_BUF + 10);
-    net_send(out);
+    out[WRITE_BUF + 9] = '\0';
+    net_send(conn, out);
+    net_flush(conn);
 
     in = fdopen(socks[1], "r");
     ret = fgets(msg, WRITE_BUF + 10, in);
 
-    close(socks[0]);
-    close(socks[1]);
+    net_free(conn);
+    fclose(in);
 
     mu_assert(ret != NULL, "test_send: fgets should not return NULL");
     mu_assert(strlen(out) > strlen(msg), "test_send_longer: The received message should be stripped");
@@ -141,28 +185,159 @@ void test_send_longer() {
             "test_send_longer: Sent message length should be 'WRITE_BUF + strlen(MSG_SEP)'");
 }
 
-void test_recv() {
+void test_send_batch() {
+    int socks[2], i, ret;
+    char msg[READ_BUF * 4];
+    char* expected = "PRIVMSG #a :1\r\nPRIVMSG #a :2\r\nPRIVMSG #a :3\r\n";
+    struct net_conn* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Start near the end of the buffer so the queued lines wrap around */
+    conn = net_attach(socks[0]);
+    conn->out.head = conn->out.tail = NET_RING_SIZE - 20;
+
+    for (i = 1; i <= 3; i++) {
+        sprintf(msg, "PRIVMSG #a :%d", i);
+        mu_assert(net_send(conn, msg) == 1, "test_send_batch: net_send should return 1");
+    }
+
+    /* All the queued lines must be sent at once */
+    mu_assert(net_flush(conn) == 0, "test_send_batch: there should be no queued messages after flushing");
+    ret = recv(socks[1], msg, sizeof(msg) - 1, 0);
+
+    net_free(conn);
+    close(socks[1]);
+
+    mu_assert(ret == strlen(expected), "test_send_batch: all lines should be received in one read");
+    msg[ret > 0 ? ret : 0] = '\0';
+    mu_assert(s_eq(msg, expected), "test_send_batch: lines should be received in order");
+}
+
+void test_send_backpressure() {
+    int socks[2], ret, sent = 0;
+    char msg[WRITE_BUF];
+    struct net_conn* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    /* The peer never reads, so the queue can only grow */
+    conn = net_attach(socks[0]);
+    memset(msg, 'a', WRITE_BUF - 1);
+    msg[WRITE_BUF - 1] = '\0';
+
+    while ((ret = net_send(conn, msg)) == 1) {
+        sent++;
+    }
+
+    mu_assert(ret == 0, "test_send_backpressure: net_send should return 0 above the high-water mark");
+    mu_assert(net_queued(conn) > NET_OUT_HIGH, "test_send_backpressure: the queue should be above the high-water mark");
+    mu_assert(sent == NET_OUT_HIGH / (WRITE_BUF + 1), "test_send_backpressure: lines below the high-water mark should be accepted");
+
+    while ((ret = net_send(conn, msg)) == 0) {
+        sent++;
+    }
+
+    mu_assert(ret == -1, "test_send_backpressure: net_send should return -1 when the queue is full");
+    mu_assert(NET_RING_SIZE - net_queued(conn) < WRITE_BUF + 1, "test_send_backpressure: the queue should be full");
+
+    net_free(conn);
+    close(socks[1]);
+}
+
+void test_send_throttle() {
+    int socks[2], ret;
+    char msg[READ_BUF];
+    struct net_conn* conn;
+    struct sch_stats stats;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    conn = net_attach(socks[0]);
+    net_throttle(conn, 2, 50);
+
+    net_send(conn, "PRIVMSG #a :1");
+    net_send(conn, "PRIVMSG #a :2");
+    net_send(conn, "PRIVMSG #a :3");
+    net_send(conn, "PONG irc.server");
+    net_flush(conn);
+
+    /* Only the burst can be sent right away */
+    ret = recv(socks[1], msg, READ_BUF - 1, MSG_DONTWAIT);
+    msg[ret > 0 ? ret : 0] = '\0';
+    mu_assert(s_eq(msg, "PRIVMSG #a :1\r\nPRIVMSG #a :2\r\n"), "test_send_throttle: only the burst should be sent");
+
+    net_stats(conn, &stats);
+    mu_assert(stats.depth == 2, "test_send_throttle: two lines should be waiting");
+    mu_assert(net_queued(conn) == strlen("PRIVMSG #a :3\r\nPONG irc.server\r\n"), "test_send_throttle: the waiting lines should be queued");
+    mu_assert(conns_release() > 0, "test_send_throttle: the event loop should wait for the next token");
+
+    /* The event loop releases the urgent line first when the next token arrives */
+    poll(0, 0, 60);
+    conns_release();
+    net_flush(conn);
+    ret = recv(socks[1], msg, READ_BUF - 1, MSG_DONTWAIT);
+    msg[ret > 0 ? ret : 0] = '\0';
+    mu_assert(s_eq(msg, "PONG irc.server\r\n"), "test_send_throttle: the PONG should go before the regular lines");
+
+    net_free(conn);
+    close(socks[1]);
+    mu_assert(conns.throttled == 0, "test_send_throttle: there should be no throttled connections");
+}
+
+void test_send_closed() {
     int socks[2];
+    struct net_conn* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    conn = net_attach(socks[0]);
+    net_disconnect(conn);
+    close(socks[1]);
+
+    mu_assert(net_send(conn, "Outgoing message") == -1, "test_send_closed: net_send should return -1");
+    mu_assert(net_send(NULL, "Outgoing message") == -1, "test_send_closed: net_send should return -1 without connection");
+
+    net_free(conn);
+}
+
+void test_recv() {
+    int socks[2], ret;
     char msg[READ_BUF];
+    struct net_conn* conn;
 
     if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
         perror("socketpair error");
         exit(EXIT_FAILURE);
     }
 
-    _sd = fdopen(socks[1], "r");   /* Override the socket the net_recv will use */
+    conn = net_attach(socks[1]);
     send(socks[0], "Outgoing message\r\n", strlen("Outgoing message\r\n"), 0);
-    net_recv(msg);
+    ret = net_recv(conn, msg);
 
     close(socks[0]);
-    close(socks[1]);
+    net_free(conn);
 
+    mu_assert(ret == 1, "test_recv: net_recv should return 1");
     mu_assert(s_eq(msg, "Outgoing message\r\n"), "test_recv: Message should be 'Outgoing message\\r\\n'");
 }
 
 void test_recv_longer() {
     int socks[2];
     char in[READ_BUF + 10], out[READ_BUF + 10];
+    struct net_conn* conn;
 
     if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
         perror("socketpair error");
@@ -172,17 +347,171 @@ void test_recv_longer() {
     memset(out, 'a', READ_BUF + 10);
     out[READ_BUF + 9] = '\0';
 
-    _sd = fdopen(socks[1], "r");   /* Override the socket the net_recv will use */
+    conn = net_attach(socks[1]);
     send(socks[0], out, strlen(out), 0);
-    net_recv(in);
+    net_recv(conn, in);
 
     close(socks[0]);
-    close(socks[1]);
+    net_free(conn);
 
     mu_assert(strlen(out) > strlen(in), "test_recv_longer: The received message should be stripped");
     mu_assert(strlen(in) == MSG_SIZE, "test_recv_longer: Received message length should be 'MSG_SIZE'");
 }
 
+void test_recv_linelen() {
+    int socks[2];
+    char in[READ_BUF], out[1000];
+    char* tokens[] = { "LINELEN=1024" };
+    struct net_conn* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(out, 'a', 997);
+    strcpy(out + 997, "\r\n");
+
+    /* Complete lines above the default limit are returned in chunks too */
+    conn = net_attach(socks[1]);
+    send(socks[0], out, strlen(out), 0);
+    net_recv(conn, in);
+    mu_assert(strlen(in) == MSG_SIZE, "test_recv_linelen: The first chunk length should be 'MSG_SIZE'");
+    net_recv(conn, in);
+    mu_assert(strlen(in) == strlen(out) - MSG_SIZE, "test_recv_linelen: The second chunk should have the rest of the line");
+
+    /* Until the server advertises longer lines */
+    isp_parse(net_isupport(conn), 1, tokens);
+    send(socks[0], out, strlen(out), 0);
+    net_recv(conn, in);
+    mu_assert(s_eq(in, out), "test_recv_linelen: The line should be received at once");
+
+    close(socks[0]);
+    net_free(conn);
+}
+
+void test_recv_overflow() {
+    int socks[2], chunks = 0, received = 0;
+    char in[READ_BUF + 16], out[8000];
+    char* tokens[] = { "LINELEN=100000" };
+    struct net_conn* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    /* A complete 2 KB line is already buffered when it is read. It must
+     * come in chunks that fit in the buffer, never past its end */
+    memset(out, 'a', 2000);
+    strcpy(out + 2000, "\r\n");
+    memset(in + READ_BUF, 'x', 16);
+
+    conn = net_attach(socks[1]);
+    send(socks[0], out, strlen(out), 0);
+    while (received < (int) strlen(out) && net_recv(conn, in) == 1) {
+        mu_assert(strlen(in) <= MSG_SIZE, "test_recv_overflow: chunks should not exceed 'MSG_SIZE'");
+        received += strlen(in);
+        chunks++;
+    }
+    mu_assert(received == (int) strlen(out) && chunks == 4, "test_recv_overflow: the line should come in four chunks");
+
+    /* Servers can not raise the limit beyond the buffer */
+    isp_parse(net_isupport(conn), 1, tokens);
+    memset(out, 'b', 7000);
+    strcpy(out + 7000, "\r\n");
+    send(socks[0], out, strlen(out), 0);
+    net_recv(conn, in);
+    mu_assert(strlen(in) == NET_LINE_MAX, "test_recv_overflow: the chunk should be cut at 'NET_LINE_MAX'");
+    mu_assert(in[READ_BUF] == 'x' && in[READ_BUF + 15] == 'x', "test_recv_overflow: nothing should be written past the buffer");
+
+    close(socks[0]);
+    net_free(conn);
+}
+
+void test_recv_many() {
+    int socks[2], ret;
+    char msg[READ_BUF];
+    char* lines = "PING :one\r\nPING :two\r\nPING :three\r\n";
+    struct net_conn* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    conn = net_attach(socks[1]);
+    send(socks[0], lines, strlen(lines), 0);
+
+    ret = net_recv(conn, msg);
+    mu_assert(ret == 1 && s_eq(msg, "PING :one\r\n"), "test_recv_many: first message should be 'PING :one'");
+
+    /* Close the peer to make sure the remaining lines come from the buffer */
+    close(socks[0]);
+
+    mu_assert(net_pending(conn), "test_recv_many: there should be pending lines");
+    ret = net_recv(conn, msg);
+    mu_assert(ret == 1 && s_eq(msg, "PING :two\r\n"), "test_recv_many: second message should be 'PING :two'");
+    mu_assert(net_pending(conn), "test_recv_many: there should be pending lines");
+    ret = net_recv(conn, msg);
+    mu_assert(ret == 1 && s_eq(msg, "PING :three\r\n"), "test_recv_many: third message should be 'PING :three'");
+    mu_assert(!net_pending(conn), "test_recv_many: there should not be pending lines");
+    ret = net_recv(conn, msg);
+    mu_assert(ret == -1, "test_recv_many: net_recv should return -1 when the peer is closed");
+
+    net_free(conn);
+}
+
+void test_recv_partial() {
+    int socks[2], ret;
+    char msg[READ_BUF];
+    struct net_conn* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    conn = net_attach(socks[1]);
+
+    send(socks[0], "PING :zel", strlen("PING :zel"), 0);
+    ret = net_recv(conn, msg);
+    mu_assert(ret == 0, "test_recv_partial: net_recv should return 0 for incomplete lines");
+    mu_assert(!net_pending(conn), "test_recv_partial: there should not be pending lines");
+
+    send(socks[0], "azny\r\n", strlen("azny\r\n"), 0);
+    ret = net_recv(conn, msg);
+
+    close(socks[0]);
+    net_free(conn);
+
+    mu_assert(ret == 1, "test_recv_partial: net_recv should return 1");
+    mu_assert(s_eq(msg, "PING :zelazny\r\n"), "test_recv_partial: Message should be 'PING :zelazny\\r\\n'");
+}
+
+void test_recv_wrap() {
+    int socks[2], ret;
+    char msg[READ_BUF];
+    struct net_conn* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Place the buffer positions near the end of the array so the line wraps around */
+    conn = net_attach(socks[1]);
+    conn->ring.head = conn->ring.tail = conn->ring.scan = NET_RING_SIZE - 5;
+    send(socks[0], "NOTICE * :wrapped\r\n", strlen("NOTICE * :wrapped\r\n"), 0);
+    ret = net_recv(conn, msg);
+
+    close(socks[0]);
+    net_free(conn);
+
+    mu_assert(ret == 1, "test_recv_wrap: net_recv should return 1");
+    mu_assert(s_eq(msg, "NOTICE * :wrapped\r\n"), "test_recv_wrap: Message should be 'NOTICE * :wrapped\\r\\n'");
+}
+
 void test_listen_ready() {
     int pid, p2c[2], c2p[2];
 
@@ -219,17 +548,27 @@ void test_listen_ready() {
 
         close(p2c[1]);
         close(c2p[0]);
+        waitpid(pid, NULL, 0);
 
         mu_assert(status == NET_READY, "test_listen_ready: status should be 'NET_READY'");
     } else { /* Child process */
         enum net_status status;
+        struct net_conn* ready[NET_EVENTS];
+        struct net_conn* conn;
+        int num_ready = 0;
 
         /* Close parent write and clieht read endpoints */
         close(p2c[1]);
         close(c2p[0]);
 
-        _socket = p2c[0];   /* Overwrite the file descriptor net_listen will use */
-        status = net_listen();
+        conn = net_attach(p2c[0]);  /* Watch the pipe from the parent process */
+        status = net_listen(ready, &num_ready, -1);
+        if (num_ready != 1 || ready[0] != conn) {
+            status = NET_ERROR;
+        }
+
+        /* The event loop is shared with the parent. Stop watching the pipe before notifying it */
+        net_free(conn);
 
         /* Notify the returned value tot he parent process */
         if (write(c2p[1], &status, sizeof(enum net_status)) == -1) {
@@ -237,7 +576,6 @@ void test_listen_ready() {
             exit(EXIT_FAILURE);
         }
 
-        close(p2c[0]);
         close(c2p[1]);
 
         /* Terminate the child process */
@@ -245,32 +583,332 @@ void test_listen_ready() {
     }
 }
 
+void test_listen_many() {
+    int socks[3][2], i, num_ready, found;
+    struct net_conn* conns[3];
+    struct net_conn* ready[NET_EVENTS];
+    enum net_status status;
+
+    for (i = 0; i < 3; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks[i]) == -1) {
+            perror("socketpair error");
+            exit(EXIT_FAILURE);
+        }
+        conns[i] = net_attach(socks[i][1]);
+    }
+
+    /* Only the first and the last connections have data to be read */
+    send(socks[0][0], "PING :one\r\n", strlen("PING :one\r\n"), 0);
+    send(socks[2][0], "PING :three\r\n", strlen("PING :three\r\n"), 0);
+
+    status = net_listen(ready, &num_ready, -1);
+    for (i = 0, found = 0; status == NET_READY && i < num_ready; i++) {
+        found |= (ready[i] == conns[0]) ? 1 : (ready[i] == conns[2]) ? 4 : 2;
+    }
+
+    for (i = 0; i < 3; i++) {
+        close(socks[i][0]);
+        net_free(conns[i]);
+    }
+
+    mu_assert(status == NET_READY, "test_listen_many: status should be 'NET_READY'");
+    mu_assert(num_ready == 2, "test_listen_many: there should be two ready connections");
+    mu_assert(found == 5, "test_listen_many: the first and the last connections should be ready");
+}
+
+void test_listen_flush() {
+    int socks[2], num_ready, ret;
+    char msg[READ_BUF];
+    struct net_conn* ready[NET_EVENTS];
+    struct net_conn* conn;
+    enum net_status status;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    conn = net_attach(socks[1]);
+    net_send(conn, "PONG :one");
+    send(socks[0], "PING :two\r\n", strlen("PING :two\r\n"), 0);
+
+    /* The event loop sends the queued lines while waiting for incoming data */
+    status = net_listen(ready, &num_ready, -1);
+    ret = recv(socks[0], msg, READ_BUF - 1, MSG_DONTWAIT);
+    msg[ret > 0 ? ret : 0] = '\0';
+
+    close(socks[0]);
+    net_free(conn);
+
+    mu_assert(status == NET_READY && num_ready == 1, "test_listen_flush: the connection should be ready");
+    mu_assert(s_eq(msg, "PONG :one\r\n"), "test_listen_flush: the queued message should be sent");
+}
+
+void test_listen_timeout() {
+    int socks[2], num_ready;
+    struct net_conn* ready[NET_EVENTS];
+    struct net_conn* conn;
+    enum net_status status;
+    double start, waited;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    conn = net_attach(socks[1]);
+
+    start = sch_now();
+    status = net_listen(ready, &num_ready, 50);
+    waited = sch_now() - start;
+    mu_assert(status == NET_TIMEOUT && num_ready == 0, "test_listen_timeout: status should be 'NET_TIMEOUT'");
+    mu_assert(waited >= 0.05 && waited < 1, "test_listen_timeout: the loop should wait for the timeout");
+
+    /* Waking up the loop ends the wait without any data */
+    net_wake();
+    start = sch_now();
+    status = net_listen(ready, &num_ready, -1);
+    mu_assert(status == NET_TIMEOUT, "test_listen_timeout: the loop should be woken up");
+    mu_assert(sch_now() - start < 1, "test_listen_timeout: the loop should not wait");
+
+    /* Data received before the timeout is returned as usual */
+    send(socks[0], "PING :one\r\n", strlen("PING :one\r\n"), 0);
+    status = net_listen(ready, &num_ready, 1000);
+    mu_assert(status == NET_READY && num_ready == 1, "test_listen_timeout: the connection should be ready");
+
+    close(socks[0]);
+    net_free(conn);
+}
+
+void test_keepalive() {
+    int socks[2], num_dead, next, ret;
+    char msg[READ_BUF];
+    struct net_conn* dead[NET_EVENTS];
+    struct net_conn* conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair error");
+        exit(EXIT_FAILURE);
+    }
+
+    conn = net_attach(socks[1]);
+    net_keepalive(conn, 50, 150);
+    mu_assert(net_lag(conn) == -1, "test_keepalive: the lag should not be measured yet");
+
+    next = net_heartbeat(dead, &num_dead);
+    mu_assert(num_dead == 0 && next > 0 && next <= 51, "test_keepalive: the ping should be due after the interval");
+
+    /* Receiving data postpones the ping */
+    poll(0, 0, 30);
+    send(socks[0], "NOTICE me :hi\r\n", strlen("NOTICE me :hi\r\n"), 0);
+    net_recv(conn, msg);
+    next = net_heartbeat(dead, &num_dead);
+    mu_assert(next > 30, "test_keepalive: the ping should be postponed");
+
+    poll(0, 0, next);
+    net_heartbeat(dead, &num_dead);
+    net_flush(conn);
+    ret = recv(socks[0], msg, READ_BUF - 1, MSG_DONTWAIT);
+    msg[ret > 0 ? ret : 0] = '\0';
+    mu_assert(strncmp(msg, "PING :" NET_PING_TOKEN, strlen("PING :" NET_PING_TOKEN)) == 0, "test_keepalive: the server should be pinged");
+
+    /* The answer to the ping measures the lag */
+    msg[strcspn(msg, "\r\n")] = '\0';
+    net_pong(conn, "other");
+    mu_assert(net_lag(conn) == -1, "test_keepalive: other pongs should not be measured");
+    net_pong(conn, msg + strlen("PING :"));
+    mu_assert(net_lag(conn) >= 0 && net_lag(conn) < 1000, "test_keepalive: the lag should be measured");
+
+    /* The connection is dead after the timeout without data */
+    poll(0, 0, 160);
+    net_heartbeat(dead, &num_dead);
+    mu_assert(num_dead == 1 && dead[0] == conn, "test_keepalive: the connection should be dead");
+
+    close(socks[0]);
+    net_free(conn);
+}
+
+/* Update the tracker of the connection with a received message */
+static void track(struct net_conn* conn, char* msg) {
+    struct raw_event* raw = lst_parse(msg);
+    trk_update(conn->tracker, raw);
+    evt_raw_destroy(raw);
+}
+
+/* Read the given number of bytes sent by the connection */
+static void expect(struct net_conn* conn, int server, char* msg, int len) {
+    int ret;
+
+    net_flush(conn);
+    ret = recv(server, msg, len, MSG_WAITALL);
+    msg[ret > 0 ? ret : 0] = '\0';
+}
+
+/* Let the helper thread reconnect, waiting in the event loop as irc_listen does.
+ * Returns the milliseconds until the next attempt */
+static int redial(struct net_conn* conn) {
+    struct net_conn* ready[NET_EVENTS];
+    int num_ready, next, i;
+
+    next = net_retry();
+    for (i = 0; i < 100 && conn->dial != NULL; i++) {
+        net_listen(ready, &num_ready, 100);
+        next = net_retry();
+    }
+
+    return next;
+}
+
+void test_interleave() {
+    struct addrinfo list[6], *addrs[NET_DIAL_MAX];
+    int families[6] = { AF_INET6, AF_INET6, AF_INET6, AF_INET, AF_INET, AF_INET6 };
+    int expected[6] = { 0, 3, 1, 4, 2, 5 };
+    int i, count;
+
+    memset(list, 0, sizeof(list));
+    for (i = 0; i < 6; i++) {
+        list[i].ai_family = families[i];
+        list[i].ai_next = i < 5 ? &list[i + 1] : NULL;
+    }
+
+    count = conn_interleave(list, addrs);
+    mu_assert(count == 6, "test_interleave: all the addresses should be tried");
+    for (i = 0; i < count; i++) {
+        mu_assert(addrs[i] == &list[expected[i]], "test_interleave: the families should alternate");
+    }
+
+    mu_assert(conn_interleave(NULL, addrs) == 0, "test_interleave: there should be no addresses");
+}
+
+void test_reconnect() {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    struct net_conn* conn;
+    char port[16], msg[READ_BUF];
+    int listener, server, next;
+    char* session = "NICK other\r\nUSER circus hostname server :Circus\r\n";
+
+    /* Let the system choose a free port for the mock server */
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listener == -1 || bind(listener, (struct sockaddr*) &addr, sizeof(addr)) == -1
+            || listen(listener, 1) == -1 || getsockname(listener, (struct sockaddr*) &addr, &addr_len) == -1) {
+        perror("mock server error");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+
+    conn = net_connect("127.0.0.1", port);
+    server = accept(listener, NULL, NULL);
+    mu_assert(conn != NULL && server != -1, "test_reconnect: the connection should be open");
+
+    /* The last line of each command is remembered */
+    net_session(conn, "NICK circus");
+    net_session(conn, "USER circus hostname server :Circus");
+    net_session(conn, "NICK other");
+    track(conn, ":irc 001 other :Welcome");
+    track(conn, ":other!circus@host JOIN #a");
+    track(conn, ":other!circus@host JOIN #b");
+
+    /* The first attempt is immediate and registers again */
+    close(server);
+    net_lost(conn);
+    mu_assert(conn->socket == -1 && net_count() == 0, "test_reconnect: the connection should be closed");
+    mu_assert(net_waiting() == 1, "test_reconnect: the connection should be waiting to reconnect");
+    mu_assert(redial(conn) == -1 && net_waiting() == 0, "test_reconnect: the connection should not wait any more");
+    mu_assert(net_count() == 1 && net_lag(conn) == -1, "test_reconnect: the connection should be open again");
+
+    server = accept(listener, NULL, NULL);
+    expect(conn, server, msg, strlen(session));
+    mu_assert(s_eq(msg, session), "test_reconnect: the session lines should be sent again");
+
+    /* The channels are joined again once registered */
+    net_registered(conn);
+    expect(conn, server, msg, strlen("JOIN #a,#b\r\n"));
+    mu_assert(s_eq(msg, "JOIN #a,#b\r\n") || s_eq(msg, "JOIN #b,#a\r\n"), "test_reconnect: the channels should be joined again");
+    net_registered(conn);
+    mu_assert(net_queued(conn) == 0, "test_reconnect: the channels should be joined only once");
+
+    /* Failed attempts wait before trying again */
+    close(server);
+    close(listener);
+    mu_assert(net_connect("127.0.0.1", port) == NULL, "test_reconnect: an unreachable server should not be connected");
+    net_reconnect(conn, 100, 1000);
+    net_lost(conn);
+    next = redial(conn);
+    mu_assert(net_waiting() == 1 && next >= 50 && next <= 101, "test_reconnect: the next attempt should wait");
+    mu_assert(net_retry() > 0 && conn->attempts == 1, "test_reconnect: the next attempt should not be due yet");
+    conn->attempts = 4;
+    mu_assert(conn_backoff(conn) >= 0.4 && conn_backoff(conn) <= 0.8, "test_reconnect: the wait should double with each failure");
+    conn->attempts = 10;
+    mu_assert(conn_backoff(conn) >= 0.5 && conn_backoff(conn) <= 1, "test_reconnect: the wait should be limited");
+
+    /* Disconnecting on purpose gives up */
+    net_disconnect(conn);
+    mu_assert(net_waiting() == 0 && net_retry() == -1, "test_reconnect: the connection should not reconnect");
+
+    net_free(conn);
+}
+
+void test_listen_close() {
+    struct net_conn* ready[NET_EVENTS];
+    int num_ready;
+
+    mu_assert(net_count() == 0, "test_listen_close: there should be no open connections");
+    mu_assert(net_listen(ready, &num_ready, -1) == NET_CLOSE, "test_listen_close: status should be 'NET_CLOSE'");
+}
+
 void test_listen_error() {
     int fd[2];
     enum net_status status;
+    struct net_conn* ready[NET_EVENTS];
+    struct net_conn* conn;
+    int num_ready;
 
     if (pipe(fd) == -1) {
         perror("pipe error");
         exit(EXIT_FAILURE);
     }
 
-    _socket = fd[0];    /* Override the file descriptor net_listen will use */
+    conn = net_attach(fd[0]);
 
-    close(fd[0]);
-    close(fd[1]);
+    /* Break the event loop so waiting for events fails */
+    close(conns.poller);
+    conns.poller = -1;
 
-    status = net_listen();
+    status = net_listen(ready, &num_ready, -1);
+
+    close(fd[1]);
+    net_free(conn);
 
     mu_assert(status == NET_ERROR, "test_listen_error: status should be 'NET_ERROR'");
 }
 
 void test_network() {
     mu_run(test_connection);
+    mu_run(test_current);
     mu_run(test_send);
     mu_run(test_send_longer);
+    mu_run(test_send_batch);
+    mu_run(test_send_backpressure);
+    mu_run(test_send_throttle);
+    mu_run(test_send_closed);
     mu_run(test_recv);
     mu_run(test_recv_longer);
+    mu_run(test_recv_linelen);
+    mu_run(test_recv_overflow);
+    mu_run(test_recv_many);
+    mu_run(test_recv_partial);
+    mu_run(test_recv_wrap);
     mu_run(test_listen_ready);
+    mu_run(test_listen_many);
+    mu_run(test_listen_flush);
+    mu_run(test_listen_timeout);
+    mu_run(test_keepalive);
+    mu_run(test_interleave);
+    mu_run(test_reconnect);
+    mu_run(test_listen_close);
     mu_run(test_listen_error);
 }
-
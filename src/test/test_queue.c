@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L      /* Use posix_memalign in queue.c */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <poll.h>
+#include "minunit.h"
+#include "test.h"
+#include "../lib/queue.c"
+
+/* Items used to fill the queues */
+static int items[Q_SIZE * 2];
+
+/* Consumer thread used to test the wait and wake functions */
+static void* waiting_consumer(void* arg) {
+    struct q_ring* q = (struct q_ring*) arg;
+    void* item;
+
+    while ((item = q_pop(q)) == NULL) {
+        q_wait(q);
+    }
+
+    pthread_exit(item);
+}
+
+void test_q_create_destroy() {
+    struct q_ring* q = q_create(1000);
+
+    mu_assert(q != NULL, "test_q_create_destroy: q should not be NULL");
+    mu_assert(q->mask == 1023, "test_q_create_destroy: capacity should be rounded to 1024");
+    mu_assert(q_size(q) == 0, "test_q_create_destroy: q should be empty");
+    mu_assert(q_pop(q) == NULL, "test_q_create_destroy: q_pop should return NULL");
+    mu_assert(((unsigned long) q) % CACHE_LINE == 0, "test_q_create_destroy: q should be aligned to a cache line");
+
+    q_destroy(q);
+}
+
+void test_q_push_pop() {
+    struct q_ring* q = q_create(4);
+
+    mu_assert(q_push(q, &items[0]) == 1, "test_q_push_pop: q_push should return 1");
+    mu_assert(q_push(q, &items[1]) == 1, "test_q_push_pop: q_push should return 1");
+    mu_assert(q_size(q) == 2, "test_q_push_pop: q size should be 2");
+    mu_assert(q_pop(q) == &items[0], "test_q_push_pop: first item should be items[0]");
+    mu_assert(q_pop(q) == &items[1], "test_q_push_pop: second item should be items[1]");
+    mu_assert(q_pop(q) == NULL, "test_q_push_pop: q_pop should return NULL");
+
+    q_destroy(q);
+}
+
+void test_q_full() {
+    int i;
+    struct q_ring* q = q_create(4);
+
+    for (i = 0; i < 4; i++) {
+        q_push(q, &items[i]);
+    }
+
+    mu_assert(q_push(q, &items[4]) == 0, "test_q_full: q_push should return 0 when full");
+    mu_assert(q_pop(q) == &items[0], "test_q_full: first item should be items[0]");
+    mu_assert(q_push(q, &items[4]) == 1, "test_q_full: q_push should return 1 after a pop");
+    mu_assert(q_size(q) == 4, "test_q_full: q size should be 4");
+
+    q_destroy(q);
+}
+
+void test_q_wrap() {
+    int i;
+    struct q_ring* q = q_create(8);
+
+    /* Go around the array several times */
+    for (i = 0; i < Q_SIZE * 2; i++) {
+        q_push(q, &items[i]);
+        if (q_pop(q) != &items[i]) {
+            break;
+        }
+    }
+
+    mu_assert(i == Q_SIZE * 2, "test_q_wrap: items should come out in order");
+    mu_assert(q_size(q) == 0, "test_q_wrap: q should be empty");
+
+    q_destroy(q);
+}
+
+void test_q_wait_push() {
+    pthread_t thread;
+    void* result;
+    struct q_ring* q = q_create(4);
+
+    pthread_create(&thread, NULL, waiting_consumer, q);
+    poll(0, 0, 100);    /* Let the consumer park */
+
+    q_push(q, &items[0]);
+    pthread_join(thread, &result);
+
+    mu_assert(result == &items[0], "test_q_wait_push: the consumer should get items[0]");
+    mu_assert(q->parked == 0, "test_q_wait_push: the consumer should not be parked");
+
+    q_destroy(q);
+}
+
+void test_q_wake() {
+    struct q_ring* q = q_create(4);
+
+    /* A pending wakeup makes the next wait return immediately */
+    q_wake(q);
+    q_wait(q);
+
+    mu_assert(q->parked == 0, "test_q_wake: the consumer should not be parked");
+    mu_assert(q_pop(q) == NULL, "test_q_wake: q should be empty");
+
+    q_destroy(q);
+}
+
+void test_queue() {
+    mu_run(test_q_create_destroy);
+    mu_run(test_q_push_pop);
+    mu_run(test_q_full);
+    mu_run(test_q_wrap);
+    mu_run(test_q_wait_push);
+    mu_run(test_q_wake);
+}
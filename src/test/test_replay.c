@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L      /* Use mmap in replay.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "minunit.h"
+#include "test.h"
+#include "../lib/irc.h"
+#include "../lib/timer.h"
+#include "../lib/utils.h"
+#include "../lib/replay.c"
+
+#define TEST_LOG "1318000000.5 << :irc.example.org 001 circus :Welcome\r\n" \
+                 "1318000000.75 >> PRIVMSG #circus :Sent by the bot\r\n" \
+                 "\r\n" \
+                 "1318000000.75 :nick!~user@host PRIVMSG #circus :one\r\n" \
+                 "3 :nick!~user@host PRIVMSG #circus :two\r\n" \
+                 ":nick!~user@host PRIVMSG #other :three"
+
+static int messages = 0;    /* Number of messages handled by the callback */
+
+static void on_message(MessageEvent* event) {
+    __atomic_add_fetch(&messages, 1, __ATOMIC_RELAXED);
+}
+
+/* Write the contents to a temporary file and get its path */
+static char* write_log(char* path, const char* contents) {
+    int fd;
+
+    sprintf(path, "/tmp/circus-replay-%d.log", (int) getpid());
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1
+            || write(fd, contents, strlen(contents)) != (int) strlen(contents)) {
+        perror("Error writing the log");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    return path;
+}
+
+void test_rep_time() {
+    double when = -1;
+
+    mu_assert(rep_time("12.25 PING", 10, &when) == 6 && when == 12.25, "test_rep_time: the time should be parsed");
+    mu_assert(rep_time("12 PING", 7, &when) == 3 && when == 12, "test_rep_time: the fraction should be optional");
+    when = -1;
+    mu_assert(rep_time(":irc 001", 8, &when) == 0 && when == -1, "test_rep_time: a message should not have a time");
+    mu_assert(rep_time("12. PING", 8, &when) == 0, "test_rep_time: the fraction should have digits");
+    mu_assert(rep_time("12", 2, &when) == 0, "test_rep_time: the time should be followed by a message");
+}
+
+void test_rep_next() {
+    struct rep_source* source;
+    char path[32], msg[READ_BUF];
+    double when;
+
+    source = rep_open(write_log(path, TEST_LOG));
+    mu_assert(source != NULL, "test_rep_next: the log should be opened");
+
+    mu_assert(rep_next(source, msg, &when) == 1, "test_rep_next: there should be a line");
+    mu_assert(s_eq(msg, ":irc.example.org 001 circus :Welcome\r\n"), "test_rep_next: the marker should be removed");
+    mu_assert(when == 1318000000.5, "test_rep_next: the time should be read");
+
+    /* The sent lines and the empty ones are skipped */
+    mu_assert(rep_next(source, msg, &when) == 1, "test_rep_next: there should be a second line");
+    mu_assert(s_eq(msg, ":nick!~user@host PRIVMSG #circus :one\r\n"), "test_rep_next: the received line should be next");
+    mu_assert(when == 1318000000.75, "test_rep_next: the time should be read");
+
+    mu_assert(rep_next(source, msg, &when) == 1 && when == 3, "test_rep_next: there should be a third line");
+    mu_assert(rep_next(source, msg, &when) == 1, "test_rep_next: the last line should not need a terminator");
+    mu_assert(s_eq(msg, ":nick!~user@host PRIVMSG #other :three") && when == -1, "test_rep_next: the last line has no time");
+    mu_assert(rep_next(source, msg, &when) == 0, "test_rep_next: there should be no more lines");
+
+    rep_close(source);
+    unlink(path);
+
+    /* Empty logs have no lines, and missing ones can not be opened */
+    source = rep_open(write_log(path, ""));
+    mu_assert(source != NULL && rep_next(source, msg, &when) == 0, "test_rep_next: an empty log should have no lines");
+    rep_close(source);
+    unlink(path);
+    mu_assert(rep_open(path) == NULL, "test_rep_next: a missing log should not be opened");
+}
+
+void test_rep_longer() {
+    struct rep_source* source;
+    char path[32], msg[READ_BUF], *log;
+    double when;
+
+    /* A line longer than the buffer followed by a short one */
+    if ((log = malloc(2 * READ_BUF)) == 0) {
+        perror("Out of memory (test_rep_longer)");
+        exit(EXIT_FAILURE);
+    }
+    memset(log, 'a', READ_BUF + 10);
+    strcpy(log + READ_BUF + 10, "\nPING :b\r\n");
+
+    source = rep_open(write_log(path, log));
+    mu_assert(rep_next(source, msg, &when) == 1 && strlen(msg) == READ_BUF - 1, "test_rep_longer: the line should be cut");
+    mu_assert(rep_next(source, msg, &when) == 1 && s_eq(msg, "PING :b\r\n"), "test_rep_longer: the rest of the line should be skipped");
+
+    rep_close(source);
+    unlink(path);
+    free(log);
+}
+
+void test_irc_replay() {
+    char path[32];
+    unsigned long start;
+
+    messages = 0;
+    irc_bind_event(PRIVMSG, (Callback) on_message);
+
+    /* As fast as possible. All the callbacks have run when it returns */
+    start = tmr_now();
+    mu_assert(irc_replay(write_log(path, TEST_LOG), 0) == 4, "test_irc_replay: all the received lines should be replayed");
+    mu_assert(messages == 3, "test_irc_replay: the messages should be dispatched");
+    mu_assert(tmr_now() - start < 1000, "test_irc_replay: the recorded times should be ignored");
+    unlink(path);
+
+    /* At the recorded times */
+    messages = 0;
+    start = tmr_now();
+    irc_replay(write_log(path, "10.0 :n!u@h PRIVMSG #a :x\r\n10.1 :n!u@h PRIVMSG #a :y\r\n"), 1);
+    mu_assert(messages == 2, "test_irc_replay: the timed messages should be dispatched");
+    mu_assert(tmr_now() - start >= 100, "test_irc_replay: the recorded times should be kept");
+    unlink(path);
+
+    irc_unbind_event(PRIVMSG);
+    mu_assert(irc_replay(path, 0) == -1, "test_irc_replay: a missing log should not be replayed");
+}
+
+void test_replay() {
+    mu_run(test_rep_time);
+    mu_run(test_rep_next);
+    mu_run(test_rep_longer);
+    mu_run(test_irc_replay);
+}
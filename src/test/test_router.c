@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "minunit.h"
+#include "test.h"
+#include "../lib/router.h"
+
+static void on_help(void) { }
+static void on_op(void) { }
+static void on_opall(void) { }
+
+void test_rtr_match() {
+    struct rtr_table* rtr = rtr_create();
+    const char* rest = NULL;
+
+    mu_assert(rtr_match(rtr, "help", NULL, &rest) == NULL, "test_rtr_match: there should be no commands");
+
+    rtr_add(rtr, "Help", on_help);
+    rtr_add(rtr, "!op", on_op);
+    mu_assert(rtr_match(rtr, "  HELP me please", NULL, &rest) == on_help, "test_rtr_match: help should match in any case");
+    mu_assert(strcmp(rest, "me please") == 0, "test_rtr_match: the arguments should follow the command");
+    mu_assert(rtr_match(rtr, "!op", NULL, &rest) == on_op, "test_rtr_match: !op should match");
+    mu_assert(*rest == '\0', "test_rtr_match: there should be no arguments");
+    mu_assert(rtr_match(rtr, "helpme", NULL, NULL) == NULL, "test_rtr_match: longer words should not match");
+    mu_assert(rtr_match(rtr, "hel", NULL, NULL) == NULL, "test_rtr_match: abbreviations should be disabled");
+    mu_assert(rtr_match(rtr, "", NULL, NULL) == NULL, "test_rtr_match: empty messages should not match");
+
+    mu_assert(rtr_del(rtr, "HELP"), "test_rtr_match: help should be removed");
+    mu_assert(!rtr_del(rtr, "help"), "test_rtr_match: help should not be there");
+    mu_assert(rtr_match(rtr, "help", NULL, NULL) == NULL, "test_rtr_match: help should not match");
+
+    rtr_destroy(rtr);
+}
+
+void test_rtr_prefix() {
+    struct rtr_table* rtr = rtr_create();
+    const char* rest = NULL;
+
+    rtr_add(rtr, "help", on_help);
+    rtr_add(rtr, "!op", on_op);
+    rtr_prefix(rtr, "!");
+    rtr_prefix(rtr, "bot.");
+
+    mu_assert(rtr_match(rtr, "!help topic", NULL, &rest) == on_help, "test_rtr_prefix: !help should match");
+    mu_assert(strcmp(rest, "topic") == 0, "test_rtr_prefix: the arguments should follow the command");
+    mu_assert(rtr_match(rtr, "bot.help", NULL, NULL) == on_help, "test_rtr_prefix: bot.help should match");
+    mu_assert(rtr_match(rtr, "help", NULL, NULL) == NULL, "test_rtr_prefix: words without a prefix should be chat");
+    mu_assert(rtr_match(rtr, "!op", NULL, NULL) == on_op, "test_rtr_prefix: commands bound with the prefix should match");
+
+    /* Commands addressed to the bot */
+    mu_assert(rtr_match(rtr, "circus: help", "circus", NULL) == NULL, "test_rtr_prefix: the nick should be disabled");
+    rtr_nick(rtr, 1);
+    mu_assert(rtr_match(rtr, "Circus:  help x", "circus", &rest) == on_help, "test_rtr_prefix: the nick should match");
+    mu_assert(strcmp(rest, "x") == 0, "test_rtr_prefix: the arguments should follow the command");
+    mu_assert(rtr_match(rtr, "circus,help", "circus", NULL) == on_help, "test_rtr_prefix: a comma should follow the nick");
+    mu_assert(rtr_match(rtr, "circusbot: help", "circus", NULL) == NULL, "test_rtr_prefix: other nicks should not match");
+    mu_assert(rtr_match(rtr, "circus help", "circus", NULL) == NULL, "test_rtr_prefix: the nick needs a separator");
+
+    rtr_prefix(rtr, "");
+    mu_assert(rtr_match(rtr, "help", NULL, NULL) == on_help, "test_rtr_prefix: the prefixes should be removed");
+
+    rtr_destroy(rtr);
+}
+
+void test_rtr_alias_abbrev() {
+    struct rtr_table* rtr = rtr_create(), *copy;
+
+    rtr_add(rtr, "help", on_help);
+    rtr_add(rtr, "op", on_op);
+    rtr_add(rtr, "opall", on_opall);
+    rtr_alias(rtr, "?", "help");
+    rtr_alias(rtr, "hilfe", "help");
+    rtr_alias(rtr, "x", "missing");
+
+    mu_assert(rtr_match(rtr, "?", NULL, NULL) == on_help, "test_rtr_alias_abbrev: the alias should run help");
+    mu_assert(rtr_match(rtr, "x", NULL, NULL) == NULL, "test_rtr_alias_abbrev: aliases of missing commands should not match");
+
+    /* help and hilfe run the same command, so h is not ambiguous */
+    rtr_abbrev(rtr, 1);
+    mu_assert(rtr_match(rtr, "h", NULL, NULL) == on_help, "test_rtr_alias_abbrev: h should be help");
+
+    rtr_abbrev(rtr, 2);
+    mu_assert(rtr_match(rtr, "h", NULL, NULL) == NULL, "test_rtr_alias_abbrev: abbreviations should be 2 characters long");
+    mu_assert(rtr_match(rtr, "he", NULL, NULL) == on_help, "test_rtr_alias_abbrev: he should be help");
+    mu_assert(rtr_match(rtr, "op", NULL, NULL) == on_op, "test_rtr_alias_abbrev: exact names should win");
+    mu_assert(rtr_match(rtr, "opa", NULL, NULL) == on_opall, "test_rtr_alias_abbrev: opa should be opall");
+
+    mu_assert(rtr_match(rtr, "h?", NULL, NULL) == NULL, "test_rtr_alias_abbrev: unknown words should not match");
+    rtr_add(rtr, "hint", on_op);
+    mu_assert(rtr_match(rtr, "hi", NULL, NULL) == NULL, "test_rtr_alias_abbrev: hi should be ambiguous");
+    mu_assert(rtr_match(rtr, "hil", NULL, NULL) == on_help, "test_rtr_alias_abbrev: hil should be hilfe");
+
+    /* Copies are independent */
+    copy = rtr_copy(rtr);
+    rtr_del(rtr, "help");
+    mu_assert(rtr_match(rtr, "he", NULL, NULL) == NULL, "test_rtr_alias_abbrev: help should be removed");
+    mu_assert(rtr_match(copy, "he", NULL, NULL) == on_help, "test_rtr_alias_abbrev: the copy should keep help");
+    mu_assert(rtr_match(copy, "hilfe", NULL, NULL) == on_help, "test_rtr_alias_abbrev: the copy should keep the alias");
+
+    rtr_destroy(copy);
+    rtr_destroy(rtr);
+}
+
+void test_router() {
+    mu_run(test_rtr_match);
+    mu_run(test_rtr_prefix);
+    mu_run(test_rtr_alias_abbrev);
+}
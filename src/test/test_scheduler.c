@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L      /* Use clock_gettime in scheduler.c */
+
+#include <stdio.h>
+#include "minunit.h"
+#include "test.h"
+#include "../lib/scheduler.c"
+
+/* Queue a line */
+static void push(struct sch_queue* q, char* line, double now) {
+    sch_push(q, line, strlen(line), now);
+}
+
+void test_sch_unlimited() {
+    struct sch_queue q;
+    int i;
+
+    sch_init(&q);
+    for (i = 0; i < 1000; i++) {
+        mu_assert(sch_admit(&q, 0), "test_sch_unlimited: all lines should be admitted");
+    }
+
+    mu_assert(q.stats.sent == 1000, "test_sch_unlimited: sent should be 1000");
+    mu_assert(sch_wait(&q, 0) == -1, "test_sch_unlimited: sch_wait should return -1 without queued lines");
+
+    sch_destroy(&q);
+}
+
+void test_sch_rate() {
+    struct sch_queue q;
+    char line[SCH_LINE_SIZE];
+
+    sch_init(&q);
+    sch_rate(&q, 3, 2000);
+
+    mu_assert(sch_admit(&q, 100), "test_sch_rate: the first line of the burst should be admitted");
+    mu_assert(sch_admit(&q, 100), "test_sch_rate: the second line of the burst should be admitted");
+    mu_assert(sch_admit(&q, 100), "test_sch_rate: the third line of the burst should be admitted");
+    mu_assert(!sch_admit(&q, 100), "test_sch_rate: lines after the burst should not be admitted");
+
+    push(&q, "PRIVMSG #circus :four", 100);
+    mu_assert(sch_pop(&q, line, 101) == 0, "test_sch_rate: the line should wait for a new token");
+    mu_assert(sch_wait(&q, 101) == 1, "test_sch_rate: the line should wait one more second");
+    mu_assert(sch_pop(&q, line, 102) == strlen("PRIVMSG #circus :four"), "test_sch_rate: the line should be released");
+    mu_assert(s_eq(line, "PRIVMSG #circus :four"), "test_sch_rate: line should be 'PRIVMSG #circus :four'");
+
+    /* Queued lines go before new ones, even if there are tokens */
+    push(&q, "PRIVMSG #circus :five", 110);
+    mu_assert(!sch_admit(&q, 110), "test_sch_rate: new lines should not skip the queue");
+    mu_assert(sch_pop(&q, line, 110) > 0, "test_sch_rate: the line should be released");
+    mu_assert(sch_admit(&q, 110), "test_sch_rate: the new line should be admitted once the queue is empty");
+
+    sch_destroy(&q);
+}
+
+void test_sch_priority() {
+    struct sch_queue q;
+    char line[SCH_LINE_SIZE];
+
+    sch_init(&q);
+    sch_rate(&q, 1, 1000);
+    sch_admit(&q, 0);   /* Use the only token */
+
+    push(&q, "PRIVMSG #a :1", 0);
+    push(&q, "PRIVMSG #A :2", 0);
+    push(&q, "PRIVMSG nick :3", 0);
+    push(&q, "PONG irc.server", 0);
+    push(&q, ":me QUIT :bye", 0);
+    push(&q, "NOTICE #a :4", 0);
+    push(&q, "PING :LAG1", 0);
+
+    mu_assert(q.stats.depth == 7, "test_sch_priority: depth should be 7");
+
+    sch_pop(&q, line, 1);
+    mu_assert(s_eq(line, "PONG irc.server"), "test_sch_priority: PONG should go first");
+    sch_pop(&q, line, 2);
+    mu_assert(s_eq(line, ":me QUIT :bye"), "test_sch_priority: QUIT should go second");
+    sch_pop(&q, line, 3);
+    mu_assert(s_eq(line, "PING :LAG1"), "test_sch_priority: PING should not wait for the rest");
+    sch_pop(&q, line, 4);
+    mu_assert(s_eq(line, "PRIVMSG #a :1"), "test_sch_priority: the first target should go next");
+    sch_pop(&q, line, 5);
+    mu_assert(s_eq(line, "PRIVMSG nick :3"), "test_sch_priority: the second target should take its turn");
+    sch_pop(&q, line, 6);
+    mu_assert(s_eq(line, "PRIVMSG #A :2"), "test_sch_priority: targets should be case insensitive");
+    sch_pop(&q, line, 7);
+    mu_assert(s_eq(line, "NOTICE #a :4"), "test_sch_priority: the last line should go last");
+    mu_assert(sch_pop(&q, line, 7) == 0, "test_sch_priority: there should be no lines left");
+
+    sch_destroy(&q);
+}
+
+void test_sch_stats() {
+    struct sch_queue q;
+    char line[SCH_LINE_SIZE];
+
+    sch_init(&q);
+    sch_rate(&q, 1, 1000);
+    sch_admit(&q, 0);
+
+    push(&q, "PRIVMSG #a :1", 0);
+    push(&q, "PRIVMSG #b :2", 0);
+    mu_assert(q.stats.depth == 2, "test_sch_stats: depth should be 2");
+    mu_assert(q.stats.max_depth == 2, "test_sch_stats: max_depth should be 2");
+    mu_assert(q.stats.bytes == 2 * strlen("PRIVMSG #a :1"), "test_sch_stats: bytes should count the queued lines");
+
+    sch_pop(&q, line, 1);
+    sch_pop(&q, line, 3);
+    mu_assert(q.stats.depth == 0, "test_sch_stats: depth should be 0");
+    mu_assert(q.stats.max_depth == 2, "test_sch_stats: max_depth should be 2");
+    mu_assert(q.stats.bytes == 0, "test_sch_stats: bytes should be 0");
+    mu_assert(q.stats.sent == 3, "test_sch_stats: sent should be 3");
+    mu_assert(q.stats.delayed == 2, "test_sch_stats: delayed should be 2");
+    mu_assert(q.stats.total_delay == 4, "test_sch_stats: total_delay should be 4");
+    mu_assert(q.stats.max_delay == 3, "test_sch_stats: max_delay should be 3");
+
+    sch_destroy(&q);
+}
+
+void test_sch_destroy() {
+    struct sch_queue q;
+
+    sch_init(&q);
+    sch_rate(&q, 2, 500);
+    sch_admit(&q, 0);
+    sch_admit(&q, 0);
+    push(&q, "PRIVMSG #a :1", 0);
+    push(&q, "PONG irc.server", 0);
+
+    sch_destroy(&q);
+    mu_assert(q.stats.depth == 0, "test_sch_destroy: there should be no queued lines");
+    mu_assert(q.burst == 2 && q.interval_ms == 500, "test_sch_destroy: the rate limit should be kept");
+    mu_assert(sch_admit(&q, 0), "test_sch_destroy: the bucket should be full again");
+}
+
+void test_scheduler() {
+    mu_run(test_sch_unlimited);
+    mu_run(test_sch_rate);
+    mu_run(test_sch_priority);
+    mu_run(test_sch_stats);
+    mu_run(test_sch_destroy);
+}
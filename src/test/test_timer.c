@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include "minunit.h"
+#include "test.h"
+#include "../lib/timer.h"
+
+#define TEST_START 1000000UL    /* Start the wheel at any time, not aligned to its levels */
+
+static int expired[8];      /* How many times each timer has run */
+
+static void on_timer(void* data) {
+    expired[*(int*) data]++;
+}
+
+/* Invoke the callback as the dispatcher would */
+static int runs = 0;
+static void run_timer(tmr_callback callback, void* data) {
+    runs++;
+    callback(data);
+}
+
+static int ids[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+static void reset() {
+    int i;
+    for (i = 0; i < 8; i++) {
+        expired[i] = 0;
+    }
+}
+
+void test_tmr_add() {
+    struct tmr_wheel* wheel = tmr_create(TEST_START);
+    unsigned long now = TEST_START + 77;
+
+    reset();
+    mu_assert(tmr_next(wheel, now) == -1, "test_tmr_add: an empty wheel should not wait");
+    mu_assert(tmr_add(wheel, now, 10, 0, on_timer, &ids[0]) != 0, "test_tmr_add: the timer should be added");
+    mu_assert(tmr_add(wheel, now, 0, 0, on_timer, &ids[1]) != 0, "test_tmr_add: the timer should be added");
+    mu_assert(tmr_count(wheel) == 2, "test_tmr_add: there should be two timers");
+
+    /* The wheel has not advanced since it was created */
+    mu_assert(tmr_next(wheel, now) == 0, "test_tmr_add: a timer should have expired");
+    mu_assert(tmr_advance(wheel, now, NULL) == 1, "test_tmr_add: only the immediate timer should expire");
+    mu_assert(expired[1] == 1 && expired[0] == 0, "test_tmr_add: the immediate timer should run");
+    mu_assert(tmr_next(wheel, now) == 10, "test_tmr_add: the next timer should expire in 10 ms");
+
+    mu_assert(tmr_advance(wheel, now + 9, NULL) == 0, "test_tmr_add: the timer should not expire early");
+    mu_assert(tmr_advance(wheel, now + 10, run_timer) == 1, "test_tmr_add: the timer should expire");
+    mu_assert(expired[0] == 1 && runs == 1, "test_tmr_add: the runner should invoke the timer");
+    mu_assert(tmr_count(wheel) == 0, "test_tmr_add: there should be no timers");
+
+    tmr_destroy(wheel);
+}
+
+void test_tmr_cancel() {
+    struct tmr_wheel* wheel = tmr_create(TEST_START);
+    unsigned long first, second;
+
+    reset();
+    first = tmr_add(wheel, TEST_START, 100, 0, on_timer, &ids[0]);
+    second = tmr_add(wheel, TEST_START, 100, 0, on_timer, &ids[1]);
+    mu_assert(tmr_cancel(wheel, first), "test_tmr_cancel: the timer should be canceled");
+    mu_assert(!tmr_cancel(wheel, first), "test_tmr_cancel: the timer should not be canceled twice");
+
+    /* The position of the canceled timer is reused with another id */
+    first = tmr_add(wheel, TEST_START, 50, 0, on_timer, &ids[2]);
+    mu_assert(tmr_count(wheel) == 2, "test_tmr_cancel: there should be two timers");
+
+    mu_assert(tmr_advance(wheel, TEST_START + 100, NULL) == 2, "test_tmr_cancel: the pending timers should expire");
+    mu_assert(expired[0] == 0 && expired[1] == 1 && expired[2] == 1, "test_tmr_cancel: the canceled timer should not run");
+    mu_assert(!tmr_cancel(wheel, second), "test_tmr_cancel: expired timers cannot be canceled");
+    mu_assert(!tmr_cancel(wheel, 0), "test_tmr_cancel: 0 is not a timer");
+
+    tmr_destroy(wheel);
+}
+
+void test_tmr_periodic() {
+    struct tmr_wheel* wheel = tmr_create(TEST_START);
+    unsigned long id;
+
+    reset();
+    id = tmr_add(wheel, TEST_START, 30, 20, on_timer, &ids[0]);
+    tmr_advance(wheel, TEST_START + 30, NULL);
+    tmr_advance(wheel, TEST_START + 50, NULL);
+    tmr_advance(wheel, TEST_START + 69, NULL);
+    mu_assert(expired[0] == 2, "test_tmr_periodic: the timer should run every period");
+
+    /* Periods missed while the wheel did not advance run only once */
+    tmr_advance(wheel, TEST_START + 1000, NULL);
+    mu_assert(expired[0] == 3, "test_tmr_periodic: missed periods should be skipped");
+    mu_assert(tmr_next(wheel, TEST_START + 1000) == 20, "test_tmr_periodic: the period should restart");
+
+    mu_assert(tmr_cancel(wheel, id), "test_tmr_periodic: periodic timers should be canceled");
+    mu_assert(tmr_count(wheel) == 0, "test_tmr_periodic: there should be no timers");
+
+    tmr_destroy(wheel);
+}
+
+void test_tmr_levels() {
+    struct tmr_wheel* wheel = tmr_create(TEST_START);
+    unsigned long delays[5] = { 255, 256, 20000, 3000000, 100000000 };
+    unsigned long now = TEST_START;
+    int i, next;
+
+    reset();
+    for (i = 0; i < 5; i++) {
+        tmr_add(wheel, TEST_START, delays[i], 0, on_timer, &ids[i]);
+    }
+
+    /* Follow the wheel as the event loop would, waking up when it says */
+    for (i = 0; i < 1000 && (next = tmr_next(wheel, now)) != -1; i++) {
+        now += next;
+        tmr_advance(wheel, now, NULL);
+        mu_assert(expired[0] + expired[1] + expired[2] + expired[3] + expired[4] <= 5, "test_tmr_levels: timers should run once");
+        if (expired[2] == 1 && expired[3] == 0) {
+            mu_assert(now >= TEST_START + delays[2], "test_tmr_levels: timers should not run early");
+        }
+    }
+
+    mu_assert(i < 1000, "test_tmr_levels: the wheel should not wake up too often");
+    mu_assert(now == TEST_START + delays[4], "test_tmr_levels: the last timer should expire on time");
+    for (i = 0; i < 5; i++) {
+        mu_assert(expired[i] == 1, "test_tmr_levels: all timers should run");
+    }
+
+    tmr_destroy(wheel);
+}
+
+static struct tmr_wheel* nested = NULL;
+
+/* Expired timers can add more timers */
+static void on_nested(void* data) {
+    tmr_add(nested, TEST_START + 10, 0, 0, on_timer, data);
+}
+
+void test_tmr_nested() {
+    int i;
+
+    reset();
+    nested = tmr_create(TEST_START);
+    for (i = 0; i < TMR_BATCH * 2; i++) {
+        tmr_add(nested, TEST_START, 10, 0, on_nested, &ids[i % 8]);
+    }
+
+    mu_assert(tmr_advance(nested, TEST_START + 10, NULL) == TMR_BATCH * 4, "test_tmr_nested: all the timers should expire");
+    mu_assert(expired[0] == TMR_BATCH * 2 / 8, "test_tmr_nested: the added timers should run");
+    mu_assert(tmr_count(nested) == 0, "test_tmr_nested: there should be no timers");
+
+    tmr_destroy(nested);
+}
+
+void test_timer() {
+    mu_run(test_tmr_add);
+    mu_run(test_tmr_cancel);
+    mu_run(test_tmr_periodic);
+    mu_run(test_tmr_levels);
+    mu_run(test_tmr_nested);
+}
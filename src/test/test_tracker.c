@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2011 Ignasi Barrera
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L      /* Support read-write locks in tracker.c */
+
+#include <stdio.h>
+#include "minunit.h"
+#include "test.h"
+#include "../lib/utils.h"
+#include "../lib/listener.h"
+#include "../lib/tracker.c"
+
+/* Update the state with a message from the server */
+static void update(struct trk_table* trk, char* msg) {
+    struct raw_event* raw = lst_parse(msg);
+    trk_update(trk, raw);
+    evt_raw_destroy(raw);
+}
+
+/* Start with the bot in #circus and #clowns, along with nacx and bob */
+static struct trk_table* joined(struct isp_table* isp) {
+    struct trk_table* trk;
+
+    isp_init(isp);
+    trk = trk_create(isp);
+    update(trk, ":server 001 circus-bot :Welcome to the Internet Relay Network circus-bot");
+    update(trk, ":circus-bot!~circus@127.0.0.1 JOIN #circus");
+    update(trk, ":circus-bot!~circus@127.0.0.1 JOIN #clowns");
+    update(trk, ":nacx!~nacx@127.0.0.1 JOIN #circus");
+    update(trk, ":nacx!~nacx@127.0.0.1 JOIN #clowns");
+    update(trk, ":bob!~bob@127.0.0.1 JOIN #circus");
+
+    return trk;
+}
+
+/* Collect the visited names */
+static void collect(const char* name, const char* modes, void* data) {
+    char* names = (char*) data;
+    sprintf(names + strlen(names), "%s%s:%s", *names != '\0' ? " " : "", name, modes);
+}
+
+void test_trk_join_part() {
+    struct isp_table isp;
+    struct trk_table* trk = joined(&isp);
+
+    mu_assert(trk_num_members(trk, "#circus") == 3, "test_trk_join_part: #circus should have 3 members");
+    mu_assert(trk_num_members(trk, "#clowns") == 2, "test_trk_join_part: #clowns should have 2 members");
+    mu_assert(trk_num_members(trk, "#other") == -1, "test_trk_join_part: #other should not be tracked");
+    mu_assert(trk_is_member(trk, "#circus", "bob"), "test_trk_join_part: bob should be in #circus");
+    mu_assert(!trk_is_member(trk, "#clowns", "bob"), "test_trk_join_part: bob should not be in #clowns");
+
+    update(trk, ":nacx!~nacx@127.0.0.1 PART #circus :Bye");
+    mu_assert(!trk_is_member(trk, "#circus", "nacx"), "test_trk_join_part: nacx should have left #circus");
+    mu_assert(trk_num_channels(trk, "nacx") == 1, "test_trk_join_part: nacx should be in one channel");
+
+    /* When the bot leaves, the channel and the users only seen there are forgotten */
+    update(trk, ":circus-bot!~circus@127.0.0.1 PART #circus");
+    mu_assert(trk_num_members(trk, "#circus") == -1, "test_trk_join_part: #circus should be forgotten");
+    mu_assert(trk_num_channels(trk, "bob") == 0, "test_trk_join_part: bob should be forgotten");
+    mu_assert(trk_num_channels(trk, "circus-bot") == 1, "test_trk_join_part: the bot should be in one channel");
+
+    trk_destroy(trk);
+}
+
+void test_trk_kick() {
+    struct isp_table isp;
+    struct trk_table* trk = joined(&isp);
+
+    update(trk, ":nacx!~nacx@127.0.0.1 KICK #circus bob :Out");
+    mu_assert(!trk_is_member(trk, "#circus", "bob"), "test_trk_kick: bob should have been kicked");
+    mu_assert(trk_num_members(trk, "#circus") == 2, "test_trk_kick: #circus should have 2 members");
+
+    update(trk, ":nacx!~nacx@127.0.0.1 KICK #clowns circus-bot :Out");
+    mu_assert(trk_num_members(trk, "#clowns") == -1, "test_trk_kick: #clowns should be forgotten");
+    mu_assert(trk_num_channels(trk, "nacx") == 1, "test_trk_kick: nacx should be in one channel");
+
+    trk_destroy(trk);
+}
+
+void test_trk_nick_quit() {
+    struct isp_table isp;
+    struct trk_table* trk = joined(&isp);
+
+    update(trk, ":nacx!~nacx@127.0.0.1 NICK ignasi");
+    mu_assert(trk_num_channels(trk, "nacx") == 0, "test_trk_nick_quit: nacx should not be tracked");
+    mu_assert(trk_is_member(trk, "#circus", "ignasi"), "test_trk_nick_quit: ignasi should be in #circus");
+    mu_assert(trk_is_member(trk, "#clowns", "ignasi"), "test_trk_nick_quit: ignasi should be in #clowns");
+
+    update(trk, ":ignasi!~nacx@127.0.0.1 QUIT :Gone");
+    mu_assert(trk_num_channels(trk, "ignasi") == 0, "test_trk_nick_quit: ignasi should not be tracked");
+    mu_assert(trk_num_members(trk, "#circus") == 2, "test_trk_nick_quit: #circus should have 2 members");
+    mu_assert(trk_num_members(trk, "#clowns") == 1, "test_trk_nick_quit: #clowns should have 1 member");
+
+    /* The quit message is optional */
+    update(trk, ":bob!~bob@127.0.0.1 QUIT");
+    mu_assert(!trk_is_member(trk, "#circus", "bob"), "test_trk_nick_quit: bob should have quit without a message");
+    mu_assert(trk_num_members(trk, "#circus") == 1, "test_trk_nick_quit: #circus should have 1 member");
+
+    /* Malformed messages without enough parameters are not quits */
+    update(trk, ":nacx!~nacx@127.0.0.1 JOIN #circus");
+    update(trk, ":nacx!~nacx@127.0.0.1 KICK #circus");
+    update(trk, ":nacx!~nacx@127.0.0.1 MODE #circus");
+    mu_assert(trk_is_member(trk, "#circus", "nacx"), "test_trk_nick_quit: a KICK or MODE without target should not remove nacx");
+    mu_assert(trk_num_members(trk, "#circus") == 2, "test_trk_nick_quit: #circus should have 2 members");
+
+    /* The bot quitting closes the connection */
+    update(trk, ":circus-bot!~circus@127.0.0.1 QUIT :Bye");
+    mu_assert(trk_num_members(trk, "#circus") == -1, "test_trk_nick_quit: #circus should be forgotten");
+
+    trk_destroy(trk);
+}
+
+void test_trk_names_modes() {
+    struct isp_table isp;
+    struct trk_table* trk = joined(&isp);
+    char names[200] = "";
+
+    update(trk, ":server 353 circus-bot = #circus :@circus-bot +bob @+carol dave!~dave@127.0.0.1 nacx");
+    mu_assert(trk_num_members(trk, "#circus") == 5, "test_trk_names_modes: #circus should have 5 members");
+    mu_assert(trk_has_mode(trk, "#circus", "carol", 'o'), "test_trk_names_modes: carol should be op");
+    mu_assert(trk_has_mode(trk, "#circus", "carol", 'v'), "test_trk_names_modes: carol should have voice");
+    mu_assert(trk_has_mode(trk, "#circus", "bob", 'v'), "test_trk_names_modes: bob should have voice");
+    mu_assert(!trk_has_mode(trk, "#circus", "bob", 'o'), "test_trk_names_modes: bob should not be op");
+    mu_assert(trk_is_member(trk, "#circus", "dave"), "test_trk_names_modes: dave should be in #circus");
+
+    /* Keys and bans take a parameter that is not a nick */
+    update(trk, ":nacx!~nacx@127.0.0.1 MODE #circus +ko-v+b key dave bob *!*@spam");
+    mu_assert(trk_has_mode(trk, "#circus", "dave", 'o'), "test_trk_names_modes: dave should be op");
+    mu_assert(!trk_has_mode(trk, "#circus", "bob", 'v'), "test_trk_names_modes: bob should not have voice");
+
+    trk_members(trk, "#clowns", collect, names);
+    mu_assert(s_eq(names, "nacx: circus-bot:"), "test_trk_names_modes: #clowns should have nacx and the bot");
+
+    names[0] = '\0';
+    trk_channels(trk, "carol", collect, names);
+    mu_assert(s_eq(names, "#circus:ov"), "test_trk_names_modes: carol should be op and voice in #circus");
+
+    /* Channels that have not been joined are not tracked */
+    update(trk, ":server 353 circus-bot = #other :nacx bob");
+    mu_assert(trk_num_members(trk, "#other") == -1, "test_trk_names_modes: #other should not be tracked");
+
+    trk_destroy(trk);
+}
+
+void test_trk_casemapping() {
+    struct isp_table isp;
+    struct trk_table* trk = joined(&isp);
+    char* ascii[] = { "CASEMAPPING=ascii" };
+
+    update(trk, ":Nick[1]!~nick@127.0.0.1 JOIN #Circus");
+    mu_assert(trk_is_member(trk, "#CIRCUS", "nick{1}"), "test_trk_casemapping: nicks should be compared with rfc1459");
+    trk_destroy(trk);
+
+    trk = joined(&isp);
+    isp_parse(&isp, 1, ascii);
+    update(trk, ":Nick[1]!~nick@127.0.0.1 JOIN #circus");
+    mu_assert(trk_is_member(trk, "#circus", "NICK[1]"), "test_trk_casemapping: nicks should be compared with ascii");
+    mu_assert(!trk_is_member(trk, "#circus", "nick{1}"), "test_trk_casemapping: brackets should be different with ascii");
+
+    trk_clear(trk);
+    mu_assert(trk_num_members(trk, "#circus") == -1, "test_trk_casemapping: the state should be empty");
+    trk_destroy(trk);
+}
+
+void test_trk_bans() {
+    struct isp_table isp;
+    struct trk_table* trk = joined(&isp);
+
+    mu_assert(trk_bans(trk, "#circus", "bob!~bob@host.spam.net", NULL, NULL) == 0, "test_trk_bans: there should be no bans");
+
+    update(trk, ":server 367 circus-bot #circus *!*@*.spam.net nacx 1500000000");
+    update(trk, ":nacx!~nacx@127.0.0.1 MODE #circus +bb-o eve *!~bob@* circus-bot");
+    mu_assert(trk_bans(trk, "#circus", "bob!~bob@host.SPAM.net", NULL, NULL) == 2, "test_trk_bans: bob should match two bans");
+    mu_assert(trk_bans(trk, "#CIRCUS", "Eve!eve@127.0.0.1", NULL, NULL) == 1, "test_trk_bans: eve should be banned");
+    mu_assert(trk_bans(trk, "#clowns", "eve!eve@127.0.0.1", NULL, NULL) == 0, "test_trk_bans: bans should be per channel");
+
+    update(trk, ":nacx!~nacx@127.0.0.1 MODE #circus -b *!*@*.spam.net");
+    mu_assert(trk_bans(trk, "#circus", "bob!~bob@host.spam.net", NULL, NULL) == 1, "test_trk_bans: the ban should be removed");
+
+    /* Bans of channels that have not been joined are not tracked */
+    update(trk, ":server 367 circus-bot #other *!*@*");
+    mu_assert(trk_bans(trk, "#other", "bob!~bob@host.spam.net", NULL, NULL) == 0, "test_trk_bans: #other should not be tracked");
+
+    trk_destroy(trk);
+}
+
+/* Read the features as a worker would, while the test updates them */
+static void* read_features(void* data) {
+    struct trk_table* trk = (struct trk_table*) data;
+    struct isp_table copy;
+    int i, channels = 0;
+
+    for (i = 0; i < 1000; i++) {
+        channels += trk_is_channel(trk, "#circus");
+        trk_isupport(trk, &copy);
+        channels += isp_is_channel(&copy, "&circus");
+    }
+
+    return (void*) (long) channels;
+}
+
+void test_trk_features() {
+    struct isp_table isp, copy;
+    struct trk_table* trk = joined(&isp);
+    char* chantypes[] = { "CHANTYPES=&", "MODES=6" };
+    char* defaults[] = { "CHANTYPES=#&", "MODES=3" };
+    pthread_t reader;
+    void* channels;
+    int i;
+
+    pthread_create(&reader, NULL, read_features, trk);
+    for (i = 0; i < 1000; i++) {
+        trk_features(trk, 2, i % 2 == 0 ? chantypes : defaults);
+    }
+    pthread_join(reader, &channels);
+    mu_assert((long) channels >= 1000, "test_trk_features: every read should see a whole table");
+
+    trk_features(trk, 2, chantypes);
+    trk_isupport(trk, &copy);
+    mu_assert(copy.modes == 6, "test_trk_features: the copy should have the parsed modes");
+    mu_assert(!trk_is_channel(trk, "#circus"), "test_trk_features: # should not be a channel type");
+    mu_assert(trk_is_channel(trk, "&circus"), "test_trk_features: & should be a channel type");
+
+    trk_clear(trk);
+    mu_assert(trk_is_channel(trk, "#circus"), "test_trk_features: clearing should reset the features");
+    trk_destroy(trk);
+}
+
+void test_tracker() {
+    mu_run(test_trk_join_part);
+    mu_run(test_trk_kick);
+    mu_run(test_trk_nick_quit);
+    mu_run(test_trk_names_modes);
+    mu_run(test_trk_casemapping);
+    mu_run(test_trk_bans);
+    mu_run(test_trk_features);
+}
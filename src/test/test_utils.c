@@ -30,6 +30,10 @@ void test_upper() {
     char text[10] = "Test Text";
     upper(text);
     mu_assert(s_eq(text, "TEST TEXT"), "test_uppper: text should be 'TEST TEXT'");
+
+    strcpy(text, "{nick}\xe9");
+    upper(text);
+    mu_assert(s_eq(text, "{NICK}\xe9"), "test_upper: only ASCII letters should change");
 }
 
 void test_lower() {
@@ -38,16 +42,6 @@ void test_lower() {
     mu_assert(s_eq(text, "test text"), "test_uppper: text should be 'test text'");
 }
 
-void test_build_command_key() {
-    char key[50];
-
-    build_command_key(key, "cmd");
-    mu_assert(s_eq(key, "PRIVMSG#cmd"), "test_build_command_key: key should be 'PRIVMSG#cmd'");
-
-    build_command_key(key, "");
-    mu_assert(s_eq(key, "PRIVMSG#"), "test_build_command_key: key should be 'PRIVMSG#'");
-}
-
 void test_append_channel_flags() {
     char text[10] = "";
 
@@ -97,7 +91,6 @@ void test_append_user_flags() {
 void test_utils() {
     mu_run(test_upper);
     mu_run(test_lower);
-    mu_run(test_build_command_key);
     mu_run(test_append_channel_flags);
     mu_run(test_append_user_flags);
 }